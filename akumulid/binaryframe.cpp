@@ -0,0 +1,305 @@
+#include "binaryframe.h"
+#include "storage_engine/compression.h"
+
+#include <cstring>
+
+namespace Akumuli {
+
+namespace {
+
+/** Base128 decoder that doesn't trust its input. Stream readers from
+  * the compression library panic on malformed data, this one returns false.
+  */
+bool read_base128(const u8** pos, const u8* end, u64* value) {
+    u64 acc = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos == end) {
+            return false;
+        }
+        u8 byte = *(*pos)++;
+        acc |= static_cast<u64>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = acc;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool read_u64(const u8** pos, const u8* end, u64* value) {
+    if (end - *pos < static_cast<std::ptrdiff_t>(sizeof(u64))) {
+        return false;
+    }
+    memcpy(value, *pos, sizeof(u64));
+    *pos += sizeof(u64);
+    return true;
+}
+
+//! Checked version of the VByteStreamReader
+struct VByteReader {
+    const u8* pos_;
+    const u8* end_;
+    u32       cnt_;
+    int       ctrl_;
+    int       scut_elements_;
+
+    VByteReader(const u8* begin, const u8* end)
+        : pos_(begin)
+        , end_(end)
+        , cnt_(0)
+        , ctrl_(0)
+        , scut_elements_(0)
+    {
+    }
+
+    bool next(u64* value) {
+        if (ctrl_ == 0xFF && scut_elements_) {
+            scut_elements_--;
+            cnt_++;
+            *value = 0;
+            return true;
+        }
+        int bytelen = 0;
+        if (cnt_++ % 2 == 0) {
+            if (pos_ == end_) {
+                return false;
+            }
+            ctrl_ = *pos_++;
+            bytelen = ctrl_ & 0xF;
+            if ((ctrl_ >> 4) == 0xF) {
+                // Shortcut is valid only at the beginning of the chunk
+                if (ctrl_ != 0xFF || (cnt_ - 1) % BinaryFrame::CHUNK_SIZE != 0) {
+                    return false;
+                }
+                scut_elements_ = BinaryFrame::CHUNK_SIZE - 1;
+                *value = 0;
+                return true;
+            }
+        } else {
+            bytelen = ctrl_ >> 4;
+        }
+        if (bytelen > 8 || end_ - pos_ < bytelen) {
+            return false;
+        }
+        u64 acc = 0;
+        for (int i = 0; i < bytelen*8; i += 8) {
+            acc |= static_cast<u64>(*pos_++) << i;
+        }
+        *value = acc;
+        return true;
+    }
+};
+
+bool decode_timestamps_delta(const u8** pos, const u8* end, u64 size, aku_Sample* out) {
+    VByteReader reader(*pos, end);
+    u64 prev = 0;
+    u64 min = 0;
+    for (u64 i = 0; i < size; i++) {
+        if (i % BinaryFrame::CHUNK_SIZE == 0) {
+            if (!read_base128(&reader.pos_, end, &min)) {
+                return false;
+            }
+        }
+        u64 delta;
+        if (!reader.next(&delta)) {
+            return false;
+        }
+        prev += delta + min;
+        out[i].timestamp = prev;
+    }
+    if (reader.scut_elements_ != 0) {
+        // Shortcut can't be used for the incomplete chunk
+        return false;
+    }
+    *pos = reader.pos_;
+    return true;
+}
+
+/** Write data frame (without length prefix) to the [begin, end) region.
+  * @return AKU_EOVERFLOW if the region is too small
+  */
+aku_Status write_data_frame(u8* begin,
+                            const u8* end,
+                            u64 id,
+                            aku_Timestamp const* ts,
+                            double const* xs,
+                            u32 size,
+                            u32 flags,
+                            size_t* frame_size)
+{
+    Base128StreamWriter header(begin, end);
+    if (!header.put(static_cast<u8>(BinaryFrame::DATA)) || !header.put(static_cast<u8>(flags)) ||
+        !header.put(id) || !header.put(static_cast<u64>(size)))
+    {
+        return AKU_EOVERFLOW;
+    }
+    u8* pos = begin + header.size();
+    if (flags & BinaryFrame::TIMESTAMPS_DELTA) {
+        VByteStreamWriter vbyte(pos, end);
+        DeltaDeltaStreamWriter<BinaryFrame::CHUNK_SIZE, u64> stream(vbyte);
+        u32 nchunks = size / BinaryFrame::CHUNK_SIZE;
+        for (u32 i = 0; i < nchunks; i++) {
+            if (!stream.tput(ts + i*BinaryFrame::CHUNK_SIZE, BinaryFrame::CHUNK_SIZE)) {
+                return AKU_EOVERFLOW;
+            }
+        }
+        for (u32 i = nchunks*BinaryFrame::CHUNK_SIZE; i < size; i++) {
+            if (!stream.put(ts[i])) {
+                return AKU_EOVERFLOW;
+            }
+        }
+        if (!stream.commit()) {
+            return AKU_EOVERFLOW;
+        }
+        pos += vbyte.size();
+    } else if (size != 0) {
+        memcpy(pos, ts, size*sizeof(u64));
+        pos += size*sizeof(u64);
+    }
+    if (flags & BinaryFrame::VALUES_XOR) {
+        Base128StreamWriter stream(pos, end);
+        u64 prev = 0;
+        for (u32 i = 0; i < size; i++) {
+            u64 bits;
+            memcpy(&bits, xs + i, sizeof(bits));
+            // Similar values differ only in the high bits of the mantissa, byte
+            // swap moves them to the low bits that are base128 encoded first.
+            if (!stream.put(__builtin_bswap64(bits ^ prev))) {
+                return AKU_EOVERFLOW;
+            }
+            prev = bits;
+        }
+        pos += stream.size();
+    } else if (size != 0) {
+        memcpy(pos, xs, size*sizeof(double));
+        pos += size*sizeof(double);
+    }
+    *frame_size = static_cast<size_t>(pos - begin);
+    return AKU_SUCCESS;
+}
+
+}  // namespace
+
+aku_Status BinaryFrame::encode_dict(u64 id, const char* name, size_t size, std::vector<u8>* out) {
+    size_t prefix = out->size();
+    out->resize(prefix + PREFIX_SIZE + 1 + 10 + size);
+    u8* begin = out->data() + prefix + PREFIX_SIZE;
+    Base128StreamWriter stream(begin, out->data() + out->size());
+    if (!stream.put(static_cast<u8>(DICTIONARY)) || !stream.put(id) || stream.size() + size > MAX_FRAME_SIZE) {
+        // Frame is not appended on error
+        out->resize(prefix);
+        return AKU_EOVERFLOW;
+    }
+    memcpy(begin + stream.size(), name, size);
+    u32 frame_size = static_cast<u32>(stream.size() + size);
+    memcpy(out->data() + prefix, &frame_size, PREFIX_SIZE);
+    out->resize(prefix + PREFIX_SIZE + frame_size);
+    return AKU_SUCCESS;
+}
+
+aku_Status BinaryFrame::encode_data(u64 id,
+                                    aku_Timestamp const* ts,
+                                    double const* xs,
+                                    u32 size,
+                                    u32 flags,
+                                    std::vector<u8>* out)
+{
+    // Header (4 values, 10 bytes max each), timestamps (1 byte for every pair of values
+    // and 1 byte for every chunk in the worst case) and values
+    size_t capacity = 40 + (size/CHUNK_SIZE + 1)*10 + size*9 + size/2 + 1 + size*10;
+    size_t prefix = out->size();
+    out->resize(prefix + PREFIX_SIZE + capacity);
+    u8* begin = out->data() + prefix + PREFIX_SIZE;
+    const u8* end = out->data() + out->size();
+    size_t frame_size = 0;
+    aku_Status status = write_data_frame(begin, end, id, ts, xs, size, flags, &frame_size);
+    if (status == AKU_SUCCESS && frame_size > MAX_FRAME_SIZE) {
+        status = AKU_EOVERFLOW;
+    }
+    if (status != AKU_SUCCESS) {
+        // Frame is not appended on error
+        out->resize(prefix);
+        return status;
+    }
+    u32 frame_size32 = static_cast<u32>(frame_size);
+    memcpy(out->data() + prefix, &frame_size32, PREFIX_SIZE);
+    out->resize(prefix + PREFIX_SIZE + frame_size);
+    return AKU_SUCCESS;
+}
+
+u32 BinaryFrame::get_frame_size(const u8* begin) {
+    u32 size;
+    memcpy(&size, begin, PREFIX_SIZE);
+    return size;
+}
+
+aku_Status BinaryFrame::decode_dict(const u8* begin, const u8* end, u64* id, const char** name, size_t* size) {
+    u64 type;
+    if (!read_base128(&begin, end, &type) || type != DICTIONARY) {
+        return AKU_EBAD_DATA;
+    }
+    if (!read_base128(&begin, end, id)) {
+        return AKU_EBAD_DATA;
+    }
+    *name = reinterpret_cast<const char*>(begin);
+    *size = static_cast<size_t>(end - begin);
+    return AKU_SUCCESS;
+}
+
+aku_Status BinaryFrame::decode_data_header(const u8* begin, const u8* end, DataHeader* header) {
+    u64 type, flags;
+    if (!read_base128(&begin, end, &type) || type != DATA) {
+        return AKU_EBAD_DATA;
+    }
+    if (!read_base128(&begin, end, &flags) || (flags & ~static_cast<u64>(TIMESTAMPS_DELTA|VALUES_XOR))) {
+        return AKU_EBAD_DATA;
+    }
+    if (!read_base128(&begin, end, &header->id) || !read_base128(&begin, end, &header->size)) {
+        return AKU_EBAD_DATA;
+    }
+    // Every value takes at least one byte
+    if (header->size > static_cast<u64>(end - begin)) {
+        return AKU_EBAD_DATA;
+    }
+    header->flags = static_cast<u32>(flags);
+    header->body  = begin;
+    header->end   = end;
+    return AKU_SUCCESS;
+}
+
+aku_Status BinaryFrame::decode_data(DataHeader const& header, aku_Sample* out) {
+    const u8* pos = header.body;
+    const u8* end = header.end;
+    if (header.flags & TIMESTAMPS_DELTA) {
+        if (!decode_timestamps_delta(&pos, end, header.size, out)) {
+            return AKU_EBAD_DATA;
+        }
+    } else {
+        for (u64 i = 0; i < header.size; i++) {
+            if (!read_u64(&pos, end, &out[i].timestamp)) {
+                return AKU_EBAD_DATA;
+            }
+        }
+    }
+    u64 prev = 0;
+    for (u64 i = 0; i < header.size; i++) {
+        u64 bits;
+        if (header.flags & VALUES_XOR) {
+            if (!read_base128(&pos, end, &bits)) {
+                return AKU_EBAD_DATA;
+            }
+            bits = __builtin_bswap64(bits) ^ prev;
+        } else if (!read_u64(&pos, end, &bits)) {
+            return AKU_EBAD_DATA;
+        }
+        memcpy(&out[i].payload.float64, &bits, sizeof(bits));
+        prev = bits;
+    }
+    if (pos != end) {
+        // Trailing garbage
+        return AKU_EBAD_DATA;
+    }
+    return AKU_SUCCESS;
+}
+
+}  // namespace
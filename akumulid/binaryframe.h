@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+/** Frames of the binary ingestion protocol.
+  *
+  * Every frame starts with the 4-byte little-endian length prefix (size of the
+  * frame without the prefix) followed by the frame type byte. All integers
+  * except the length prefix are base128 encoded.
+  *
+  * DICTIONARY frame maps user supplied id to a series name. Ids are local to
+  * the connection, the same id can be redefined later.
+  *     | length | type=1 | id | series name (the rest of the frame) |
+  *
+  * DATA frame contains a column of samples that belong to one series.
+  *     | length | type=2 | flags | id | n | timestamps | values |
+  * Timestamps are stored as `n` little-endian u64 values or, if TIMESTAMPS_DELTA
+  * flag is set, using DeltaDelta encoding (DeltaDeltaStreamWriter on top of the
+  * VByteStreamWriter: full chunks of 16 values are written using `tput`, the
+  * remainder using `put`). Values are stored as `n` little-endian doubles or, if
+  * VALUES_XOR flag is set, every value is XOR-ed with the previous one, byte swapped
+  * and written using Base128StreamWriter.
+  */
+struct BinaryFrame {
+    enum {
+        //! Size of the length prefix
+        PREFIX_SIZE = 4,
+        //! Max frame size (without prefix)
+        MAX_FRAME_SIZE = 0x100000,
+        //! Number of timestamps in DeltaDelta chunk
+        CHUNK_SIZE = 16,
+    };
+
+    enum Type {
+        DICTIONARY = 1,
+        DATA = 2,
+    };
+
+    enum Flags {
+        TIMESTAMPS_DELTA = 1,
+        VALUES_XOR = 2,
+    };
+
+    //! Decoded header of the data frame
+    struct DataHeader {
+        u32 flags;
+        u64 id;
+        u64 size;
+        //! Encoded timestamps and values
+        const u8* body;
+        const u8* end;
+    };
+
+    /** Append dictionary frame to the `out` buffer (`out` is not changed on error).
+      * @return AKU_EOVERFLOW if frame is too large
+      */
+    static aku_Status encode_dict(u64 id, const char* name, size_t size, std::vector<u8>* out);
+
+    /** Append data frame to the `out` buffer (`out` is not changed on error).
+      * @return AKU_EOVERFLOW if frame is too large
+      */
+    static aku_Status encode_data(u64 id,
+                                  aku_Timestamp const* ts,
+                                  double const* xs,
+                                  u32 size,
+                                  u32 flags,
+                                  std::vector<u8>* out);
+
+    /** Get size of the frame from the length prefix (`begin` should point
+      * to at least PREFIX_SIZE bytes).
+      */
+    static u32 get_frame_size(const u8* begin);
+
+    /** Decode dictionary frame (without length prefix).
+      * @return AKU_EBAD_DATA if frame is malformed
+      */
+    static aku_Status decode_dict(const u8* begin, const u8* end, u64* id, const char** name, size_t* size);
+
+    /** Decode header of the data frame (without length prefix).
+      * @return AKU_EBAD_DATA if frame is malformed
+      */
+    static aku_Status decode_data_header(const u8* begin, const u8* end, DataHeader* header);
+
+    /** Decode timestamps and values of the data frame. Only `timestamp` and
+      * `payload.float64` fields of the `header.size` samples are set.
+      * @return AKU_EBAD_DATA if frame is malformed
+      */
+    static aku_Status decode_data(DataHeader const& header, aku_Sample* out);
+};
+
+}  // namespace
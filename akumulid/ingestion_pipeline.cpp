@@ -52,6 +52,10 @@ aku_Status AkumuliSession::write(const aku_Sample &sample) {
     return aku_write(session_, &sample);
 }
 
+aku_Status AkumuliSession::write_batch(const aku_Sample* samples, size_t size) {
+    return aku_write_batch(session_, samples, size);
+}
+
 std::shared_ptr<DbCursor> AkumuliSession::query(std::string query) {
     aku_Cursor* cursor = aku_query(session_, query.c_str());
     return std::make_shared<AkumuliCursor>(cursor);
@@ -81,11 +85,10 @@ int AkumuliSession::name_to_param_id_list(const char* begin, const char* end, ak
 
 // Connection //
 
-AkumuliConnection::AkumuliConnection(const char *path)
+AkumuliConnection::AkumuliConnection(const char *path, const aku_FineTuneParams &params)
     : dbpath_(path)
 {
     db_logger_.info() << "Open database at: " << path;
-    aku_FineTuneParams params = {};
     db_ = aku_open_database(dbpath_.c_str(), params);
 }
 
@@ -56,6 +56,20 @@ struct DbSession {
     //! Write value to DB
     virtual aku_Status write(const aku_Sample& sample) = 0;
 
+    /** Write batch of values to DB. All valid values are written,
+      * status of the first failed value is returned on error.
+      */
+    virtual aku_Status write_batch(const aku_Sample* samples, size_t size) {
+        aku_Status result = AKU_SUCCESS;
+        for (size_t i = 0; i < size; i++) {
+            auto status = write(samples[i]);
+            if (status != AKU_SUCCESS && result == AKU_SUCCESS) {
+                result = status;
+            }
+        }
+        return result;
+    }
+
     //! Execute database query
     virtual std::shared_ptr<DbCursor> query(std::string query) = 0;
 
@@ -91,6 +105,7 @@ public:
     AkumuliSession(aku_Session* session);
     virtual ~AkumuliSession() override;
     virtual aku_Status write(const aku_Sample &sample) override;
+    virtual aku_Status write_batch(const aku_Sample* samples, size_t size) override;
     virtual std::shared_ptr<DbCursor> query(std::string query) override;
     virtual std::shared_ptr<DbCursor> suggest(std::string query) override;
     virtual std::shared_ptr<DbCursor> search(std::string query) override;
@@ -107,7 +122,7 @@ class AkumuliConnection : public DbConnection {
     aku_Database* db_;
 
 public:
-    AkumuliConnection(const char* path);
+    AkumuliConnection(const char* path, const aku_FineTuneParams& params);
 
     virtual ~AkumuliConnection() override;
 
@@ -16,6 +16,7 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 #include <boost/format.hpp>
 
@@ -50,6 +51,50 @@ nvolumes=%1%
 # Default value is 4GB (if value is not set).
 volume_size=4GB
 
+# Size of the block cache that keeps recently read pages in memory.
+# You can use MB or GB suffix. Default value is 256MB.
+block_cache_size=256MB
+
+# Volume I/O backend: apr, io_uring or io_uring_direct.
+# io_uring backends batch block reads and writes and are available only on
+# Linux; `io_uring_direct` also bypasses the page cache (O_DIRECT). If
+# io_uring is not supported by the kernel `apr` backend is used.
+io_backend=apr
+
+# Codec used to compress values: fcm, gorilla, chimp or adaptive.
+# `adaptive` tries every codec on the first values of each leaf node
+# and picks the one that gives the smallest output. Existing data stays
+# readable when this value is changed.
+value_codec=fcm
+
+# Reorder window. Samples that are late by no more than this amount of
+# time (relative to the latest sample of the same series) are buffered
+# in memory and written in time order. Samples that are late by more
+# than this are rejected. You can use ms, s, min or h suffix.
+# Default value is 0 (out of order samples are rejected).
+reorder_window=0s
+
+# Max number of queries executed concurrently. Queries that can't be
+# started right away are queued (up to `max_queued_queries`), queries
+# that doesn't fit the queue are rejected. Default value is 0 (number
+# of CPU cores).
+max_concurrent_queries=0
+max_queued_queries=1024
+
+# Size of the group-aggregate query results cache. Buckets that can't
+# change anymore are cached, so repeated group-aggregate queries (e.g.
+# dashboards that refresh every few seconds) read from disk only the
+# most recent part of the time range. Set to 0 to disable the cache.
+query_cache_size=64MB
+
+# Rollup bucket sizes (comma separated, up to 4 values). Aggregates of
+# every bucket are stored in a separate tree per series and updated as
+# the data is written. Group-aggregate queries with a step that is a
+# multiple of the rollup step are answered from the rollup tree. Steps
+# should be whole seconds, you can use s, min, h or d suffix.
+# Default value is empty (rollups are disabled).
+rollup_steps=
+
 
 # HTTP API endpoint configuration
 
@@ -72,8 +117,16 @@ pool_size=0
 [UDP]
 # port number
 port=8383
-# worker pool size
+# worker pool size (every worker receives packets through its own socket)
 pool_size=1
+# max number of packets received by the worker at once
+batch_size=64
+# max packet size in bytes
+buffer_size=65536
+# pin worker threads to CPUs
+pin_threads=false
+# enable UDP generic receive offload (requires Linux 5.0 or later)
+gro=false
 
 # OpenTSDB telnet-style data connection enabled (remove this section to disable).
 
@@ -81,6 +134,12 @@ pool_size=1
 # port number
 port=4242
 
+# Binary protocol data connection enabled (remove this section to disable).
+
+[Binary]
+# port number
+port=8484
+
 
 
 # Logging configuration
@@ -171,22 +230,21 @@ struct ConfigFile {
         return conf.get<i32>("nvolumes");
     }
 
-    static u64 get_volume_size(PTree conf) {
+    static u64 decode_size(std::string strsize) {
         u64 result = 0;
-        auto strsize = conf.get<std::string>("volume_size", "4GB");
         try {
             result = boost::lexical_cast<u64>(strsize);
         } catch (boost::bad_lexical_cast const&) {
             // Try to read suffix (GB or MB)
             auto throw_decode_error = [strsize]() {
                 std::stringstream fmt;
-                fmt << "can't decode volume size: `" << strsize << "`";
+                fmt << "can't decode size: `" << strsize << "`";
                 std::runtime_error err(fmt.str());
                 BOOST_THROW_EXCEPTION(err);
             };
             auto tmp = strsize;
             u64 mul = 1;
-            if (tmp.back() != 'B' && tmp.back() != 'b') {
+            if (tmp.size() < 2 || (tmp.back() != 'B' && tmp.back() != 'b')) {
                 throw_decode_error();
             }
             tmp.pop_back();
@@ -209,6 +267,92 @@ struct ConfigFile {
         return result;
     }
 
+    static u64 decode_duration(std::string strdur) {
+        auto throw_decode_error = [strdur]() {
+            std::stringstream fmt;
+            fmt << "can't decode duration: `" << strdur << "`";
+            std::runtime_error err(fmt.str());
+            BOOST_THROW_EXCEPTION(err);
+        };
+        auto pos = strdur.find_first_not_of("0123456789");
+        u64 mul = 1000000000ul;  // seconds by default
+        if (pos != std::string::npos) {
+            auto suffix = strdur.substr(pos);
+            if (suffix == "ms") {
+                mul = 1000000ul;
+            } else if (suffix == "s") {
+                mul = 1000000000ul;
+            } else if (suffix == "min") {
+                mul = 60*1000000000ul;
+            } else if (suffix == "h") {
+                mul = 60*60*1000000000ul;
+            } else if (suffix == "d") {
+                mul = 24*60*60*1000000000ul;
+            } else {
+                throw_decode_error();
+            }
+        }
+        u64 result = 0;
+        try {
+            result = boost::lexical_cast<u64>(strdur.substr(0, pos));
+        } catch (boost::bad_lexical_cast const&) {
+            throw_decode_error();
+        }
+        return result*mul;
+    }
+
+    static u64 get_volume_size(PTree conf) {
+        return decode_size(conf.get<std::string>("volume_size", "4GB"));
+    }
+
+    static aku_FineTuneParams get_fine_tune_params(PTree conf) {
+        aku_FineTuneParams params = {};
+        params.max_cache_size = decode_size(conf.get<std::string>("block_cache_size", "256MB"));
+        auto io_backend = conf.get<std::string>("io_backend", "apr");
+        if (io_backend == "io_uring") {
+            params.io_backend = AKU_IO_BACKEND_IO_URING;
+        } else if (io_backend == "io_uring_direct") {
+            params.io_backend = AKU_IO_BACKEND_IO_URING_DIRECT;
+        } else if (io_backend == "apr") {
+            params.io_backend = AKU_IO_BACKEND_APR;
+        } else {
+            std::runtime_error err("unknown io_backend `" + io_backend + "`");
+            BOOST_THROW_EXCEPTION(err);
+        }
+        auto value_codec = conf.get<std::string>("value_codec", "fcm");
+        if (value_codec == "gorilla") {
+            params.value_codec = AKU_VALUE_CODEC_GORILLA;
+        } else if (value_codec == "chimp") {
+            params.value_codec = AKU_VALUE_CODEC_CHIMP;
+        } else if (value_codec == "adaptive") {
+            params.value_codec = AKU_VALUE_CODEC_ADAPTIVE;
+        } else if (value_codec == "fcm") {
+            params.value_codec = AKU_VALUE_CODEC_FCM;
+        } else {
+            std::runtime_error err("unknown value_codec `" + value_codec + "`");
+            BOOST_THROW_EXCEPTION(err);
+        }
+        params.reorder_window = decode_duration(conf.get<std::string>("reorder_window", "0s"));
+        params.max_concurrent_queries = conf.get<u32>("max_concurrent_queries", 0);
+        params.max_queued_queries = conf.get<u32>("max_queued_queries", 0);
+        params.query_cache_size = decode_size(conf.get<std::string>("query_cache_size", "64MB"));
+        std::stringstream steps(conf.get<std::string>("rollup_steps", ""));
+        std::string step;
+        int nsteps = 0;
+        while (std::getline(steps, step, ',')) {
+            boost::algorithm::trim(step);
+            if (step.empty()) {
+                continue;
+            }
+            if (nsteps == AKU_MAX_ROLLUPS) {
+                std::runtime_error err("too many rollup_steps, max " + std::to_string(AKU_MAX_ROLLUPS));
+                BOOST_THROW_EXCEPTION(err);
+            }
+            params.rollup_steps[nsteps++] = decode_duration(step);
+        }
+        return params;
+    }
+
     static ServerSettings get_http_server(PTree conf) {
         ServerSettings settings;
         settings.name = "HTTP";
@@ -222,6 +366,12 @@ struct ConfigFile {
         settings.name = "UDP";
         settings.protocols.push_back({ "UDP", conf.get<int>("UDP.port")});
         settings.nworkers = conf.get<int>("UDP.pool_size");
+        for (auto key: { "batch_size", "buffer_size", "pin_threads", "gro" }) {
+            auto value = conf.get_optional<std::string>(std::string("UDP.") + key);
+            if (value) {
+                settings.options[key] = *value;
+            }
+        }
         return settings;
     }
 
@@ -232,6 +382,9 @@ struct ConfigFile {
         if (conf.count("OpenTSDB")) {
             settings.protocols.push_back({ "OpenTSDB", conf.get<int>("OpenTSDB.port")});
         }
+        if (conf.count("Binary")) {
+            settings.protocols.push_back({ "Binary", conf.get<int>("Binary.port")});
+        }
         settings.nworkers = conf.get<int>("TCP.pool_size");
         return settings;
     }
@@ -405,6 +558,7 @@ void cmd_run_server() {
     auto config                 = ConfigFile::read_config_file(config_path);
     auto path                   = ConfigFile::get_path(config);
     auto ingestion_servers      = ConfigFile::get_server_settings(config);
+    auto params                 = ConfigFile::get_fine_tune_params(config);
     auto full_path              = boost::filesystem::path(path) / "db.akumuli";
 
     if (!boost::filesystem::exists(full_path)) {
@@ -412,7 +566,7 @@ void cmd_run_server() {
         fmt << "**ERROR** database file doesn't exists at " << path;
         std::cout << cli_format(fmt.str()) << std::endl;
     } else {
-        auto connection             = std::make_shared<AkumuliConnection>(full_path.c_str());
+        auto connection             = std::make_shared<AkumuliConnection>(full_path.c_str(), params);
         auto qproc                  = std::make_shared<QueryProcessor>(connection, 1000);
 
         SignalHandler sighandler;
@@ -0,0 +1,123 @@
+#include "numparser.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace Akumuli {
+
+//! Exactly representable powers of ten
+static const double POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+//! Max mantissa that can be converted to double exactly
+static const u64 MAX_MANTISSA = 1ull << 53;
+
+static bool parse_double_slow(const char* begin, const char* end, double* result) {
+    // strtod needs zero-terminated string
+    const size_t size = static_cast<size_t>(end - begin);
+    char buffer[128];
+    std::string tmp;
+    char* str = buffer;
+    if (size < sizeof(buffer)) {
+        memcpy(buffer, begin, size);
+        buffer[size] = '\0';
+    } else {
+        tmp.assign(begin, end);
+        str = &tmp[0];
+    }
+    char* endptr = nullptr;
+    *result = strtod(str, &endptr);
+    return size != 0 && endptr == str + size;
+}
+
+bool parse_double(const char* begin, const char* end, double* result) {
+    const char* p = begin;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    u64 mantissa = 0;
+    int ndigits = 0;      // number of significant digits
+    int nfraction = 0;    // number of digits after the point
+    bool has_digits = false;
+    while (p != end && *p == '0') {
+        has_digits = true;
+        p++;
+    }
+    while (p != end && *p >= '0' && *p <= '9') {
+        mantissa = mantissa*10 + static_cast<u64>(*p - '0');
+        ndigits++;
+        has_digits = true;
+        p++;
+    }
+    if (p != end && *p == '.') {
+        p++;
+        if (ndigits == 0) {
+            // Leading zeroes of the fraction are not significant
+            while (p != end && *p == '0') {
+                nfraction++;
+                has_digits = true;
+                p++;
+            }
+        }
+        while (p != end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa*10 + static_cast<u64>(*p - '0');
+            ndigits++;
+            nfraction++;
+            has_digits = true;
+            p++;
+        }
+    }
+    if (!has_digits || ndigits > 19) {
+        return parse_double_slow(begin, end, result);
+    }
+    int exponent = 0;
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negexp = false;
+        if (p != end && (*p == '-' || *p == '+')) {
+            negexp = *p == '-';
+            p++;
+        }
+        if (p == end) {
+            return parse_double_slow(begin, end, result);
+        }
+        while (p != end && *p >= '0' && *p <= '9') {
+            if (exponent > 10000) {
+                return parse_double_slow(begin, end, result);
+            }
+            exponent = exponent*10 + (*p - '0');
+            p++;
+        }
+        if (negexp) {
+            exponent = -exponent;
+        }
+    }
+    if (p != end) {
+        return parse_double_slow(begin, end, result);
+    }
+    exponent -= nfraction;
+    double value;
+    if (mantissa == 0) {
+        value = 0.0;
+    } else if (mantissa <= MAX_MANTISSA && exponent >= -22 && exponent <= 22) {
+        // Both operands are exact, the result is correctly rounded. Divisor is
+        // loaded from the table so it can't be replaced with reciprocal.
+        value = static_cast<double>(mantissa);
+        if (exponent < 0) {
+            value /= POW10[-exponent];
+        } else {
+            value *= POW10[exponent];
+        }
+    } else {
+        return parse_double_slow(begin, end, result);
+    }
+    *result = negative ? -value : value;
+    return true;
+}
+
+}  // namespace
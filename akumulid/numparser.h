@@ -0,0 +1,32 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+/** Parse floating point value. The whole [begin, end) range should be consumed,
+  * the result is bit-exact with the `strtod` function.
+  * Values with up to 19 significant digits and small exponents (the vast majority
+  * of the values sent by the clients) are parsed without `strtod`. Value is computed
+  * using single multiplication or division of two exactly representable values
+  * (Clinger's fast path) so it's correctly rounded. Everything else (large exponents,
+  * long mantissas, hexadecimal floats, 'inf', 'nan') is passed to `strtod`.
+  * @return true on success, false if the string is not a valid floating point value
+  */
+bool parse_double(const char* begin, const char* end, double* result);
+
+}  // namespace
@@ -3,7 +3,13 @@
 #include <cassert>
 #include <boost/algorithm/string.hpp>
 
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "resp.h"
+#include "numparser.h"
+#include "binaryframe.h"
 #include "ingestion_pipeline.h"
 
 namespace Akumuli {
@@ -27,61 +33,106 @@ const char* DatabaseError::what() const noexcept {
 
 // ReadBuffer class //
 
+/** Map `size` bytes of memory twice into adjacent regions of the address space,
+  * the result is a pointer to the `2*size` bytes long region. Size should be a
+  * multiple of the page size.
+  */
+static Byte* map_mirrored(size_t size) {
+    int fd = -1;
+#ifdef SYS_memfd_create
+    fd = static_cast<int>(syscall(SYS_memfd_create, "akumuli-rdbuf", 0));
+#endif
+    if (fd < 0) {
+        char path[] = "/tmp/akumuli-rdbuf-XXXXXX";
+        fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);
+        }
+    }
+    void* result = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        // Reserve address space first, then replace both halves with the same pages
+        result = mmap(nullptr, 2*size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (result != MAP_FAILED) {
+            auto base = static_cast<char*>(result);
+            if (mmap(base, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED ||
+                mmap(base + size, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED)
+            {
+                munmap(result, 2*size);
+                result = MAP_FAILED;
+            }
+        }
+    }
+    int error = errno;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (result == MAP_FAILED) {
+        BOOST_THROW_EXCEPTION(std::runtime_error(std::string("can't allocate read buffer: ") + strerror(error)));
+    }
+    return static_cast<Byte*>(result);
+}
+
 ReadBuffer::ReadBuffer(const size_t buffer_size)
     : BUFFER_SIZE(buffer_size)
-    , buffer_(buffer_size*N_BUF, 0)
-    , rpos_(0)
-    , wpos_(0)
-    , cons_(0)
+    , buffer_(nullptr)
+    , capacity_(static_cast<size_t>(sysconf(_SC_PAGESIZE)))
+    , cons_(nullptr)
     , buffers_allocated_(0)
 {
+    while (capacity_ < BUFFER_SIZE*N_BUF) {
+        capacity_ *= 2;
+    }
+    buffer_ = map_mirrored(capacity_);
+    cons_   = buffer_;
+    rbegin_ = buffer_;
+    rend_   = buffer_;
+}
+
+ReadBuffer::~ReadBuffer() {
+    munmap(buffer_, 2*capacity_);
 }
 
 Byte ReadBuffer::get() {
-    if (rpos_ == wpos_) {
+    if (rbegin_ == rend_) {
         auto ctx = get_error_context("unexpected end of stream");
         BOOST_THROW_EXCEPTION(ProtocolParserError(std::get<0>(ctx), std::get<1>(ctx)));
     }
-    return buffer_[rpos_++];
+    return *rbegin_++;
 }
 
 Byte ReadBuffer::pick() const {
-    if (rpos_ == wpos_) {
+    if (rbegin_ == rend_) {
         auto ctx = get_error_context("unexpected end of stream");
         BOOST_THROW_EXCEPTION(ProtocolParserError(std::get<0>(ctx), std::get<1>(ctx)));
     }
-    return buffer_[rpos_];
+    return *rbegin_;
 }
 
 bool ReadBuffer::is_eof() {
-    return rpos_ == wpos_;
+    return rbegin_ == rend_;
 }
 
 int ReadBuffer::read(Byte *buffer, size_t buffer_len) {
     assert(buffer_len < 0x100000000ul);
-    u32 to_read = wpos_ - rpos_;
-    to_read = std::min(static_cast<u32>(buffer_len), to_read);
-    std::copy(buffer_.begin() + rpos_, buffer_.begin() + rpos_ + to_read, buffer);
-    rpos_ += to_read;
+    auto to_read = std::min(buffer_len, static_cast<size_t>(rend_ - rbegin_));
+    memcpy(buffer, rbegin_, to_read);
+    rbegin_ += to_read;
     return static_cast<int>(to_read);
 }
 
 int ReadBuffer::read_line(Byte* buffer, size_t quota) {
     assert(quota < 0x100000000ul);
-    u32 available = wpos_ - rpos_;
-    auto to_read = std::min(static_cast<u32>(quota), available);
-    for (u32 i = 0; i < to_read; i++) {
-        Byte c = buffer_[rpos_ + i];
-        buffer[i] = c;
-        if (c == '\n') {
-            // Stop iteration
-            u32 bytes_copied = i + 1;
-            rpos_ += bytes_copied;
-            return static_cast<int>(bytes_copied);
-        }
+    auto to_read = std::min(quota, static_cast<size_t>(rend_ - rbegin_));
+    auto eol = static_cast<const Byte*>(memchr(rbegin_, '\n', to_read));
+    if (eol == nullptr) {
+        // No end of line found
+        return -1*static_cast<int>(to_read);
     }
-    // No end of line found
-    return -1*static_cast<int>(to_read);
+    auto bytes_copied = static_cast<size_t>(eol - rbegin_) + 1;
+    memcpy(buffer, rbegin_, bytes_copied);
+    rbegin_ += bytes_copied;
+    return static_cast<int>(bytes_copied);
 }
 
 void ReadBuffer::close() {
@@ -89,10 +140,10 @@ void ReadBuffer::close() {
 
 std::tuple<std::string, size_t> ReadBuffer::get_error_context(const char *error_message) const {
     // Get the frame: [...\r\n...\r\n...\r\n]
-    auto origin = buffer_.data() + cons_;
+    auto origin = cons_;
     const Byte* stop = origin;
     int nlcnt = 0;
-    const Byte* end = buffer_.data() + wpos_;
+    const Byte* end = rend_;
     while (stop < end) {
         if (*stop == '\n') {
             nlcnt++;
@@ -113,52 +164,87 @@ std::tuple<std::string, size_t> ReadBuffer::get_error_context(const char *error_
 
 void ReadBuffer::consume() {
     assert(buffers_allocated_ == 0);  // Invariant check: buffer can be invalidated!
-    cons_ = rpos_;
+    cons_ = rbegin_;
 }
 
 void ReadBuffer::discard() {
     assert(buffers_allocated_ == 0);  // Invariant check: buffer can be invalidated!
-    rpos_ = cons_;
+    rbegin_ = cons_;
+}
+
+void ReadBuffer::reset() {
+    assert(buffers_allocated_ == 0);
+    cons_   = buffer_;
+    rbegin_ = buffer_;
+    rend_   = buffer_;
+}
+
+void ReadBuffer::grow() {
+    auto capacity = capacity_*2;
+    auto buffer = map_mirrored(capacity);
+    auto size = static_cast<size_t>(rend_ - cons_);
+    auto rpos = static_cast<size_t>(rbegin_ - cons_);
+    memcpy(buffer, cons_, size);
+    munmap(buffer_, 2*capacity_);
+    buffer_   = buffer;
+    capacity_ = capacity;
+    cons_     = buffer_;
+    rbegin_   = buffer_ + rpos;
+    rend_     = buffer_ + size;
 }
 
 ReadBuffer::BufferT ReadBuffer::pull() {
-    assert(buffers_allocated_ == 0);  // Invariant check: buffer will be invalidated after vector.resize!
+    assert(buffers_allocated_ == 0);  // Invariant check: buffer will be invalidated after grow!
     buffers_allocated_++;
 
-    u32 sz = static_cast<u32>(buffer_.size()) - wpos_;  // because previous push can bring partially filled buffer
-    if (sz < BUFFER_SIZE) {
-        if ((cons_ + sz) > BUFFER_SIZE) {
-            // Problem can be solved by rotating the buffer and asjusting wpos_, rpos_ and cons_
-            std::copy(buffer_.begin() + cons_, buffer_.end(), buffer_.begin());
-            wpos_ -= cons_;
-            rpos_ -= cons_;
-            cons_ = 0;
-        } else {
-            // Double the size of the buffer
-            buffer_.resize(buffer_.size() * 2);
-        }
+    if (cons_ >= buffer_ + capacity_) {
+        // Both halves of the buffer are mapped to the same memory, so the ring
+        // can be rotated by adjusting the pointers, the data stays in place.
+        cons_   -= capacity_;
+        rbegin_ -= capacity_;
+        rend_   -= capacity_;
     }
-    Byte* ptr = buffer_.data() + wpos_;
-    return ptr;
+    if (capacity_ - static_cast<size_t>(rend_ - cons_) < BUFFER_SIZE) {
+        // Unconsumed part of the message doesn't leave enough space
+        grow();
+    }
+    return buffer_ + (rend_ - buffer_);
 }
 
 void ReadBuffer::push(ReadBuffer::BufferT, u32 size) {
     assert(buffers_allocated_ == 1);
     buffers_allocated_--;
-    wpos_ += size;
+    rend_ += size;
 }
 
 
 // ProtocolParser class //
 
-RESPProtocolParser::RESPProtocolParser(std::shared_ptr<DbSession> consumer)
+RESPProtocolParser::RESPProtocolParser(std::shared_ptr<DbSession> consumer, std::shared_ptr<SeriesNameCache> cache)
     : done_(false)
     , rdbuf_(RDBUF_SIZE)
     , consumer_(consumer)
     , logger_("resp-protocol-parser")
+    , cache_(cache ? cache : std::make_shared<SeriesNameCache>())
 {
 }
 
+SeriesNameCache::Stats RESPProtocolParser::get_cache_stats() const {
+    return cache_->get_stats();
+}
+
+int RESPProtocolParser::match_series(const Byte* name, int size, aku_ParamId* ids, u32 nvalues) {
+    int rowwidth = cache_->find(name, name + size, ids, nvalues);
+    if (rowwidth > 0) {
+        return rowwidth;
+    }
+    rowwidth = consumer_->name_to_param_id_list(name, name + size, ids, nvalues);
+    if (rowwidth > 0) {
+        cache_->insert(name, name + size, ids, static_cast<u32>(rowwidth));
+    }
+    return rowwidth;
+}
+
 void RESPProtocolParser::start() {
     logger_.info() << "Starting protocol parser";
 }
@@ -231,8 +317,7 @@ bool RESPProtocolParser::parse_dict(RESPStream& stream) {
     bool success;
     int bytes_read;
     int rowwidth = -1;
-    const int buffer_len = RESPStream::STRING_LENGTH_MAX;
-    Byte buffer[buffer_len] = {};
+    const Byte* name = nullptr;
     while(true) {
         // read id
         auto next = stream.next_type();
@@ -260,12 +345,13 @@ bool RESPProtocolParser::parse_dict(RESPStream& stream) {
                     rdbuf_.discard();
                     return false;
                 } else if (next == RESPStream::STRING) {
-                    std::tie(success, bytes_read) = stream.read_string(buffer, buffer_len);
+                    // Series name is passed to the cache and the consumer without copying
+                    std::tie(success, name, bytes_read) = stream.read_string_view();
                     if (!success) {
                         rdbuf_.discard();
                         return false;
                     }
-                    rowwidth = consumer_->name_to_param_id_list(buffer, buffer + bytes_read, ids, nvalues);
+                    rowwidth = match_series(name, bytes_read, ids, nvalues);
                     if (rowwidth <= 0) {
                         std::string msg;
                         size_t pos;
@@ -321,8 +407,7 @@ int RESPProtocolParser::parse_ids(RESPStream& stream, aku_ParamId* ids, int nval
     bool success;
     int bytes_read;
     int rowwidth = -1;
-    const int buffer_len = RESPStream::STRING_LENGTH_MAX;
-    Byte buffer[buffer_len] = {};
+    const Byte* name = nullptr;
     aku_ParamId uid = 0;
     // read id
     auto next = stream.next_type();
@@ -331,12 +416,13 @@ int RESPProtocolParser::parse_ids(RESPStream& stream, aku_ParamId* ids, int nval
         rdbuf_.discard();
         return -1;
     case RESPStream::STRING:
-        std::tie(success, bytes_read) = stream.read_string(buffer, buffer_len);
+        // Series name is passed to the cache and the consumer without copying
+        std::tie(success, name, bytes_read) = stream.read_string_view();
         if (!success) {
             rdbuf_.discard();
             return -1;
         }
-        rowwidth = consumer_->name_to_param_id_list(buffer, buffer + bytes_read, ids, static_cast<u32>(nvalues));
+        rowwidth = match_series(name, bytes_read, ids, static_cast<u32>(nvalues));
         if (rowwidth <= 0) {
             std::string msg;
             size_t pos;
@@ -374,35 +460,32 @@ int RESPProtocolParser::parse_ids(RESPStream& stream, aku_ParamId* ids, int nval
 }
 
 bool RESPProtocolParser::parse_values(RESPStream& stream, double* values, int nvalues) {
-    const size_t buflen = 64;
-    Byte buf[buflen];
+    const int MAX_VALUE_LENGTH = 63;
+    const Byte* str;
     int bytes_read;
     int arrsize;
     bool success;
     auto parse_int_value = [&](int at) {
-        std::tie(success, values[0]) = stream.read_int();
+        std::tie(success, values[at]) = stream.read_int();
         if (!success) {
             return false;
         }
         return true;
     };
     auto parse_string_value = [&](int at) {
-        std::tie(success, bytes_read) = stream.read_string(buf, buflen);
+        std::tie(success, str, bytes_read) = stream.read_string_view();
         if (!success) {
             return false;
         }
-        if (bytes_read < 0) {
+        if (bytes_read > MAX_VALUE_LENGTH) {
             std::string msg;
             size_t pos;
             std::tie(msg, pos) = rdbuf_.get_error_context("floating point value can't be that big");
             BOOST_THROW_EXCEPTION(ProtocolParserError(msg, pos));
         }
-        buf[bytes_read] = '\0';
-        char* endptr = nullptr;
-        values[at] = strtod(buf, &endptr);
-        if (endptr - buf != bytes_read) {
+        if (!parse_double(str, str + bytes_read, &values[at])) {
             std::stringstream fmt;
-            fmt << "can't parse double value: " << buf;
+            fmt << "can't parse double value: " << std::string(str, str + bytes_read);
             std::string msg;
             size_t pos;
             std::tie(msg, pos) = rdbuf_.get_error_context(fmt.str().c_str());
@@ -505,7 +588,6 @@ void RESPProtocolParser::worker() {
     int rowwidth = 0;
     // Data to read
     aku_Sample sample;
-    aku_Status status = AKU_SUCCESS;
     //
     RESPStream stream(&rdbuf_);
     // try to read dict
@@ -545,19 +627,33 @@ void RESPProtocolParser::worker() {
         for (int i = 0; i < rowwidth; i++) {
             sample.paramid = paramids[i];
             sample.payload.float64 = values[i];
-            status = consumer_->write(sample);
-            // Message processed and frame can be removed (if possible)
-            if (status != AKU_SUCCESS) {
-                BOOST_THROW_EXCEPTION(DatabaseError(status));
-            }
+            batch_.push_back(sample);
         }
     }
 }
 
+void RESPProtocolParser::write_batch() {
+    if (batch_.empty()) {
+        return;
+    }
+    auto status = consumer_->write_batch(batch_.data(), batch_.size());
+    batch_.clear();
+    if (status != AKU_SUCCESS) {
+        BOOST_THROW_EXCEPTION(DatabaseError(status));
+    }
+}
+
 NullResponse RESPProtocolParser::parse_next(Byte* buffer, u32 sz) {
     static NullResponse response;
     rdbuf_.push(buffer, sz);
-    worker();
+    try {
+        worker();
+    } catch (StreamError const&) {
+        // Samples that precede the error should be written anyway
+        write_batch();
+        throw;
+    }
+    write_batch();
     return response;
 }
 
@@ -569,6 +665,13 @@ void RESPProtocolParser::close() {
     done_ = true;
 }
 
+void RESPProtocolParser::reset() {
+    done_ = false;
+    rdbuf_.reset();
+    idmap_.clear();
+    batch_.clear();
+}
+
 std::string RESPProtocolParser::error_repr(int kind, std::string const& err) const {
     switch (kind) {
     case ERR:
@@ -592,13 +695,37 @@ OpenTSDBProtocolParser::OpenTSDBProtocolParser(std::shared_ptr<DbSession> consum
 {
 }
 
+SeriesNameCache::Stats OpenTSDBProtocolParser::get_cache_stats() const {
+    return cache_.get_stats();
+}
+
 void OpenTSDBProtocolParser::start() {
     logger_.info() << "Starting protocol parser";
 }
 
 OpenTSDBResponse OpenTSDBProtocolParser::parse_next(Byte* buffer, u32 sz) {
     rdbuf_.push(buffer, sz);
-    return worker();
+    OpenTSDBResponse response;
+    try {
+        response = worker();
+    } catch (StreamError const&) {
+        // Samples that precede the error should be written anyway
+        write_batch();
+        throw;
+    }
+    write_batch();
+    return response;
+}
+
+void OpenTSDBProtocolParser::write_batch() {
+    if (batch_.empty()) {
+        return;
+    }
+    auto status = consumer_->write_batch(batch_.data(), batch_.size());
+    batch_.clear();
+    if (status != AKU_SUCCESS) {
+        BOOST_THROW_EXCEPTION(DatabaseError(status));
+    }
 }
 
 Byte* OpenTSDBProtocolParser::get_next_buffer() {
@@ -804,7 +931,13 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
             std::rotate(a, b, pend);
 
             // Buffer contains only one data point
-            status = consumer_->series_to_param_id(pbuf, static_cast<u32>(name_size - tags_trailing), &sample);  // -1 because name_size includes space
+            const Byte* name_end = pbuf + name_size - tags_trailing;
+            if (cache_.find(pbuf, name_end, &sample.paramid, 1) == 0) {
+                status = consumer_->series_to_param_id(pbuf, static_cast<u32>(name_size - tags_trailing), &sample);  // -1 because name_size includes space
+                if (status == AKU_SUCCESS) {
+                    cache_.insert(pbuf, name_end, &sample.paramid, 1);
+                }
+            }
             if (status != AKU_SUCCESS) {
                 std::string msg;
                 size_t pos;
@@ -820,7 +953,6 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
                 const int eix = timestamp_size - timestamp_trailing;
                 pbuf[eix] = '\0';  // timestamp_trailing can't be 0 or less
                 auto result = strtoul(pbuf, &endptr, 10);
-                pbuf[eix] = ' ';
                 if (result == 0) {
                     err = true;
                 }
@@ -843,6 +975,7 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
                         err = false;
                     }
                 }
+                pbuf[eix] = ' ';
                 if (err) {
                     std::string msg;
                     size_t pos;
@@ -852,12 +985,8 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
             }
             pbuf += timestamp_size;
 
-            const int tix = value_size - value_trailing;
-            pbuf[tix] = '\0';  // Replace space with 0-terminator
-            char* endptr = nullptr;
-            pbuf[tix] = ' ';
-            double value = strtod(pbuf, &endptr);
-            if (endptr - pbuf != (value_size - value_trailing)) {
+            double value;
+            if (!parse_double(pbuf, pbuf + value_size - value_trailing, &value)) {
                 std::string msg;
                 size_t pos;
                 std::tie(msg, pos) = rdbuf_.get_error_context("put: bad floating point value");
@@ -867,11 +996,8 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
             sample.payload.float64 = value;
             sample.payload.type = AKU_PAYLOAD_FLOAT;
 
-            // Put value
-            status = consumer_->write(sample);
-            if (status != AKU_SUCCESS) {
-                BOOST_THROW_EXCEPTION(DatabaseError(status));
-            }
+            // Put value, batch is written when the buffer is parsed
+            batch_.push_back(sample);
 
             rdbuf_.consume();
             break;
@@ -911,4 +1037,151 @@ std::string OpenTSDBProtocolParser::error_repr(int kind, std::string const& err)
     return err + "\n";
 }
 
+
+//     Binary protocol      //
+
+BinaryProtocolParser::BinaryProtocolParser(std::shared_ptr<DbSession> consumer)
+    : done_(false)
+    , rdbuf_(RDBUF_SIZE)
+    , consumer_(consumer)
+    , logger_("binary-protocol-parser")
+{
+}
+
+SeriesNameCache::Stats BinaryProtocolParser::get_cache_stats() const {
+    return cache_.get_stats();
+}
+
+void BinaryProtocolParser::start() {
+    logger_.info() << "Starting protocol parser";
+}
+
+void BinaryProtocolParser::parse_dict_frame(const u8* begin, const u8* end) {
+    u64 uid;
+    const char* name;
+    size_t size;
+    auto status = BinaryFrame::decode_dict(begin, end, &uid, &name, &size);
+    if (status != AKU_SUCCESS || size == 0 || size >= AKU_LIMITS_MAX_SNAME) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("binary: malformed dictionary frame", 0));
+    }
+    aku_ParamId ids[AKU_LIMITS_MAX_ROW_WIDTH];
+    int rowwidth = cache_.find(name, name + size, ids, AKU_LIMITS_MAX_ROW_WIDTH);
+    if (rowwidth == 0) {
+        rowwidth = consumer_->name_to_param_id_list(name, name + size, ids, AKU_LIMITS_MAX_ROW_WIDTH);
+        if (rowwidth > 0) {
+            cache_.insert(name, name + size, ids, static_cast<u32>(rowwidth));
+        }
+    }
+    if (rowwidth > 1) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("binary: compound series names are not supported - "
+                                                  + std::string(name, name + size), 0));
+    } else if (rowwidth <= 0) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("binary: invalid series name format - "
+                                                  + std::string(name, name + size), 0));
+    }
+    idmap_[uid] = ids[0];
+}
+
+void BinaryProtocolParser::parse_data_frame(const u8* begin, const u8* end) {
+    BinaryFrame::DataHeader header;
+    auto status = BinaryFrame::decode_data_header(begin, end, &header);
+    if (status != AKU_SUCCESS) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("binary: malformed data frame", 0));
+    }
+    auto it = idmap_.find(header.id);
+    if (it == idmap_.end()) {
+        BOOST_THROW_EXCEPTION(ProtocolParserError("binary: unknown series id " + std::to_string(header.id), 0));
+    }
+    aku_Sample sample = {};
+    sample.paramid = it->second;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    sample.payload.size = sizeof(aku_Sample);
+    // Timestamps and values are decoded in place
+    size_t pos = batch_.size();
+    batch_.resize(pos + header.size, sample);
+    status = BinaryFrame::decode_data(header, batch_.data() + pos);
+    if (status != AKU_SUCCESS) {
+        batch_.resize(pos);
+        BOOST_THROW_EXCEPTION(ProtocolParserError("binary: malformed data frame", 0));
+    }
+}
+
+void BinaryProtocolParser::worker() {
+    while (true) {
+        const Byte* data;
+        size_t size;
+        std::tie(data, size) = rdbuf_.get_window();
+        if (size < BinaryFrame::PREFIX_SIZE) {
+            return;
+        }
+        auto begin = reinterpret_cast<const u8*>(data);
+        u32 frame_size = BinaryFrame::get_frame_size(begin);
+        if (frame_size == 0 || frame_size > BinaryFrame::MAX_FRAME_SIZE) {
+            BOOST_THROW_EXCEPTION(ProtocolParserError("binary: invalid frame size " + std::to_string(frame_size), 0));
+        }
+        if (size - BinaryFrame::PREFIX_SIZE < frame_size) {
+            // Frame is incomplete
+            return;
+        }
+        begin += BinaryFrame::PREFIX_SIZE;
+        switch (*begin) {
+        case BinaryFrame::DICTIONARY:
+            parse_dict_frame(begin, begin + frame_size);
+            break;
+        case BinaryFrame::DATA:
+            parse_data_frame(begin, begin + frame_size);
+            break;
+        default:
+            BOOST_THROW_EXCEPTION(ProtocolParserError("binary: unknown frame type " + std::to_string(*begin), 0));
+        };
+        rdbuf_.advance(BinaryFrame::PREFIX_SIZE + frame_size);
+        rdbuf_.consume();
+    }
+}
+
+void BinaryProtocolParser::write_batch() {
+    if (batch_.empty()) {
+        return;
+    }
+    auto status = consumer_->write_batch(batch_.data(), batch_.size());
+    batch_.clear();
+    if (status != AKU_SUCCESS) {
+        BOOST_THROW_EXCEPTION(DatabaseError(status));
+    }
+}
+
+NullResponse BinaryProtocolParser::parse_next(Byte* buffer, u32 sz) {
+    static NullResponse response;
+    rdbuf_.push(buffer, sz);
+    try {
+        worker();
+    } catch (StreamError const&) {
+        // Samples that precede the error should be written anyway
+        write_batch();
+        throw;
+    }
+    write_batch();
+    return response;
+}
+
+Byte* BinaryProtocolParser::get_next_buffer() {
+    return rdbuf_.pull();
+}
+
+void BinaryProtocolParser::close() {
+    done_ = true;
+}
+
+std::string BinaryProtocolParser::error_repr(int kind, std::string const& err) const {
+    switch (kind) {
+    case ERR:
+        return "-ERR " + err + "\r\n";
+    case DB:
+        return "-DB " + err + "\r\n";
+    case PARSE:
+        return "-PARSER " + err + "\r\n";
+    };
+    return "-UNKNOWN " + err + "\r\n";
+}
+
 }
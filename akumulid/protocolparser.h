@@ -25,6 +25,7 @@
 
 #include "logger.h"
 #include "resp.h"
+#include "seriescache.h"
 #include "stream.h"
 
 namespace Akumuli {
@@ -79,23 +80,33 @@ struct ChunkedWriter {
 
 /** This class should be used in conjunction with tcp-server class.
  * It allocates buffers for server and makes them available to parser.
+ * The buffer is a ring that is mapped twice into adjacent regions of virtual
+ * memory. Because of that both the unconsumed data and the buffer returned by
+ * `pull` are always contiguous and the unconsumed data is never moved (it's
+ * copied only if the ring is too small for the message and has to grow).
  */
 class ReadBuffer : public ByteStreamReader, public ChunkedWriter {
     enum {
         // This parameter defines initial buffer size as a number of BUFFER_SIZE regions.
-        // Increasing this parameter will increase memory requirements. Decreasing this parameter
-        // will increase amount of copying.
+        // Increasing this parameter will increase memory requirements. Buffer is doubled
+        // if the message doesn't fit.
         N_BUF = 4,
     };
     const size_t BUFFER_SIZE;
-    std::vector<Byte> buffer_;
-    mutable u32 rpos_;   // Current read position
-    mutable u32 wpos_;   // Current write position
-    mutable u32 cons_;   // Consumed part of the buffer
-    int buffers_allocated_; // Buffer counter (only one allocated buffer is allowed)
+    Byte*        buffer_;    // Ring buffer, [capacity_, 2*capacity_) is mapped to [0, capacity_)
+    size_t       capacity_;  // Size of the ring buffer
+    const Byte*  cons_;      // Consumed part of the buffer
+    int buffers_allocated_;  // Buffer counter (only one allocated buffer is allowed)
+
+    //! Double the capacity of the buffer
+    void grow();
 
 public:
     ReadBuffer(const size_t buffer_size);
+    ~ReadBuffer();
+
+    ReadBuffer(ReadBuffer const&) = delete;
+    ReadBuffer& operator = (ReadBuffer const&) = delete;
 
     // ByteStreamReader interface
 public:
@@ -108,6 +119,8 @@ public:
     virtual std::tuple<std::string, size_t> get_error_context(const char *error_message) const override;
     virtual void consume();
     virtual void discard();
+    //! Drop all data, mapped memory is reused
+    void reset();
 
     // BufferAllocator interface
 public:
@@ -219,10 +232,16 @@ class RESPProtocolParser {
     std::shared_ptr<DbSession>         consumer_;
     Logger                             logger_;
     SeriesIdMap                        idmap_;
+    //! Samples parsed from the current buffer
+    std::vector<aku_Sample>            batch_;
+    std::shared_ptr<SeriesNameCache>   cache_;
 
     //! Process frames from queue
     void worker();
 
+    //! Write all parsed samples to the consumer
+    void write_batch();
+
     //! Generate error message
     std::tuple<std::string, size_t> get_error_from_pdu(PDU const& pdu) const;
 
@@ -230,6 +249,8 @@ class RESPProtocolParser {
     bool parse_timestamp(RESPStream& stream, aku_Sample& sample);
     bool parse_values(RESPStream& stream, double* values, int nvalues);
     int parse_ids(RESPStream& stream, aku_ParamId* ids, int nvalues);
+    //! Match series name using the cache first, return number of ids or negative value on error
+    int match_series(const Byte* name, int size, aku_ParamId* ids, u32 nvalues);
     /**
      * @brief Cache series id mapping
      * @param uid is a user supplied id
@@ -243,11 +264,22 @@ public:
     enum {
         RDBUF_SIZE = 0x1000,  // 4KB
     };
-    RESPProtocolParser(std::shared_ptr<DbSession> consumer);
+    /** C-tor
+      * @param consumer is a database session
+      * @param cache is a series name cache (parser creates its own cache if null),
+      *        cache can be shared by parsers created by the same thread one after another
+      */
+    RESPProtocolParser(std::shared_ptr<DbSession> consumer,
+                       std::shared_ptr<SeriesNameCache> cache = std::shared_ptr<SeriesNameCache>());
     void start();
     NullResponse parse_next(Byte *buffer, u32 sz);
     void close();
+    /** Drop buffered data and the dictionary, parser can be used for the next independent
+      * input after that (the read buffer and the series name cache are reused).
+      */
+    void reset();
     Byte* get_next_buffer();
+    SeriesNameCache::Stats get_cache_stats() const;
 
     // Error representation
     enum {
@@ -303,8 +335,14 @@ class OpenTSDBProtocolParser {
     ReadBuffer                         rdbuf_;
     std::shared_ptr<DbSession>         consumer_;
     Logger                             logger_;
+    //! Samples parsed from the current buffer
+    std::vector<aku_Sample>            batch_;
+    SeriesNameCache                    cache_;
 
     OpenTSDBResponse worker();
+
+    //! Write all parsed samples to the consumer
+    void write_batch();
 public:
     enum {
         RDBUF_SIZE = 0x1000,  // 4KB
@@ -316,6 +354,7 @@ public:
     OpenTSDBResponse parse_next(Byte *buffer, u32 sz);
     void close();
     Byte* get_next_buffer();
+    SeriesNameCache::Stats get_cache_stats() const;
 
     // Error representation
     enum {
@@ -330,4 +369,61 @@ public:
     std::string error_repr(int kind, std::string const& err) const;
 };
 
+/**
+ * @brief Binary protocol parser
+ *
+ * Implements compact binary protocol. Data is sent using length-prefixed frames
+ * (see BinaryFrame for the format). DICTIONARY frame maps user supplied id to the
+ * series name, DATA frame contains the id and the arrays of timestamps and values
+ * of the series. Series should be added to the dictionary before the id is used.
+ * Compound series names are not supported.
+ *
+ * Timestamps and values are decoded directly into the batch of samples that is
+ * written to the consumer using `write_batch` method.
+ */
+class BinaryProtocolParser {
+    typedef std::unordered_map<u64, aku_ParamId> SeriesIdMap;
+    bool                               done_;
+    ReadBuffer                         rdbuf_;
+    std::shared_ptr<DbSession>         consumer_;
+    Logger                             logger_;
+    SeriesIdMap                        idmap_;
+    //! Samples parsed from the current buffer
+    std::vector<aku_Sample>            batch_;
+    SeriesNameCache                    cache_;
+
+    //! Process frames from the buffer
+    void worker();
+
+    //! Write all parsed samples to the consumer
+    void write_batch();
+
+    void parse_dict_frame(const u8* begin, const u8* end);
+    void parse_data_frame(const u8* begin, const u8* end);
+public:
+    enum {
+        RDBUF_SIZE = 0x1000,  // 4KB
+    };
+
+    BinaryProtocolParser(std::shared_ptr<DbSession> consumer);
+
+    void start();
+    NullResponse parse_next(Byte *buffer, u32 sz);
+    void close();
+    Byte* get_next_buffer();
+    SeriesNameCache::Stats get_cache_stats() const;
+
+    // Error representation
+    enum {
+        DB,
+        ERR,
+        PARSE,
+    };
+
+    /**
+     * @brief Return error representation (the same as in RESP protocol)
+     */
+    std::string error_repr(int kind, std::string const& err) const;
+};
+
 }  // namespace
@@ -1,6 +1,7 @@
 #include "query_results_pooler.h"
 #include "logger.h"
 #include <cstdio>
+#include <sstream>
 #include <thread>
 #include <inttypes.h>
 #include <stdint.h>
@@ -545,7 +546,19 @@ ReadOperation *QueryProcessor::create(ApiEndpoint endpoint) {
 std::string QueryProcessor::get_all_stats() {
     auto con = con_.lock();
     if (con) {
-        return con->get_all_stats();
+        std::string stats = con->get_all_stats();
+        // Add server counters to the database stats
+        boost::property_tree::ptree tree;
+        try {
+            std::stringstream input(stats);
+            boost::property_tree::json_parser::read_json(input, tree);
+        } catch (boost::property_tree::json_parser_error const&) {
+            return stats;
+        }
+        ServerStats::instance().report(&tree);
+        std::stringstream output;
+        boost::property_tree::json_parser::write_json(output, tree, true);
+        return output.str();
     }
     std::runtime_error err("Database connection was closed");
     BOOST_THROW_EXCEPTION(err);
@@ -1,6 +1,7 @@
 #include "resp.h"
 #include <boost/exception/all.hpp>
 #include <cassert>
+#include <cstring>
 
 namespace Akumuli {
 
@@ -13,13 +14,30 @@ RESPStream::RESPStream(ByteStreamReader *stream) {
     stream_ = stream;
 }
 
+/** Find the end of the line. Line should fit in `quota` bytes (including
+  * line terminator).
+  * @return pointer to the '\n' symbol or null if the line is not received completely
+  * @throw RESPError if the line is too long
+  */
+static const Byte* find_eol(ByteStreamReader const* stream, const Byte* begin, size_t size, size_t quota, const char* error) {
+    // memchr is vectorized by all major libc implementations
+    auto eol = static_cast<const Byte*>(memchr(begin, '\n', std::min(size, quota)));
+    if (eol == nullptr && size >= quota) {
+        auto ctx = stream->get_error_context(error);
+        BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+    }
+    return eol;
+}
+
 RESPStream::Type RESPStream::next_type() const {
-    if (stream_->is_eof()) {
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = stream_->get_window();
+    if (size == 0) {
         return _AGAIN;
     }
-    auto ch = stream_->pick();
     Type result = _BAD;
-    switch(ch) {
+    switch(*begin) {
     case '+':
         result = STRING;
         break;
@@ -42,103 +60,149 @@ RESPStream::Type RESPStream::next_type() const {
     return result;
 }
 
-std::tuple<bool, u64> RESPStream::_read_int_body() {
-    const int MAX_DIGITS = 84 + 2;  // Maximum number of decimal digits in u64 + \r\n
-    Byte buf[MAX_DIGITS];
+//! Check that all eight bytes of the word are decimal digits
+static inline bool is_eight_digits(u64 word) {
+    return ((word & 0xF0F0F0F0F0F0F0F0ull) |
+            (((word + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull;
+}
+
+//! Parse eight decimal digits at once (SWAR, little endian byte order)
+static inline u64 parse_eight_digits(u64 word) {
+    word -= 0x3030303030303030ull;
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+            (((word >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return word;
+}
+
+std::tuple<bool, u64> RESPStream::_read_int_body(const Byte* begin, size_t size) {
+    const size_t MAX_DIGITS = 84 + 2;  // Maximum number of decimal digits in u64 + \r\n
+    // Skip the type prefix
+    begin++;
+    size--;
+    const Byte* it  = begin;
+    const Byte* end = begin + std::min(size, MAX_DIGITS);
     u64 result = 0;
-    int res = stream_->read_line(buf, MAX_DIGITS);
-    if (res <= 0) {
-        if (res == -1*MAX_DIGITS) {
-            // Invalid input, too many digits in the number
-            auto ctx = stream_->get_error_context("integer is too long");
-            BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+    while (end - it >= 8) {
+        u64 word;
+        memcpy(&word, it, 8);
+        if (!is_eight_digits(word)) {
+            break;
         }
-        return std::make_tuple(false, 0ull);
+        result = result*100000000 + parse_eight_digits(word);
+        it += 8;
     }
-    for (int i = 0; i < res; i++) {
-        Byte c = buf[i];
-        // c must be in [0x30:0x39] range
-        if (c <= 0x39 && c >= 0x30) {
-            result = result*10 + static_cast<u32>(c & 0x0F);
-        } else if (c == '\n') {
-            // Note: I decided to support both \r\n and \n line endings in Akumuli for simplicity.
-            return std::make_tuple(true, result);
-        } else if (c == '\r') {
-            // The next one should be \n
-            i++;
-            if (i < res && buf[i] == '\n') {
-                return std::make_tuple(true, result);
-            }
+    // c must be in [0x30:0x39] range
+    while (it != end && *it <= 0x39 && *it >= 0x30) {
+        result = result*10 + static_cast<u32>(*it & 0x0F);
+        it++;
+    }
+    // Note: I decided to support both \r\n and \n line endings in Akumuli for simplicity.
+    if (it != end && *it == '\r') {
+        it++;
+        if (it != end && *it != '\n') {
             auto ctx = stream_->get_error_context("invalid symbol inside stream - '\\r'");
             BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
-        } else {
-            auto ctx = stream_->get_error_context("can't parse integer (character value out of range)");
+        }
+    }
+    if (it == end) {
+        if (size >= MAX_DIGITS) {
+            // Invalid input, too many digits in the number
+            auto ctx = stream_->get_error_context("integer is too long");
             BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
         }
+        return std::make_tuple(false, 0ull);
     }
-    // Bad stream
-    auto ctx = stream_->get_error_context("error in stream decoding routine");
-    BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+    if (*it != '\n') {
+        auto ctx = stream_->get_error_context("can't parse integer (character value out of range)");
+        BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+    }
+    stream_->advance(static_cast<size_t>(it - begin) + 2);
+    return std::make_tuple(true, result);
 }
 
 std::tuple<bool, u64> RESPStream::read_int() {
-    if (stream_->is_eof()) {
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = stream_->get_window();
+    if (size == 0) {
         return std::make_tuple(false, 0ull);
     }
-    Byte c = stream_->get();
-    if (c != ':') {
+    if (*begin != ':') {
         auto ctx = stream_->get_error_context("integer expected");
         BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
     }
-    return _read_int_body();
+    return _read_int_body(begin, size);
 }
 
-std::tuple<bool, int> RESPStream::_read_string_body(Byte *buffer, size_t byte_buffer_size) {
-    auto quota = std::min(byte_buffer_size, static_cast<size_t>(RESPStream::STRING_LENGTH_MAX));
-    auto res = stream_->read_line(buffer, quota);
-    if (res > 0) {
-        // Success
-        if (buffer[res - 1] == '\n') {
-            res--;
-            if (buffer[res - 1] == '\r') {
-                res--;
-            }
-        }
-        return std::make_tuple(true, res);
+std::tuple<bool, const Byte*, int> RESPStream::_read_string_body(const Byte* begin, size_t size, size_t quota) {
+    // Skip the type prefix
+    begin++;
+    size--;
+    // Max string length reached, invalid input
+    auto eol = find_eol(stream_, begin, size, quota, "out of quota");
+    if (eol == nullptr) {
+        return std::make_tuple(false, nullptr, 0);
     }
-    if (res == -1*static_cast<int>(quota)) {
-        // Max string length reached, invalid input.
-        auto ctx = stream_->get_error_context("out of quota");
-        BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+    const Byte* end = eol;
+    if (end != begin && end[-1] == '\r') {
+        end--;
     }
-    return std::make_tuple(false, 0ull);
+    stream_->advance(static_cast<size_t>(eol - begin) + 2);
+    return std::make_tuple(true, begin, static_cast<int>(end - begin));
 }
 
 std::tuple<bool, int> RESPStream::read_string(Byte *buffer, size_t byte_buffer_size) {
-    if (stream_->is_eof()) {
-        return std::make_tuple(false, 0ull);
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = stream_->get_window();
+    if (size == 0) {
+        return std::make_tuple(false, 0);
     }
-    Byte c = stream_->get();
-    if (c != '+') {
+    if (*begin != '+') {
         auto ctx = stream_->get_error_context("bad call");
         BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
     }
-    return _read_string_body(buffer, byte_buffer_size);
+    auto quota = std::min(byte_buffer_size, static_cast<size_t>(RESPStream::STRING_LENGTH_MAX));
+    bool success;
+    const Byte* str;
+    int len;
+    std::tie(success, str, len) = _read_string_body(begin, size, quota);
+    if (success) {
+        memcpy(buffer, str, static_cast<size_t>(len));
+    }
+    return std::make_tuple(success, len);
+}
+
+std::tuple<bool, const Byte*, int> RESPStream::read_string_view() {
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = stream_->get_window();
+    if (size == 0) {
+        return std::make_tuple(false, nullptr, 0);
+    }
+    if (*begin != '+') {
+        auto ctx = stream_->get_error_context("bad call");
+        BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
+    }
+    return _read_string_body(begin, size, RESPStream::STRING_LENGTH_MAX);
 }
 
 std::tuple<bool, int> RESPStream::read_bulkstr(Byte *buffer, size_t buffer_size) {
-    if (stream_->is_eof()) {
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = stream_->get_window();
+    if (size == 0) {
         return std::make_tuple(false, 0);
     }
-    Byte c = stream_->get();
-    if (c != '$') {
+    if (*begin != '$') {
         auto ctx = stream_->get_error_context("bad call");
         BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
     }
     // parse "{value}\r\n"
     bool success;
     u64 n;
-    std::tie(success, n) = _read_int_body();
+    std::tie(success, n) = _read_int_body(begin, size);
     if (!success) {
         return std::make_tuple(false, 0);
     }
@@ -176,15 +240,17 @@ std::tuple<bool, int> RESPStream::read_bulkstr(Byte *buffer, size_t buffer_size)
 }
 
 std::tuple<bool, u64> RESPStream::read_array_size() {
-    if (stream_->is_eof()) {
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = stream_->get_window();
+    if (size == 0) {
         return std::make_tuple(false, 0);
     }
-    Byte c = stream_->get();
-    if (c != '*') {
+    if (*begin != '*') {
         auto ctx = stream_->get_error_context("bad call");
         BOOST_THROW_EXCEPTION(RESPError(std::get<0>(ctx), std::get<1>(ctx)));
     }
-    return _read_int_body();
+    return _read_int_body(begin, size);
 }
 
 }
@@ -64,10 +64,12 @@ struct RESPStream {
     std::tuple<bool, u64> read_int();
 
     /** Read integer implementation
+      * @param begin is a pointer to the element (starting from type prefix)
+      * @param size is a number of bytes available in the stream
       * @throw on error
       * @return parsed integer
       */
-    std::tuple<bool, u64> _read_int_body();
+    std::tuple<bool, u64> _read_int_body(const Byte* begin, size_t size);
 
     /** Read string element.
       * Result is undefined unless next element in a stream is a string.
@@ -77,8 +79,20 @@ struct RESPStream {
       */
     std::tuple<bool, int> read_string(Byte* buffer, size_t buffer_size);
 
-    /** Read string implementation */
-    std::tuple<bool, int> _read_string_body(Byte* buffer, size_t buffer_size);
+    /** Read string element without copying.
+      * Result is undefined unless next element in a stream is a string.
+      * @return pointer to the string inside the stream and its size, pointer
+      *         is valid until the stream is consumed
+      */
+    std::tuple<bool, const Byte*, int> read_string_view();
+
+    /** Read string implementation (doesn't copy the string).
+      * @param begin is a pointer to the element (starting from type prefix)
+      * @param size is a number of bytes available in the stream
+      * @param quota is a max size of the string including line terminator
+      * @return pointer to the string and its size
+      */
+    std::tuple<bool, const Byte*, int> _read_string_body(const Byte* begin, size_t size, size_t quota);
 
     /** Read bulk string element.
       * Result is undefined unless next element in a stream is a bulk string.
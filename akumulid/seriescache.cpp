@@ -0,0 +1,99 @@
+#include "seriescache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Akumuli {
+
+SeriesNameCache::SeriesNameCache()
+    : stats_()
+{
+}
+
+u64 SeriesNameCache::hash(const char* begin, const char* end) {
+    static const u64 K = 0x9E3779B97F4A7C15ull;
+    u64 h = static_cast<u64>(end - begin) * K;
+    // Names are hashed eight bytes at a time
+    while (end - begin >= 8) {
+        u64 word;
+        memcpy(&word, begin, sizeof(word));
+        h = (h ^ word) * K;
+        h ^= h >> 32;
+        begin += 8;
+    }
+    u64 tail = 0;
+    memcpy(&tail, begin, static_cast<size_t>(end - begin));
+    h = (h ^ tail) * K;
+    h ^= h >> 29;
+    return h;
+}
+
+void SeriesNameCache::reset() {
+    std::fill(table_.begin(), table_.end(), Slot());
+    names_.clear();
+    ids_.clear();
+    stats_.size = 0;
+    stats_.resets++;
+}
+
+int SeriesNameCache::find(const char* begin, const char* end, aku_ParamId* ids, u32 cap) {
+    if (!table_.empty()) {
+        u64 h = hash(begin, end);
+        size_t size = static_cast<size_t>(end - begin);
+        for (u32 i = 0; i < MAX_PROBES; i++) {
+            Slot const& slot = table_[(h + i) & (CAPACITY - 1)];
+            if (slot.nids == 0) {
+                break;
+            }
+            if (slot.hash == h && slot.name_size == size &&
+                memcmp(names_.data() + slot.name_offset, begin, size) == 0)
+            {
+                if (slot.nids > cap) {
+                    break;
+                }
+                std::copy_n(ids_.data() + slot.ids_offset, slot.nids, ids);
+                stats_.hits++;
+                return static_cast<int>(slot.nids);
+            }
+        }
+    }
+    stats_.misses++;
+    return 0;
+}
+
+void SeriesNameCache::insert(const char* begin, const char* end, const aku_ParamId* ids, u32 nids) {
+    size_t size = static_cast<size_t>(end - begin);
+    if (nids == 0 || size > MAX_NAMES_SIZE) {
+        return;
+    }
+    if (table_.empty()) {
+        table_.resize(CAPACITY);
+    }
+    if (names_.size() + size > MAX_NAMES_SIZE || stats_.size >= CAPACITY*3/4) {
+        reset();
+    }
+    u64 h = hash(begin, end);
+    // Use the first empty slot, the first probed slot is replaced if there is no empty slots
+    Slot* target = &table_[h & (CAPACITY - 1)];
+    for (u32 i = 0; i < MAX_PROBES; i++) {
+        Slot* slot = &table_[(h + i) & (CAPACITY - 1)];
+        if (slot->nids == 0) {
+            target = slot;
+            stats_.size++;
+            break;
+        }
+    }
+    target->hash        = h;
+    target->name_offset = static_cast<u32>(names_.size());
+    target->name_size   = static_cast<u32>(size);
+    target->ids_offset  = static_cast<u32>(ids_.size());
+    target->nids        = nids;
+    names_.insert(names_.end(), begin, end);
+    ids_.insert(ids_.end(), ids, ids + nids);
+}
+
+SeriesNameCache::Stats SeriesNameCache::get_stats() const {
+    return stats_;
+}
+
+}  // namespace
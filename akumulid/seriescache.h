@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <vector>
+
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+/** Cache of the series name -> id mapping used by the protocol parsers.
+  *
+  * Cache is keyed on the raw series name as it was received from the client,
+  * so names found in the cache are not normalized and not matched by the
+  * storage session. Compound names ("cpu.user|cpu.sys host=foo") map to
+  * several ids.
+  *
+  * The cache is an open-addressing hash table with a limited number of probes.
+  * Names and ids are stored in arenas, the whole table is cleared when it's
+  * full (clients resend the same small set of names, so the table is rebuilt
+  * quickly). Not thread-safe, every connection should have its own cache.
+  */
+class SeriesNameCache {
+public:
+    enum {
+        //! Number of slots in the table (should be a power of two)
+        CAPACITY = 0x1000,
+        //! Max number of slots probed on lookup
+        MAX_PROBES = 8,
+        //! Max size of the name arena in bytes
+        MAX_NAMES_SIZE = 0x100000,
+    };
+
+    struct Stats {
+        u64 hits;
+        u64 misses;
+        //! Number of times the table was cleared
+        u64 resets;
+        //! Number of cached names
+        u64 size;
+    };
+
+private:
+    struct Slot {
+        u64 hash;
+        u32 name_offset;
+        u32 name_size;
+        u32 ids_offset;
+        //! Number of ids (0 - slot is empty)
+        u32 nids;
+    };
+
+    std::vector<Slot>        table_;
+    std::vector<char>        names_;
+    std::vector<aku_ParamId> ids_;
+    Stats                    stats_;
+
+    static u64 hash(const char* begin, const char* end);
+
+    void reset();
+
+public:
+    SeriesNameCache();
+
+    SeriesNameCache(SeriesNameCache const&) = delete;
+    SeriesNameCache& operator = (SeriesNameCache const&) = delete;
+
+    /** Find series name in cache.
+      * @param begin is a beginning of the raw series name
+      * @param end is an end of the raw series name
+      * @param ids is an output array
+      * @param cap is a size of the output array
+      * @return number of ids written to `ids` or 0 if name is not cached
+      */
+    int find(const char* begin, const char* end, aku_ParamId* ids, u32 cap);
+
+    //! Add series name and its ids (result of the storage lookup) to the cache
+    void insert(const char* begin, const char* end, const aku_ParamId* ids, u32 nids);
+
+    Stats get_stats() const;
+};
+
+}  // namespace
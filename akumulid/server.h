@@ -3,11 +3,15 @@
 #include "ingestion_pipeline.h"
 #include "signal_handler.h"
 
+#include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <tuple>
 
+#include <boost/property_tree/ptree.hpp>
+
 namespace Akumuli {
 
 struct ProtocolSettings {
@@ -19,6 +23,8 @@ struct ServerSettings {
     std::string                   name;
     std::vector<ProtocolSettings> protocols;
     int                           nworkers;
+    //! Server specific options (optional keys of the server's config section)
+    std::map<std::string, std::string> options;
 };
 
 
@@ -80,6 +86,38 @@ struct Server {
     virtual void start(SignalHandler* sig_handler, int id) = 0;
 };
 
+/** Registry of the server counters. Counters are reported by the stats
+  * endpoint along with the database stats.
+  */
+struct ServerStats {
+
+    //! Reporter adds server counters to the property tree
+    typedef std::function<void(boost::property_tree::ptree*)> Reporter;
+
+    std::mutex                      mutex_;
+    std::map<std::string, Reporter> reporters_;
+
+    void register_reporter(std::string name, Reporter reporter) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        reporters_[name] = reporter;
+    }
+
+    //! Add counters of all servers to `out` (every server gets its own subtree)
+    void report(boost::property_tree::ptree* out) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto const& kv: reporters_) {
+            boost::property_tree::ptree child;
+            kv.second(&child);
+            out->add_child(kv.first, child);
+        }
+    }
+
+    static ServerStats& instance() {
+        static ServerStats stats;
+        return stats;
+    }
+};
+
 struct ServerFactory {
 
     typedef std::function<std::shared_ptr<Server>(std::shared_ptr<AkumuliConnection>,
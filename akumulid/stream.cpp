@@ -26,63 +26,65 @@ std::string StreamError::get_bottom_line() const {
     return s.str();
 }
 
+ByteStreamReader::ByteStreamReader()
+    : rbegin_(nullptr)
+    , rend_(nullptr)
+{
+}
+
 ByteStreamReader::~ByteStreamReader() {}
 
 // MemStreamReader implementation
 
 MemStreamReader::MemStreamReader(const Byte *buffer, size_t buffer_len)
     : buf_(buffer)
-    , size_(buffer_len)
-    , cons_(0ul)
-    , pos_(0ul)
+    , cons_(buffer)
 {
-    assert(size_ < std::numeric_limits<int>::max());
+    assert(buffer_len < std::numeric_limits<int>::max());
+    rbegin_ = buffer;
+    rend_   = buffer + buffer_len;
 }
 
 Byte MemStreamReader::get() {
-    if (pos_ < size_) {
-        return buf_[pos_++];
+    if (rbegin_ < rend_) {
+        return *rbegin_++;
     }
-    BOOST_THROW_EXCEPTION(StreamError("unexpected end of stream", pos_));
+    BOOST_THROW_EXCEPTION(StreamError("unexpected end of stream", static_cast<size_t>(rbegin_ - buf_)));
 }
 
 Byte MemStreamReader::pick() const {
-    if (pos_ < size_) {
-        return buf_[pos_];
+    if (rbegin_ < rend_) {
+        return *rbegin_;
     }
-    BOOST_THROW_EXCEPTION(StreamError("unexpected end of stream", pos_));
+    BOOST_THROW_EXCEPTION(StreamError("unexpected end of stream", static_cast<size_t>(rbegin_ - buf_)));
 }
 
 bool MemStreamReader::is_eof() {
-    return pos_ == size_;
+    return rbegin_ == rend_;
 }
 
 int MemStreamReader::read(Byte *buffer, size_t buffer_len) {
-    auto nbytes = std::min(buffer_len, size_ - pos_);
-    memcpy(buffer, buf_ + pos_, nbytes);
-    pos_ += nbytes;
+    auto nbytes = std::min(buffer_len, static_cast<size_t>(rend_ - rbegin_));
+    memcpy(buffer, rbegin_, nbytes);
+    rbegin_ += nbytes;
     return static_cast<int>(nbytes);
 }
 
 int MemStreamReader::read_line(Byte* buffer, size_t quota) {
-    auto available = size_ - pos_;
-    auto to_read = std::min(quota, available);
-    for (u32 i = 0; i < to_read; i++) {
-        Byte c = buf_[pos_ + i];
-        buffer[i] = c;
-        if (c == '\n') {
-            // Stop iteration
-            u32 bytes_copied = i + 1;
-            pos_ += bytes_copied;
-            return static_cast<int>(bytes_copied);
-        }
+    auto to_read = std::min(quota, static_cast<size_t>(rend_ - rbegin_));
+    auto eol = static_cast<const Byte*>(memchr(rbegin_, '\n', to_read));
+    if (eol == nullptr) {
+        // No end of line found
+        return -1*static_cast<int>(to_read);
     }
-    // No end of line found
-    return -1*static_cast<int>(to_read);
+    auto bytes_copied = static_cast<size_t>(eol - rbegin_) + 1;
+    memcpy(buffer, rbegin_, bytes_copied);
+    rbegin_ += bytes_copied;
+    return static_cast<int>(bytes_copied);
 }
 
 void MemStreamReader::close() {
-    pos_ = size_;
+    rbegin_ = rend_;
 }
 
 std::tuple<std::string, size_t> MemStreamReader::get_error_context(const char* error_message) const {
@@ -90,11 +92,11 @@ std::tuple<std::string, size_t> MemStreamReader::get_error_context(const char* e
 }
 
 void MemStreamReader::consume() {
-    cons_ = pos_;
+    cons_ = rbegin_;
 }
 
 void MemStreamReader::discard() {
-    pos_ = cons_;
+    rbegin_ = cons_;
 }
 
 }
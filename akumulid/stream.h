@@ -16,11 +16,13 @@
 
 #pragma once
 #include "akumuli_def.h"
+#include <cassert>
 #include <cstddef>
 #include <memory>
 #include <queue>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace Akumuli {
@@ -43,6 +45,14 @@ public:
 
 /** Stream reader that operates on byte level. */
 struct ByteStreamReader {
+protected:
+    // Unread part of the stream, implementation should use `rbegin_` as a
+    // read position and `rend_` as an end of the received data.
+    const Byte* rbegin_;
+    const Byte* rend_;
+
+public:
+    ByteStreamReader();
 
     virtual ~ByteStreamReader();
 
@@ -79,6 +89,22 @@ struct ByteStreamReader {
       */
     virtual int read_line(Byte* buffer, size_t quota) = 0;
 
+    /** Return the unread part of the stream as a contiguous memory region.
+      * This is a non-virtual fast path that allows to scan the data in bulk
+      * instead of reading it byte by byte. The data is valid until it's consumed.
+      */
+    std::tuple<const Byte*, size_t> get_window() const {
+        return std::make_tuple(rbegin_, static_cast<size_t>(rend_ - rbegin_));
+    }
+
+    /** Move read position `nbytes` forward (`nbytes` shouldn't be larger
+      * than the size of the window).
+      */
+    void advance(size_t nbytes) {
+        assert(nbytes <= static_cast<size_t>(rend_ - rbegin_));
+        rbegin_ += nbytes;
+    }
+
     /** Close stream.
      **/
     virtual void close() = 0;
@@ -103,9 +129,7 @@ struct ByteStreamReader {
 
 class MemStreamReader : public ByteStreamReader {
     const Byte*  buf_;   //< Source bytes
-    const size_t size_;  //< Source size
-    size_t       cons_;  //< Size of the consumed part of the stream
-    size_t       pos_;   //< Position in the stream
+    const Byte*  cons_;  //< End of the consumed part of the stream
 public:
     MemStreamReader(const Byte* buffer, size_t buffer_len);
 
@@ -97,6 +97,13 @@ struct ProtocolSessionBuilder {
      * @return newly created object
      */
     static std::unique_ptr<ProtocolSessionBuilder> create_opentsdb_builder(bool parallel=true);
+
+    /**
+     * @brief Create binary protocol parser builder
+     * @param parallel use thread safe implementation if true
+     * @return newly created object
+     */
+    static std::unique_ptr<ProtocolSessionBuilder> create_binary_builder(bool parallel=true);
 };
 
 
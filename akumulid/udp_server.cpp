@@ -2,78 +2,215 @@
 
 #include <thread>
 
+#include <algorithm>
+#include <sstream>
+
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/ip.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef __gnu_linux__
+#include <linux/udp.h>
+#endif
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 
 namespace Akumuli {
 
-UdpServer::UdpServer(std::shared_ptr<DbConnection> db, int nworkers, int port)
+UdpServer::Settings::Settings()
+    : batch_size(64)
+    , buffer_size(0x10000)
+    , pin_threads(false)
+    , gro(false)
+{
+}
+
+UdpServer::Counters::Counters()
+    : packets{0}
+    , bytes{0}
+    , drops{0}
+    , cache_hits{0}
+    , cache_misses{0}
+{
+}
+
+UdpServer::IOBuf::IOBuf(int batch_size, int buffer_size)
+    : buffer_size(buffer_size)
+    , msgs(static_cast<size_t>(batch_size))
+    , iovecs(static_cast<size_t>(batch_size))
+    , bufs(static_cast<size_t>(batch_size)*static_cast<size_t>(buffer_size))
+    , control(static_cast<size_t>(batch_size)*CONTROL_SIZE)
+{
+    reset();
+}
+
+void UdpServer::IOBuf::reset() {
+    for (size_t i = 0; i < msgs.size(); i++) {
+        // Kernel updates msg_len and msg_controllen on every call
+        memset(&msgs[i], 0, sizeof(mmsghdr));
+        iovecs[i].iov_base              = get_buffer(static_cast<int>(i));
+        iovecs[i].iov_len               = static_cast<size_t>(buffer_size);
+        msgs[i].msg_hdr.msg_iov         = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen      = 1;
+        msgs[i].msg_hdr.msg_control     = control.data() + i*CONTROL_SIZE;
+        msgs[i].msg_hdr.msg_controllen  = CONTROL_SIZE;
+    }
+}
+
+char* UdpServer::IOBuf::get_buffer(int i) {
+    return bufs.data() + static_cast<size_t>(i)*static_cast<size_t>(buffer_size);
+}
+
+UdpServer::UdpServer(std::shared_ptr<DbConnection> db, int nworkers, int port, Settings const& settings)
     : db_(db)
     , start_barrier_(static_cast<u32>(nworkers + 1))
     , stop_barrier_(static_cast<u32>(nworkers + 1))
     , stop_{0}
     , port_(port)
     , nworkers_(nworkers)
-    , sockfd_(-1)
+    , settings_(settings)
+    , counters_(new Counters[static_cast<size_t>(nworkers)])
     , logger_("UdpServer")
 {
 }
 
+static void throw_socket_error(const char* what) {
+    const char* msg = strerror(errno);
+    std::stringstream fmt;
+    fmt << what << ": " << msg;
+    std::runtime_error err(fmt.str());
+    BOOST_THROW_EXCEPTION(err);
+}
+
+int UdpServer::create_socket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        throw_socket_error("can't create socket");
+    }
+    try {
+        // All workers share the same port
+        int optval = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+            throw_socket_error("can't set socket options");
+        }
+        // Timeout is needed to check the stop flag if the socket can't be shut down
+        timeval timeout = {};
+        timeout.tv_sec  = RECV_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (RECV_TIMEOUT_MS % 1000)*1000;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+            throw_socket_error("can't set receive timeout");
+        }
+#ifdef SO_RXQ_OVFL
+        // Kernel will report number of dropped packets with every packet
+        if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(optval)) == -1) {
+            logger_.error() << "Can't enable drop counter: " << strerror(errno);
+        }
+#endif
+        if (settings_.gro) {
+#ifdef UDP_GRO
+            if (setsockopt(fd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval)) == -1) {
+                logger_.error() << "Can't enable UDP GRO: " << strerror(errno);
+            }
+#else
+            logger_.error() << "UDP GRO is not supported";
+#endif
+        }
+
+        // Bind socket to port
+        sockaddr_in sa{};
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_ANY);
+        sa.sin_port = htons(port_);
+
+        if (bind(fd, (sockaddr *) &sa, sizeof(sa)) == -1) {
+            throw_socket_error("can't bind socket");
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    return fd;
+}
+
 void UdpServer::start(SignalHandler *sig, int id) {
+    // Sockets are created before the workers to report errors early
+    try {
+        for (int i = 0; i < nworkers_; i++) {
+            sockets_.push_back(create_socket());
+        }
+    } catch (...) {
+        for (int fd: sockets_) {
+            close(fd);
+        }
+        sockets_.clear();
+        throw;
+    }
+
     auto self = shared_from_this();
     sig->add_handler(boost::bind(&UdpServer::stop, std::move(self)), id);
 
+    std::weak_ptr<UdpServer> weak = shared_from_this();
+    ServerStats::instance().register_reporter("udp_server", [weak](boost::property_tree::ptree* out) {
+        auto self = weak.lock();
+        if (self) {
+            self->report(out);
+        }
+    });
+
     // Create workers
     for (int i = 0; i < nworkers_; i++) {
         auto session = db_->create_session();
-        std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), std::move(session)));
+        std::thread thread(std::bind(&UdpServer::worker, shared_from_this(), i, std::move(session)));
         thread.detach();
     }
     start_barrier_.wait();
 }
 
-static void sendByteToLocalhost(int port) {
-    Logger logger("UdpServer");
-    int fd;
-    struct sockaddr_in addr;
-    const char* ip = "127.0.0.1";
-
-    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        // We can't send the message to the socket thus, we wouldn't be able
-        // to stop the program normally anyway.
-        logger.error() << "Can't create the socket";
-        std::terminate();
-    }
-
-    addr.sin_family = AF_INET;
-    inet_aton(ip, &addr.sin_addr);
-    addr.sin_port = htons(port);
-    char payload = 0;
-
-    if (sendto(fd, &payload, 1, 0, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
-        // Same reasoning as previously
-        logger.error() << "Can't send the data through the socket";
-        std::terminate();
-    }
-}
-
 void UdpServer::stop() {
-    // Set the flag and then send the 1-byte payload to wake up the
-    // worker thread. The socket descriptor can be closed afterwards.
+    // Set the flag and then shut down the sockets to wake up the
+    // worker threads. The sockets can be closed afterwards.
     stop_.store(1, std::memory_order_relaxed);
-    sendByteToLocalhost(port_);
+    for (int fd: sockets_) {
+        shutdown(fd, SHUT_RD);
+    }
     stop_barrier_.wait();
+    for (int fd: sockets_) {
+        close(fd);
+    }
     logger_.info() << "UDP server stopped";
-    close(sockfd_);
+}
+
+void UdpServer::report(boost::property_tree::ptree* out) const {
+    u64 packets = 0, bytes = 0, drops = 0, cache_hits = 0, cache_misses = 0;
+    for (int i = 0; i < nworkers_; i++) {
+        auto const& counters = counters_[static_cast<size_t>(i)];
+        std::string prefix = "workers." + std::to_string(i) + ".";
+        out->put(prefix + "packets", counters.packets.load());
+        out->put(prefix + "bytes", counters.bytes.load());
+        out->put(prefix + "drops", counters.drops.load());
+        out->put(prefix + "series_cache_hits", counters.cache_hits.load());
+        out->put(prefix + "series_cache_misses", counters.cache_misses.load());
+        packets      += counters.packets;
+        bytes        += counters.bytes;
+        drops        += counters.drops;
+        cache_hits   += counters.cache_hits;
+        cache_misses += counters.cache_misses;
+    }
+    out->put("packets", packets);
+    out->put("bytes", bytes);
+    out->put("drops", drops);
+    out->put("series_cache_hits", cache_hits);
+    out->put("series_cache_misses", cache_misses);
 }
 
 #ifdef __APPLE__
@@ -88,108 +225,117 @@ int UdpServer::recvmsg_(int fd, UdpServer::mmsghdr* hdr, unsigned, int) {
 }
 #endif
 
-void UdpServer::worker(std::shared_ptr<DbSession> spout) {
+void UdpServer::worker(int ix, std::shared_ptr<DbSession> spout) {
 #ifdef __gnu_linux__
         // Name the thread
         auto thread = pthread_self();
         pthread_setname_np(thread, "UDP-worker");
+        if (settings_.pin_threads) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(static_cast<unsigned>(ix) % std::max(1u, std::thread::hardware_concurrency()), &cpuset);
+            if (pthread_setaffinity_np(thread, sizeof(cpuset), &cpuset) != 0) {
+                logger_.error() << "Can't pin worker " << ix << " to CPU";
+            }
+        }
 #endif
     start_barrier_.wait();
 
     int retval;
-    sockaddr_in sa{};
+    int sockfd = sockets_.at(static_cast<size_t>(ix));
+    auto& counters = counters_[static_cast<size_t>(ix)];
+    // Parser is reset between packet groups, its read buffer and the series
+    // name cache are reused by the worker
+    RESPProtocolParser parser(spout);
 
     try {
-        // Create socket
-        sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd_ == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't create socket: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
-
-        // Set socket options
-        int optval = 1;
-        if (setsockopt(sockfd_, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't set socket options: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
-
-        // Bind socket to port
-        sa.sin_family = AF_INET;
-        sa.sin_addr.s_addr = htonl(INADDR_ANY);
-        sa.sin_port = htons(port_);
-
-        if (bind(sockfd_, (sockaddr *) &sa, sizeof(sa)) == -1) {
-            const char* msg = strerror(errno);
-            std::stringstream fmt;
-            fmt << "can't bind socket: " << msg;
-            std::runtime_error err(fmt.str());
-            BOOST_THROW_EXCEPTION(err);
-        }
-
-        auto iobuf = std::make_shared<IOBuf>();
+#ifdef __APPLE__
+        IOBuf iobuf(1, settings_.buffer_size);
+#else
+        IOBuf iobuf(settings_.batch_size, settings_.buffer_size);
+#endif
 
         while(true) {
-
+            iobuf.reset();
 #ifdef __APPLE__
-            retval = recvmsg_(sockfd_, iobuf->msgs, NPACKETS, MSG_WAITALL);
+            retval = recvmsg_(sockfd, iobuf.msgs.data(), 1, MSG_WAITALL);
 #else
-            retval = recvmmsg(sockfd_, iobuf->msgs, NPACKETS, MSG_WAITFORONE, nullptr);
+            retval = recvmmsg(sockfd, iobuf.msgs.data(), static_cast<unsigned>(iobuf.msgs.size()), MSG_WAITFORONE, nullptr);
 #endif
+            if (stop_.load(std::memory_order_seq_cst)) {
+                break;
+            }
             if (retval == -1) {
-                if (errno == EAGAIN || errno == EINTR) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
                     continue;
                 }
-                const char* msg = strerror(errno);
-                std::stringstream fmt;
-                fmt << "socket read error: " << msg;
-                std::runtime_error err(fmt.str());
-                BOOST_THROW_EXCEPTION(err);
-            }
-            if (stop_.load(std::memory_order_seq_cst)) {
-                break;
+                throw_socket_error("socket read error");
             }
 
-            iobuf->pps++;
-
-            RESPProtocolParser parser(spout);
-            // Protocol parser should be created for each Udp packet
+            // Protocol parser should be reset for each Udp packet
             // group. Otherwise one bad packet can corrupt the state
             // of the parser and it will be unable to process remaining
             // packets and only restart will help.
             // Also, it's not necessary to call parser.start() since
             // it only writes to the log. This call here will polute the
             // log file.
+            parser.reset();
             for (int i = 0; i < retval; i++) {
-                // reset buffer to receive new message
-                iobuf->bps += iobuf->msgs[i].msg_len;
-                auto mlen = iobuf->msgs[i].msg_len;
-                iobuf->msgs[i].msg_len = 0;
-
-                auto buf = parser.get_next_buffer();
-                memcpy(buf, iobuf->bufs[i], mlen);
-                try {
-                    parser.parse_next(buf, mlen);
-                } catch (StreamError const& err) {
-                    // Catch protocol parsing errors here and continue processing data
-                    logger_.error() << err.what();
-                    break;
-                } catch (DatabaseError const& err) {
-                    // Late write detected.
-                    logger_.error() << err.what();
+                auto const& hdr = iobuf.msgs[static_cast<size_t>(i)];
+                u32 mlen = hdr.msg_len;
+                // Coalesced packet (GRO) consists of the segments of the same size
+                u32 segment = mlen;
+                for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr.msg_hdr); cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&hdr.msg_hdr), cmsg))
+                {
+#ifdef SO_RXQ_OVFL
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                        // Total number of packets dropped by the socket
+                        u32 drops;
+                        memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                        counters.drops = drops;
+                    }
+#endif
+#ifdef UDP_GRO
+                    if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                        int gso_size;
+                        memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                        segment = gso_size > 0 ? static_cast<u32>(gso_size) : mlen;
+                    }
+#endif
+                }
+                counters.bytes   += mlen;
+                counters.packets += segment == 0 ? 1 : (mlen + segment - 1) / segment;
+
+                // Packets are concatenated into a single stream, parser's buffer
+                // is filled in small chunks because packets can be large.
+                const char* data = iobuf.get_buffer(i);
+                bool error = false;
+                for (u32 pos = 0; pos < mlen && !error;) {
+                    u32 size = std::min(mlen - pos, static_cast<u32>(RESPProtocolParser::RDBUF_SIZE));
+                    auto buf = parser.get_next_buffer();
+                    memcpy(buf, data + pos, size);
+                    pos += size;
+                    try {
+                        parser.parse_next(buf, size);
+                    } catch (StreamError const& err) {
+                        // Catch protocol parsing errors here and continue processing data
+                        logger_.error() << err.what();
+                        error = true;
+                    } catch (DatabaseError const& err) {
+                        // Late write detected.
+                        logger_.error() << err.what();
+                        error = true;
+                    }
+                }
+                if (error) {
                     break;
                 }
             }
-            if (retval != 0) {
-                iobuf = std::make_shared<IOBuf>();
-            }
             parser.close();
+            auto stats = parser.get_cache_stats();
+            counters.cache_hits   = stats.hits;
+            counters.cache_misses = stats.misses;
         }
     } catch(...) {
         logger_.error() << boost::current_exception_diagnostic_information();
@@ -213,7 +359,33 @@ struct UdpServerBuilder {
             s_logger_.error() << "Can't initialize UDP server, more than one protocol specified";
             BOOST_THROW_EXCEPTION(std::runtime_error("invalid upd-server settings"));
         }
-        return std::make_shared<UdpServer>(con, settings.nworkers, settings.protocols.front().port);
+        UdpServer::Settings udpsettings;
+        try {
+            auto it = settings.options.find("batch_size");
+            if (it != settings.options.end()) {
+                udpsettings.batch_size = boost::lexical_cast<int>(it->second);
+            }
+            it = settings.options.find("buffer_size");
+            if (it != settings.options.end()) {
+                udpsettings.buffer_size = boost::lexical_cast<int>(it->second);
+            }
+            it = settings.options.find("pin_threads");
+            if (it != settings.options.end()) {
+                udpsettings.pin_threads = it->second == "true";
+            }
+            it = settings.options.find("gro");
+            if (it != settings.options.end()) {
+                udpsettings.gro = it->second == "true";
+            }
+        } catch (boost::bad_lexical_cast const&) {
+            s_logger_.error() << "Can't initialize UDP server, invalid batch_size or buffer_size";
+            BOOST_THROW_EXCEPTION(std::runtime_error("invalid upd-server settings"));
+        }
+        if (udpsettings.batch_size <= 0 || udpsettings.buffer_size <= 0) {
+            s_logger_.error() << "Can't initialize UDP server, batch_size and buffer_size should be positive";
+            BOOST_THROW_EXCEPTION(std::runtime_error("invalid upd-server settings"));
+        }
+        return std::make_shared<UdpServer>(con, settings.nworkers, settings.protocols.front().port, udpsettings);
     }
 };
 
@@ -18,6 +18,9 @@
 
 #include <atomic>
 #include <memory>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include <boost/thread/barrier.hpp>
 
@@ -31,24 +34,55 @@ namespace Akumuli {
 
 
 /** UDP server for data ingestion.
+  * Every worker thread receives packets through its own socket. Sockets
+  * share the port (SO_REUSEPORT) and the kernel distributes packets between
+  * them, so workers never contend on the same socket.
   */
 class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server {
+public:
+    struct Settings {
+        //! Max number of packets received at once
+        int  batch_size;
+        //! Max packet size (max size of the coalesced packet if GRO is enabled)
+        int  buffer_size;
+        //! Pin worker threads to CPUs
+        bool pin_threads;
+        //! Enable UDP generic receive offload
+        bool gro;
+
+        Settings();
+    };
+
+private:
+    //! Worker counters
+    struct Counters {
+        std::atomic<u64> packets;
+        std::atomic<u64> bytes;
+        //! Number of packets dropped by the kernel because socket buffer was full
+        std::atomic<u64> drops;
+        //! Series name cache counters
+        std::atomic<u64> cache_hits;
+        std::atomic<u64> cache_misses;
+
+        Counters();
+    };
+
     std::shared_ptr<DbConnection>      db_;
     boost::barrier                     start_barrier_;  //< Barrier to start worker thread
     boost::barrier                     stop_barrier_;   //< Barrier to stop worker thread
     std::atomic<int>                   stop_;
     const int                          port_;
     const int                          nworkers_;
-    int                                sockfd_;         //< UDP socket file descriptor
+    const Settings                     settings_;
+    std::vector<int>                   sockets_;        //< UDP socket of every worker
+    std::unique_ptr<Counters[]>        counters_;       //< Counters of every worker
 
     Logger logger_;
 
-    static const int MSS      = 0x10000;
-    
-#ifndef __APPLE__
-    static const int NPACKETS = 16;
-#else
-    static const int NPACKETS = 1;
+    //! Receive timeout, workers check the stop flag at least this often
+    static const int RECV_TIMEOUT_MS = 1000;
+
+#ifdef __APPLE__
     struct mmsghdr {
         struct msghdr msg_hdr;  /* Message header */
         unsigned int  msg_len;  /* Number of received bytes for header */
@@ -56,43 +90,49 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
 
     static int recvmsg_(int fd, mmsghdr* hdr, unsigned, int);
 #endif
+    //! Receive buffers of the worker
     struct IOBuf {
-        // Counters
-        std::atomic<u64> pps;
-        std::atomic<u64> bps;
-        // Packet recv structs
-        mmsghdr msgs[NPACKETS];
-        iovec   iovecs[NPACKETS];
-        char    bufs[NPACKETS][MSS];  // 1MB
-        IOBuf() {
-            memset(this, 0, sizeof(IOBuf));
-            for (int i = 0; i < NPACKETS; i++) {
-                iovecs[i].iov_base         = bufs[i];
-                iovecs[i].iov_len          = MSS;
-                msgs[i].msg_hdr.msg_iov    = &iovecs[i];
-                msgs[i].msg_hdr.msg_iovlen = 1;
-            }
-        }
-
+        enum {
+            //! Space for SO_RXQ_OVFL and UDP_GRO control messages
+            CONTROL_SIZE = 64,
+        };
+        const int buffer_size;
+        std::vector<mmsghdr> msgs;
+        std::vector<iovec>   iovecs;
+        std::vector<char>    bufs;
+        std::vector<char>    control;
+
+        IOBuf(int batch_size, int buffer_size);
+
+        //! Prepare message headers for the next receive call
+        void reset();
+
+        char* get_buffer(int i);
     };
 
-
 public:
     /** C-tor.
       * @param nworker number of workers
       * @param port port number
       * @param pipeline pointer to ingestion pipeline
+      * @param settings socket and buffer settings
       */
-    UdpServer(std::shared_ptr<DbConnection> pipeline, int nworkers, int port);
+    UdpServer(std::shared_ptr<DbConnection> pipeline, int nworkers, int port, Settings const& settings = Settings());
 
     //! Start processing packets
     virtual void start(SignalHandler* sig, int id);
 
 private:
-    //! Stop processing packets, close the socket
+    //! Stop processing packets, close the sockets
     void stop();
 
-    void worker(std::shared_ptr<DbSession> spout);
+    //! Create socket bound to the server port
+    int create_socket();
+
+    //! Add counters to the stats
+    void report(boost::property_tree::ptree* out) const;
+
+    void worker(int ix, std::shared_ptr<DbSession> spout);
 };
 
 }  // namespace
@@ -0,0 +1,207 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "binaryframe.h"
+#include "protocolparser.h"
+#include "ingestion_pipeline.h"
+
+using namespace Akumuli;
+
+//! Records samples written by the parser, every series name is valid
+struct ConsumerMock : DbSession {
+    std::vector<aku_Sample> samples;
+
+    virtual aku_Status write(const aku_Sample &sample) override {
+        samples.push_back(sample);
+        return AKU_SUCCESS;
+    }
+
+    virtual std::shared_ptr<DbCursor> query(std::string) override {
+        abort();
+    }
+
+    virtual std::shared_ptr<DbCursor> suggest(std::string) override {
+        abort();
+    }
+
+    virtual std::shared_ptr<DbCursor> search(std::string) override {
+        abort();
+    }
+
+    virtual int param_id_to_series(aku_ParamId, char*, size_t) override {
+        abort();
+    }
+
+    virtual aku_Status series_to_param_id(const char*, size_t, aku_Sample*) override {
+        abort();
+    }
+
+    virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override {
+        if (cap == 0) {
+            return -1;
+        }
+        ids[0] = std::hash<std::string>()(std::string(begin, end));
+        return 1;
+    }
+};
+
+/** Feed `data` to the new parser in chunks of `chunk` bytes (frames are split
+  * between chunks). Return samples written by the parser and set `error` if
+  * the input was rejected.
+  */
+static std::vector<aku_Sample> parse(std::vector<u8> const& data, size_t chunk, bool* error) {
+    auto cons = std::make_shared<ConsumerMock>();
+    BinaryProtocolParser parser(cons);
+    *error = false;
+    for (size_t pos = 0; pos < data.size() && !*error; pos += chunk) {
+        size_t len = std::min(chunk, data.size() - pos);
+        auto buf = parser.get_next_buffer();
+        memcpy(buf, data.data() + pos, len);
+        try {
+            parser.parse_next(buf, static_cast<u32>(len));
+        } catch (ProtocolParserError const&) {
+            *error = true;
+        }
+    }
+    parser.close();
+    return cons->samples;
+}
+
+static bool equal(std::vector<aku_Sample> const& lhs, std::vector<aku_Sample> const& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); i++) {
+        if (lhs[i].paramid != rhs[i].paramid || lhs[i].timestamp != rhs[i].timestamp ||
+            memcmp(&lhs[i].payload.float64, &rhs[i].payload.float64, sizeof(double)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Parser output shouldn't depend on how the input is split into chunks. Partial
+  * frames and frames larger than the initial read buffer are produced by small chunks.
+  */
+static void check_parser(std::vector<u8> const& data) {
+    bool error;
+    auto expected = parse(data, BinaryProtocolParser::RDBUF_SIZE, &error);
+    size_t chunk = data.empty() ? 1 : 1 + data[0] % 17;
+    bool other_error;
+    auto actual = parse(data, chunk, &other_error);
+    if (error != other_error || !equal(expected, actual)) {
+        abort();
+    }
+}
+
+/** Build the frame that doesn't fit the initial read buffer using values from
+  * the input, parse it and compare with the original.
+  */
+static void check_parser_large_frame(std::vector<u8> const& data) {
+    const u32 N = 0x1000;
+    std::vector<aku_Timestamp> ts(N);
+    std::vector<double> xs(N);
+    for (u32 i = 0; i < N; i++) {
+        u8 byte = data.empty() ? 0 : data[i % data.size()];
+        ts[i] = 1000ull*i + byte;
+        xs[i] = static_cast<double>(byte)*i;
+    }
+    std::vector<u8> frames;
+    if (BinaryFrame::encode_dict(1, "test", 4, &frames) != AKU_SUCCESS) {
+        abort();
+    }
+    u32 flags = data.empty() ? 0 : data[0] % 4;
+    if (BinaryFrame::encode_data(1, ts.data(), xs.data(), N, flags, &frames) != AKU_SUCCESS) {
+        abort();
+    }
+    bool error;
+    auto samples = parse(frames, 1 + (data.empty() ? 0 : data.back()) % BinaryProtocolParser::RDBUF_SIZE, &error);
+    if (error || samples.size() != N) {
+        abort();
+    }
+    for (u32 i = 0; i < N; i++) {
+        if (samples[i].timestamp != ts[i] || memcmp(&samples[i].payload.float64, &xs[i], sizeof(double)) != 0) {
+            abort();
+        }
+    }
+}
+
+//! Decode data frame, encode decoded values again and compare the results
+static void check_data_frame(const u8* begin, const u8* end) {
+    BinaryFrame::DataHeader header;
+    if (BinaryFrame::decode_data_header(begin, end, &header) != AKU_SUCCESS) {
+        return;
+    }
+    std::vector<aku_Sample> samples(header.size);
+    if (BinaryFrame::decode_data(header, samples.data()) != AKU_SUCCESS) {
+        return;
+    }
+    std::vector<aku_Timestamp> ts;
+    std::vector<double> xs;
+    for (auto const& sample: samples) {
+        ts.push_back(sample.timestamp);
+        xs.push_back(sample.payload.float64);
+    }
+    std::vector<u8> frame;
+    auto status = BinaryFrame::encode_data(header.id, ts.data(), xs.data(),
+                                           static_cast<u32>(ts.size()), header.flags, &frame);
+    if (status != AKU_SUCCESS) {
+        return;
+    }
+    const u8* fbegin = frame.data() + BinaryFrame::PREFIX_SIZE;
+    const u8* fend = frame.data() + frame.size();
+    BinaryFrame::DataHeader other;
+    if (BinaryFrame::decode_data_header(fbegin, fend, &other) != AKU_SUCCESS) {
+        abort();
+    }
+    if (other.id != header.id || other.size != header.size || other.flags != header.flags) {
+        abort();
+    }
+    std::vector<aku_Sample> decoded(other.size);
+    if (BinaryFrame::decode_data(other, decoded.data()) != AKU_SUCCESS) {
+        abort();
+    }
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (decoded[i].timestamp != samples[i].timestamp ||
+            memcmp(&decoded[i].payload.float64, &samples[i].payload.float64, sizeof(double)) != 0)
+        {
+            abort();
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        return 1;
+    }
+    std::string file_name(argv[1]);
+    std::fstream input(file_name, std::ios::binary|std::ios::in);
+    std::vector<u8> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    const u8* pos = data.data();
+    const u8* end = data.data() + data.size();
+    while (end - pos >= BinaryFrame::PREFIX_SIZE) {
+        u32 size = BinaryFrame::get_frame_size(pos);
+        pos += BinaryFrame::PREFIX_SIZE;
+        if (size == 0 || size > BinaryFrame::MAX_FRAME_SIZE || size > static_cast<u64>(end - pos)) {
+            break;
+        }
+        if (pos[0] == BinaryFrame::DICTIONARY) {
+            u64 id;
+            const char* name;
+            size_t len;
+            BinaryFrame::decode_dict(pos, pos + size, &id, &name, &len);
+        } else {
+            check_data_frame(pos, pos + size);
+        }
+        pos += size;
+    }
+
+    check_parser(data);
+    check_parser_large_frame(data);
+}
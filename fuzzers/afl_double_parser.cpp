@@ -0,0 +1,29 @@
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include "numparser.h"
+
+using namespace Akumuli;
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        return 1;
+    }
+    std::string file_name(argv[1]);
+    std::fstream input(file_name, std::ios::binary|std::ios::in|std::ios::out);
+
+    for (std::string line; std::getline(input, line);) {
+        double fast = 0;
+        bool fast_success = parse_double(line.data(), line.data() + line.size(), &fast);
+        char* endptr = nullptr;
+        double slow = strtod(line.c_str(), &endptr);
+        bool slow_success = !line.empty() && endptr == line.c_str() + line.size();
+        if (fast_success != slow_success) {
+            abort();
+        }
+        if (fast_success && memcmp(&fast, &slow, sizeof(double)) != 0) {
+            abort();
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #include <fstream>
 #include <iostream>
+#include <cstdlib>
 #include "datetime.h"
 
 using namespace Akumuli;
@@ -12,10 +13,20 @@ int main(int argc, char** argv) {
     std::fstream input(file_name, std::ios::binary|std::ios::in|std::ios::out);
 
     for (std::string line; std::getline(input, line);) {
+        aku_Timestamp fast = 0;
+        bool fast_success = DateTimeUtil::parse_timestamp_fast(line.data(), line.data() + line.size(), &fast);
+        aku_Timestamp slow = 0;
         try {
-            DateTimeUtil::from_iso_string(line.c_str());
+            slow = DateTimeUtil::from_iso_string(line.c_str());
         } catch(BadDateTimeFormat const&) {
+            if (fast_success) {
+                // Fast parser accepted the string that is rejected by the reference parser
+                abort();
+            }
             continue;
         }
+        if (fast_success && fast != slow) {
+            abort();
+        }
     }
 }
@@ -231,6 +231,17 @@ AKU_EXPORT aku_Status aku_write_double_raw(aku_Session* session, aku_ParamId par
   */
 AKU_EXPORT aku_Status aku_write(aku_Session* ist, const aku_Sample* sample);
 
+/** Write batch of measurements to DB
+  * Samples are grouped by series and each group is written at once which is
+  * much cheaper than writing the same samples one by one. All valid samples
+  * are written even if some of them can't be.
+  * @param ist is an opened ingestion stream
+  * @param samples is an array of measurements
+  * @param size is a number of measurements in `samples` array
+  * @returns AKU_SUCCESS or status of the first failed measurement
+  */
+AKU_EXPORT aku_Status aku_write_batch(aku_Session* ist, const aku_Sample* samples, size_t size);
+
 
 //---------
 // Queries
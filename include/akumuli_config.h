@@ -28,6 +28,20 @@
 #define AKU_DURABILITY_SPEED_TRADEOFF 2
 #define AKU_MAX_WRITE_SPEED 4
 
+// Values for io_backend parameter
+#define AKU_IO_BACKEND_APR 0  // default value
+#define AKU_IO_BACKEND_IO_URING 1
+#define AKU_IO_BACKEND_IO_URING_DIRECT 2
+
+// Values for value_codec parameter
+#define AKU_VALUE_CODEC_FCM 0  // default value
+#define AKU_VALUE_CODEC_GORILLA 1
+#define AKU_VALUE_CODEC_CHIMP 2
+#define AKU_VALUE_CODEC_ADAPTIVE 3
+
+// Max number of rollup steps
+#define AKU_MAX_ROLLUPS 4
+
 
 // Log levels
 typedef enum {
@@ -66,7 +80,28 @@ typedef struct {
     //! Windth of the sliding window
     u64 window_size;
 
-    //! Cache size limit
+    //! Block cache size limit in bytes (0 - use default value)
     u64 max_cache_size;
 
+    //! Volume I/O backend, one of the AKU_IO_BACKEND_XXX values
+    u32 io_backend;
+
+    //! Codec used to compress values, one of the AKU_VALUE_CODEC_XXX values
+    u32 value_codec;
+
+    //! Reorder window in nanoseconds (0 - out of order writes are rejected)
+    u64 reorder_window;
+
+    //! Max number of concurrently executed queries (0 - number of CPUs)
+    u32 max_concurrent_queries;
+
+    //! Max number of queries waiting for execution (0 - use default value)
+    u32 max_queued_queries;
+
+    //! Group-aggregate query results cache size in bytes (0 - cache disabled)
+    u64 query_cache_size;
+
+    //! Rollup bucket sizes in nanoseconds (0 - unused slot)
+    u64 rollup_steps[AKU_MAX_ROLLUPS];
+
 } aku_FineTuneParams;
@@ -174,8 +174,14 @@ typedef enum {
     AKU_EREGULLAR_EXPECTED = 21,
     //! Function can't handle missing values
     AKU_EMISSING_DATA_NOT_SUPPORTED = 22,
+    //! Query was cancelled
+    AKU_ECANCELLED = 23,
+    //! Query deadline exceeded
+    AKU_EDEADLINE = 24,
+    //! Query memory limit exceeded
+    AKU_EMEMORY_LIMIT = 25,
     //! All error codes should be less then AKU_EMAX_ERROR
-    AKU_EMAX_ERROR = 23,
+    AKU_EMAX_ERROR = 26,
     // NOTE: Update status_util.cpp and AKU_EMAX_ERROR to add new error code!
 } aku_Status;
 
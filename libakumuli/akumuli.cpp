@@ -17,6 +17,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <memory>
 #include <iostream>
@@ -97,7 +98,8 @@ struct CursorImpl : aku_Cursor {
         : query_(query)
     {
         status_ = AKU_SUCCESS;
-        cursor_ = ConcurrentCursor::make(&StorageSession::query, storage, query_.data());
+        cursor_ = ConcurrentCursor::make(storage->get_query_executor(),
+                                         &StorageSession::query, storage, query_.data());
     }
 
     ~CursorImpl() {
@@ -137,7 +139,8 @@ struct SuggestCursorImpl : aku_Cursor {
         : query_(query)
     {
         status_ = AKU_SUCCESS;
-        cursor_ = ConcurrentCursor::make(&StorageSession::suggest, storage, query_.data());
+        cursor_ = ConcurrentCursor::make(storage->get_query_executor(),
+                                         &StorageSession::suggest, storage, query_.data());
     }
 
     ~SuggestCursorImpl() {
@@ -175,7 +178,8 @@ struct SearchCursorImpl : aku_Cursor {
         : query_(query)
     {
         status_ = AKU_SUCCESS;
-        cursor_ = ConcurrentCursor::make(&StorageSession::search, storage, query_.data());
+        cursor_ = ConcurrentCursor::make(storage->get_query_executor(),
+                                         &StorageSession::search, storage, query_.data());
     }
 
     ~SearchCursorImpl() {
@@ -228,6 +232,10 @@ public:
         return session_->write(sample);
     }
 
+    aku_Status add_samples(aku_Sample const* samples, size_t size) {
+        return session_->write_batch(samples, size);
+    }
+
     CursorImpl* query(const char* q) {
         auto res = new CursorImpl(session_, q);
         return res;
@@ -253,12 +261,12 @@ class DatabaseImpl : public aku_Database
     std::shared_ptr<Storage> storage_;
 public:
     // private fields
-    DatabaseImpl(const char* path)
+    DatabaseImpl(const char* path, const aku_FineTuneParams& params)
     {
         if (path == std::string(":memory:")) {
             storage_ = std::make_shared<Storage>();
         } else {
-            storage_ = std::make_shared<Storage>(path);
+            storage_ = std::make_shared<Storage>(path, params);
         }
     }
 
@@ -266,8 +274,8 @@ public:
         storage_->close();
     }
 
-    static aku_Database* create(const char* path) {
-        DatabaseImpl* ptr = new DatabaseImpl(path);
+    static aku_Database* create(const char* path, const aku_FineTuneParams& params) {
+        DatabaseImpl* ptr = new DatabaseImpl(path, params);
         return static_cast<aku_Database*>(ptr);
     }
 
@@ -347,6 +355,11 @@ aku_Status aku_write(aku_Session* session, const aku_Sample* sample) {
     return ises->add_sample(*sample);
 }
 
+aku_Status aku_write_batch(aku_Session* session, const aku_Sample* samples, size_t size) {
+    auto ises = reinterpret_cast<Session*>(session);
+    return ises->add_samples(samples, size);
+}
+
 
 aku_Status aku_parse_duration(const char* str, int* value) {
     try {
@@ -358,6 +371,9 @@ aku_Status aku_parse_duration(const char* str, int* value) {
 }
 
 aku_Status aku_parse_timestamp(const char* iso_str, aku_Sample* sample) {
+    if (DateTimeUtil::parse_timestamp_fast(iso_str, iso_str + strlen(iso_str), &sample->timestamp)) {
+        return AKU_SUCCESS;
+    }
     try {
         sample->timestamp = DateTimeUtil::from_iso_string(iso_str);
     } catch (...) {
@@ -377,8 +393,7 @@ int aku_name_to_param_id_list(aku_Session* ist, const char* begin, const char* e
 }
 
 aku_Database* aku_open_database(const char* path, aku_FineTuneParams parameters) {
-    AKU_UNUSED(parameters);
-    return DatabaseImpl::create(path);
+    return DatabaseImpl::create(path, parameters);
 }
 
 void aku_close_database(aku_Database* db) {
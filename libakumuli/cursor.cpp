@@ -24,19 +24,186 @@
 #include <string.h>
 #include <algorithm>
 #include <functional>
+#include <set>
+#include <boost/exception/diagnostic_information.hpp>
 // TODO: remove
 #include "log_iface.h"
 #include "status_util.h"
+#include "storage_engine/query_context.h"
 
 
 namespace Akumuli {
 
-// CoroCursor //
+// QueryTask //
+
+QueryTask::QueryTask(std::function<void()> fn, std::function<void()> on_interrupt)
+    : fn_(fn)
+    , on_interrupt_(on_interrupt)
+    , state_{QUEUED}
+{
+}
+
+void QueryTask::set_state(int state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        state_ = state;
+    }
+    cond_.notify_all();
+}
+
+void QueryTask::run() {
+    int expected = QUEUED;
+    if (!state_.compare_exchange_strong(expected, RUNNING)) {
+        // Task was cancelled
+        return;
+    }
+    fn_();
+    set_state(DONE);
+}
+
+bool QueryTask::cancel() {
+    int expected = QUEUED;
+    if (state_.compare_exchange_strong(expected, CANCELLED)) {
+        set_state(CANCELLED);
+        return true;
+    }
+    return false;
+}
+
+void QueryTask::interrupt() {
+    // Task can't switch to DONE or CANCELLED state while the mutex is held, so the
+    // callback never runs after `wait` returned and the owner of the task is destroyed.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int state = QUEUED;
+        bool cancelled = state_.compare_exchange_strong(state, CANCELLED);
+        // Owner of the queued task is notified too, otherwise it will wait
+        // for the results that never come.
+        if ((cancelled || state == RUNNING) && on_interrupt_) {
+            on_interrupt_();
+        }
+        if (!cancelled) {
+            return;
+        }
+    }
+    cond_.notify_all();
+}
+
+bool QueryTask::is_cancelled() const {
+    return state_ == CANCELLED;
+}
+
+void QueryTask::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() {
+        int state = state_;
+        return state == DONE || state == CANCELLED;
+    });
+}
+
+// QueryExecutor //
+
+struct QueryExecutor::State {
+    std::deque<std::shared_ptr<QueryTask>> queue;
+    std::set<std::shared_ptr<QueryTask>>   running;
+    size_t                                 queue_max;
+    bool                                   stop;
+    std::mutex                             mutex;
+    std::condition_variable                cond;
+};
+
+QueryExecutor::QueryExecutor(u32 nthreads, u32 queue_max)
+    : state_(std::make_shared<State>())
+{
+    state_->queue_max = queue_max ? queue_max : DEFAULT_QUEUE_SIZE;
+    state_->stop = false;
+    if (nthreads == 0) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (u32 i = 0; i < nthreads; i++) {
+        threads_.emplace_back(&QueryExecutor::worker, state_);
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    stop();
+}
+
+void QueryExecutor::worker(std::shared_ptr<State> state) {
+    while (true) {
+        std::shared_ptr<QueryTask> task;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->cond.wait(lock, [&state]() {
+                return state->stop || !state->queue.empty();
+            });
+            if (state->stop) {
+                return;
+            }
+            task = std::move(state->queue.front());
+            state->queue.pop_front();
+            state->running.insert(task);
+        }
+        task->run();
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->running.erase(task);
+    }
+}
+
+aku_Status QueryExecutor::submit(std::shared_ptr<QueryTask> task) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->stop) {
+            return AKU_ECLOSED;
+        }
+        if (state_->queue.size() >= state_->queue_max) {
+            return AKU_EBUSY;
+        }
+        state_->queue.push_back(std::move(task));
+    }
+    state_->cond.notify_one();
+    return AKU_SUCCESS;
+}
+
+size_t QueryExecutor::get_nthreads() const {
+    return threads_.size();
+}
+
+void QueryExecutor::stop() {
+    std::deque<std::shared_ptr<QueryTask>> queue;
+    std::vector<std::shared_ptr<QueryTask>> running;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->stop = true;
+        std::swap(queue, state_->queue);
+        running.assign(state_->running.begin(), state_->running.end());
+    }
+    state_->cond.notify_all();
+    // Queued tasks are cancelled
+    for (auto& task: queue) {
+        task->interrupt();
+    }
+    // Running task can be blocked by the slow client, it won't finish
+    // (and the thread can't be joined) until it's interrupted.
+    for (auto& task: running) {
+        task->interrupt();
+    }
+    for (auto& thread: threads_) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            // Executor is destroyed by one of its own tasks, worker thread
+            // will exit after the task completes (state is shared).
+            thread.detach();
+        } else if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads_.clear();
+}
+
+// ConcurrentCursor //
 
 namespace {
     enum {
-        BUFFER_SIZE = 0x4000,
-        QUEUE_MAX = 0x20,
         CURSOR_READ_TIMEOUT = 10,
     };
 }
@@ -44,8 +211,14 @@ namespace {
 // External cursor implementation //
 
 ConcurrentCursor::ConcurrentCursor()
-    : done_{false}
+    : head_{0}
+    , tail_{0}
+    , wrbuf_{nullptr}
+    , reader_waiting_{false}
+    , writer_waiting_{false}
+    , done_{false}
     , error_code_{AKU_SUCCESS}
+    , context_(std::make_shared<StorageEngine::QueryContext>())
 {}
 
 
@@ -71,32 +244,50 @@ static u32 samplecpy(u8* dest, u8 const* source, u32 size) {
     return static_cast<u32>(rcvbuf - dest);
 }
 
+void ConcurrentCursor::notify(std::atomic_bool const& waiting) {
+    if (waiting) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+}
+
 u32 ConcurrentCursor::read(void* buffer, u32 buffer_size) {
     u32 nbytes = 0;
     u8* dest = static_cast<u8*>(buffer);
-    std::unique_lock<std::mutex> lock(mutex_);
     while(true) {
-        if (queue_.empty()) {
+        u64 head = head_.load(std::memory_order_relaxed);
+        if (head == tail_) {
             if (done_) {
-                return nbytes;
+                // Producer publishes everything before setting the flag
+                if (head == tail_) {
+                    return nbytes;
+                }
+                continue;
             }
-            cond_.wait_for(lock, std::chrono::milliseconds(CURSOR_READ_TIMEOUT));
+            reader_waiting_ = true;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::milliseconds(CURSOR_READ_TIMEOUT), [this, head]() {
+                    return head != tail_ || done_;
+                });
+            }
+            reader_waiting_ = false;
             continue;
         }
-        auto front = queue_.front();
-        auto bytes2read = std::min(buffer_size, static_cast<u32>(front->wrpos - front->rdpos));
-        auto out = samplecpy(dest, front->buf.data() + front->rdpos, bytes2read);
+        auto& front = ring_[head % QUEUE_MAX];
+        auto bytes2read = std::min(buffer_size, static_cast<u32>(front.wrpos - front.rdpos));
+        auto out = samplecpy(dest, front.buf.data() + front.rdpos, bytes2read);
         if (out == 0) {
             // The last sample in the array doesn't fit
             break;
         }
-        front->rdpos += out;
+        front.rdpos += out;
         nbytes += out;
         dest += out;
         buffer_size -= out;
-        if (front->rdpos == front->wrpos) {
-            queue_.pop_front();
-            cond_.notify_all();
+        if (front.rdpos == front.wrpos) {
+            head_ = head + 1;
+            notify(writer_waiting_);
         }
         if (buffer_size < sizeof(aku_Sample)) {
             break;
@@ -106,78 +297,124 @@ u32 ConcurrentCursor::read(void* buffer, u32 buffer_size) {
 }
 
 bool ConcurrentCursor::is_done() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return done_ && queue_.empty();
+    return done_ && head_ == tail_;
 }
 
 bool ConcurrentCursor::is_error(aku_Status* out_error_code_or_null) const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    bool done = done_;
     if (out_error_code_or_null != nullptr) {
         *out_error_code_or_null = error_code_;
     }
-    return done_ && error_code_ != AKU_SUCCESS;
+    return done && error_code_ != AKU_SUCCESS;
 }
 
-void ConcurrentCursor::close() {
+void ConcurrentCursor::interrupt() {
+    // Stop the query even if it doesn't produce any output
+    context_->cancel();
     std::lock_guard<std::mutex> lock(mutex_);
+    if (!done_ && error_code_ == AKU_SUCCESS) {
+        // Results are incomplete, client shouldn't mistake them for the full result
+        error_code_ = AKU_ECANCELLED;
+    }
     done_ = true;
     cond_.notify_all();
-    if (thread_.joinable()) {
-        thread_.join();
+}
+
+void ConcurrentCursor::close() {
+    interrupt();
+    if (task_ && !task_->cancel()) {
+        task_->wait();
+    }
+}
+
+void ConcurrentCursor::start_task(QueryExecutor& executor, std::function<void()> fn) {
+    task_ = std::make_shared<QueryTask>([this, fn]() {
+        try {
+            fn();
+        } catch (...) {
+            Logger::msg(AKU_LOG_ERROR, "Query failed: " + boost::current_exception_diagnostic_information());
+            set_error(AKU_EGENERAL);
+        }
+    }, [this]() {
+        interrupt();
+    });
+    auto status = executor.submit(task_);
+    if (status != AKU_SUCCESS) {
+        Logger::msg(AKU_LOG_ERROR, "Query rejected: " + StatusUtil::str(status));
+        set_error(status);
     }
 }
 
 // Internal cursor implementation
 
+void ConcurrentCursor::publish() {
+    if (wrbuf_ == nullptr) {
+        return;
+    }
+    if (wrbuf_->wrpos != 0) {
+        tail_++;
+    }
+    wrbuf_ = nullptr;
+    notify(reader_waiting_);
+}
+
 void ConcurrentCursor::set_error(aku_Status error_code) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    done_ = true;
+    publish();
     error_code_ = error_code;
+    done_ = true;
+    std::lock_guard<std::mutex> lock(mutex_);
     cond_.notify_all();
 }
 
-static std::shared_ptr<ConcurrentCursor::BufferT> make_empty() {
-    auto buf = std::make_shared<ConcurrentCursor::BufferT>();
-    buf->buf.resize(BUFFER_SIZE);
-    buf->rdpos = 0;
-    buf->wrpos = 0;
-    return buf;
-}
-
 bool ConcurrentCursor::put(aku_Sample const& result) {
     if (done_) {
         return false;
     }
     u32 bytes = result.payload.size;
-    std::unique_lock<std::mutex> lock(mutex_);
-    std::shared_ptr<BufferT> top;
-    while(true) {
-        if(queue_.empty()) {
-            top = make_empty();
-            queue_.push_back(top);
-        }
-        top = queue_.back();
-        if (top->wrpos + bytes > BUFFER_SIZE) {
-            // Overflow
-            if (queue_.size() < QUEUE_MAX) {
-                top = make_empty();
-                queue_.push_back(top);
-            } else {
-                cond_.wait(lock);
+    if (wrbuf_ != nullptr && wrbuf_->wrpos + bytes > BUFFER_SIZE) {
+        // Overflow
+        publish();
+    }
+    if (wrbuf_ == nullptr) {
+        u64 tail = tail_.load(std::memory_order_relaxed);
+        while (tail - head_ >= QUEUE_MAX) {
+            // Wait until reader will free some space
+            writer_waiting_ = true;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::milliseconds(CURSOR_READ_TIMEOUT), [this, tail]() {
+                    return tail - head_ < QUEUE_MAX || done_;
+                });
             }
-            continue;
-        } else {
-            break;
+            writer_waiting_ = false;
+            if (done_) {
+                return false;
+            }
+        }
+        wrbuf_ = &ring_[tail % QUEUE_MAX];
+        if (wrbuf_->buf.empty()) {
+            wrbuf_->buf.resize(BUFFER_SIZE);
         }
+        wrbuf_->rdpos = 0;
+        wrbuf_->wrpos = 0;
+    }
+    memcpy(wrbuf_->buf.data() + wrbuf_->wrpos, &result, bytes);
+    wrbuf_->wrpos += bytes;
+    if (reader_waiting_.load(std::memory_order_relaxed)) {
+        // Don't keep the reader waiting until the buffer is full
+        publish();
     }
-    memcpy(top->buf.data() + top->wrpos, &result, bytes);
-    top->wrpos += bytes;
-    cond_.notify_all();
     return true;
 }
 
+std::shared_ptr<StorageEngine::QueryContext> ConcurrentCursor::get_query_context() {
+    return context_;
+}
+
 void ConcurrentCursor::complete() {
+    publish();
     done_ = true;
+    std::lock_guard<std::mutex> lock(mutex_);
     cond_.notify_all();
 }
 
@@ -28,6 +28,8 @@
 #include <condition_variable>
 #include <atomic>
 #include <deque>
+#include <array>
+#include <mutex>
 #include <functional>
 
 
@@ -44,10 +46,91 @@ std::ostream& operator<<(std::ostream& st, aku_Sample res);
 struct Cursor : InternalCursor, ExternalCursor {};
 
 
+/**
+ * @brief Query task
+ * Unit of work executed by the QueryExecutor. Task can be cancelled
+ * while it waits in the queue.
+ */
+class QueryTask {
+    enum {
+        QUEUED,
+        RUNNING,
+        CANCELLED,
+        DONE,
+    };
+    std::function<void()>   fn_;
+    std::function<void()>   on_interrupt_;
+    std::atomic<int>        state_;
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+
+    void set_state(int state);
+public:
+    QueryTask(std::function<void()> fn, std::function<void()> on_interrupt = std::function<void()>());
+
+    //! Execute the task (called by the executor)
+    void run();
+
+    //! Cancel the task if it's not started yet, return true on success
+    bool cancel();
+
+    //! Invoke interrupt callback if the task is running, cancel the task and invoke the callback if it's queued
+    void interrupt();
+
+    //! Return true if the task was cancelled before it was started
+    bool is_cancelled() const;
+
+    //! Wait until the task is completed or cancelled
+    void wait();
+};
+
+/**
+ * @brief Fixed size thread pool that executes queries
+ * Number of worker threads limits the number of concurrently executed queries.
+ * Queries that can't be started immediately are queued. Queue size is also
+ * limited, new queries are rejected with AKU_EBUSY when the queue is full.
+ */
+class QueryExecutor {
+    //! Queue and synchronization primitives, shared with worker threads
+    struct State;
+    std::shared_ptr<State>   state_;
+    std::vector<std::thread> threads_;
+
+    static void worker(std::shared_ptr<State> state);
+public:
+    enum {
+        DEFAULT_QUEUE_SIZE = 1024,
+    };
+
+    /** C-tor
+      * @param nthreads is a number of worker threads (0 - number of CPUs)
+      * @param queue_max is a max number of queued queries (0 - default value)
+      */
+    QueryExecutor(u32 nthreads = 0, u32 queue_max = 0);
+
+    ~QueryExecutor();
+
+    QueryExecutor(QueryExecutor const&) = delete;
+    QueryExecutor& operator = (QueryExecutor const&) = delete;
+
+    /** Add task to the queue.
+      * @return AKU_SUCCESS or AKU_EBUSY if the queue is full
+      */
+    aku_Status submit(std::shared_ptr<QueryTask> task);
+
+    //! Number of worker threads
+    size_t get_nthreads() const;
+
+    //! Stop all worker threads, queued tasks are cancelled, running tasks are interrupted
+    void stop();
+};
+
 /**
  * @brief The ConcurrentCursor struct
- * Implements cursor interface. Starts computation in parallel thread.
- * All communication is done through message queue.
+ * Implements cursor interface. Computation is performed by the QueryExecutor.
+ * Results are passed to the reader through the single producer single consumer
+ * ring of buffers. Producer and consumer synchronize only when the buffer
+ * is handed over or when one of them have to wait.
  */
 struct ConcurrentCursor : Cursor {
 
@@ -57,12 +140,28 @@ struct ConcurrentCursor : Cursor {
         size_t wrpos;
     };
 
-    std::thread thread_;
+    enum {
+        BUFFER_SIZE = 0x4000,
+        QUEUE_MAX = 0x20,
+    };
+
+    std::shared_ptr<QueryTask> task_;
+    //! Ring of buffers, buffers are allocated on demand
+    std::array<BufferT, QUEUE_MAX> ring_;
+    //! Consumer position (buffers before `head_` are consumed)
+    std::atomic<u64> head_;
+    //! Producer position (buffers before `tail_` are published)
+    std::atomic<u64> tail_;
+    //! Buffer that is being filled by producer (not published yet)
+    BufferT* wrbuf_;
+    std::atomic_bool reader_waiting_;
+    std::atomic_bool writer_waiting_;
     mutable std::mutex  mutex_;
     std::condition_variable cond_;
     std::atomic_bool done_;
-    std::deque<std::shared_ptr<BufferT>> queue_;
     aku_Status error_code_;
+    //! Query is cancelled through this context when the cursor is closed
+    std::shared_ptr<StorageEngine::QueryContext> context_;
 
     ConcurrentCursor();
 
@@ -76,6 +175,10 @@ struct ConcurrentCursor : Cursor {
 
     virtual void close();
 
+    //! Cancel the query (AKU_ECANCELLED is reported unless the query is done) and wake up
+    //! the producer and the consumer, called by the executor on stop
+    void interrupt();
+
     // Internal cursor implementation
 
     void set_error(aku_Status error_code);
@@ -84,37 +187,48 @@ struct ConcurrentCursor : Cursor {
 
     void complete();
 
-    template <class Fn_1arg_caller> void start(Fn_1arg_caller const& fn) {
-        thread_ = std::thread(fn);
+    std::shared_ptr<StorageEngine::QueryContext> get_query_context();
+
+    //! Publish buffer that is being filled by producer
+    void publish();
+
+    //! Wake up other side if it's waiting
+    void notify(std::atomic_bool const& waiting);
+
+    //! Submit computation to the executor
+    void start_task(QueryExecutor& executor, std::function<void()> fn);
+
+    template <class Fn_1arg_caller> void start(QueryExecutor& executor, Fn_1arg_caller const& fn) {
+        start_task(executor, fn);
     }
 
-    template <class Fn_1arg> static std::unique_ptr<ExternalCursor> make(Fn_1arg const& fn) {
+    template <class Fn_1arg> static std::unique_ptr<ExternalCursor> make(QueryExecutor& executor, Fn_1arg const& fn) {
         std::unique_ptr<ConcurrentCursor> cursor(new ConcurrentCursor());
-        cursor->start(fn);
+        cursor->start(executor, fn);
         return std::move(cursor);
     }
 
     template <class Fn_2arg, class Tobj, class T2nd>
-    static std::unique_ptr<ExternalCursor> make(Fn_2arg const& fn, Tobj obj, T2nd const& arg2) {
+    static std::unique_ptr<ExternalCursor> make(QueryExecutor& executor, Fn_2arg const& fn, Tobj obj, T2nd const& arg2) {
         std::unique_ptr<ConcurrentCursor> cursor(new ConcurrentCursor());
-        cursor->start(std::bind(fn, obj, cursor.get(), arg2));
+        cursor->start(executor, std::bind(fn, obj, cursor.get(), arg2));
         return std::move(cursor);
     }
 
     template <class Fn_3arg, class Tobj, class T2nd, class T3rd>
-    static std::unique_ptr<ExternalCursor> make(Fn_3arg const& fn, Tobj obj, T2nd const& arg2,
+    static std::unique_ptr<ExternalCursor> make(QueryExecutor& executor, Fn_3arg const& fn, Tobj obj, T2nd const& arg2,
                                                 T3rd const& arg3) {
         std::unique_ptr<ConcurrentCursor> cursor(new ConcurrentCursor());
-        cursor->start(
+        cursor->start(executor,
             std::bind(fn, obj, cursor.get(), arg2, arg3));
         return std::move(cursor);
     }
 
     template <class Fn_4arg, class Tobj, class T2nd, class T3rd, class T4th>
-    static std::unique_ptr<ExternalCursor> make(Fn_4arg const& fn, Tobj obj, T2nd const& arg2,
+    static std::unique_ptr<ExternalCursor> make(QueryExecutor& executor, Fn_4arg const& fn, Tobj obj, T2nd const& arg2,
                                                 T3rd const& arg3, T4th const& arg4) {
         std::unique_ptr<ConcurrentCursor> cursor(new ConcurrentCursor());
-        cursor->start(
+        cursor->start(executor,
             std::bind(fn, obj, cursor.get(), arg2, arg3, arg4));
         return std::move(cursor);
     }
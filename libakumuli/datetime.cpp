@@ -15,7 +15,9 @@
  */
 
 #include "datetime.h"
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include <boost/regex.hpp>
 
 namespace Akumuli {
@@ -57,6 +59,113 @@ static int parse_n_digits(const char* p, int n, const char* error_message = "can
     return value;
 }
 
+//! Check that all eight bytes of the word are decimal digits
+static inline bool is_eight_digits(u64 word) {
+    return ((word & 0xF0F0F0F0F0F0F0F0ull) |
+            (((word + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull;
+}
+
+//! Parse eight decimal digits at once (SWAR, little endian byte order)
+static inline u32 parse_eight_digits(u64 word) {
+    word -= 0x3030303030303030ull;
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+            (((word >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    return static_cast<u32>(word);
+}
+
+static inline u64 load_u64(const char* p) {
+    u64 word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+//! Number of days since epoch (proleptic Gregorian calendar)
+static inline i64 days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    const i64 era = (year >= 0 ? year : year - 399) / 400;
+    const i64 yoe = year - era * 400;
+    const i64 doy = (153*(month > 2 ? month - 3 : month + 9) + 2)/5 + day - 1;
+    const i64 doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static inline int days_in_month(int year, int month) {
+    static const int DAYS[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month == 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) {
+        return 29;
+    }
+    return DAYS[month - 1];
+}
+
+bool DateTimeUtil::parse_timestamp_fast(const char* begin, const char* end, aku_Timestamp* result) {
+    static const i64 NS = 1000000000;
+    auto len = end - begin;
+    if (len <= 0) {
+        return false;
+    }
+    if (len < 15 || begin[8] != 'T') {
+        // Raw timestamp, 19 digits can't overflow
+        if (len > 19) {
+            return false;
+        }
+        u64 ts = 0;
+        for (const char* p = begin; p != end; p++) {
+            if (*p > 0x39 || *p < 0x30) {
+                return false;
+            }
+            ts = ts*10 + static_cast<u64>(*p & 0x0F);
+        }
+        *result = ts;
+        return true;
+    }
+    // YYYYMMDD
+    u64 word = load_u64(begin);
+    // HHMMSS, two bytes before it ("DT") are replaced with zeroes
+    u64 time = (load_u64(begin + 7) & ~0xFFFFull) | 0x3030ull;
+    if (!is_eight_digits(word) || !is_eight_digits(time)) {
+        return false;
+    }
+    u32 date = parse_eight_digits(word);
+    u32 hms  = parse_eight_digits(time);
+    int year   = static_cast<int>(date / 10000);
+    int month  = static_cast<int>(date / 100 % 100);
+    int day    = static_cast<int>(date % 100);
+    int hour   = static_cast<int>(hms / 10000);
+    int minute = static_cast<int>(hms / 100 % 100);
+    int second = static_cast<int>(hms % 100);
+    int nanoseconds = 0;
+    const char* p = begin + 15;
+    if (p != end) {
+        if (*p != '.' && *p != ',') {
+            return false;
+        }
+        p++;
+        auto n = end - p;
+        if (n > 9) {
+            return false;
+        }
+        // Fractional part is padded with zeroes to nine digits
+        char frac[16] = { '0', '0', '0', '0', '0', '0', '0', '0', '0' };
+        memcpy(frac, p, static_cast<size_t>(n));
+        u64 head = load_u64(frac);
+        if (!is_eight_digits(head) || frac[8] > 0x39 || frac[8] < 0x30) {
+            return false;
+        }
+        nanoseconds = static_cast<int>(parse_eight_digits(head)*10 + static_cast<u32>(frac[8] & 0x0F));
+    }
+    // Nanosecond timestamps overflow outside of the [1678, 2262] range, the
+    // result of the slow path is used for them as well as for invalid dates.
+    if (year < 1700 || year > 2200 || month < 1 || month > 12 || day < 1 || day > days_in_month(year, month)) {
+        return false;
+    }
+    // Hours, minutes and seconds are not validated by the slow path (boost accepts
+    // any value and adds it to the date)
+    i64 seconds = days_from_civil(year, month, day)*86400 + hour*3600 + minute*60 + second;
+    *result = static_cast<aku_Timestamp>(seconds*NS + nanoseconds);
+    return true;
+}
+
 aku_Timestamp DateTimeUtil::from_iso_string(const char* iso_str) {
     u32 len = static_cast<u32>(std::strlen(iso_str));
     if (len == 0) {
@@ -75,6 +184,7 @@ aku_Timestamp DateTimeUtil::from_iso_string(const char* iso_str) {
         // Raw timestamp
         aku_Timestamp ts;
         char* end;
+        errno = 0;
         ts = strtoull(iso_str, &end, 10);
         if (errno == ERANGE) {
             BadDateTimeFormat error("can't parse unix-timestamp from string");
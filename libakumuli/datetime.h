@@ -55,6 +55,15 @@ struct DateTimeUtil {
       */
     static aku_Timestamp from_iso_string(const char* iso_str);
 
+    /** Convert timestamp to aku_Timestamp value without allocations, exceptions and locale.
+      * Only fixed layouts are supported: number of nanoseconds since epoch (up to 19 digits) and
+      * basic ISO 8601 format with optional fraction of the second ("20141210T074343.999999999").
+      * The result is the same as the result of the `from_iso_string` function.
+      * @return false if the layout is not supported or value is invalid (`from_iso_string` should
+      *         be used to get the value or the error in this case)
+      */
+    static bool parse_timestamp_fast(const char* begin, const char* end, aku_Timestamp* result);
+
     /** Convert timestamp to string.
       */
     static int to_iso_string(aku_Timestamp ts, char* buffer, size_t buffer_size);
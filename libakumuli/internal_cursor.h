@@ -19,12 +19,17 @@
 
 #pragma once
 
+#include <memory>
+
 #include <boost/version.hpp>
 
 #include "akumuli.h"
 
 namespace Akumuli {
 
+namespace StorageEngine {
+class QueryContext;
+}
 
 /** Interface used by different search procedures
  *  in akumuli. Must be used only inside library.
@@ -35,5 +40,9 @@ struct InternalCursor {
     virtual void complete() = 0;
     //! Set error and stop execution
     virtual void set_error(aku_Status error_code) = 0;
+    //! Return execution limits of the query (cursor can cancel the query through it)
+    virtual std::shared_ptr<StorageEngine::QueryContext> get_query_context() {
+        return std::shared_ptr<StorageEngine::QueryContext>();
+    }
 };
 }
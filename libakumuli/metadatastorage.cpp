@@ -369,6 +369,14 @@ void MetadataStorage::add_rescue_point(aku_ParamId id, std::vector<u64>&& val) {
     sync_cvar_.notify_one();
 }
 
+void MetadataStorage::add_rescue_points(std::unordered_map<aku_ParamId, std::vector<u64>>&& batch) {
+    std::lock_guard<std::mutex> guard(sync_lock_);
+    for (auto& kv: batch) {
+        pending_rescue_points_[kv.first] = std::move(kv.second);
+    }
+    sync_cvar_.notify_one();
+}
+
 void MetadataStorage::update_volume(const VolumeDesc& vol) {
     std::lock_guard<std::mutex> guard(sync_lock_);
     pending_volumes_[vol.id] = vol;
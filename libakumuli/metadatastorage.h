@@ -122,6 +122,9 @@ struct MetadataStorage : VolumeRegistry {
 
     void add_rescue_point(aku_ParamId id, std::vector<u64>&& val);
 
+    //! Add rescue points of many series at once
+    void add_rescue_points(std::unordered_map<aku_ParamId, std::vector<u64>>&& batch);
+
     /**
      * @brief Add/update volume metadata asynchronously
      * @param vol is a volume description
@@ -32,6 +32,16 @@ bool Absolute::put(MutableSample &mut) {
     return next_->put(mut);
 }
 
+bool Absolute::put_batch(SampleBatch& batch) {
+    for (u32 col = 0; col < batch.ncolumns; col++) {
+        double* xs = batch.column(col);
+        for (size_t ix = 0; ix < batch.size; ix++) {
+            xs[ix] = std::abs(xs[ix]);
+        }
+    }
+    return next_->put_batch(batch);
+}
+
 void Absolute::set_error(aku_Status status) {
     next_->set_error(status);
 }
@@ -21,6 +21,8 @@ struct Absolute : Node {
 
     virtual bool put(MutableSample& sample);
 
+    virtual bool put_batch(SampleBatch& batch);
+
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
@@ -27,6 +27,24 @@ bool Limiter::put(MutableSample &sample) {
     return next_->put(sample);
 }
 
+bool Limiter::put_batch(SampleBatch& batch) {
+    if (counter_ < offset_) {
+        // continue iteration
+        return true;
+    } else if (counter_ >= limit_) {
+        // stop iteration
+        return false;
+    }
+    auto nrows = std::min(static_cast<u64>(batch.size), limit_ - counter_);
+    bool truncated = nrows < batch.size;
+    batch.truncate(nrows);
+    counter_ += nrows;
+    if (!next_->put_batch(batch)) {
+        return false;
+    }
+    return !truncated;
+}
+
 void Limiter::set_error(aku_Status status) {
     next_->set_error(status);
 }
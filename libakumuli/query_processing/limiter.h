@@ -20,6 +20,8 @@ struct Limiter : Node {
 
     virtual bool put(MutableSample& sample);
 
+    virtual bool put_batch(SampleBatch& batch);
+
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
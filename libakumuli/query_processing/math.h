@@ -11,6 +11,7 @@ struct MathOperation : Node {
 
     std::shared_ptr<Node> next_;
     bool ignore_missing_;
+    std::vector<double> acc_;  //< accumulator used by `put_batch`
 
     MathOperation(bool ignore_missing, std::shared_ptr<Node> next);
 
@@ -20,6 +21,8 @@ struct MathOperation : Node {
 
     virtual bool put(MutableSample& sample);
 
+    virtual bool put_batch(SampleBatch& batch);
+
     virtual void set_error(aku_Status status);
 
     virtual int get_requirements() const;
@@ -69,6 +72,31 @@ bool MathOperation<Op>::put(MutableSample &mut) {
     return next_->put(mut);
 }
 
+template<class Op>
+bool MathOperation<Op>::put_batch(SampleBatch& batch) {
+    Op operation;
+    const double missing = ignore_missing_ ? operation.unit()
+                                           : std::numeric_limits<double>::quiet_NaN();
+    acc_.assign(batch.size, 0.);
+    double* acc = acc_.data();
+    for (u32 col = 0; col < batch.ncolumns; col++) {
+        const double* xs = batch.column(col);
+        if (!batch.is_tuple()) {
+            for (size_t ix = 0; ix < batch.size; ix++) {
+                acc[ix] = operation(acc[ix], xs[ix]);
+            }
+        } else {
+            for (size_t ix = 0; ix < batch.size; ix++) {
+                double x = batch.is_present(ix, col) ? xs[ix] : missing;
+                acc[ix] = operation(acc[ix], x);
+            }
+        }
+    }
+    batch.collapse();
+    std::copy(acc_.begin(), acc_.end(), batch.column(0));
+    return next_->put_batch(batch);
+}
+
 template<class Op>
 void MathOperation<Op>::set_error(aku_Status status) {
     next_->set_error(status);
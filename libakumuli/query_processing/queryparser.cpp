@@ -751,6 +751,49 @@ std::tuple<aku_Status, QueryKind> QueryParser::get_query_kind(boost::property_tr
     return std::make_tuple(AKU_EQUERY_PARSING_ERROR, QueryKind::SELECT);
 }
 
+std::tuple<aku_Status, ExplainMode> QueryParser::get_explain_mode(boost::property_tree::ptree const& ptree) {
+    ExplainMode mode = ExplainMode::NONE;
+    for (auto kw: { "explain", "profile" }) {
+        auto child = ptree.get_child_optional(kw);
+        if (!child) {
+            continue;
+        }
+        bool value = false;
+        try {
+            value = child->get_value<bool>();
+        } catch (boost::property_tree::ptree_error const& e) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't parse `") + kw + "` statement, " + e.what());
+            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, mode);
+        }
+        if (value) {
+            if (mode != ExplainMode::NONE) {
+                Logger::msg(AKU_LOG_ERROR, "`explain` and `profile` statements can't be used together");
+                return std::make_tuple(AKU_EQUERY_PARSING_ERROR, mode);
+            }
+            mode = std::string(kw) == "explain" ? ExplainMode::EXPLAIN : ExplainMode::PROFILE;
+        }
+    }
+    return std::make_tuple(AKU_SUCCESS, mode);
+}
+
+std::tuple<aku_Status, u64, u64> QueryParser::get_query_limits(boost::property_tree::ptree const& ptree) {
+    u64 limits[] = { 0, 0 };
+    const char* keywords[] = { "timeout", "memory-limit" };
+    for (int i = 0; i < 2; i++) {
+        auto child = ptree.get_child_optional(keywords[i]);
+        if (!child) {
+            continue;
+        }
+        try {
+            limits[i] = child->get_value<u64>();
+        } catch (boost::property_tree::ptree_error const& e) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't parse `") + keywords[i] + "` statement, " + e.what());
+            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, 0, 0);
+        }
+    }
+    return std::make_tuple(AKU_SUCCESS, limits[0], limits[1]);
+}
+
 aku_Status validate_query(boost::property_tree::ptree const& ptree) {
     static const std::vector<std::string> UNIQUE_STMTS = {
         "select",
@@ -772,6 +815,11 @@ aku_Status validate_query(boost::property_tree::ptree const& ptree) {
         "group-aggregate",
         "apply",
         "filter",
+        "top",
+        "explain",
+        "profile",
+        "timeout",
+        "memory-limit",
     };
     std::set<std::string> keywords;
     for (const auto& item: ptree) {
@@ -1187,6 +1235,22 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_aggregate_query(boost:
         return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
     }
 
+    // Top statement, format: { "top": 10, ... }
+    u64 top = 0;
+    auto opttop = ptree.get_child_optional("top");
+    if (opttop) {
+        try {
+            top = opttop->get_value<u64>();
+        } catch (boost::property_tree::ptree_error const& e) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't parse `top` statement, ") + e.what());
+            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
+        }
+        if (top == 0 || groupbytag) {
+            Logger::msg(AKU_LOG_ERROR, "`top` statement should be positive and can't be used with `group-by`");
+            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
+        }
+    }
+
     // Where statement
     std::vector<aku_ParamId> ids;
     std::tie(status, ids) = parse_where_clause(ptree, {metric}, matcher);
@@ -1204,6 +1268,7 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_aggregate_query(boost:
     // Initialize request
     result.agg.enabled = true;
     result.agg.func = { func };
+    result.agg.top = top;
 
     result.select.begin = ts_begin;
     result.select.end = ts_end;
@@ -1481,6 +1546,17 @@ struct TerminalNode : QP::Node {
         return cursor->put(sample.payload_.sample);
     }
 
+    bool put_batch(SampleBatch& batch) {
+        MutableSample::Payload row;
+        for (size_t ix = 0; ix < batch.size; ix++) {
+            batch.get_sample(ix, reinterpret_cast<u8*>(&row));
+            if (!cursor->put(row.sample)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     void set_error(aku_Status status) {
         cursor->set_error(status);
     }
@@ -18,6 +18,16 @@ enum class QueryKind {
     GROUP_AGGREGATE,
 };
 
+//! Query output mode
+enum class ExplainMode {
+    //! Return query results
+    NONE,
+    //! Return query plan instead of the results
+    EXPLAIN,
+    //! Execute the query and return query plan with execution statistics
+    PROFILE,
+};
+
 class SeriesRetreiver {
     std::vector<std::string> metric_;
     std::map<std::string, std::vector<std::string>> tags_;
@@ -55,6 +65,16 @@ struct QueryParser {
       */
     static std::tuple<aku_Status, QueryKind> get_query_kind(boost::property_tree::ptree const& ptree);
 
+    /** Determain query output mode, format: { "explain": true, ... } or { "profile": true, ... }
+      */
+    static std::tuple<aku_Status, ExplainMode> get_explain_mode(boost::property_tree::ptree const& ptree);
+
+    /** Parse execution limits of the query, format: { "timeout": 1000, "memory-limit": 1000000, ... }
+      * Timeout is set in milliseconds, memory limit in bytes, zero value means that there is no limit.
+      * @returns status, timeout and memory limit
+      */
+    static std::tuple<aku_Status, u64, u64> get_query_limits(boost::property_tree::ptree const& ptree);
+
     /** Parse query and produce reshape request.
       * @param ptree contains query
       * @returns status and ReshapeRequest
@@ -1,4 +1,5 @@
 #include "queryplan.h"
+#include "cursor.h"
 #include "storage_engine/nbtree.h"
 #include "storage_engine/column_store.h"
 #include "storage_engine/operators/operator.h"
@@ -6,9 +7,15 @@
 #include "storage_engine/operators/merge.h"
 #include "storage_engine/operators/aggregate.h"
 #include "storage_engine/operators/join.h"
+#include "storage_engine/profile.h"
 #include "log_iface.h"
 #include "status_util.h"
 
+#include <algorithm>
+#include <chrono>
+
+#include <boost/exception/diagnostic_information.hpp>
+
 namespace Akumuli {
 namespace QP {
 
@@ -25,6 +32,10 @@ struct ProcessingPrelude {
     virtual aku_Status extract_result(std::vector<std::unique_ptr<RealValuedOperator>>* dest) = 0;
     //! Get result of the processing step
     virtual aku_Status extract_result(std::vector<std::unique_ptr<AggregateOperator>>* dest) = 0;
+    //! Get result of the processing step
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) = 0;
+    //! Get name of the processing step (used by `explain`)
+    virtual std::string get_name() const = 0;
 };
 
 /**
@@ -42,6 +53,9 @@ struct MaterializationStep {
      * to the `dest` array.
      */
     virtual aku_Status extract_result(std::unique_ptr<ColumnMaterializer>* dest) = 0;
+
+    //! Get name of the processing step (used by `explain`)
+    virtual std::string get_name() const = 0;
 };
 
 // -------------------------------- //
@@ -77,6 +91,14 @@ struct ScanProcessingStep : ProcessingPrelude {
     virtual aku_Status extract_result(std::vector<std::unique_ptr<AggregateOperator>>* dest) {
         return AKU_ENO_DATA;
     }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual std::string get_name() const {
+        return "ScanProcessingStep";
+    }
 };
 
 
@@ -119,6 +141,14 @@ struct FilterProcessingStep : ProcessingPrelude {
     virtual aku_Status extract_result(std::vector<std::unique_ptr<AggregateOperator>>* dest) {
         return AKU_ENO_DATA;
     }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual std::string get_name() const {
+        return "FilterProcessingStep";
+    }
 };
 
 struct AggregateProcessingStep : ProcessingPrelude {
@@ -150,6 +180,57 @@ struct AggregateProcessingStep : ProcessingPrelude {
         *dest = std::move(agglist_);
         return AKU_SUCCESS;
     }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual std::string get_name() const {
+        return "AggregateProcessingStep";
+    }
+};
+
+struct TopAggregateProcessingStep : ProcessingPrelude {
+    std::vector<std::unique_ptr<AggregateOperator>> agglist_;
+    aku_Timestamp begin_;
+    aku_Timestamp end_;
+    AggregationFunction func_;
+    u64 top_;
+    std::vector<aku_ParamId> ids_;
+
+    template<class T>
+    TopAggregateProcessingStep(aku_Timestamp begin, aku_Timestamp end, AggregationFunction func, u64 top, T&& t)
+        : begin_(begin)
+        , end_(end)
+        , func_(func)
+        , top_(top)
+        , ids_(std::forward<T>(t))
+    {
+    }
+
+    virtual aku_Status apply(const ColumnStore& cstore) {
+        return cstore.top_aggregate(ids_, begin_, end_, func_, top_, &agglist_);
+    }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<RealValuedOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<AggregateOperator>>* dest) {
+        if (agglist_.empty()) {
+            return AKU_ENO_DATA;
+        }
+        *dest = std::move(agglist_);
+        return AKU_SUCCESS;
+    }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual std::string get_name() const {
+        return "TopAggregateProcessingStep";
+    }
 };
 
 
@@ -184,6 +265,14 @@ struct GroupAggregateProcessingStep : ProcessingPrelude {
         *dest = std::move(agglist_);
         return AKU_SUCCESS;
     }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual std::string get_name() const {
+        return "GroupAggregateProcessingStep";
+    }
 };
 
 struct GroupAggregateFilterProcessingStep : ProcessingPrelude {
@@ -227,6 +316,55 @@ struct GroupAggregateFilterProcessingStep : ProcessingPrelude {
         *dest = std::move(agglist_);
         return AKU_SUCCESS;
     }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual std::string get_name() const {
+        return "GroupAggregateFilterProcessingStep";
+    }
+};
+
+struct GroupQuantileProcessingStep : ProcessingPrelude {
+    std::vector<std::unique_ptr<QuantileOperator>> qlist_;
+    aku_Timestamp begin_;
+    aku_Timestamp end_;
+    aku_Timestamp step_;
+    std::vector<aku_ParamId> ids_;
+
+    template<class T>
+    GroupQuantileProcessingStep(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step, T&& t)
+        : begin_(begin)
+        , end_(end)
+        , step_(step)
+        , ids_(std::forward<T>(t))
+    {
+    }
+
+    virtual aku_Status apply(const ColumnStore& cstore) {
+        return cstore.group_quantiles(ids_, begin_, end_, step_, &qlist_);
+    }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<RealValuedOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<AggregateOperator>>* dest) {
+        return AKU_ENO_DATA;
+    }
+
+    virtual aku_Status extract_result(std::vector<std::unique_ptr<QuantileOperator>>* dest) {
+        if (qlist_.empty()) {
+            return AKU_ENO_DATA;
+        }
+        *dest = std::move(qlist_);
+        return AKU_SUCCESS;
+    }
+
+    virtual std::string get_name() const {
+        return "GroupQuantileProcessingStep";
+    }
 };
 
 
@@ -270,6 +408,10 @@ struct MergeBy : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return order == OrderBy::SERIES ? "MergeBy<SERIES>" : "MergeBy<TIME>";
+    }
 };
 
 struct Chain : MaterializationStep {
@@ -299,6 +441,10 @@ struct Chain : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return "Chain";
+    }
 };
 
 /**
@@ -337,6 +483,10 @@ struct Aggregate : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return "Aggregate";
+    }
 };
 
 /**
@@ -390,6 +540,10 @@ struct AggregateCombiner : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return "AggregateCombiner";
+    }
 };
 
 /**
@@ -458,6 +612,10 @@ struct Join : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return "Join";
+    }
 };
 
 /**
@@ -492,6 +650,10 @@ struct SeriesOrderAggregate : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return "SeriesOrderAggregate";
+    }
 };
 
 struct TimeOrderAggregate : MaterializationStep {
@@ -523,25 +685,114 @@ struct TimeOrderAggregate : MaterializationStep {
         *dest = std::move(mat_);
         return AKU_SUCCESS;
     }
+
+    std::string get_name() const {
+        return "TimeOrderAggregate";
+    }
 };
 
+/**
+ * Materializes percentile group-aggregate operators
+ */
+template<OrderBy order>
+struct GroupQuantile : MaterializationStep {
+    std::vector<aku_ParamId> ids_;
+    std::vector<AggregationFunction> fn_;
+    std::unique_ptr<ColumnMaterializer> mat_;
+
+    template<class IdVec, class FnVec>
+    GroupQuantile(IdVec&& vec, FnVec&& fn)
+        : ids_(std::forward<IdVec>(vec))
+        , fn_(std::forward<FnVec>(fn))
+    {
+    }
+
+    aku_Status apply(ProcessingPrelude *prelude) {
+        std::vector<std::unique_ptr<QuantileOperator>> iters;
+        auto status = prelude->extract_result(&iters);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        if (order == OrderBy::SERIES) {
+            mat_.reset(new SeriesOrderQuantileMaterializer(std::move(ids_), std::move(iters), fn_));
+        } else {
+            mat_.reset(new TimeOrderQuantileMaterializer(ids_, iters, fn_));
+        }
+        return AKU_SUCCESS;
+    }
+
+    aku_Status extract_result(std::unique_ptr<ColumnMaterializer> *dest) {
+        if (!mat_) {
+            return AKU_ENO_DATA;
+        }
+        *dest = std::move(mat_);
+        return AKU_SUCCESS;
+    }
+
+    std::string get_name() const {
+        return order == OrderBy::SERIES ? "GroupQuantile<SERIES>" : "GroupQuantile<TIME>";
+    }
+};
+
+//! Return number of samples in the buffer (samples can be of variable size)
+static u64 count_samples(const u8* buf, size_t size) {
+    u64 result = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        aku_Sample const* sample = reinterpret_cast<aku_Sample const*>(buf + pos);
+        pos += sample->payload.size;
+        result++;
+    }
+    return result;
+}
+
+//! Add line with the step name and (if profiling is enabled) execution statistics
+static void explain_step(std::string const& indent,
+                         std::string const& name,
+                         QueryProfile const* stats,
+                         std::vector<std::string>* dest)
+{
+    std::string line = indent + name;
+    if (stats) {
+        line += " (" + stats->to_string() + ")";
+    }
+    dest->push_back(line);
+}
+
 struct TwoStepQueryPlan : IQueryPlan {
+    //! Should outlive the operators (they can hold memory reservations)
+    std::shared_ptr<QueryContext> context_;
     std::unique_ptr<ProcessingPrelude> prelude_;
     std::unique_ptr<MaterializationStep> mater_;
     std::unique_ptr<ColumnMaterializer> column_;
+    bool profile_;
+    QueryProfile prelude_stats_;
+    QueryProfile mater_stats_;
 
     template<class T1, class T2>
     TwoStepQueryPlan(T1&& t1, T2&& t2)
         : prelude_(std::forward<T1>(t1))
         , mater_(std::forward<T2>(t2))
+        , profile_(false)
+        , prelude_stats_()
+        , mater_stats_()
     {
     }
 
     aku_Status execute(const ColumnStore &cstore) {
-        auto status = prelude_->apply(cstore);
+        QueryContextScope ctxscope(context_.get());
+        aku_Status status = context_ ? context_->check() : AKU_SUCCESS;
         if (status != AKU_SUCCESS) {
             return status;
         }
+        {
+            ProfileScope scope(profile_ ? &prelude_stats_ : nullptr);
+            status = prelude_->apply(cstore);
+        }
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        ProfileScope scope(profile_ ? &mater_stats_ : nullptr);
         status = mater_->apply(prelude_.get());
         if (status != AKU_SUCCESS) {
             return status;
@@ -553,7 +804,356 @@ struct TwoStepQueryPlan : IQueryPlan {
         if (!column_) {
             AKU_PANIC("Successful execute step required");
         }
-        return column_->read(dest, size);
+        QueryContextScope ctxscope(context_.get());
+        if (context_) {
+            auto status = context_->check();
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+        }
+        if (!profile_) {
+            return column_->read(dest, size);
+        }
+        ProfileScope scope(&mater_stats_);
+        auto result = column_->read(dest, size);
+        mater_stats_.samples += count_samples(dest, std::get<1>(result));
+        return result;
+    }
+
+    std::tuple<aku_Status, size_t> read_batch(SampleBatch* dest) {
+        if (!column_) {
+            AKU_PANIC("Successful execute step required");
+        }
+        QueryContextScope ctxscope(context_.get());
+        if (context_) {
+            auto status = context_->check();
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+        }
+        if (!profile_) {
+            return column_->read_batch(dest);
+        }
+        ProfileScope scope(&mater_stats_);
+        auto result = column_->read_batch(dest);
+        mater_stats_.samples += std::get<1>(result);
+        return result;
+    }
+
+    void enable_profiling() {
+        profile_ = true;
+    }
+
+    void set_context(std::shared_ptr<QueryContext> context) {
+        context_ = context;
+    }
+
+    void explain(std::string const& indent, std::vector<std::string>* dest) const {
+        dest->push_back(indent + "TwoStepQueryPlan");
+        explain_step(indent + "  ", prelude_->get_name(), profile_ ? &prelude_stats_ : nullptr, dest);
+        explain_step(indent + "  ", mater_->get_name(), profile_ ? &mater_stats_ : nullptr, dest);
+    }
+};
+
+/**
+ * Materializer that reads output of the query plan that covers one partition
+ * of the series. Query plan is executed by the executor thread, results are passed
+ * to the reader through the bounded queue. If the task wasn't started by the
+ * executor (all threads are busy or the task wasn't submitted) the query plan
+ * is executed in the reader's thread. This way the reader never waits for the
+ * task that can't be started.
+ */
+struct PartitionReader : ColumnMaterializer {
+    enum {
+        CHUNK_SIZE = 0x4000,
+        QUEUE_MAX = 0x40,
+        START_TIMEOUT_MS = 5,
+    };
+
+    std::shared_ptr<IQueryPlan>  plan_;
+    const ColumnStore&           cstore_;
+    std::shared_ptr<QueryTask>   task_;
+    bool                         submitted_;
+    bool                         checked_;
+    bool                         inline_;
+    std::deque<std::vector<u8>>  queue_;
+    std::vector<u8>              chunk_;
+    size_t                       chunk_pos_;
+    bool                         started_;
+    bool                         done_;
+    bool                         stop_;
+    aku_Status                   status_;
+    std::mutex                   mutex_;
+    std::condition_variable      cond_;
+
+    PartitionReader(std::shared_ptr<IQueryPlan> plan, const ColumnStore& cstore)
+        : plan_(plan)
+        , cstore_(cstore)
+        , submitted_(false)
+        , checked_(false)
+        , inline_(false)
+        , chunk_pos_(0)
+        , started_(false)
+        , done_(false)
+        , stop_(false)
+        , status_(AKU_ENO_DATA)
+    {
+        task_ = std::make_shared<QueryTask>([this]() {
+            produce();
+        }, [this]() {
+            interrupt();
+        });
+    }
+
+    ~PartitionReader() {
+        interrupt();
+        if (!task_->cancel()) {
+            task_->wait();
+        }
+    }
+
+    //! Unblock the producer
+    void interrupt() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+    }
+
+    void submit(QueryExecutor& executor) {
+        submitted_ = executor.submit(task_) == AKU_SUCCESS;
+    }
+
+    //! Push chunk to the queue, return false if the reader is closed
+    bool push(std::vector<u8>&& chunk) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() {
+            return stop_ || queue_.size() < QUEUE_MAX;
+        });
+        if (stop_) {
+            return false;
+        }
+        queue_.push_back(std::move(chunk));
+        lock.unlock();
+        cond_.notify_all();
+        return true;
+    }
+
+    //! Executed by the executor thread
+    void produce() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            started_ = true;
+        }
+        cond_.notify_all();
+        aku_Status status = AKU_SUCCESS;
+        try {
+            status = plan_->execute(cstore_);
+            while (status == AKU_SUCCESS) {
+                std::vector<u8> chunk(CHUNK_SIZE);
+                size_t size;
+                std::tie(status, size) = plan_->read(chunk.data(), chunk.size());
+                if (status != AKU_SUCCESS && status != AKU_ENO_DATA && status != AKU_EUNAVAILABLE) {
+                    break;
+                }
+                if (size != 0) {
+                    chunk.resize(size);
+                    if (!push(std::move(chunk))) {
+                        // Reader is closed or the executor is stopped
+                        status = AKU_ECANCELLED;
+                        break;
+                    }
+                }
+            }
+        } catch (...) {
+            Logger::msg(AKU_LOG_ERROR, "Partition query error: " + boost::current_exception_diagnostic_information());
+            status = AKU_EGENERAL;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+            status_ = (status == AKU_SUCCESS || status == AKU_EUNAVAILABLE) ? AKU_ENO_DATA : status;
+        }
+        cond_.notify_all();
+    }
+
+    //! Check whether the task is started and switch to inline mode if it's not
+    aku_Status check_started() {
+        if (submitted_) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (cond_.wait_for(lock, std::chrono::milliseconds(START_TIMEOUT_MS), [this]() { return started_; })) {
+                return AKU_SUCCESS;
+            }
+        }
+        if (task_->cancel()) {
+            inline_ = true;
+            return plan_->execute(cstore_);
+        }
+        if (task_->is_cancelled()) {
+            // Executor is stopped
+            return AKU_ECANCELLED;
+        }
+        // Task was started after timeout
+        return AKU_SUCCESS;
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(u8* dest, size_t size) override {
+        if (chunk_pos_ == chunk_.size()) {
+            if (!checked_) {
+                checked_ = true;
+                auto status = check_started();
+                if (status != AKU_SUCCESS) {
+                    return std::make_tuple(status, 0);
+                }
+            }
+            if (inline_) {
+                return plan_->read(dest, size);
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() {
+                return done_ || !queue_.empty();
+            });
+            if (queue_.empty()) {
+                return std::make_tuple(status_, 0);
+            }
+            chunk_ = std::move(queue_.front());
+            queue_.pop_front();
+            chunk_pos_ = 0;
+            lock.unlock();
+            cond_.notify_all();
+        }
+        // Copy samples (samples can be of variable size)
+        size_t outpos = 0;
+        while (chunk_pos_ < chunk_.size()) {
+            aku_Sample const* sample = reinterpret_cast<aku_Sample const*>(chunk_.data() + chunk_pos_);
+            size_t ssize = sample->payload.size;
+            if (size - outpos < ssize) {
+                break;
+            }
+            memcpy(dest + outpos, sample, ssize);
+            outpos += ssize;
+            chunk_pos_ += ssize;
+        }
+        return std::make_tuple(AKU_SUCCESS, outpos);
+    }
+};
+
+/**
+ * Query plan that processes partitions of the series in parallel.
+ * Each partition is processed by its own serial query plan. Results
+ * are merged by timestamp (order by time) or concatenated (order by series).
+ * Ids are required to be unique, in this case output is the same as the
+ * output of the serial query plan.
+ */
+struct ParallelQueryPlan : IQueryPlan {
+    //! Should outlive the operators (they can hold memory reservations)
+    std::shared_ptr<QueryContext> context_;
+    //! Partitions (shared with partition readers to be able to explain the plan after execution)
+    std::vector<std::shared_ptr<IQueryPlan>> partitions_;
+    QueryExecutor& executor_;
+    OrderBy order_;
+    bool forward_;
+    std::unique_ptr<ColumnMaterializer> column_;
+    bool profile_;
+    QueryProfile stats_;
+
+    ParallelQueryPlan(std::vector<std::unique_ptr<IQueryPlan>>&& partitions,
+                      QueryExecutor& executor,
+                      OrderBy order,
+                      bool forward)
+        : partitions_(std::make_move_iterator(partitions.begin()), std::make_move_iterator(partitions.end()))
+        , executor_(executor)
+        , order_(order)
+        , forward_(forward)
+        , profile_(false)
+        , stats_()
+    {
+    }
+
+    aku_Status execute(const ColumnStore &cstore) {
+        QueryContextScope ctxscope(context_.get());
+        ProfileScope scope(profile_ ? &stats_ : nullptr);
+        std::vector<std::unique_ptr<ColumnMaterializer>> iters;
+        for (size_t i = 0; i < partitions_.size(); i++) {
+            std::unique_ptr<PartitionReader> reader(new PartitionReader(partitions_.at(i), cstore));
+            if (i != 0) {
+                // First partition is processed by the current thread
+                reader->submit(executor_);
+            }
+            iters.push_back(std::move(reader));
+        }
+        if (order_ == OrderBy::SERIES) {
+            column_.reset(new JoinConcatMaterializer(std::move(iters)));
+        } else {
+            typedef MergeJoinMaterializer<MergeJoinUtil::OrderByTimestamp> Materializer;
+            column_.reset(new Materializer(std::move(iters), forward_));
+        }
+        return AKU_SUCCESS;
+    }
+
+    std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) {
+        if (!column_) {
+            AKU_PANIC("Successful execute step required");
+        }
+        QueryContextScope ctxscope(context_.get());
+        if (context_) {
+            auto status = context_->check();
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+        }
+        if (!profile_) {
+            return column_->read(dest, size);
+        }
+        ProfileScope scope(&stats_);
+        auto result = column_->read(dest, size);
+        stats_.samples += count_samples(dest, std::get<1>(result));
+        return result;
+    }
+
+    std::tuple<aku_Status, size_t> read_batch(SampleBatch* dest) {
+        if (!column_) {
+            AKU_PANIC("Successful execute step required");
+        }
+        QueryContextScope ctxscope(context_.get());
+        if (context_) {
+            auto status = context_->check();
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+        }
+        if (!profile_) {
+            return column_->read_batch(dest);
+        }
+        ProfileScope scope(&stats_);
+        auto result = column_->read_batch(dest);
+        stats_.samples += std::get<1>(result);
+        return result;
+    }
+
+    void enable_profiling() {
+        profile_ = true;
+        for (auto const& plan: partitions_) {
+            plan->enable_profiling();
+        }
+    }
+
+    void set_context(std::shared_ptr<QueryContext> context) {
+        context_ = context;
+        for (auto const& plan: partitions_) {
+            plan->set_context(context);
+        }
+    }
+
+    void explain(std::string const& indent, std::vector<std::string>* dest) const {
+        std::string name = "ParallelQueryPlan<" + std::string(order_ == OrderBy::SERIES ? "SERIES" : "TIME")
+                         + ">, " + std::to_string(partitions_.size()) + " partitions";
+        // Time of the partitions that run in parallel is included into the merge time
+        explain_step(indent, name, profile_ ? &stats_ : nullptr, dest);
+        for (auto const& plan: partitions_) {
+            plan->explain(indent + "  ", dest);
+        }
     }
 };
 
@@ -640,6 +1240,14 @@ static std::tuple<aku_Status, std::vector<AggregateFilter>> convert_aggregate_fi
         case AggregationFunction::MAX_TIMESTAMP:
             Logger::msg(AKU_LOG_ERROR, "Aggregation function 'MIN(MAX)_TIMESTAMP' can't be used with the filter");
             break;
+        case AggregationFunction::P50:
+        case AggregationFunction::P75:
+        case AggregationFunction::P90:
+        case AggregationFunction::P95:
+        case AggregationFunction::P99:
+        case AggregationFunction::P999:
+            Logger::msg(AKU_LOG_ERROR, "Percentiles can't be used with the filter");
+            break;
         };
         return std::make_tuple(AKU_EBAD_ARG, std::move(result));
     }
@@ -794,9 +1402,26 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> aggregate_query_plan(
     {
         return std::make_tuple(AKU_EBAD_ARG, std::move(result));
     }
+    if (is_quantile(req.agg.func.front())) {
+        Logger::msg(AKU_LOG_ERROR, "Percentiles can be computed only by `group-aggregate` query");
+        return std::make_tuple(AKU_EBAD_ARG, std::move(result));
+    }
 
     std::unique_ptr<ProcessingPrelude> t1stage;
-    t1stage.reset(new AggregateProcessingStep(req.select.begin, req.select.end, req.select.columns.at(0).ids));
+    if (req.agg.top != 0) {
+        // Series that can't get into the top are not read
+        if (req.group_by.enabled) {
+            Logger::msg(AKU_LOG_ERROR, "`top` can't be used with `group-by`");
+            return std::make_tuple(AKU_EBAD_ARG, std::move(result));
+        }
+        t1stage.reset(new TopAggregateProcessingStep(req.select.begin,
+                                                     req.select.end,
+                                                     req.agg.func.front(),
+                                                     req.agg.top,
+                                                     req.select.columns.at(0).ids));
+    } else {
+        t1stage.reset(new AggregateProcessingStep(req.select.begin, req.select.end, req.select.columns.at(0).ids));
+    }
 
     std::unique_ptr<MaterializationStep> t2stage;
     if (req.group_by.enabled) {
@@ -861,6 +1486,40 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> join_query_plan(Resha
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
 
+static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_quantile_query_plan(ReshapeRequest const& req) {
+    // Hardwired query plan for group aggregate query with percentiles
+    // Tier1
+    // - List of percentile operators (forward direction only, filters are not supported)
+    // Tier2
+    // - Series or time order materializer
+    std::unique_ptr<IQueryPlan> result;
+
+    if (filtering_enabled(req.select.filters)) {
+        Logger::msg(AKU_LOG_ERROR, "Percentiles can't be used with the filter");
+        return std::make_tuple(AKU_EBAD_ARG, std::move(result));
+    }
+    if (req.select.begin >= req.select.end) {
+        Logger::msg(AKU_LOG_ERROR, "Percentiles can be computed only in forward direction");
+        return std::make_tuple(AKU_EBAD_ARG, std::move(result));
+    }
+
+    std::unique_ptr<ProcessingPrelude> t1stage;
+    t1stage.reset(new GroupQuantileProcessingStep(req.select.begin,
+                                                  req.select.end,
+                                                  req.agg.step,
+                                                  req.select.columns.at(0).ids));
+
+    std::unique_ptr<MaterializationStep> t2stage;
+    if (req.order_by == OrderBy::SERIES) {
+        t2stage.reset(new GroupQuantile<OrderBy::SERIES>(req.select.columns.at(0).ids, req.agg.func));
+    } else {
+        t2stage.reset(new GroupQuantile<OrderBy::TIME>(req.select.columns.at(0).ids, req.agg.func));
+    }
+
+    result.reset(new TwoStepQueryPlan(std::move(t1stage), std::move(t2stage)));
+    return std::make_tuple(AKU_SUCCESS, std::move(result));
+}
+
 static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_aggregate_query_plan(ReshapeRequest const& req) {
     // Hardwired query plan for group aggregate query
     // Tier1
@@ -879,6 +1538,10 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_aggregate_query
         return std::make_tuple(AKU_EBAD_ARG, std::move(result));
     }
 
+    if (std::any_of(req.agg.func.begin(), req.agg.func.end(), is_quantile)) {
+        return group_quantile_query_plan(req);
+    }
+
     std::unique_ptr<ProcessingPrelude> t1stage;
     if (filtering_enabled(req.select.filters)) {
         // Scan query can only have one filter
@@ -926,6 +1589,60 @@ std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> QueryPlanBuilder::create(con
     return scan_query_plan(req);
 }
 
+//! Check whether the query can be split into independent partitions
+static bool can_partition(ReshapeRequest const& req) {
+    // Join and group-by queries combine several series into one
+    if (req.select.columns.size() != 1 || req.group_by.enabled) {
+        return false;
+    }
+    // Top-N is computed across all series
+    if (req.agg.top != 0) {
+        return false;
+    }
+    // Duplicate ids doesn't have well defined order
+    std::vector<aku_ParamId> ids = req.select.columns.at(0).ids;
+    std::sort(ids.begin(), ids.end());
+    return std::adjacent_find(ids.begin(), ids.end()) == ids.end();
+}
+
+std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> QueryPlanBuilder::create(const ReshapeRequest& req,
+                                                                             QueryExecutor& executor)
+{
+    size_t nseries = req.select.columns.empty() ? 0 : req.select.columns.at(0).ids.size();
+    size_t npartitions = std::min(executor.get_nthreads(), nseries / MIN_PARTITION_SIZE);
+    return create(req, executor, npartitions);
+}
+
+std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> QueryPlanBuilder::create(const ReshapeRequest& req,
+                                                                             QueryExecutor& executor,
+                                                                             size_t npartitions)
+{
+    if (npartitions < 2 || !can_partition(req)) {
+        return create(req);
+    }
+    std::unique_ptr<IQueryPlan> result;
+    auto const& ids = req.select.columns.at(0).ids;
+    npartitions = std::min(npartitions, ids.size());
+    std::vector<std::unique_ptr<IQueryPlan>> partitions;
+    for (size_t i = 0; i < npartitions; i++) {
+        // Partitions are contiguous, concatenation preserves the order of series
+        auto begin = ids.begin() + static_cast<std::ptrdiff_t>(ids.size()*i/npartitions);
+        auto end   = ids.begin() + static_cast<std::ptrdiff_t>(ids.size()*(i + 1)/npartitions);
+        ReshapeRequest preq = req;
+        preq.select.columns.at(0).ids.assign(begin, end);
+        aku_Status status;
+        std::unique_ptr<IQueryPlan> plan;
+        std::tie(status, plan) = create(preq);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, std::move(result));
+        }
+        partitions.push_back(std::move(plan));
+    }
+    bool forward = req.select.begin < req.select.end;
+    result.reset(new ParallelQueryPlan(std::move(partitions), executor, req.order_by, forward));
+    return std::make_tuple(AKU_SUCCESS, std::move(result));
+}
+
 void QueryPlanExecutor::execute(const StorageEngine::ColumnStore& cstore, std::unique_ptr<QP::IQueryPlan>&& iter, QP::IStreamProcessor& qproc) {
     aku_Status status = iter->execute(cstore);
     if (status != AKU_SUCCESS) {
@@ -933,30 +1650,34 @@ void QueryPlanExecutor::execute(const StorageEngine::ColumnStore& cstore, std::u
         qproc.set_error(status);
         return;
     }
-    const size_t dest_size = 0x1000;
-    std::vector<u8> dest;
-    dest.resize(dest_size);
+    SampleBatch batch;
     while(status == AKU_SUCCESS) {
         size_t size;
-        // This is OK because normal query (aggregate or select) will write fixed size samples with size = sizeof(aku_Sample).
-        //
-        std::tie(status, size) = iter->read(reinterpret_cast<u8*>(dest.data()), dest_size);
+        std::tie(status, size) = iter->read_batch(&batch);
         if (status != AKU_SUCCESS && (status != AKU_ENO_DATA && status != AKU_EUNAVAILABLE)) {
             Logger::msg(AKU_LOG_ERROR, "Iteration error " + StatusUtil::str(status));
             qproc.set_error(status);
             return;
         }
-
-        size_t pos = 0;
-        while(pos < size) {
-            aku_Sample const* sample = reinterpret_cast<aku_Sample const*>(dest.data() + pos);
-            if (!qproc.put(*sample)) {
-                Logger::msg(AKU_LOG_TRACE, "Iteration stopped by client");
-                return;
-            }
-            pos += sample->payload.size;
+        if (size != 0 && !qproc.put_batch(batch)) {
+            Logger::msg(AKU_LOG_TRACE, "Iteration stopped by client");
+            return;
         }
     }
 }
 
+aku_Status QueryPlanExecutor::profile(const StorageEngine::ColumnStore& cstore, QP::IQueryPlan& plan) {
+    aku_Status status = plan.execute(cstore);
+    SampleBatch batch;
+    while (status == AKU_SUCCESS) {
+        size_t size;
+        std::tie(status, size) = plan.read_batch(&batch);
+    }
+    if (status != AKU_ENO_DATA && status != AKU_EUNAVAILABLE) {
+        Logger::msg(AKU_LOG_ERROR, "Query plan error" + StatusUtil::str(status));
+        return status;
+    }
+    return AKU_SUCCESS;
+}
+
 }} // namespaces
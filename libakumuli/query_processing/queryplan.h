@@ -1,13 +1,18 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "index/seriesparser.h"
 #include "queryprocessor_framework.h"
 #include "storage_engine/column_store.h"
+#include "storage_engine/query_context.h"
 
 namespace Akumuli {
+
+class QueryExecutor;
+
 namespace QP {
 
 /**
@@ -29,15 +34,64 @@ struct IQueryPlan {
       * @return status of the operation (success or error code) and number of written bytes
       */
     virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) = 0;
+
+    /** Read samples in columnar format.
+      * @param dest is a batch that will receive the samples
+      * @return status of the operation and number of rows in the batch
+      */
+    virtual std::tuple<aku_Status, size_t> read_batch(SampleBatch* dest) = 0;
+
+    /** Enable collection of the execution statistics.
+      * Should be called before `execute`.
+      */
+    virtual void enable_profiling() = 0;
+
+    /** Set execution limits of the query (cancellation, deadline, memory budget).
+      * Should be called before `execute`. Steps of the plan return the status of
+      * the context (e.g. AKU_ECANCELLED) when the limit is reached.
+      */
+    virtual void set_context(std::shared_ptr<StorageEngine::QueryContext> context) = 0;
+
+    /** Describe the query plan (one line per step). Execution statistics
+      * of every step are added if profiling is enabled.
+      * @param indent is a prefix of every line
+      * @param dest receives the description
+      */
+    virtual void explain(std::string const& indent, std::vector<std::string>* dest) const = 0;
 };
 
 struct QueryPlanBuilder {
+    enum {
+        //! Min number of series per partition of the parallel query plan
+        MIN_PARTITION_SIZE = 64,
+    };
+
     static std::tuple<aku_Status, std::unique_ptr<IQueryPlan> > create(const ReshapeRequest& req);
+
+    /** Create query plan that can be executed in parallel. Series are split into
+      * partitions (no more than one partition per executor thread, no less than
+      * MIN_PARTITION_SIZE series per partition). Serial query plan is returned
+      * if the query can't be partitioned.
+      */
+    static std::tuple<aku_Status, std::unique_ptr<IQueryPlan> > create(const ReshapeRequest& req,
+                                                                       QueryExecutor& executor);
+
+    /** Create query plan that splits series into `npartitions` partitions. Partitions are
+      * processed by the executor and combined using merge (order by time) or
+      * concatenation (order by series). Serial query plan is returned if the query
+      * can't be partitioned or `npartitions` is less than two.
+      */
+    static std::tuple<aku_Status, std::unique_ptr<IQueryPlan> > create(const ReshapeRequest& req,
+                                                                       QueryExecutor& executor,
+                                                                       size_t npartitions);
 };
 
 struct QueryPlanExecutor {
 
     void execute(const StorageEngine::ColumnStore& cstore, std::unique_ptr<QP::IQueryPlan>&& iter, QP::IStreamProcessor& qproc);
+
+    //! Execute query plan and discard the output (used to collect execution statistics)
+    aku_Status profile(const StorageEngine::ColumnStore& cstore, QP::IQueryPlan& plan);
 };
 
 }}  // namespaces
@@ -48,6 +48,36 @@ bool SimpleRate::put(MutableSample &mut) {
     return next_->put(mut);
 }
 
+bool SimpleRate::put_batch(SampleBatch& batch) {
+    const double nsec = 1000000000;
+    const aku_Timestamp* ts = batch.timestamps.data();
+    const aku_ParamId* ids = batch.paramids.data();
+    for (u32 col = 0; col < batch.ncolumns; col++) {
+        double* xs = batch.column(col);
+        // Consecutive rows usually belong to the same series, previous
+        // state is kept in local variables to avoid hash table lookups.
+        aku_ParamId curr = 0;
+        std::tuple<aku_Timestamp, double>* state = nullptr;
+        for (size_t ix = 0; ix < batch.size; ix++) {
+            if (!batch.is_present(ix, col)) {
+                continue;
+            }
+            if (state == nullptr || ids[ix] != curr) {
+                curr = ids[ix];
+                auto key = std::make_tuple(curr, col);
+                state = &table_[key];  // zero initialized if not present
+            }
+            aku_Timestamp oldT = std::get<0>(*state);
+            double oldX = std::get<1>(*state);
+            double newX = xs[ix];
+            // Formula: rate = Δx/Δt
+            xs[ix] = (newX - oldX) / (ts[ix] - oldT) * nsec;
+            *state = std::make_tuple(ts[ix], newX);
+        }
+    }
+    return next_->put_batch(batch);
+}
+
 void SimpleRate::set_error(aku_Status status) {
     next_->set_error(status);
 }
@@ -42,6 +42,19 @@ bool Scale::put(MutableSample &mut) {
     return next_->put(mut);
 }
 
+bool Scale::put_batch(SampleBatch& batch) {
+    auto ncolumns = std::min(batch.ncolumns, static_cast<u32>(weights_.size()));
+    for (u32 col = 0; col < ncolumns; col++) {
+        // Missing values are scaled too, they're ignored anyway
+        double* xs = batch.column(col);
+        const double weight = weights_[col];
+        for (size_t ix = 0; ix < batch.size; ix++) {
+            xs[ix] *= weight;
+        }
+    }
+    return next_->put_batch(batch);
+}
+
 void Scale::set_error(aku_Status status) {
     next_->set_error(status);
 }
@@ -42,6 +42,8 @@ struct ScanQueryProcessor : IStreamProcessor {
     bool start();
     //! Process value
     bool put(const aku_Sample& sample);
+    //! Process batch of values
+    bool put_batch(SampleBatch& batch);
     //! Should be called when processing completed
     void stop();
     //! Set execution error
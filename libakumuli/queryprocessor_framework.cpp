@@ -146,4 +146,31 @@ char* MutableSample::get_payload() {
     return payload_.sample.payload.data;
 }
 
+// ----------------
+// Batch processing
+// ----------------
+
+bool Node::put_batch(SampleBatch& batch) {
+    MutableSample::Payload row;
+    for (size_t ix = 0; ix < batch.size; ix++) {
+        batch.get_sample(ix, reinterpret_cast<u8*>(&row));
+        MutableSample mut(&row.sample);
+        if (!put(mut)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IStreamProcessor::put_batch(SampleBatch& batch) {
+    MutableSample::Payload row;
+    for (size_t ix = 0; ix < batch.size; ix++) {
+        batch.get_sample(ix, reinterpret_cast<u8*>(&row));
+        if (!put(row.sample)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 }}  // namespace
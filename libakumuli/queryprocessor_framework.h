@@ -39,11 +39,13 @@ namespace QP {
  */
 
 using AggregationFunction = StorageEngine::AggregationFunction;
+using SampleBatch = StorageEngine::SampleBatch;
 
 struct Aggregation {
     bool enabled;
     std::vector<AggregationFunction> func;
     u64 step;  // 0 if group by time disabled
+    u64 top;   // only `top` series with the largest aggregate are returned (0 if disabled)
 
     static std::string to_string(AggregationFunction f) {
         switch(f) {
@@ -61,6 +63,18 @@ struct Aggregation {
             return "min";
         case AggregationFunction::MIN_TIMESTAMP:
             return "min_timestamp";
+        case AggregationFunction::P50:
+            return "p50";
+        case AggregationFunction::P75:
+            return "p75";
+        case AggregationFunction::P90:
+            return "p90";
+        case AggregationFunction::P95:
+            return "p95";
+        case AggregationFunction::P99:
+            return "p99";
+        case AggregationFunction::P999:
+            return "p999";
         };
         AKU_PANIC("Invalid aggregation function");
     }
@@ -80,6 +94,18 @@ struct Aggregation {
             return std::make_tuple(AKU_SUCCESS, AggregationFunction::MAX_TIMESTAMP);
         } else if (str == "mean") {
             return std::make_tuple(AKU_SUCCESS, AggregationFunction::MEAN);
+        } else if (str == "p50" || str == "median") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::P50);
+        } else if (str == "p75") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::P75);
+        } else if (str == "p90") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::P90);
+        } else if (str == "p95") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::P95);
+        } else if (str == "p99") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::P99);
+        } else if (str == "p999") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::P999);
         }
         return std::make_tuple(AKU_EBAD_ARG, AggregationFunction::CNT);
     }
@@ -203,6 +229,12 @@ struct Node {
       */
     virtual bool put(MutableSample& sample) = 0;
 
+    /** Process batch of values, return false to interrupt process.
+      * Node can modify the batch in place and pass it to the next node.
+      * Default implementation converts rows to samples and calls `put`.
+      */
+    virtual bool put_batch(SampleBatch& batch);
+
     virtual void set_error(aku_Status status) = 0;
 
     // Query validation
@@ -273,6 +305,11 @@ struct IStreamProcessor {
     //! Get new value
     virtual bool put(const aku_Sample& sample) = 0;
 
+    /** Get batch of values.
+      * Default implementation converts rows to samples and calls `put`.
+      */
+    virtual bool put_batch(SampleBatch& batch);
+
     //! Will be called when processing completed without errors
     virtual void stop() = 0;
 
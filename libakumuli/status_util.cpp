@@ -28,6 +28,9 @@ static const char* g_error_messages[] = {
     "high cardinality, lower cardinality required",
     "regullar series expected",
     "missing data not supported",
+    "query cancelled",
+    "query deadline exceeded",
+    "query memory limit exceeded",
     "unknown error code"
 };
 
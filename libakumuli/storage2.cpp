@@ -17,6 +17,7 @@
 
 
 #include "storage2.h"
+#include "cursor.h"
 #include "util.h"
 #include "queryprocessor.h"
 #include "query_processing/queryparser.h"
@@ -108,9 +109,15 @@ aku_Status StorageSession::write(aku_Sample const& sample) {
     switch (status) {
     case NBTreeAppendResult::OK:
         return AKU_SUCCESS;
-    case NBTreeAppendResult::OK_FLUSH_NEEDED:
+    case NBTreeAppendResult::OK_FLUSH_NEEDED: {
         storage_-> _update_rescue_points(sample.paramid, std::move(rpoints));
+        std::unordered_map<aku_ParamId, std::vector<LogicAddr>> rollups;
+        session_->get_rollup_roots(sample.paramid, &rollups);
+        if (!rollups.empty()) {
+            storage_->_update_rescue_points(std::move(rollups));
+        }
         return AKU_SUCCESS;
+    }
     case NBTreeAppendResult::FAIL_BAD_ID:
         AKU_PANIC("Invalid session cache, id = " + std::to_string(sample.paramid));
     case NBTreeAppendResult::FAIL_LATE_WRITE:
@@ -121,6 +128,31 @@ aku_Status StorageSession::write(aku_Sample const& sample) {
     return AKU_SUCCESS;
 }
 
+QueryExecutor& StorageSession::get_query_executor() const {
+    return storage_->get_query_executor();
+}
+
+aku_Status StorageSession::write_batch(aku_Sample const* samples, size_t size) {
+    using namespace StorageEngine;
+    std::unordered_map<aku_ParamId, std::vector<LogicAddr>> rpoints;
+    auto status = session_->write_batch(samples, size, &rpoints);
+    if (!rpoints.empty()) {
+        storage_->_update_rescue_points(std::move(rpoints));
+    }
+    switch (status) {
+    case NBTreeAppendResult::OK:
+    case NBTreeAppendResult::OK_FLUSH_NEEDED:
+        return AKU_SUCCESS;
+    case NBTreeAppendResult::FAIL_BAD_ID:
+        AKU_PANIC("Invalid session cache");
+    case NBTreeAppendResult::FAIL_LATE_WRITE:
+        return AKU_ELATE_WRITE;
+    case NBTreeAppendResult::FAIL_BAD_VALUE:
+        return AKU_EBAD_ARG;
+    };
+    return AKU_SUCCESS;
+}
+
 aku_Status StorageSession::init_series_id(const char* begin, const char* end, aku_Sample *sample) {
     // Series name normalization procedure. Most likeley a bottleneck but
     // can be easily parallelized.
@@ -281,11 +313,12 @@ Storage::Storage()
 
     bstore_ = StorageEngine::BlockStoreBuilder::create_memstore();
     cstore_ = std::make_shared<StorageEngine::ColumnStore>(bstore_);
+    executor_ = std::make_shared<QueryExecutor>();
 
     start_sync_worker();
 }
 
-Storage::Storage(const char* path)
+Storage::Storage(const char* path, aku_FineTuneParams const& params)
     : done_{0}
     , close_barrier_(2)
 {
@@ -303,17 +336,69 @@ Storage::Storage(const char* path)
     std::string db_name = "db";
     metadata_->get_config_param("blockstore_type", &bstore_type);
     metadata_->get_config_param("db_name", &db_name);
+    size_t cache_size = params.max_cache_size ? params.max_cache_size
+                                              : StorageEngine::FileStorage::DEFAULT_CACHE_SIZE;
+    Logger::msg(AKU_LOG_INFO, "Block cache size: " + std::to_string(cache_size));
+    StorageEngine::VolumeIO io = StorageEngine::VolumeIO::APR;
+    switch (params.io_backend) {
+    case AKU_IO_BACKEND_IO_URING:
+        io = StorageEngine::VolumeIO::IO_URING;
+        Logger::msg(AKU_LOG_INFO, "Volume I/O backend: io_uring");
+        break;
+    case AKU_IO_BACKEND_IO_URING_DIRECT:
+        io = StorageEngine::VolumeIO::IO_URING_DIRECT;
+        Logger::msg(AKU_LOG_INFO, "Volume I/O backend: io_uring + O_DIRECT");
+        break;
+    default:
+        Logger::msg(AKU_LOG_INFO, "Volume I/O backend: apr");
+        break;
+    };
     if (bstore_type == "FixedSizeFileStorage") {
         Logger::msg(AKU_LOG_INFO, "Open as fxied size storage");
-        bstore_ = StorageEngine::FixedSizeFileStorage::open(metadata_);
+        bstore_ = StorageEngine::FixedSizeFileStorage::open(metadata_, cache_size, io);
     } else if (bstore_type == "ExpandableFileStorage") {
         Logger::msg(AKU_LOG_INFO, "Open as expandable storage");
-        bstore_ = StorageEngine::ExpandableFileStorage::open(metadata_);
+        bstore_ = StorageEngine::ExpandableFileStorage::open(metadata_, cache_size, io);
     } else {
         Logger::msg(AKU_LOG_ERROR, "Unknown blockstore type (" + bstore_type + ")");
         AKU_PANIC("Unknown blockstore type (" + bstore_type + ")");
     }
     cstore_ = std::make_shared<StorageEngine::ColumnStore>(bstore_);
+    switch (params.value_codec) {
+    case AKU_VALUE_CODEC_GORILLA:
+        cstore_->set_value_codec(StorageEngine::ValueCodec::GORILLA);
+        Logger::msg(AKU_LOG_INFO, "Value codec: gorilla");
+        break;
+    case AKU_VALUE_CODEC_CHIMP:
+        cstore_->set_value_codec(StorageEngine::ValueCodec::CHIMP);
+        Logger::msg(AKU_LOG_INFO, "Value codec: chimp");
+        break;
+    case AKU_VALUE_CODEC_ADAPTIVE:
+        cstore_->set_value_codec(StorageEngine::ValueCodec::ADAPTIVE);
+        Logger::msg(AKU_LOG_INFO, "Value codec: adaptive");
+        break;
+    default:
+        Logger::msg(AKU_LOG_INFO, "Value codec: fcm");
+        break;
+    };
+    if (params.reorder_window) {
+        cstore_->set_reorder_window(params.reorder_window);
+        Logger::msg(AKU_LOG_INFO, "Reorder window: " + std::to_string(params.reorder_window) + "ns");
+    }
+    if (params.query_cache_size) {
+        cstore_->set_query_cache_size(params.query_cache_size);
+        Logger::msg(AKU_LOG_INFO, "Query cache size: " + std::to_string(params.query_cache_size));
+    }
+    std::vector<aku_Timestamp> rollup_steps;
+    for (int i = 0; i < AKU_MAX_ROLLUPS; i++) {
+        if (params.rollup_steps[i]) {
+            rollup_steps.push_back(params.rollup_steps[i]);
+            Logger::msg(AKU_LOG_INFO, "Rollup step: " + std::to_string(params.rollup_steps[i]) + "ns");
+        }
+    }
+    cstore_->set_rollup_steps(rollup_steps);
+    executor_ = std::make_shared<QueryExecutor>(params.max_concurrent_queries, params.max_queued_queries);
+    Logger::msg(AKU_LOG_INFO, "Max concurrent queries: " + std::to_string(executor_->get_nthreads()));
     // Update series matcher
     boost::optional<u64> baseline = metadata_->get_prev_largest_id();
     if (baseline) {
@@ -705,6 +790,7 @@ Storage::Storage(std::shared_ptr<MetadataStorage>                  meta,
     , done_{0}
     , close_barrier_(2)
     , metadata_(meta)
+    , executor_(std::make_shared<QueryExecutor>())
 {
     if (start_worker) {
         start_sync_worker();
@@ -743,6 +829,8 @@ void Storage::start_sync_worker() {
 void Storage::close() {
     // Wait for all ingestion sessions to stop
     done_.store(1);
+    // Wait for running queries, queued queries are cancelled
+    executor_->stop();
     metadata_->force_sync();
     close_barrier_.wait();
     // Close column store
@@ -765,6 +853,14 @@ void Storage::_update_rescue_points(aku_ParamId id, std::vector<StorageEngine::L
     metadata_->add_rescue_point(id, std::move(rpoints));
 }
 
+void Storage::_update_rescue_points(std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>>&& rpoints) {
+    metadata_->add_rescue_points(std::move(rpoints));
+}
+
+QueryExecutor& Storage::get_query_executor() const {
+    return *executor_;
+}
+
 std::shared_ptr<StorageSession> Storage::create_write_session() {
     std::shared_ptr<StorageEngine::CStoreSession> session = std::make_shared<StorageEngine::CStoreSession>(cstore_);
     return std::make_shared<StorageSession>(shared_from_this(), session);
@@ -864,6 +960,18 @@ void Storage::query(StorageSession const* session, InternalCursor* cur, const ch
         cur->set_error(status);
         return;
     }
+    ExplainMode mode;
+    std::tie(status, mode) = QueryParser::get_explain_mode(ptree);
+    if (status != AKU_SUCCESS) {
+        cur->set_error(status);
+        return;
+    }
+    u64 timeout, memory_limit;
+    std::tie(status, timeout, memory_limit) = QueryParser::get_query_limits(ptree);
+    if (status != AKU_SUCCESS) {
+        cur->set_error(status);
+        return;
+    }
     std::shared_ptr<IStreamProcessor> proc;
     ReshapeRequest req;
 
@@ -914,12 +1022,27 @@ void Storage::query(StorageSession const* session, InternalCursor* cur, const ch
             return;
         }
         std::unique_ptr<QP::IQueryPlan> query_plan;
-        std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req);
+        std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req, *executor_);
         if (status != AKU_SUCCESS) {
             cur->set_error(status);
             return;
         }
-        // TODO: log query plan if required
+        // Cursor provides the context if the query can be cancelled by the client
+        auto context = cur->get_query_context();
+        if (!context && (timeout != 0 || memory_limit != 0)) {
+            context = std::make_shared<StorageEngine::QueryContext>();
+        }
+        if (context) {
+            if (timeout != 0) {
+                context->set_timeout(std::chrono::milliseconds(timeout));
+            }
+            context->set_memory_limit(memory_limit);
+            query_plan->set_context(context);
+        }
+        if (mode != ExplainMode::NONE) {
+            explain(session, cur, nodes.front(), mode, *query_plan);
+            return;
+        }
         if (proc->start()) {
             QueryPlanExecutor executor;
             executor.execute(*cstore_, std::move(query_plan), *proc);
@@ -928,6 +1051,38 @@ void Storage::query(StorageSession const* session, InternalCursor* cur, const ch
     }
 }
 
+void Storage::explain(StorageSession const* session,
+                      InternalCursor* cur,
+                      std::shared_ptr<QP::Node> output,
+                      QP::ExplainMode mode,
+                      QP::IQueryPlan& plan) const
+{
+    using namespace QP;
+    if (mode == ExplainMode::PROFILE) {
+        plan.enable_profiling();
+        QueryPlanExecutor executor;
+        auto status = executor.profile(*cstore_, plan);
+        if (status != AKU_SUCCESS) {
+            cur->set_error(status);
+            return;
+        }
+    }
+    std::vector<std::string> lines;
+    plan.explain("", &lines);
+    // Every line of the plan is returned as a series name
+    auto substitute = std::make_shared<PlainSeriesMatcher>();
+    std::vector<aku_ParamId> ids;
+    for (auto const& line: lines) {
+        ids.push_back(substitute->add(line.data(), line.data() + line.size()));
+    }
+    session->set_series_matcher(substitute);
+    std::shared_ptr<IStreamProcessor> proc =
+            std::make_shared<MetadataQueryProcessor>(output, std::move(ids));
+    if (proc->start()) {
+        proc->stop();
+    }
+}
+
 void Storage::suggest(StorageSession const* session, InternalCursor* cur, const char* query) const {
     using namespace QP;
     boost::property_tree::ptree ptree;
@@ -1165,6 +1320,12 @@ boost::property_tree::ptree Storage::get_stats() {
         result.put(path + ".free_space", free_vol);
         result.put(path + ".file_name", name);
     }
+    auto cache = bstore_->get_stats().cache;
+    result.put("block_cache.hits", cache.hits);
+    result.put("block_cache.misses", cache.misses);
+    result.put("block_cache.evictions", cache.evictions);
+    result.put("block_cache.size", cache.size);
+    result.put("block_cache.capacity", cache.capacity);
     return result;
 }
 
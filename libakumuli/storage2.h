@@ -39,6 +39,12 @@
 namespace Akumuli {
 
 class Storage;
+class QueryExecutor;
+
+namespace QP {
+struct IQueryPlan;
+enum class ExplainMode;
+}
 
 class StorageSession : public std::enable_shared_from_this<StorageSession> {
     std::shared_ptr<Storage> storage_;
@@ -51,6 +57,11 @@ public:
 
     aku_Status write(aku_Sample const& sample);
 
+    /** Write batch of samples. All valid samples are written, status
+      * of the first failed sample is returned on error.
+      */
+    aku_Status write_batch(aku_Sample const* samples, size_t size);
+
     /** Match series name. If series with such name doesn't exists - create it.
       * This method should be called for each sample to init its `paramid` field.
       */
@@ -83,6 +94,9 @@ public:
     // Temporary reset series matcher
     void set_series_matcher(std::shared_ptr<PlainSeriesMatcher> matcher) const;
     void clear_series_matcher() const;
+
+    //! Get executor that should be used to run queries
+    QueryExecutor& get_query_executor() const;
 };
 
 class Storage : public std::enable_shared_from_this<Storage> {
@@ -93,17 +107,29 @@ class Storage : public std::enable_shared_from_this<Storage> {
     mutable std::mutex lock_;
     SeriesMatcher global_matcher_;
     std::shared_ptr<MetadataStorage> metadata_;
+    //! Thread pool that executes queries
+    std::shared_ptr<QueryExecutor> executor_;
 
     void start_sync_worker();
 
     aku_Status parse_query(const boost::property_tree::ptree &ptree, QP::ReshapeRequest* req) const;
+
+    //! Send query plan (and execution statistics if required) to the output node instead of the query results
+    void explain(StorageSession const* session,
+                 InternalCursor* cur,
+                 std::shared_ptr<QP::Node> output,
+                 QP::ExplainMode mode,
+                 QP::IQueryPlan& plan) const;
 public:
 
     // Create empty in-memory storage
     Storage();
 
-    // Open file-backed storage
-    Storage(const char* path);
+    /** Open file-backed storage
+      * @param path is a path to metadata file
+      * @param params is a set of tuning parameters
+      */
+    Storage(const char* path, aku_FineTuneParams const& params = aku_FineTuneParams());
 
     /** C-tor for test */
     Storage(std::shared_ptr<MetadataStorage>            meta,
@@ -139,8 +165,13 @@ public:
 
     void debug_print() const;
 
+    //! Get executor that should be used to run queries
+    QueryExecutor& get_query_executor() const;
+
     void _update_rescue_points(aku_ParamId id, std::vector<StorageEngine::LogicAddr>&& rpoints);
 
+    void _update_rescue_points(std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>>&& rpoints);
+
     /** This method should be called before object destructor.
       * All ingestion sessions should be stopped first.
       */
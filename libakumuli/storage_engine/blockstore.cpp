@@ -16,6 +16,8 @@
  */
 
 #include "blockstore.h"
+#include "nbtree_def.h"
+#include "profile.h"
 #include "log_iface.h"
 #include "util.h"
 #include "status_util.h"
@@ -29,74 +31,148 @@
 namespace Akumuli {
 namespace StorageEngine {
 
-static u64 hash32(u32 value, u32 bits, u64 seed) {
-    // hashes x strongly universally into N bits
-    // using the random seed.
-    static const u64 a = (1ul << 32) - 1;
-    return (a * value + seed) >> (64-bits);
-}
-
-static u64 hash(u64 value, u32 bits) {
-    auto a = hash32(value & 0xFFFFFFFF, bits, 277);
-    auto b = hash32(value >> 32, bits, 337);
-    return a ^ b;
-}
+// ////////// //
+// BlockCache //
+// ////////// //
 
-BlockCache::BlockCache(u32 Nbits)
-    : block_cache_(1 << Nbits, PBlock())
-    , bits_(Nbits)
-    , gen_(dev_())
-    , dist_(0, 1 << Nbits)
+BlockCache::BlockCache(size_t capacity)
+    : capacity_(capacity)
+    , shard_capacity_(capacity / NSHARDS)
 {
-}
-
-int BlockCache::probe(LogicAddr addr) {
-    auto h = hash(addr, bits_);
-    auto b = block_cache_.at(h);
-    if (b) {
-        return b->get_addr() == addr ? 2 : 1;
+    for (auto& shard: shards_) {
+        shard.probation_size = 0;
+        shard.protected_size = 0;
+        shard.inner_size     = 0;
+        shard.hits           = 0;
+        shard.misses         = 0;
+        shard.evictions      = 0;
+    }
+}
+
+BlockCache::Shard& BlockCache::get_shard(LogicAddr addr) {
+    // Consecutive blocks should end up in different shards
+    return shards_[(addr ^ (addr >> 32)) % NSHARDS];
+}
+
+BlockCache::BlockList& BlockCache::get_queue(Shard& shard, Queue queue) {
+    switch (queue) {
+    case Queue::PROBATION:
+        return shard.probation;
+    case Queue::PROTECTED:
+        return shard.protected_;
+    case Queue::INNER:
+        break;
+    };
+    return shard.inner;
+}
+
+size_t& BlockCache::get_queue_size(Shard& shard, Queue queue) {
+    switch (queue) {
+    case Queue::PROBATION:
+        return shard.probation_size;
+    case Queue::PROTECTED:
+        return shard.protected_size;
+    case Queue::INNER:
+        break;
+    };
+    return shard.inner_size;
+}
+
+void BlockCache::evict(Shard& shard, size_t size) {
+    while (shard.probation_size + shard.protected_size + shard.inner_size + size > shard_capacity_) {
+        Queue victim;
+        if (shard.inner_size > shard_capacity_ / 2 || (shard.probation.empty() && shard.protected_.empty())) {
+            // Superblocks shouldn't take more than a half of the cache
+            victim = Queue::INNER;
+        } else if (shard.probation_size > shard_capacity_ / 4 || shard.protected_.empty()) {
+            // Probation queue should be drained first but it shouldn't be
+            // too small, otherwise the block will be evicted before the second access.
+            victim = Queue::PROBATION;
+        } else {
+            victim = Queue::PROTECTED;
+        }
+        auto& queue = get_queue(shard, victim);
+        if (queue.empty()) {
+            break;
+        }
+        PBlock block = queue.back();
+        queue.pop_back();
+        get_queue_size(shard, victim) -= block->get_size();
+        shard.table.erase(block->get_addr());
+        shard.evictions++;
     }
-    return 0;
 }
 
-void BlockCache::insert(PBlock block) {
+void BlockCache::insert(PBlock block, bool prefetched) {
+    size_t size = block->get_size();
+    if (size > shard_capacity_) {
+        return;
+    }
     auto addr = block->get_addr();
-    auto pr = probe(addr);
-    if (pr == 2) {
+    auto& shard = get_shard(addr);
+    std::lock_guard<std::mutex> guard(shard.lock); AKU_UNUSED(guard);
+    if (shard.table.count(addr)) {
         // No need to insert, addr already sits in the cache.
         return;
     }
-    if (pr == 0) {
-        // Eviction. Generate two random hashes. Evict least accessed.
-        auto h1 = dist_(gen_);
-        auto h2 = dist_(gen_);
-        auto p1 = block_cache_.at(h1);
-        auto p2 = block_cache_.at(h2);
-        if (p1 && p2) {
-            if (p1.use_count() > p2.use_count()) {
-                block_cache_.at(h2).reset();
-            } else if (p1.use_count() < p2.use_count()) {
-                block_cache_.at(h1).reset();
-            } else {
-                if (p1->get_addr() < p2->get_addr()) {
-                    block_cache_.at(h1).reset();
-                } else {
-                    block_cache_.at(h2).reset();
-                }
-            }
-        }
+    evict(shard, size);
+    auto subtree = reinterpret_cast<SubtreeRef const*>(block->get_cdata());
+    // Quantile sketches are read along with superblocks
+    bool inner = subtree->type == NBTreeBlockType::INNER || subtree->type == NBTreeBlockType::SKETCH;
+    Queue queue = inner ? Queue::INNER : Queue::PROBATION;
+    auto& list = get_queue(shard, queue);
+    list.push_front(std::move(block));
+    get_queue_size(shard, queue) += size;
+    Entry entry = { queue, list.begin(), prefetched };
+    shard.table[addr] = entry;
+}
+
+BlockCache::PBlock BlockCache::lookup(LogicAddr addr) {
+    auto& shard = get_shard(addr);
+    std::lock_guard<std::mutex> guard(shard.lock); AKU_UNUSED(guard);
+    auto it = shard.table.find(addr);
+    if (it == shard.table.end()) {
+        shard.misses++;
+        return PBlock();
+    }
+    shard.hits++;
+    Entry& entry = it->second;
+    PBlock block = *entry.it;
+    if (entry.prefetched) {
+        // First real access to the block that was read ahead
+        entry.prefetched = false;
+        auto& list = get_queue(shard, entry.queue);
+        list.splice(list.begin(), list, entry.it);
+    } else if (entry.queue == Queue::PROBATION) {
+        // Second access, promote to protected queue
+        shard.protected_.splice(shard.protected_.begin(), shard.probation, entry.it);
+        shard.probation_size -= block->get_size();
+        shard.protected_size += block->get_size();
+        entry.queue = Queue::PROTECTED;
+    } else {
+        auto& list = get_queue(shard, entry.queue);
+        list.splice(list.begin(), list, entry.it);
+    }
+    return block;
+}
+
+bool BlockCache::contains(LogicAddr addr) {
+    auto& shard = get_shard(addr);
+    std::lock_guard<std::mutex> guard(shard.lock); AKU_UNUSED(guard);
+    return shard.table.count(addr) != 0;
+}
+
+BlockCacheStats BlockCache::get_stats() {
+    BlockCacheStats stats = {};
+    stats.capacity = capacity_;
+    for (auto& shard: shards_) {
+        std::lock_guard<std::mutex> guard(shard.lock); AKU_UNUSED(guard);
+        stats.hits      += shard.hits;
+        stats.misses    += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.size      += shard.probation_size + shard.protected_size + shard.inner_size;
     }
-    auto h = hash(addr, bits_);
-    block_cache_.at(h) = block;
-}
-
-BlockCache::PBlock BlockCache::loockup(LogicAddr addr) {
-    auto it = hash(addr, bits_);
-    auto p = block_cache_.at(it);
-    if (p->get_addr() != addr) {
-        p.reset();
-    }
-    return p;
+    return stats;
 }
 
 
@@ -150,12 +226,36 @@ void Block::set_addr(LogicAddr addr) {
 }
 
 
-FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta)
+static u32 extract_gen(LogicAddr addr) {
+    return addr >> 32;
+}
+
+static BlockAddr extract_vol(LogicAddr addr) {
+    return addr & 0xFFFFFFFF;
+}
+
+static LogicAddr make_logic(u32 gen, BlockAddr addr) {
+    return static_cast<u64>(gen) << 32 | addr;
+}
+
+void BlockStore::prefetch(LogicAddr) {
+}
+
+//! Max number of pending prefetch requests, new requests are dropped when queue is full
+static const size_t PREFETCH_QUEUE_MAX = 256;
+
+FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta, size_t cache_size, VolumeIO io)
     : meta_(MetaVolume::open_existing(meta))
     , current_volume_(0)
     , current_gen_(0)
     , total_size_(0)
+    , io_(io)
+    , prefetch_stop_(false)
+    , commit_leader_(false)
 {
+    if (cache_size != 0) {
+        cache_.reset(new BlockCache(cache_size));
+    }
     typedef VolumeRegistry::VolumeDesc TVol;
     auto volumes = meta->get_volumes();
     std::sort(volumes.begin(), volumes.end(), [](TVol const& a, TVol const& b) {
@@ -175,7 +275,7 @@ FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta)
                                                    StatusUtil::str(status)));
             AKU_PANIC("Can't open blockstore - " + StatusUtil::str(status));
         }
-        auto uptr = Volume::open_existing(volpath.c_str(), nblocks);
+        auto uptr = Volume::open_existing(volpath.c_str(), nblocks, io_);
         volumes_.push_back(std::move(uptr));
         dirty_.push_back(0);
     }
@@ -205,6 +305,108 @@ FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta)
     }
 }
 
+FileStorage::~FileStorage() {
+    {
+        std::lock_guard<std::mutex> guard(prefetch_lock_); AKU_UNUSED(guard);
+        prefetch_stop_ = true;
+    }
+    prefetch_cvar_.notify_all();
+    if (prefetch_thread_.joinable()) {
+        prefetch_thread_.join();
+    }
+}
+
+void FileStorage::prefetch(LogicAddr addr) {
+    if (cache_ && cache_->contains(addr)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(prefetch_lock_); AKU_UNUSED(guard);
+    if (prefetch_queue_.size() >= PREFETCH_QUEUE_MAX) {
+        // It's only a hint
+        return;
+    }
+    if (!prefetch_thread_.joinable()) {
+        prefetch_thread_ = std::thread(&FileStorage::prefetch_loop, this);
+    }
+    prefetch_queue_.push_back(addr);
+    prefetch_cvar_.notify_one();
+}
+
+void FileStorage::read_ahead(std::vector<LogicAddr> const& batch) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    std::map<u32, std::vector<LogicAddr>> per_volume;
+    for (auto addr: batch) {
+        // The block could be recycled while the request was waiting in the queue
+        auto gen = extract_gen(addr);
+        auto vol = extract_vol(addr);
+        // Fixed size storage reuses volumes in round-robin fashion, expandable storage
+        // has one volume per generation and the generation check below rejects the
+        // address if it doesn't belong to the volume.
+        auto volix = gen % static_cast<u32>(volumes_.size());
+        aku_Status status;
+        u32 actual_gen;
+        u32 nblocks;
+        std::tie(status, actual_gen) = meta_->get_generation(volix);
+        if (status != AKU_SUCCESS) {
+            continue;
+        }
+        std::tie(status, nblocks) = meta_->get_nblocks(volix);
+        if (status != AKU_SUCCESS || actual_gen != gen || vol >= nblocks) {
+            continue;
+        }
+        if (cache_ && cache_->contains(addr)) {
+            continue;
+        }
+        status = volumes_[volix]->prefetch_block(vol);
+        if (status != AKU_EUNAVAILABLE || !cache_) {
+            // OS started to read the block into page cache or
+            // there is no place to put the block in.
+            continue;
+        }
+        per_volume[volix].push_back(addr);
+    }
+    for (auto const& kv: per_volume) {
+        auto const& addrlist = kv.second;
+        std::vector<std::vector<u8>> buffers(addrlist.size(), std::vector<u8>(AKU_BLOCK_SIZE, 0));
+        std::vector<u32> index;
+        std::vector<u8*> dest;
+        for (size_t i = 0; i < addrlist.size(); i++) {
+            index.push_back(extract_vol(addrlist[i]));
+            dest.push_back(buffers[i].data());
+        }
+        aku_Status status = volumes_[kv.first]->read_blocks(index.data(), dest.data(), dest.size());
+        if (status != AKU_SUCCESS) {
+            continue;
+        }
+        for (size_t i = 0; i < addrlist.size(); i++) {
+            cache_->insert(std::make_shared<Block>(addrlist[i], std::move(buffers[i])), true);
+        }
+    }
+}
+
+void FileStorage::prefetch_loop() {
+    while (true) {
+        std::vector<LogicAddr> batch;
+        {
+            std::unique_lock<std::mutex> guard(prefetch_lock_);
+            prefetch_cvar_.wait(guard, [this] {
+                return prefetch_stop_ || !prefetch_queue_.empty();
+            });
+            if (prefetch_stop_) {
+                return;
+            }
+            batch.assign(prefetch_queue_.begin(), prefetch_queue_.end());
+            prefetch_queue_.clear();
+        }
+        try {
+            read_ahead(batch);
+        } catch (...) {
+            // Error will be reported when the block will be read by the query
+            Logger::msg(AKU_LOG_ERROR, "Can't prefetch " + std::to_string(batch.size()) + " blocks");
+        }
+    }
+}
+
 void FileStorage::create(std::vector<std::tuple<u32, std::string>> vols)
 {
     std::vector<u32> caps;
@@ -251,38 +453,112 @@ void FileStorage::handle_volume_transition() {
     }
 }
 
-static u32 extract_gen(LogicAddr addr) {
-    return addr >> 32;
-}
-
-static BlockAddr extract_vol(LogicAddr addr) {
-    return addr & 0xFFFFFFFF;
+void FileStorage::append_batch(std::vector<AppendRequest*> const& batch) {
+    std::vector<const u8*> source;
+    size_t first = 0;
+    bool transition = false;
+    while (first < batch.size()) {
+        Volume* volume = volumes_.at(current_volume_).get();
+        size_t nfree = volume->get_size() - volume->get_nblocks();
+        size_t n = std::min(batch.size() - first, nfree);
+        if (n == 0) {
+            if (transition) {
+                // Next volume is full too
+                for (size_t i = first; i < batch.size(); i++) {
+                    batch[i]->status = AKU_EOVERFLOW;
+                }
+                return;
+            }
+            // transition to new/next volume
+            handle_volume_transition();
+            transition = true;
+            continue;
+        }
+        transition = false;
+        source.clear();
+        for (size_t i = first; i < first + n; i++) {
+            source.push_back(batch[i]->block->get_data());
+        }
+        BlockAddr block_addr;
+        aku_Status status;
+        std::tie(status, block_addr) = volume->append_blocks(source.data(), n);
+        if (status != AKU_SUCCESS) {
+            for (size_t i = first; i < batch.size(); i++) {
+                batch[i]->status = status;
+            }
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            auto req = batch[first + i];
+            req->block->set_addr(block_addr + i);
+            req->status = AKU_SUCCESS;
+            req->addr = make_logic(current_gen_, block_addr + static_cast<BlockAddr>(i));
+        }
+        status = meta_->set_nblocks(current_volume_, block_addr + static_cast<u32>(n));
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+        }
+        dirty_[current_volume_]++;
+        first += n;
+    }
 }
 
-static LogicAddr make_logic(u32 gen, BlockAddr addr) {
-    return static_cast<u64>(gen) << 32 | addr;
+std::tuple<aku_Status, LogicAddr> FileStorage::append_block(std::shared_ptr<Block> data) {
+    AppendRequest req = { data, AKU_SUCCESS, 0ull, false };
+    std::unique_lock<std::mutex> commit_guard(commit_lock_);
+    commit_queue_.push_back(&req);
+    while (!req.done) {
+        if (commit_leader_) {
+            // Some other writer is writing previous batch, the request will
+            // be written by the next leader
+            commit_cvar_.wait(commit_guard);
+            continue;
+        }
+        // Become a leader and write everything queued so far
+        commit_leader_ = true;
+        std::vector<AppendRequest*> batch;
+        batch.swap(commit_queue_);
+        // Leadership should be released and requests should be completed on every
+        // exit path, otherwise other writers would wait for them forever.
+        struct BatchCompletion {
+            std::unique_lock<std::mutex>& commit_guard;
+            std::vector<AppendRequest*>&  batch;
+            bool&                         commit_leader;
+            std::condition_variable&      commit_cvar;
+            bool                          written;
+
+            ~BatchCompletion() {
+                if (!commit_guard.owns_lock()) {
+                    commit_guard.lock();
+                }
+                for (auto it: batch) {
+                    if (!written) {
+                        it->status = AKU_EGENERAL;
+                    }
+                    it->done = true;
+                }
+                commit_leader = false;
+                commit_cvar.notify_all();
+            }
+        } completion = { commit_guard, batch, commit_leader_, commit_cvar_, false };
+        commit_guard.unlock();
+        {
+            std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+            append_batch(batch);
+        }
+        completion.written = true;
+    }
+    return std::make_tuple(req.status, req.addr);
 }
 
-std::tuple<aku_Status, LogicAddr> FileStorage::append_block(std::shared_ptr<Block> data) {
+VolumeIO FileStorage::get_io_backend() const {
     std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
-    BlockAddr block_addr;
-    aku_Status status;
-    std::tie(status, block_addr) = volumes_[current_volume_]->append_block(data->get_data());
-    if (status == AKU_EOVERFLOW) {
-      // transition to new/next volume
-      handle_volume_transition();
-      std::tie(status, block_addr) = volumes_.at(current_volume_)->append_block(data->get_data());
-      if (status != AKU_SUCCESS) {
-        return std::make_tuple(status, 0ull);
-      }
-    }
-    data->set_addr(block_addr);
-    status = meta_->set_nblocks(current_volume_, block_addr + 1);
-    if (status != AKU_SUCCESS) {
-      AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+    for (auto const& volume: volumes_) {
+        if (volume->get_io_backend() != io_) {
+            return volume->get_io_backend();
+        }
     }
-    dirty_[current_volume_]++;
-    return std::make_tuple(status, make_logic(current_gen_, block_addr));
+    return io_;
 }
 
 void FileStorage::flush() {
@@ -304,6 +580,9 @@ void FileStorage::flush() {
 BlockStoreStats FileStorage::get_stats() const {
     BlockStoreStats stats = {};
     stats.block_size = 4096;
+    if (cache_) {
+        stats.cache = cache_->get_stats();
+    }
     size_t nvol = meta_->get_nvolumes();
     for (u32 ix = 0; ix < nvol; ix++) {
         aku_Status stat;
@@ -354,14 +633,16 @@ u32 FileStorage::checksum(u8 const* data, size_t size) const {
 
 // FixedSizeFileStorage
 
-FixedSizeFileStorage::FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta)
-    : FileStorage::FileStorage(meta)
+FixedSizeFileStorage::FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta, size_t cache_size, VolumeIO io)
+    : FileStorage::FileStorage(meta, cache_size, io)
 {
     // nothing specific needed except calling the parent constructor
 }
 
-std::shared_ptr<FixedSizeFileStorage> FixedSizeFileStorage::open(std::shared_ptr<VolumeRegistry> meta) {
-    auto bs = new FixedSizeFileStorage(meta);
+std::shared_ptr<FixedSizeFileStorage> FixedSizeFileStorage::open(std::shared_ptr<VolumeRegistry> meta,
+                                                                 size_t cache_size,
+                                                                 VolumeIO io) {
+    auto bs = new FixedSizeFileStorage(meta, cache_size, io);
     return std::shared_ptr<FixedSizeFileStorage>(bs);
 }
 
@@ -403,11 +684,24 @@ std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(
     if (actual_gen != gen || vol >= nblocks) {
         return std::make_tuple(AKU_EUNAVAILABLE, std::unique_ptr<Block>());
     }
+    // Generation is checked first so evicted by retention blocks
+    // can't be returned from the cache.
+    if (cache_) {
+        auto cached = cache_->lookup(addr);
+        if (cached) {
+            QueryProfile::count(&QueryProfile::cache_hits);
+            return std::make_tuple(AKU_SUCCESS, std::move(cached));
+        }
+    }
+    QueryProfile::count(&QueryProfile::blocks_read);
     // Try to use zero-copy if possible
     const u8* mptr;
     std::tie(status, mptr) = volumes_[volix]->read_block_zero_copy(vol);
     if (status == AKU_SUCCESS) {
         std::shared_ptr<Block> zblock = std::make_shared<Block>(addr, mptr);
+        if (cache_) {
+            cache_->insert(zblock);
+        }
         return std::make_tuple(status, std::move(zblock));
     } else if (status == AKU_EUNAVAILABLE) {
         // Fallback to copying if not possible
@@ -417,6 +711,9 @@ std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(
             return std::make_tuple(status, std::unique_ptr<Block>());
         }
         auto block = std::make_shared<Block>(addr, std::move(dest));
+        if (cache_) {
+            cache_->insert(block);
+        }
         return std::make_tuple(status, std::move(block));
     }
     return std::make_tuple(status, std::unique_ptr<Block>());
@@ -428,15 +725,17 @@ void FixedSizeFileStorage::adjust_current_volume() {
 
 // ExpandableFileStorage
 
-ExpandableFileStorage::ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta)
-    : FileStorage::FileStorage(meta)
+ExpandableFileStorage::ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta, size_t cache_size, VolumeIO io)
+    : FileStorage::FileStorage(meta, cache_size, io)
     , db_name_(meta->get_dbname())
 {
 }
 
-std::shared_ptr<ExpandableFileStorage> ExpandableFileStorage::open(std::shared_ptr<VolumeRegistry> meta)
+std::shared_ptr<ExpandableFileStorage> ExpandableFileStorage::open(std::shared_ptr<VolumeRegistry> meta,
+                                                                   size_t cache_size,
+                                                                   VolumeIO io)
 {
-    auto bs = new ExpandableFileStorage(meta);
+    auto bs = new ExpandableFileStorage(meta, cache_size, io);
     return std::shared_ptr<ExpandableFileStorage>(bs);
 }
 
@@ -476,11 +775,24 @@ std::tuple<aku_Status, std::shared_ptr<Block>> ExpandableFileStorage::read_block
     if (actual_gen != gen || vol >= nblocks) {
       return std::make_tuple(AKU_EUNAVAILABLE, std::unique_ptr<Block>());
     }
+    // Generation is checked first so evicted by retention blocks
+    // can't be returned from the cache.
+    if (cache_) {
+        auto cached = cache_->lookup(addr);
+        if (cached) {
+            QueryProfile::count(&QueryProfile::cache_hits);
+            return std::make_tuple(AKU_SUCCESS, std::move(cached));
+        }
+    }
+    QueryProfile::count(&QueryProfile::blocks_read);
     // Try to use zero-copy if possible
     const u8* mptr;
     std::tie(status, mptr) = volumes_[gen]->read_block_zero_copy(vol);
     if (status == AKU_SUCCESS) {
         std::shared_ptr<Block> zblock = std::make_shared<Block>(addr, mptr);
+        if (cache_) {
+            cache_->insert(zblock);
+        }
         return std::make_tuple(status, std::move(zblock));
     } else if (status == AKU_EUNAVAILABLE) {
         // Fallback to copying if not possible
@@ -490,6 +802,9 @@ std::tuple<aku_Status, std::shared_ptr<Block>> ExpandableFileStorage::read_block
             return std::make_tuple(status, std::unique_ptr<Block>());
         }
         auto block = std::make_shared<Block>(addr, std::move(dest));
+        if (cache_) {
+            cache_->insert(block);
+        }
         return std::make_tuple(status, std::move(block));
     }
     return std::make_tuple(status, std::unique_ptr<Block>());
@@ -502,7 +817,7 @@ std::unique_ptr<Volume> ExpandableFileStorage::create_new_volume(u32 id) {
     std::string basename = std::string(db_name_) + "_" + std::to_string(id) + ".vol";
     boost::filesystem::path new_path = pp / basename;
     Volume::create_new(new_path.c_str(), volumes_[prev_id]->get_size());
-    return Volume::open_existing(new_path.c_str(), 0);
+    return Volume::open_existing(new_path.c_str(), 0, io_);
 }
 
 void ExpandableFileStorage::adjust_current_volume() {
@@ -560,6 +875,7 @@ std::tuple<aku_Status, std::shared_ptr<Block>> MemStore::read_block(LogicAddr ad
     if (addr < removed_pos_) {
         return std::make_tuple(AKU_EUNAVAILABLE, block);
     }
+    QueryProfile::count(&QueryProfile::blocks_read);
     std::vector<u8> data;
     data.reserve(AKU_BLOCK_SIZE);
     auto begin = buffer_.begin() + offset;
@@ -587,7 +903,7 @@ void MemStore::flush() {
 }
 
 BlockStoreStats MemStore::get_stats() const {
-    BlockStoreStats s;
+    BlockStoreStats s = {};
     s.block_size = 4096;
     s.capacity = 1024*4096;
     s.nblocks = write_pos_;
@@ -596,7 +912,7 @@ BlockStoreStats MemStore::get_stats() const {
 
 PerVolumeStats MemStore::get_volume_stats() const {
     PerVolumeStats result;
-    BlockStoreStats s;
+    BlockStoreStats s = {};
     s.block_size = 4096;
     s.capacity = 1024*4096;
     s.nblocks = write_pos_;
@@ -607,7 +923,7 @@ PerVolumeStats MemStore::get_volume_stats() const {
 bool MemStore::exists(LogicAddr addr) const {
     addr -= MEMSTORE_BASE;
     std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
-    return addr < write_pos_;
+    return addr >= removed_pos_ && addr < write_pos_;
 }
 
 std::shared_ptr<BlockStore> BlockStoreBuilder::create_memstore() {
@@ -18,10 +18,16 @@
 #pragma once
 #include "volumeregistry.h"
 #include "volume.h"
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <list>
 #include <random>
 #include <mutex>
+#include <thread>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 namespace Akumuli {
 namespace StorageEngine {
@@ -34,27 +40,102 @@ static const LogicAddr EMPTY_ADDR = std::numeric_limits<LogicAddr>::max();
 
 class Block;
 
-struct BlockCache {
+struct BlockCacheStats {
+    //! Number of cache hits
+    u64 hits;
+    //! Number of cache misses
+    u64 misses;
+    //! Number of evicted blocks
+    u64 evictions;
+    //! Memory used by cached blocks (in bytes)
+    u64 size;
+    //! Memory budget (in bytes)
+    u64 capacity;
+};
+
+/** Block cache.
+  * Sharded 2Q cache with memory budget in bytes. Each shard maintains three queues:
+  * @li probation queue - leaf nodes that was accessed only once (FIFO);
+  * @li protected queue - leaf nodes that was accessed more than once (LRU);
+  * @li inner queue - superblocks and quantile sketches (LRU).
+  * Eviction starts from the probation queue so one-off scans can't flush frequently
+  * accessed leaf nodes from the cache. Superblocks are evicted only when there is no
+  * leaf nodes left or when they occupy more than half of the shard.
+  */
+class BlockCache {
+public:
     typedef std::shared_ptr<Block> PBlock;
-    std::vector<PBlock> block_cache_;
-    const u32 bits_;
-    // RNG
-    std::random_device dev_;
-    std::mt19937 gen_;
-    std::uniform_int_distribution<u32> dist_;
-
-    /** Check status of the cache cell.
-      * Return 0 if there is no such addr in the cache and slot is free.
-      * Return 1 if addr is not present in the cache but slot is occupied by the other block.
-      * Return 2 if addr is already present in the cache.
+
+private:
+    enum {
+        NSHARDS = 16,
+    };
+
+    enum class Queue {
+        PROBATION,
+        PROTECTED,
+        INNER,
+    };
+
+    typedef std::list<PBlock> BlockList;
+
+    struct Entry {
+        Queue               queue;
+        BlockList::iterator it;
+        //! Block was read ahead and wasn't accessed yet
+        bool                prefetched;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<LogicAddr, Entry> table;
+        BlockList probation;
+        BlockList protected_;
+        BlockList inner;
+        size_t probation_size;
+        size_t protected_size;
+        size_t inner_size;
+        u64 hits;
+        u64 misses;
+        u64 evictions;
+    };
+
+    std::array<Shard, NSHARDS> shards_;
+    const size_t capacity_;
+    const size_t shard_capacity_;
+
+    Shard& get_shard(LogicAddr addr);
+
+    BlockList& get_queue(Shard& shard, Queue queue);
+
+    size_t& get_queue_size(Shard& shard, Queue queue);
+
+    //! Evict blocks until `size` bytes can be added to the shard
+    void evict(Shard& shard, size_t size);
+
+public:
+    /** C-tor
+      * @param capacity is a memory budget in bytes
       */
-    int probe(LogicAddr addr);
+    BlockCache(size_t capacity);
 
-    BlockCache(u32 Nbits);
+    BlockCache(BlockCache const&) = delete;
+    BlockCache& operator = (BlockCache const&) = delete;
 
-    void insert(PBlock block);
+    /** Add block to cache
+      * @param block is a block to add
+      * @param prefetched should be set if block was read ahead, in this case
+      *        first lookup wouldn't be counted as a second access
+      */
+    void insert(PBlock block, bool prefetched = false);
+
+    //! Find block in cache, return empty pointer on cache miss
+    PBlock lookup(LogicAddr addr);
+
+    //! Check if block is cached (doesn't affect statistics and eviction order)
+    bool contains(LogicAddr addr);
 
-    PBlock loockup(LogicAddr addr);
+    BlockCacheStats get_stats();
 };
 
 
@@ -62,6 +143,8 @@ struct BlockStoreStats {
     size_t block_size;
     size_t capacity;
     size_t nblocks;
+    //! Block cache statistics (all zeroes if cache is not used)
+    BlockCacheStats cache;
 };
 
 typedef std::map<std::string, BlockStoreStats> PerVolumeStats;
@@ -93,12 +176,21 @@ struct BlockStore {
     //! Compute checksum of the input data.
     virtual u32 checksum(u8 const* begin, size_t size) const = 0;
 
+    /** Hint that the block will be read soon. Implementation can start
+      * reading it in the background. Default implementation does nothing.
+      */
+    virtual void prefetch(LogicAddr addr);
+
     virtual BlockStoreStats get_stats() const = 0;
 
     virtual PerVolumeStats get_volume_stats() const = 0;
 };
 
 class FileStorage : public BlockStore {
+public:
+    //! Default memory budget of the block cache in bytes
+    static const size_t DEFAULT_CACHE_SIZE = 256*1024*1024;
+
 protected:
     //! Metadata volume.
     std::unique_ptr<MetaVolume> meta_;
@@ -116,22 +208,69 @@ protected:
     mutable std::mutex lock_;
     //! Volume names (for nice statistics)
     std::vector<std::string> volume_names_;
+    //! Cache for recently read blocks
+    std::unique_ptr<BlockCache> cache_;
+    //! Volume I/O backend
+    VolumeIO io_;
+
+    // Read-ahead. Hints are queued without `lock_` and processed by the background
+    // thread: mmap-ed volumes are advised to read the block, blocks of other volumes
+    // are read into the cache. One thread is enough since volume access is
+    // serialized by `lock_` anyway.
+    std::mutex prefetch_lock_;
+    std::condition_variable prefetch_cvar_;
+    //! Prefetch requests
+    std::deque<LogicAddr> prefetch_queue_;
+    std::thread prefetch_thread_;
+    bool prefetch_stop_;
+
+    // Group commit. Appends are queued and the first writer that finds no
+    // active leader writes the whole queue using one vectored write per volume
+    // and one MetaVolume update. Other writers wait for their requests to complete.
+    struct AppendRequest {
+        std::shared_ptr<Block> block;
+        aku_Status             status;
+        LogicAddr              addr;
+        bool                   done;
+    };
+    std::mutex commit_lock_;
+    std::condition_variable commit_cvar_;
+    std::vector<AppendRequest*> commit_queue_;
+    bool commit_leader_;
 
     //! Secret c-tor.
-    FileStorage(std::shared_ptr<VolumeRegistry> meta);
+    FileStorage(std::shared_ptr<VolumeRegistry> meta, size_t cache_size, VolumeIO io);
 
     virtual void adjust_current_volume() = 0;
     void handle_volume_transition();
 
+    /** Start reading blocks (called by the background thread). Blocks that
+      * can't be prefetched by the OS are read into the cache, blocks from the
+      * same volume are read using one batch.
+      */
+    void read_ahead(std::vector<LogicAddr> const& batch);
+
+    void prefetch_loop();
+
+    //! Write batch of blocks, should be called with `lock_` held
+    void append_batch(std::vector<AppendRequest*> const& batch);
+
 public:
+    virtual ~FileStorage();
+
     static void create(std::vector<std::tuple<u32, std::string>> vols);
 
-    /** Add block to blockstore.
+    /** Add block to blockstore. Concurrent calls are grouped and written
+     * together (group commit), the call returns when the block is written.
+     * If the batch can't be written because of an exception, the writer that
+     * wrote it gets the exception and the other writers get AKU_EGENERAL.
      * @param data Pointer to buffer.
      * @return Status and block's logic address.
      */
     virtual std::tuple<aku_Status, LogicAddr> append_block(std::shared_ptr<Block> data);
 
+    virtual void prefetch(LogicAddr addr);
+
     virtual void flush();
 
     virtual u32 checksum(u8 const* data, size_t size) const;
@@ -139,20 +278,28 @@ public:
     virtual BlockStoreStats get_stats() const;
 
     virtual PerVolumeStats get_volume_stats() const;
+
+    //! Return I/O backend used by volumes (APR if some volume fell back to it)
+    VolumeIO get_io_backend() const;
 };
 
 class FixedSizeFileStorage : public FileStorage,
                              public std::enable_shared_from_this<FixedSizeFileStorage> {
     //! Secret c-tor.
-    FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta);
+    FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta, size_t cache_size, VolumeIO io);
 
 protected:
     virtual void adjust_current_volume();
 
 public:
     /** Create BlockStore instance (can be created only on heap).
+      * @param meta is a volume registry
+      * @param cache_size is a block cache memory budget in bytes (0 disables cache)
+      * @param io is a volume I/O backend
       */
-    static std::shared_ptr<FixedSizeFileStorage> open(std::shared_ptr<VolumeRegistry> meta);
+    static std::shared_ptr<FixedSizeFileStorage> open(std::shared_ptr<VolumeRegistry> meta,
+                                                      size_t cache_size = DEFAULT_CACHE_SIZE,
+                                                      VolumeIO io = VolumeIO::APR);
 
     virtual bool exists(LogicAddr addr) const;
 
@@ -166,7 +313,7 @@ class ExpandableFileStorage : public FileStorage,
      std::string db_name_;
 
      //! Secret c-tor.
-     ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta);
+     ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta, size_t cache_size, VolumeIO io);
 
      std::unique_ptr<Volume> create_new_volume(u32 id);
 protected:
@@ -179,8 +326,12 @@ public:
       * @param metapath is a place where the meta-page is located
       * @param volpaths is a list of volume paths
       * @param on_volume_advance is function object that gets called when new volume is created
+      * @param cache_size is a block cache memory budget in bytes (0 disables cache)
+      * @param io is a volume I/O backend
       */
-     static std::shared_ptr<ExpandableFileStorage> open(std::shared_ptr<VolumeRegistry> meta);
+     static std::shared_ptr<ExpandableFileStorage> open(std::shared_ptr<VolumeRegistry> meta,
+                                                        size_t cache_size = DEFAULT_CACHE_SIZE,
+                                                        VolumeIO io = VolumeIO::APR);
 
      virtual bool exists(LogicAddr addr) const;
 
@@ -6,8 +6,12 @@
 #include "operators/scan.h"
 #include "operators/join.h"
 #include "operators/merge.h"
+#include "tuples.h"
+#include "profile.h"
 
 #include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <queue>
 
 namespace Akumuli {
 namespace StorageEngine {
@@ -21,12 +25,89 @@ using namespace QP;
 
 ColumnStore::ColumnStore(std::shared_ptr<BlockStore> bstore)
     : blockstore_(bstore)
+    , codec_(ValueCodec::FCM)
+    , reorder_window_(0ull)
 {
 }
 
+void ColumnStore::set_value_codec(ValueCodec codec) {
+    codec_ = codec;
+}
+
+void ColumnStore::set_reorder_window(aku_Timestamp window) {
+    reorder_window_ = window;
+}
+
+void ColumnStore::set_query_cache_size(size_t size) {
+    if (size) {
+        query_cache_ = std::make_shared<GroupAggregateCache>(size);
+    } else {
+        query_cache_.reset();
+    }
+}
+
+std::shared_ptr<GroupAggregateCache> ColumnStore::get_query_cache() const {
+    return query_cache_;
+}
+
+//! Rollup tree ids have this bit set
+static const aku_ParamId ROLLUP_ID_FLAG = 1ull << 62;
+static const aku_Timestamp ROLLUP_STEP_UNIT = 1000000000ull;
+
+static bool is_rollup_id(aku_ParamId id) {
+    return (id & ROLLUP_ID_FLAG) != 0;
+}
+
+static aku_ParamId make_rollup_id(aku_ParamId id, aku_Timestamp step) {
+    return ROLLUP_ID_FLAG | ((step / ROLLUP_STEP_UNIT) << 32) | id;
+}
+
+void ColumnStore::set_rollup_steps(std::vector<aku_Timestamp> const& steps) {
+    rollup_steps_.clear();
+    for (auto step: steps) {
+        if (step == 0 || step % ROLLUP_STEP_UNIT != 0 || step / ROLLUP_STEP_UNIT >= (1ull << 30)) {
+            Logger::msg(AKU_LOG_ERROR, "Invalid rollup step " + std::to_string(step) +
+                                       "ns, should be a multiple of one second");
+            continue;
+        }
+        if (std::find(rollup_steps_.begin(), rollup_steps_.end(), step) == rollup_steps_.end()) {
+            rollup_steps_.push_back(step);
+        }
+    }
+}
+
+void ColumnStore::add_rollups(NBTreeExtentsList& column,
+                              std::unordered_map<aku_ParamId, std::vector<LogicAddr>> const& mapping)
+{
+    aku_ParamId id = column.get_id();
+    if (id >= (1ull << 32) && !rollup_steps_.empty()) {
+        // Rollup id can't be derived from the column id
+        Logger::msg(AKU_LOG_ERROR, "Rollups are not supported for the series " + std::to_string(id) +
+                                   ", series id is too large");
+        return;
+    }
+    for (auto step: rollup_steps_) {
+        aku_ParamId rid = make_rollup_id(id, step);
+        std::vector<LogicAddr> rescue_points;
+        auto it = mapping.find(rid);
+        if (it != mapping.end()) {
+            rescue_points = it->second;
+            if (NBTreeExtentsList::repair_status(rescue_points) == NBTreeExtentsList::RepairStatus::REPAIR) {
+                Logger::msg(AKU_LOG_ERROR, "Repair needed, id=" + std::to_string(rid));
+            }
+        }
+        auto tree = std::make_shared<NBTreeExtentsList>(rid, rescue_points, blockstore_);
+        column.add_rollup(step, std::move(tree));
+    }
+}
+
 aku_Status ColumnStore::open_or_restore(std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> const& mapping, bool force_init) {
     for (auto it: mapping) {
         aku_ParamId id = it.first;
+        if (is_rollup_id(id)) {
+            // Rollup trees are opened along with the columns
+            continue;
+        }
         std::vector<LogicAddr> const& rescue_points = it.second;
         if (rescue_points.empty()) {
             Logger::msg(AKU_LOG_ERROR, "Empty rescue points list found, leaf-node data was lost");
@@ -36,16 +117,15 @@ aku_Status ColumnStore::open_or_restore(std::unordered_map<aku_ParamId, std::vec
             Logger::msg(AKU_LOG_ERROR, "Repair needed, id=" + std::to_string(id));
         }
         auto tree = std::make_shared<NBTreeExtentsList>(id, rescue_points, blockstore_);
-
-        std::lock_guard<std::mutex> tl(table_lock_);
-        if (columns_.count(id)) {
+        tree->set_value_codec(codec_);
+        tree->set_reorder_window(reorder_window_);
+        add_rollups(*tree, mapping);
+        if (!columns_.insert(id, tree)) {
             Logger::msg(AKU_LOG_ERROR, "Can't open/repair " + std::to_string(id) + " (already exists)");
             return AKU_EBAD_ARG;
-        } else {
-            columns_[id] = std::move(tree);
         }
         if (force_init) {
-            columns_[id]->force_init();
+            tree->force_init();
         }
     }
     return AKU_SUCCESS;
@@ -53,14 +133,16 @@ aku_Status ColumnStore::open_or_restore(std::unordered_map<aku_ParamId, std::vec
 
 std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> ColumnStore::close() {
     std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> result;
-    std::lock_guard<std::mutex> tl(table_lock_);
     Logger::msg(AKU_LOG_INFO, "Column-store commit called");
-    for (auto it: columns_) {
-        if (it.second->is_initialized()) {
-            auto addrlist = it.second->close();
-            result[it.first] = addrlist;
+    columns_.for_each([&result](aku_ParamId id, std::shared_ptr<NBTreeExtentsList> const& column) {
+        if (column->is_initialized()) {
+            auto addrlist = column->close();
+            result[id] = addrlist;
+            for (auto& kv: column->close_rollups()) {
+                result[kv.first] = std::move(kv.second);
+            }
         }
-    }
+    });
     Logger::msg(AKU_LOG_INFO, "Column-store commit completed");
     return result;
 }
@@ -68,40 +150,140 @@ std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> ColumnSto
 aku_Status ColumnStore::create_new_column(aku_ParamId id) {
     std::vector<LogicAddr> empty;
     auto tree = std::make_shared<NBTreeExtentsList>(id, empty, blockstore_);
-    {
-        std::lock_guard<std::mutex> tl(table_lock_);
-        if (columns_.count(id)) {
-            return AKU_EBAD_ARG;
-        } else {
-            columns_[id] = std::move(tree);
-            columns_[id]->force_init();
-            return AKU_SUCCESS;
-        }
+    tree->set_value_codec(codec_);
+    tree->set_reorder_window(reorder_window_);
+    add_rollups(*tree, std::unordered_map<aku_ParamId, std::vector<LogicAddr>>());
+    // Tree should be initialized before it will be published
+    tree->force_init();
+    if (!columns_.insert(id, std::move(tree))) {
+        return AKU_EBAD_ARG;
     }
+    return AKU_SUCCESS;
 }
 
 size_t ColumnStore::_get_uncommitted_memory() const {
-    std::lock_guard<std::mutex> guard(table_lock_);
     size_t total_size = 0;
-    for (auto const& p: columns_) {
-        if (p.second->is_initialized()) {
-            total_size += p.second->_get_uncommitted_size();
+    columns_.for_each([&total_size](aku_ParamId, std::shared_ptr<NBTreeExtentsList> const& column) {
+        if (column->is_initialized()) {
+            total_size += column->_get_uncommitted_size();
         }
-    }
+    });
     return total_size;
 }
 
+//! Return upper bound of the aggregate
+static double get_upper_bound(NBTreeBounds const& bounds, AggregationFunction func) {
+    switch (func) {
+    case AggregationFunction::MIN:
+    case AggregationFunction::MAX:
+    case AggregationFunction::MEAN:
+        return bounds.max;
+    case AggregationFunction::CNT:
+        return bounds.cnt;
+    case AggregationFunction::SUM:
+        return bounds.sum;
+    default:
+        break;
+    };
+    return std::numeric_limits<double>::infinity();
+}
+
+aku_Status ColumnStore::top_aggregate(std::vector<aku_ParamId> const& ids,
+                                      aku_Timestamp begin,
+                                      aku_Timestamp end,
+                                      AggregationFunction func,
+                                      size_t N,
+                                      std::vector<std::unique_ptr<AggregateOperator>>* dest) const
+{
+    struct Candidate {
+        double bound;
+        size_t ix;
+        std::shared_ptr<NBTreeExtentsList> column;
+    };
+    std::vector<Candidate> candidates;
+    for (size_t ix = 0; ix < ids.size(); ix++) {
+        auto column = columns_.find(ids[ix]);
+        if (!column) {
+            return AKU_ENOT_FOUND;
+        }
+        if (!column->is_initialized()) {
+            column->force_init();
+        }
+        aku_Status status;
+        NBTreeBounds bounds;
+        std::tie(status, bounds) = column->get_bounds(begin, end);
+        if (status == AKU_SUCCESS) {
+            candidates.push_back({ get_upper_bound(bounds, func), ix, column });
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](Candidate const& lhs, Candidate const& rhs) {
+        return lhs.bound > rhs.bound;
+    });
+
+    // Min-heap of the N largest values (value, index of the series)
+    typedef std::pair<double, size_t> HeapItem;
+    std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap;
+    std::vector<std::tuple<aku_Timestamp, AggregationResult>> results(ids.size());
+    std::vector<bool> selected(ids.size(), false);
+    size_t nread = 0;
+    for (auto const& candidate: candidates) {
+        if (N == 0 || (heap.size() == N && candidate.bound <= heap.top().first)) {
+            // Remaining series can't get into the top
+            break;
+        }
+        auto iter = candidate.column->aggregate(begin, end);
+        aku_Timestamp ts;
+        AggregationResult agg;
+        aku_Status status;
+        size_t size;
+        std::tie(status, size) = iter->read(&ts, &agg, 1);
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return status;
+        }
+        nread++;
+        if (size != 1) {
+            continue;
+        }
+        double value = TupleOutputUtils::get(agg, func);
+        if (heap.size() < N) {
+            heap.push(std::make_pair(value, candidate.ix));
+        } else if (value > heap.top().first) {
+            selected.at(heap.top().second) = false;
+            heap.pop();
+            heap.push(std::make_pair(value, candidate.ix));
+        } else {
+            continue;
+        }
+        selected.at(candidate.ix) = true;
+        results.at(candidate.ix) = std::make_tuple(ts, agg);
+    }
+    QueryProfile::count(&QueryProfile::series_pruned, candidates.size() - nread);
+    Logger::msg(AKU_LOG_TRACE, "Top aggregate query: " + std::to_string(nread) + " out of " +
+                               std::to_string(ids.size()) + " series was read");
+
+    auto dir = begin < end ? AggregateOperator::Direction::FORWARD : AggregateOperator::Direction::BACKWARD;
+    for (size_t ix = 0; ix < ids.size(); ix++) {
+        std::unique_ptr<AggregateOperator> result;
+        if (selected.at(ix)) {
+            result.reset(new ValueAggregator(std::get<0>(results.at(ix)), std::get<1>(results.at(ix)), dir));
+        } else {
+            result.reset(new ValueAggregator());
+        }
+        dest->push_back(std::move(result));
+    }
+    return AKU_SUCCESS;
+}
+
 NBTreeAppendResult ColumnStore::write(aku_Sample const& sample, std::vector<LogicAddr>* rescue_points,
                                std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>>* cache_or_null)
 {
-    std::lock_guard<std::mutex> lock(table_lock_);
     aku_ParamId id = sample.paramid;
-    auto it = columns_.find(id);
-    if (it != columns_.end()) {
-        if (!it->second->is_initialized()) {
-            it->second->force_init();
+    // NOTE: table is locked only during lookup, tree has its own lock
+    auto tree = columns_.find(id);
+    if (tree) {
+        if (!tree->is_initialized()) {
+            tree->force_init();
         }
-        auto tree = it->second;
         auto res = tree->append(sample.timestamp, sample.payload.float64);
         if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
             auto tmp = tree->get_roots();
@@ -117,6 +299,28 @@ NBTreeAppendResult ColumnStore::write(aku_Sample const& sample, std::vector<Logi
     return NBTreeAppendResult::FAIL_BAD_ID;
 }
 
+NBTreeAppendResult ColumnStore::write_batch(aku_ParamId id, aku_Timestamp const* ts, double const* xs, size_t size,
+                                            std::vector<LogicAddr>* rescue_points, size_t* nlate, size_t* first_late,
+                                            std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>>* cache_or_null)
+{
+    auto tree = columns_.find(id);
+    if (tree) {
+        if (!tree->is_initialized()) {
+            tree->force_init();
+        }
+        auto res = tree->append(ts, xs, size, nlate, first_late);
+        if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            auto tmp = tree->get_roots();
+            rescue_points->swap(tmp);
+        }
+        if (cache_or_null != nullptr) {
+            cache_or_null->insert(std::make_pair(id, tree));
+        }
+        return res;
+    }
+    return NBTreeAppendResult::FAIL_BAD_ID;
+}
+
 
 // ////////////////////// //
 //      WriteSession      //
@@ -145,6 +349,87 @@ NBTreeAppendResult CStoreSession::write(aku_Sample const& sample, std::vector<Lo
     return cstore_->write(sample, rescue_points, &cache_);
 }
 
+NBTreeAppendResult CStoreSession::write_batch(const aku_Sample* samples, size_t size,
+                                              std::unordered_map<aku_ParamId, std::vector<LogicAddr>>* rescue_points)
+{
+    auto result = NBTreeAppendResult::OK;
+    // Samples are written in id order but the error of the first failed
+    // sample in the input order should be returned.
+    auto error = NBTreeAppendResult::OK;
+    size_t error_pos = size;
+    auto set_error = [&error, &error_pos](NBTreeAppendResult err, size_t pos) {
+        if (pos < error_pos) {
+            error = err;
+            error_pos = pos;
+        }
+    };
+    // Group samples by id, stable sort preserves order of samples inside each group
+    batch_index_.resize(size);
+    for (u32 i = 0; i < size; i++) {
+        batch_index_[i] = i;
+    }
+    std::stable_sort(batch_index_.begin(), batch_index_.end(), [samples](u32 lhs, u32 rhs) {
+        return samples[lhs].paramid < samples[rhs].paramid;
+    });
+    size_t i = 0;
+    while (i < size) {
+        aku_ParamId id = samples[batch_index_[i]].paramid;
+        batch_pos_.clear();
+        batch_ts_.clear();
+        batch_xs_.clear();
+        for (; i < size && samples[batch_index_[i]].paramid == id; i++) {
+            auto const& sample = samples[batch_index_[i]];
+            if (AKU_UNLIKELY(sample.payload.type != AKU_PAYLOAD_FLOAT)) {
+                set_error(NBTreeAppendResult::FAIL_BAD_VALUE, batch_index_[i]);
+                continue;
+            }
+            batch_pos_.push_back(batch_index_[i]);
+            batch_ts_.push_back(sample.timestamp);
+            batch_xs_.push_back(sample.payload.float64);
+        }
+        if (batch_ts_.empty()) {
+            continue;
+        }
+        NBTreeAppendResult res;
+        size_t nlate = 0;
+        size_t first_late = 0;
+        std::vector<LogicAddr> rpoints;
+        auto it = cache_.find(id);
+        if (it != cache_.end()) {
+            res = it->second->append(batch_ts_.data(), batch_xs_.data(), batch_ts_.size(), &nlate, &first_late);
+            if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+                rpoints = it->second->get_roots();
+            }
+        } else {
+            // Cache miss - access global registry
+            res = cstore_->write_batch(id, batch_ts_.data(), batch_xs_.data(), batch_ts_.size(),
+                                       &rpoints, &nlate, &first_late, &cache_);
+        }
+        if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            (*rescue_points)[id] = std::move(rpoints);
+            get_rollup_roots(id, rescue_points);
+            if (result == NBTreeAppendResult::OK) {
+                result = res;
+            }
+        } else if (res != NBTreeAppendResult::OK) {
+            // The whole group failed
+            set_error(res, batch_pos_.front());
+        }
+        if (nlate != 0) {
+            set_error(NBTreeAppendResult::FAIL_LATE_WRITE, batch_pos_.at(first_late));
+        }
+    }
+    return error_pos < size ? error : result;
+}
+
+void CStoreSession::get_rollup_roots(aku_ParamId id, std::unordered_map<aku_ParamId, std::vector<LogicAddr>>* dest) {
+    // Tree is added to the cache by the successful write
+    auto it = cache_.find(id);
+    if (it != cache_.end()) {
+        it->second->get_rollup_roots(dest);
+    }
+}
+
 void CStoreSession::close() {
     // This method can't be implemented yet, because it will waste space.
     // Leaf node recovery should be implemented first.
@@ -26,6 +26,7 @@
  */
 
 // Stdlib
+#include <array>
 #include <unordered_map>
 #include <mutex>
 #include <tuple>
@@ -40,13 +41,92 @@
 #include "metadatastorage.h"
 #include "index/seriesparser.h"
 #include "storage_engine/nbtree.h"
+#include "storage_engine/query_cache.h"
 #include "queryprocessor_framework.h"
 #include "log_iface.h"
+#include "util.h"
 
 namespace Akumuli {
 namespace StorageEngine {
 
 
+/** Series table. Maps series ids to columns.
+  * Table is split into a fixed number of shards. Each shard is a separate
+  * hash table protected by its own reader-writer lock, so resize of one shard
+  * doesn't affect lookups in other shards and lookups in the same shard don't
+  * block each other. Lock is held only during hash table probe, column itself
+  * is always accessed outside of the critical section.
+  */
+class SeriesTable {
+public:
+    typedef std::shared_ptr<NBTreeExtentsList> PColumn;
+
+private:
+    enum {
+        NSHARDS = 64,
+    };
+
+    struct Shard {
+        mutable RWLock lock;
+        std::unordered_map<aku_ParamId, PColumn> columns;
+    };
+
+    typedef LockGuard<RWLock, &RWLock::rdlock> ReadLock;
+    typedef LockGuard<RWLock, &RWLock::wrlock> WriteLock;
+
+    std::array<Shard, NSHARDS> shards_;
+
+    Shard& get_shard(aku_ParamId id) {
+        return shards_[id % NSHARDS];
+    }
+
+    Shard const& get_shard(aku_ParamId id) const {
+        return shards_[id % NSHARDS];
+    }
+
+public:
+    //! Find column by id, return nullptr if not found
+    PColumn find(aku_ParamId id) const {
+        auto const& shard = get_shard(id);
+        ReadLock guard(shard.lock); AKU_UNUSED(guard);
+        auto it = shard.columns.find(id);
+        if (it != shard.columns.end()) {
+            return it->second;
+        }
+        return PColumn();
+    }
+
+    //! Add new column, return false if column with the same id already exists
+    bool insert(aku_ParamId id, PColumn column) {
+        auto& shard = get_shard(id);
+        WriteLock guard(shard.lock); AKU_UNUSED(guard);
+        return shard.columns.insert(std::make_pair(id, std::move(column))).second;
+    }
+
+    /** Call `fn` for every column in the table.
+      * Shards are visited one by one, only the shard that is being visited is locked.
+      */
+    template<class Fn>
+    void for_each(Fn const& fn) const {
+        for (auto const& shard: shards_) {
+            ReadLock guard(shard.lock); AKU_UNUSED(guard);
+            for (auto const& kv: shard.columns) {
+                fn(kv.first, kv.second);
+            }
+        }
+    }
+
+    //! Copy content of the table
+    std::unordered_map<aku_ParamId, PColumn> copy() const {
+        std::unordered_map<aku_ParamId, PColumn> result;
+        for_each([&result](aku_ParamId id, PColumn const& column) {
+            result[id] = column;
+        });
+        return result;
+    }
+};
+
+
 /** Columns store.
   * Serve as a central data repository for series metadata and all individual columns.
   * Each column is addressed by the series name. Data can be written in through WriteSession
@@ -57,20 +137,59 @@ namespace StorageEngine {
   */
 class ColumnStore : public std::enable_shared_from_this<ColumnStore> {
     std::shared_ptr<StorageEngine::BlockStore> blockstore_;
-    std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> columns_;
+    //! Series table (sharded, thread-safe)
+    SeriesTable columns_;
     PlainSeriesMatcher global_matcher_;
     //! List of metadata to update
     std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> rescue_points_;
     //! Mutex for metadata storage and rescue points list
     mutable std::mutex metadata_lock_;
-    //! Mutex for table_ hashmap (shrink and resize)
-    mutable std::mutex table_lock_;
     //! Syncronization for watcher thread
     std::condition_variable cvar_;
+    //! Value codec of the new and reopened columns
+    StorageEngine::ValueCodec codec_;
+    //! Reorder window of the new and reopened columns
+    aku_Timestamp reorder_window_;
+    //! Group-aggregate results cache (null if disabled)
+    std::shared_ptr<GroupAggregateCache> query_cache_;
+    //! Rollup steps of the new and reopened columns
+    std::vector<aku_Timestamp> rollup_steps_;
+
+    //! Create rollup trees for the column
+    void add_rollups(NBTreeExtentsList& column,
+                     std::unordered_map<aku_ParamId, std::vector<LogicAddr>> const& mapping);
 
 public:
     ColumnStore(std::shared_ptr<StorageEngine::BlockStore> bstore);
 
+    /** Set value codec used by the columns created or opened after this call.
+      * Should be called before `open_or_restore`.
+      */
+    void set_value_codec(StorageEngine::ValueCodec codec);
+
+    /** Set reorder window used by the columns created or opened after this call.
+      * Should be called before `open_or_restore`.
+      */
+    void set_reorder_window(aku_Timestamp window);
+
+    /** Enable group-aggregate results cache.
+      * Should be called before any query is executed.
+      * @param size is a cache size limit in bytes (0 - disable cache)
+      */
+    void set_query_cache_size(size_t size);
+
+    //! Return group-aggregate results cache or null if cache is disabled
+    std::shared_ptr<GroupAggregateCache> get_query_cache() const;
+
+    /** Set rollup steps used by the columns created or opened after this call.
+      * Every column gets one rollup tree per step. Rollup trees are stored
+      * alongside the columns and share the mapping with them (rollup tree id
+      * is derived from the column id and the step).
+      * Should be called before `open_or_restore`.
+      * @param steps is a list of bucket sizes (should be multiples of one second)
+      */
+    void set_rollup_steps(std::vector<aku_Timestamp> const& steps);
+
     // No value semantics allowed.
     ColumnStore(ColumnStore const&) = delete;
     ColumnStore(ColumnStore &&) = delete;
@@ -93,11 +212,25 @@ public:
     NBTreeAppendResult write(aku_Sample const& sample, std::vector<LogicAddr> *rescue_points,
                      std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList> > *cache_or_null=nullptr);
 
+    /** Write run of values of the same series to data-store.
+      * @param id is a series id
+      * @param ts is an array of timestamps
+      * @param xs is an array of values
+      * @param size is a size of the `ts` and `xs` arrays
+      * @param rescue_points is updated if the result is OK_FLUSH_NEEDED
+      * @param nlate is a number of values that was skipped because they're out of order
+      * @param first_late is an index of the first skipped value (set only if `nlate` is not 0)
+      * @param cache_or_null is a pointer to external cache, tree ref will be added there on success
+      */
+    NBTreeAppendResult write_batch(aku_ParamId id, aku_Timestamp const* ts, double const* xs, size_t size,
+                                   std::vector<LogicAddr> *rescue_points, size_t *nlate, size_t *first_late,
+                                   std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList> > *cache_or_null=nullptr);
+
     size_t _get_uncommitted_memory() const;
 
     //! For debug reports
     std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> _get_columns() {
-        return columns_;
+        return columns_.copy();
     }
 
     // -------------
@@ -110,15 +243,14 @@ public:
                       const Fn& fn) const
     {
         for (auto id: ids) {
-            std::lock_guard<std::mutex> lg(table_lock_); AKU_UNUSED(lg);
-            auto it = columns_.find(id);
-            if (it != columns_.end()) {
-                if (!it->second->is_initialized()) {
-                    it->second->force_init();
+            auto column = columns_.find(id);
+            if (column) {
+                if (!column->is_initialized()) {
+                    column->force_init();
                 }
                 aku_Status s;
                 std::unique_ptr<IterType> iter;
-                std::tie(s, iter) = std::move(fn(*it->second));
+                std::tie(s, iter) = std::move(fn(*column));
                 if (s != AKU_SUCCESS) {
                     return s;
                 }
@@ -176,11 +308,33 @@ public:
                                aku_Timestamp step,
                                std::vector<std::unique_ptr<AggregateOperator>>* dest) const
     {
-        return iterate(ids, dest, [begin, end, step](const NBTreeExtentsList& elist) {
+        auto cache = query_cache_;
+        return iterate(ids, dest, [begin, end, step, cache](const NBTreeExtentsList& elist) {
+            if (cache) {
+                return std::make_tuple(AKU_SUCCESS, cache->group_aggregate(elist, begin, end, step));
+            }
             return std::make_tuple(AKU_SUCCESS, elist.group_aggregate(begin, end, step));
         });
     }
 
+    /** Compute percentiles for each `step` sized bucket (see NBTreeExtentsList::group_quantiles).
+      * Only forward direction is supported.
+      */
+    aku_Status group_quantiles(std::vector<aku_ParamId> const& ids,
+                               aku_Timestamp begin,
+                               aku_Timestamp end,
+                               aku_Timestamp step,
+                               std::vector<std::unique_ptr<QuantileOperator>>* dest) const
+    {
+        if (begin >= end || step == 0) {
+            Logger::msg(AKU_LOG_ERROR, "Percentiles can be computed only in forward direction");
+            return AKU_EBAD_ARG;
+        }
+        return iterate(ids, dest, [begin, end, step](const NBTreeExtentsList& elist) {
+            return std::make_tuple(AKU_SUCCESS, elist.group_quantiles(begin, end, step));
+        });
+    }
+
     aku_Status group_aggfilter(std::vector<aku_ParamId> const& ids,
                                aku_Timestamp begin,
                                aku_Timestamp end,
@@ -201,6 +355,20 @@ public:
             return std::make_tuple(AKU_EBAD_ARG, std::unique_ptr<AggregateOperator>());
         });
     }
+
+    /** Aggregate query that returns only `N` series with the largest aggregate value.
+      * Series are visited in order of the upper bound of the aggregate (computed
+      * without reading the data, see NBTreeExtentsList::get_bounds). Series which
+      * upper bound is not greater than the N-th largest value found so far are not read.
+      * Operators are added to `dest` in `ids` order, operators of the series that are
+      * not selected are empty.
+      */
+    aku_Status top_aggregate(std::vector<aku_ParamId> const& ids,
+                             aku_Timestamp begin,
+                             aku_Timestamp end,
+                             AggregationFunction func,
+                             size_t N,
+                             std::vector<std::unique_ptr<AggregateOperator>>* dest) const;
 };
 
 
@@ -214,6 +382,11 @@ class CStoreSession : public std::enable_shared_from_this<CStoreSession>
     std::shared_ptr<ColumnStore> cstore_;
     //! Tree cache
     std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> cache_;
+    //! Scratch buffers used by `write_batch`
+    std::vector<u32> batch_index_;
+    std::vector<u32> batch_pos_;
+    std::vector<aku_Timestamp> batch_ts_;
+    std::vector<double> batch_xs_;
 public:
     //! C-tor. Shouldn't be called directly.
     CStoreSession(std::shared_ptr<ColumnStore> registry);
@@ -225,6 +398,24 @@ public:
     //! Write sample
     NBTreeAppendResult write(const aku_Sample &sample, std::vector<LogicAddr>* rescue_points);
 
+    /** Write batch of samples. Samples are grouped by series id and each group is
+      * appended to its tree at once (order of samples inside each group is preserved).
+      * All valid samples are written even if some of them can't be.
+      * @param samples is an array of samples
+      * @param size is a size of the `samples` array
+      * @param rescue_points will receive updated rescue points of all trees that needs them
+      *        (it's updated even if error is returned)
+      * @return OK, OK_FLUSH_NEEDED or the error code of the first failed sample (in the input order)
+      */
+    NBTreeAppendResult write_batch(const aku_Sample* samples, size_t size,
+                                   std::unordered_map<aku_ParamId, std::vector<LogicAddr>>* rescue_points);
+
+    /** Add rescue points of the rollup trees of the series that were changed since
+      * the previous call to `dest`. Should be called when `write` returns OK_FLUSH_NEEDED
+      * (`write_batch` does this itself).
+      */
+    void get_rollup_roots(aku_ParamId id, std::unordered_map<aku_ParamId, std::vector<LogicAddr>>* dest);
+
     /**
      * Closes the session. This method should unload all cached trees
      */
@@ -5,6 +5,12 @@
 #include <unordered_map>
 #include <algorithm>
 #include <iostream>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AKU_VBYTE_SSSE3
+#endif
 
 namespace Akumuli {
 
@@ -55,8 +61,20 @@ void DfcmPredictor::update(u64 value) {
     last_value = value;
 }
 
+void DfcmPredictor::reset() {
+    std::fill(table.begin(), table.end(), 0ull);
+    last_hash = 0ull;
+    last_value = 0ull;
+}
+
 static const int PREDICTOR_N = 1 << 7;
 
+/** This byte can be written before the chunk of values. It tells the decoder
+  * to reset predictor state. Flag 0xF is never written (except in 0xFF shortcut)
+  * so this value can't be confused with the flags byte.
+  */
+static const u8 FCM_RESET_MARKER = 0xFE;
+
 template<class StreamT>
 static inline bool encode_value(StreamT& wstream, u64 diff, unsigned char flag) {
     int nbytes = (flag & 7) + 1;
@@ -120,6 +138,144 @@ static inline u64 decode_value(StreamT& rstream, unsigned char flag) {
     return diff;
 }
 
+//! Same as `decode_value` but reads all bytes using one unaligned load when possible
+static inline u64 decode_value_fast(VByteStreamReader& rstream, unsigned char flag) {
+    if (rstream.space_left() < sizeof(u64)) {
+        return decode_value(rstream, flag);
+    }
+    int nbytes = (flag & 7) + 1;
+    u64 diff;
+    memcpy(&diff, rstream.pos_, sizeof(u64));
+    if (nbytes < 8) {
+        diff &= (1ull << (nbytes*8)) - 1;
+    }
+    rstream.pos_ += nbytes;
+    int shift_width = (64 - nbytes*8)*(flag >> 3);
+    diff <<= shift_width;
+    return diff;
+}
+
+
+        // ///////////////////////////////// //
+        //     VByteStreamReader::next_chunk //
+        // ///////////////////////////////// //
+
+/** Chunk decoder. Decodes 8 pairs of values (16 values total), each pair is
+  * prefixed by the control byte. Returns new stream position.
+  */
+typedef const u8* (*VByteChunkDecoder)(const u8* pos, const u8* end, u64* out);
+
+static inline const u8* vbyte_decode_pair(const u8* pos, const u8* end, u64* out) {
+    if (pos == end) {
+        AKU_PANIC("can't read value, out of bounds");
+    }
+    u8 ctrl = *pos++;
+    int fstlen = ctrl & 0xF;
+    int sndlen = ctrl >> 4;
+    if (fstlen > 8 || sndlen > 8 || (end - pos) < (fstlen + sndlen)) {
+        AKU_PANIC("can't read value, out of bounds");
+    }
+    u64 fst = 0, snd = 0;
+    for (int i = 0; i < fstlen; i++) {
+        fst |= static_cast<u64>(*pos++) << (i*8);
+    }
+    for (int i = 0; i < sndlen; i++) {
+        snd |= static_cast<u64>(*pos++) << (i*8);
+    }
+    out[0] = fst;
+    out[1] = snd;
+    return pos;
+}
+
+static const u8* vbyte_decode_chunk_generic(const u8* pos, const u8* end, u64* out) {
+    for (int i = 0; i < VByteStreamReader::CHUNK_SIZE; i += 2) {
+        pos = vbyte_decode_pair(pos, end, out + i);
+    }
+    return pos;
+}
+
+#ifdef AKU_VBYTE_SSSE3
+/** Shuffle masks for pshufb. Mask for control byte `c` moves first `c & 0xF` bytes
+  * to the lower 64-bit lane and next `c >> 4` bytes to the upper lane, the rest
+  * is zeroed. Masks for invalid control bytes are never used.
+  */
+struct VByteShuffleTable {
+    u8 masks[256][16];
+
+    VByteShuffleTable() {
+        for (int ctrl = 0; ctrl < 256; ctrl++) {
+            int fstlen = ctrl & 0xF;
+            int sndlen = ctrl >> 4;
+            for (int i = 0; i < 16; i++) {
+                masks[ctrl][i] = 0x80;
+            }
+            if (fstlen > 8 || sndlen > 8) {
+                continue;
+            }
+            for (int i = 0; i < fstlen; i++) {
+                masks[ctrl][i] = static_cast<u8>(i);
+            }
+            for (int i = 0; i < sndlen; i++) {
+                masks[ctrl][8 + i] = static_cast<u8>(fstlen + i);
+            }
+        }
+    }
+};
+
+static const VByteShuffleTable VBYTE_SHUFFLE;
+
+__attribute__((target("ssse3")))
+static const u8* vbyte_decode_chunk_ssse3(const u8* pos, const u8* end, u64* out) {
+    for (int i = 0; i < VByteStreamReader::CHUNK_SIZE; i += 2) {
+        if ((end - pos) < 17) {
+            // Not enough space for the unaligned load (control byte + 16 bytes)
+            pos = vbyte_decode_pair(pos, end, out + i);
+            continue;
+        }
+        u8 ctrl = *pos++;
+        int fstlen = ctrl & 0xF;
+        int sndlen = ctrl >> 4;
+        if (fstlen > 8 || sndlen > 8) {
+            AKU_PANIC("can't read value, bad control byte");
+        }
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(VBYTE_SHUFFLE.masks[ctrl]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(data, mask));
+        pos += fstlen + sndlen;
+    }
+    return pos;
+}
+#endif
+
+static VByteChunkDecoder choose_vbyte_decoder() {
+#ifdef AKU_VBYTE_SSSE3
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        return &vbyte_decode_chunk_ssse3;
+    }
+#endif
+    return &vbyte_decode_chunk_generic;
+}
+
+static const VByteChunkDecoder vbyte_decode_chunk = choose_vbyte_decoder();
+
+void VByteStreamReader::next_chunk(u64* out) {
+    assert(cnt_ % CHUNK_SIZE == 0);
+    if (space_left() == 0) {
+        AKU_PANIC("can't read value, out of bounds");
+    }
+    if ((*pos_ >> 4) == 0xF) {
+        // Shortcut, all values are zeroes
+        pos_++;
+        std::fill(out, out + CHUNK_SIZE, 0ull);
+    } else {
+        pos_ = vbyte_decode_chunk(pos_, end_, out);
+    }
+    cnt_ += CHUNK_SIZE;
+    ctrl_ = 0;
+    scut_elements_ = 0;
+}
+
 
         // ///////////////////////////////// //
         // FcmStreamWriter & FcmStreamReader //
@@ -275,6 +431,12 @@ bool FcmStreamWriter::commit() {
     return stream_.commit();
 }
 
+bool FcmStreamWriter::reset() {
+    assert(nelements_ % 2 == 0);
+    predictor_.reset();
+    return stream_.put_raw(FCM_RESET_MARKER);
+}
+
 size_t CompressionUtil::compress_doubles(std::vector<double> const& input,
                                          Base128StreamWriter &wstream)
 {
@@ -362,6 +524,9 @@ FcmStreamReader::FcmStreamReader(VByteStreamReader& stream)
 
 double FcmStreamReader::next() {
     unsigned char flag = 0;
+    if (iter_ % 16 == 0 && nzeroes_ == 0) {
+        read_reset_marker();
+    }
     if (iter_++ % 2 == 0 && nzeroes_ == 0) {
         flags_ = static_cast<u32>(stream_.read_raw<u8>());
         if (flags_ == 0xFF) {
@@ -389,8 +554,436 @@ double FcmStreamReader::next() {
     return curr.real;
 }
 
+void FcmStreamReader::next_chunk(double* out) {
+    assert(iter_ % 16 == 0 && nzeroes_ == 0);
+    read_reset_marker();
+    u64 diffs[16];
+    u8 flags = stream_.read_raw<u8>();
+    if (flags == 0xFF) {
+        // Shortcut
+        std::fill(diffs, diffs + 16, 0ull);
+    } else {
+        for (int i = 0; i < 16; i += 2) {
+            if (i != 0) {
+                flags = stream_.read_raw<u8>();
+            }
+            diffs[i]     = decode_value_fast(stream_, static_cast<unsigned char>(flags >> 4));
+            diffs[i + 1] = decode_value_fast(stream_, static_cast<unsigned char>(flags & 0xF));
+        }
+    }
+    for (int i = 0; i < 16; i++) {
+        union {
+            u64 bits;
+            double real;
+        } curr = {};
+        u64 predicted = predictor_.predict_next();
+        curr.bits = predicted ^ diffs[i];
+        predictor_.update(curr.bits);
+        out[i] = curr.real;
+    }
+    iter_ += 16;
+}
+
+void FcmStreamReader::reset() {
+    assert(iter_ % 16 == 0 && nzeroes_ == 0);
+    predictor_.reset();
+    flags_ = 0;
+    iter_ = 0;
+}
+
+void FcmStreamReader::read_reset_marker() {
+    if (stream_.space_left() != 0 && *stream_.pos() == FCM_RESET_MARKER) {
+        stream_.read_raw<u8>();
+        predictor_.reset();
+    }
+}
+
 const u8 *FcmStreamReader::pos() const { return stream_.pos(); }
 
+        // ///////////////////////////////////// //
+        // Gorilla and Chimp128 encoders/decoders //
+        // ///////////////////////////////////// //
+
+static inline u64 double_to_bits(double value) {
+    union {
+        double real;
+        u64 bits;
+    } curr = {};
+    curr.real = value;
+    return curr.bits;
+}
+
+static inline double bits_to_double(u64 value) {
+    union {
+        u64 bits;
+        double real;
+    } curr = {};
+    curr.bits = value;
+    return curr.real;
+}
+
+namespace {
+
+//! Writes bit-strings (MSB first) to the byte stream
+struct BitStreamWriter {
+    VByteStreamWriter& stream_;
+    u32  acc_;
+    int  nbits_;
+    bool success_;
+
+    BitStreamWriter(VByteStreamWriter& stream)
+        : stream_(stream)
+        , acc_(0)
+        , nbits_(0)
+        , success_(true)
+    {
+    }
+
+    //! Write `n` lowest bits of the `value` (n <= 64)
+    void put(u64 value, int n) {
+        while (n > 0) {
+            int take = std::min(n, 8 - nbits_);
+            n -= take;
+            acc_ = (acc_ << take) | static_cast<u32>((value >> n) & ((1ull << take) - 1));
+            nbits_ += take;
+            if (nbits_ == 8) {
+                success_ = stream_.put_raw(static_cast<u8>(acc_)) && success_;
+                acc_ = 0;
+                nbits_ = 0;
+            }
+        }
+    }
+
+    //! Pad last byte with zeroes
+    bool flush() {
+        if (nbits_ != 0) {
+            put(0ull, 8 - nbits_);
+        }
+        return success_;
+    }
+};
+
+//! Reads bit-strings written by BitStreamWriter
+struct BitStreamReader {
+    VByteStreamReader& stream_;
+    u32 acc_;
+    int nbits_;
+
+    BitStreamReader(VByteStreamReader& stream)
+        : stream_(stream)
+        , acc_(0)
+        , nbits_(0)
+    {
+    }
+
+    //! Read `n` bits (n <= 64)
+    u64 get(int n) {
+        u64 result = 0;
+        while (n > 0) {
+            if (nbits_ == 0) {
+                acc_ = stream_.read_raw<u8>();
+                nbits_ = 8;
+            }
+            int take = std::min(n, nbits_);
+            n -= take;
+            nbits_ -= take;
+            result = (result << take) | ((acc_ >> nbits_) & ((1u << take) - 1));
+        }
+        return result;
+    }
+};
+
+}
+
+GorillaStreamWriter::GorillaStreamWriter(VByteStreamWriter& stream)
+    : stream_(stream)
+    , prev_(0)
+    , lead_(-1)
+    , trail_(0)
+    , reset_(false)
+{
+}
+
+bool GorillaStreamWriter::tput(double const* values, size_t n) {
+    assert(n == 16);
+    auto oldpos = stream_.pos_;
+    BitStreamWriter bits(stream_);
+    bits.put(reset_ ? 1 : 0, 1);
+    for (size_t i = 0; i < n; i++) {
+        u64 curr = double_to_bits(values[i]);
+        u64 diff = curr ^ prev_;
+        prev_ = curr;
+        if (diff == 0) {
+            bits.put(0, 1);
+            continue;
+        }
+        // Leading zeros count is stored using 5 bits
+        int lead = std::min(__builtin_clzl(diff), 31);
+        int trail = __builtin_ctzl(diff);
+        if (lead_ >= 0 && lead >= lead_ && trail >= trail_) {
+            // Meaningful bits fit into the previous window
+            bits.put(2, 2);
+            bits.put(diff >> trail_, 64 - lead_ - trail_);
+        } else {
+            int len = 64 - lead - trail;
+            bits.put(3, 2);
+            bits.put(static_cast<u64>(lead), 5);
+            bits.put(static_cast<u64>(len & 63), 6);  // 64 is stored as 0
+            bits.put(diff >> trail, len);
+            lead_ = lead;
+            trail_ = trail;
+        }
+    }
+    if (!bits.flush()) {
+        stream_.pos_ = oldpos;
+        return false;
+    }
+    reset_ = false;
+    return true;
+}
+
+bool GorillaStreamWriter::reset() {
+    prev_ = 0;
+    lead_ = -1;
+    trail_ = 0;
+    reset_ = true;
+    return true;
+}
+
+GorillaStreamReader::GorillaStreamReader(VByteStreamReader& stream)
+    : stream_(stream)
+    , prev_(0)
+    , lead_(-1)
+    , trail_(0)
+    , iter_(0)
+    , buffer_{}
+{
+}
+
+void GorillaStreamReader::decode(double* out) {
+    BitStreamReader bits(stream_);
+    if (bits.get(1) != 0) {
+        prev_ = 0;
+        lead_ = -1;
+        trail_ = 0;
+    }
+    for (int i = 0; i < 16; i++) {
+        if (bits.get(1) != 0) {
+            if (bits.get(1) != 0) {
+                lead_ = static_cast<int>(bits.get(5));
+                int len = static_cast<int>(bits.get(6));
+                if (len == 0) {
+                    len = 64;
+                }
+                trail_ = 64 - lead_ - len;
+            } else if (lead_ < 0) {
+                AKU_PANIC("Gorilla stream is corrupted");
+            }
+            prev_ ^= bits.get(64 - lead_ - trail_) << trail_;
+        }
+        out[i] = bits_to_double(prev_);
+    }
+}
+
+double GorillaStreamReader::next() {
+    if (iter_ % 16 == 0) {
+        decode(buffer_);
+    }
+    return buffer_[iter_++ % 16];
+}
+
+void GorillaStreamReader::next_chunk(double* out) {
+    assert(iter_ % 16 == 0);
+    decode(out);
+    iter_ += 16;
+}
+
+void GorillaStreamReader::reset() {
+    assert(iter_ % 16 == 0);
+    prev_ = 0;
+    lead_ = -1;
+    trail_ = 0;
+    iter_ = 0;
+}
+
+//! Value is XOR-ed with the matching previous value if result has more trailing zeros
+static const int CHIMP_THRESHOLD = 6 + ChimpStreamWriter::NPREV_LOG2;
+
+//! Rounded number of leading zeros, 3-bit code is stored instead of the actual value
+static const int CHIMP_LEADING[] = { 0, 8, 12, 16, 18, 20, 22, 24 };
+
+//! Number of leading zeros -> 3-bit code
+static const u8 CHIMP_LEADING_CODE[65] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7,
+};
+
+//! Hash of the low bits that should match to use previous value as a reference
+static inline u32 chimp_hash(u64 bits) {
+    u64 key = bits & ((1ull << (CHIMP_THRESHOLD + 1)) - 1);
+    return static_cast<u32>((key ^ (key >> 8)) & (ChimpStreamWriter::TABLE_SIZE - 1));
+}
+
+ChimpStreamWriter::ChimpStreamWriter(VByteStreamWriter& stream)
+    : stream_(stream)
+    , index_(0)
+    , lead_(65)
+    , reset_(false)
+{
+}
+
+bool ChimpStreamWriter::tput(double const* values, size_t n) {
+    assert(n == 16);
+    if (ring_.empty()) {
+        ring_.resize(NPREV);
+        table_.resize(TABLE_SIZE);
+    }
+    auto oldpos = stream_.pos_;
+    BitStreamWriter bits(stream_);
+    bits.put(reset_ ? 1 : 0, 1);
+    for (size_t i = 0; i < n; i++) {
+        u64 curr = double_to_bits(values[i]);
+        u32 hash = chimp_hash(curr);
+        // Lookup table only gives a hint, decoder reads the reference from the stream
+        u32 ref = table_[hash];
+        u64 diff = curr ^ ring_[ref];
+        int trail = diff == 0 ? 64 : __builtin_ctzl(diff);
+        bool use_ref = trail > CHIMP_THRESHOLD;
+        if (!use_ref) {
+            ref = (index_ + NPREV - 1) % NPREV;
+            diff = curr ^ ring_[ref];
+        }
+        if (diff == 0) {
+            // '00' flag followed by the reference
+            bits.put(ref, 2 + NPREV_LOG2);
+            lead_ = 65;
+        } else {
+            u8 code = CHIMP_LEADING_CODE[__builtin_clzl(diff)];
+            int lead = CHIMP_LEADING[code];
+            if (use_ref) {
+                int len = 64 - lead - trail;
+                bits.put(1, 2);
+                bits.put(ref, NPREV_LOG2);
+                bits.put(code, 3);
+                bits.put(static_cast<u64>(len), 6);
+                bits.put(diff >> trail, len);
+                lead_ = 65;
+            } else if (lead == lead_) {
+                bits.put(2, 2);
+                bits.put(diff, 64 - lead);
+            } else {
+                bits.put(3, 2);
+                bits.put(code, 3);
+                bits.put(diff, 64 - lead);
+                lead_ = lead;
+            }
+        }
+        u32 slot = index_ % NPREV;
+        ring_[slot] = curr;
+        table_[hash] = static_cast<u8>(slot);
+        index_++;
+    }
+    if (!bits.flush()) {
+        stream_.pos_ = oldpos;
+        return false;
+    }
+    reset_ = false;
+    return true;
+}
+
+bool ChimpStreamWriter::reset() {
+    std::fill(ring_.begin(), ring_.end(), 0ull);
+    std::fill(table_.begin(), table_.end(), 0);
+    index_ = 0;
+    lead_ = 65;
+    reset_ = true;
+    return true;
+}
+
+ChimpStreamReader::ChimpStreamReader(VByteStreamReader& stream)
+    : stream_(stream)
+    , index_(0)
+    , lead_(65)
+    , iter_(0)
+    , buffer_{}
+{
+}
+
+void ChimpStreamReader::decode(double* out) {
+    typedef ChimpStreamWriter Writer;
+    if (ring_.empty()) {
+        ring_.resize(Writer::NPREV);
+    }
+    BitStreamReader bits(stream_);
+    if (bits.get(1) != 0) {
+        std::fill(ring_.begin(), ring_.end(), 0ull);
+        index_ = 0;
+        lead_ = 65;
+    }
+    for (int i = 0; i < 16; i++) {
+        u64 prev = ring_[(index_ + Writer::NPREV - 1) % Writer::NPREV];
+        u64 curr;
+        switch (bits.get(2)) {
+        case 0:
+            curr = ring_[bits.get(Writer::NPREV_LOG2)];
+            lead_ = 65;
+            break;
+        case 1: {
+            u64 ref = ring_[bits.get(Writer::NPREV_LOG2)];
+            int lead = CHIMP_LEADING[bits.get(3)];
+            int len = static_cast<int>(bits.get(6));
+            if (len == 0 || lead + len > 64) {
+                AKU_PANIC("Chimp stream is corrupted");
+            }
+            curr = ref ^ (bits.get(len) << (64 - lead - len));
+            lead_ = 65;
+            break;
+        }
+        case 2:
+            if (lead_ > 64) {
+                AKU_PANIC("Chimp stream is corrupted");
+            }
+            curr = prev ^ bits.get(64 - lead_);
+            break;
+        default:
+            lead_ = CHIMP_LEADING[bits.get(3)];
+            curr = prev ^ bits.get(64 - lead_);
+            break;
+        };
+        ring_[index_ % Writer::NPREV] = curr;
+        index_++;
+        out[i] = bits_to_double(curr);
+    }
+}
+
+double ChimpStreamReader::next() {
+    if (iter_ % 16 == 0) {
+        decode(buffer_);
+    }
+    return buffer_[iter_++ % 16];
+}
+
+void ChimpStreamReader::next_chunk(double* out) {
+    assert(iter_ % 16 == 0);
+    decode(out);
+    iter_ += 16;
+}
+
+void ChimpStreamReader::reset() {
+    assert(iter_ % 16 == 0);
+    std::fill(ring_.begin(), ring_.end(), 0ull);
+    index_ = 0;
+    lead_ = 65;
+    iter_ = 0;
+}
+
 void CompressionUtil::decompress_doubles(Base128StreamReader &rstream,
                                          size_t                   numvalues,
                                          std::vector<double>     *output)
@@ -592,38 +1185,139 @@ bool CompressionUtil::convert_from_time_order(UncompressedChunk const& header, U
 
 namespace StorageEngine {
 
+static_assert(AKUMULI_VERSION < (1 << DataBlockWriter::CODEC_SHIFT), "Version overlaps with codec id");
+
 DataBlockWriter::DataBlockWriter()
     : stream_(nullptr, nullptr)
     , ts_stream_(stream_)
-    , val_stream_(stream_)
+    , fcm_stream_(stream_)
+    , gorilla_stream_(stream_)
+    , chimp_stream_(stream_)
+    , codec_(ValueCodec::FCM)
     , write_index_(0)
+    , version_(nullptr)
     , nchunks_(nullptr)
     , ntail_(nullptr)
+    , dir_offset_(nullptr)
+    , dir_(nullptr)
+    , buf_end_(nullptr)
+    , last_entry_(0)
 {
 }
 
-DataBlockWriter::DataBlockWriter(aku_ParamId id, u8 *buf, int size)
+DataBlockWriter::DataBlockWriter(aku_ParamId id, u8 *buf, int size, ValueCodec codec)
     : stream_(buf, buf + size)
     , ts_stream_(stream_)
-    , val_stream_(stream_)
+    , fcm_stream_(stream_)
+    , gorilla_stream_(stream_)
+    , chimp_stream_(stream_)
+    , codec_(ValueCodec::FCM)
     , write_index_(0)
+    , dir_(nullptr)
+    , buf_end_(buf + size)
+    , last_entry_(INDEXED_HEADER_SIZE)
 {
     // offset 0
-    auto success = stream_.put_raw<u16>(AKUMULI_VERSION);
+    version_ = stream_.allocate<u16>();
     // offset 2
     nchunks_ = stream_.allocate<u16>();
     // offset 4
     ntail_ = stream_.allocate<u16>();
     // offset 6
-    success = stream_.put_raw(id) && success;
-    if (!success || nchunks_ == nullptr || ntail_ == nullptr) {
+    auto success = stream_.put_raw(id);
+    // offset 14
+    dir_offset_ = stream_.allocate<u16>();
+    if (!success || version_ == nullptr || nchunks_ == nullptr || ntail_ == nullptr || dir_offset_ == nullptr) {
         AKU_PANIC("Buffer is too small (3)");
     }
+    set_codec(codec);
     *ntail_ = 0;
     *nchunks_ = 0;
+    *dir_offset_ = 0;
+    if (size <= 0xFFFF) {
+        // Chunk offsets are 16-bit, directory can't be used with larger buffers.
+        // Space for the number of entries is reserved in advance.
+        dir_ = buf + size;
+        stream_.end_ = dir_ - sizeof(u16);
+    }
+    if (codec == ValueCodec::ADAPTIVE && stream_.space_left() < ADAPTIVE_NCHUNKS*(MAX_CHUNK_SIZE + DIRECTORY_ENTRY_SIZE + 1)) {
+        // Buffered elements may not fit into the small block
+        set_codec(ValueCodec::FCM);
+    }
+}
+
+void DataBlockWriter::set_codec(ValueCodec codec) {
+    codec_ = codec;
+    u16 id = codec == ValueCodec::ADAPTIVE ? 0 : static_cast<u16>(codec);
+    *version_ = static_cast<u16>(AKUMULI_VERSION | INDEXED_VERSION_FLAG | (id << CODEC_SHIFT));
+}
+
+ValueCodec DataBlockWriter::get_codec() const {
+    return codec_;
+}
+
+//! Return size of the first `nchunks` chunks of `xs` compressed using `Writer`
+template<class Writer>
+static size_t trial_encode(double const* xs, int nchunks) {
+    u8 buffer[DataBlockWriter::ADAPTIVE_NCHUNKS*DataBlockWriter::MAX_CHUNK_SIZE];
+    VByteStreamWriter stream(buffer, buffer + sizeof(buffer));
+    Writer writer(stream);
+    for (int i = 0; i < nchunks; i++) {
+        if (!writer.tput(xs + i*DataBlockWriter::CHUNK_SIZE, DataBlockWriter::CHUNK_SIZE)) {
+            return sizeof(buffer);
+        }
+    }
+    return stream.size();
+}
+
+aku_Status DataBlockWriter::select_codec() {
+    int nchunks = static_cast<int>(trial_xs_.size() / CHUNK_SIZE);
+    ValueCodec codec = ValueCodec::FCM;
+    if (nchunks != 0) {
+        size_t fcm = trial_encode<FcmStreamWriter>(trial_xs_.data(), nchunks);
+        size_t gorilla = trial_encode<GorillaStreamWriter>(trial_xs_.data(), nchunks);
+        size_t chimp = trial_encode<ChimpStreamWriter>(trial_xs_.data(), nchunks);
+        if (gorilla < fcm && gorilla <= chimp) {
+            codec = ValueCodec::GORILLA;
+        } else if (chimp < fcm && chimp < gorilla) {
+            codec = ValueCodec::CHIMP;
+        }
+    }
+    set_codec(codec);
+    std::vector<aku_Timestamp> ts;
+    std::vector<double> xs;
+    std::swap(ts, trial_ts_);
+    std::swap(xs, trial_xs_);
+    for (size_t i = 0; i < ts.size(); i++) {
+        // Can't overflow, c-tor checks that the buffer is large enough
+        auto status = put(ts[i], xs[i]);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+bool DataBlockWriter::put_values(bool reset) {
+    switch (codec_) {
+    case ValueCodec::GORILLA:
+        return (!reset || gorilla_stream_.reset()) && gorilla_stream_.tput(val_writebuf_, CHUNK_SIZE);
+    case ValueCodec::CHIMP:
+        return (!reset || chimp_stream_.reset()) && chimp_stream_.tput(val_writebuf_, CHUNK_SIZE);
+    default:
+        return (!reset || fcm_stream_.reset()) && fcm_stream_.tput(val_writebuf_, CHUNK_SIZE);
+    };
 }
 
 aku_Status DataBlockWriter::put(aku_Timestamp ts, double value) {
+    if (codec_ == ValueCodec::ADAPTIVE) {
+        trial_ts_.push_back(ts);
+        trial_xs_.push_back(value);
+        if (trial_xs_.size() < ADAPTIVE_NCHUNKS*CHUNK_SIZE) {
+            return AKU_SUCCESS;
+        }
+        return select_codec();
+    }
     if (room_for_chunk()) {
         // Invariant 1: number of elements stored in write buffer (ts_writebuf_ val_writebuf_)
         // equals `write_index_ % CHUNK_SIZE`.
@@ -631,9 +1325,23 @@ aku_Status DataBlockWriter::put(aku_Timestamp ts, double value) {
         val_writebuf_[write_index_ & CHUNK_MASK] = value;
         write_index_++;
         if ((write_index_ & CHUNK_MASK) == 0) {
+            bool indexed = next_chunk_indexed();
+            if (indexed) {
+                // Add directory entry, `room_for_chunk` reserves space for it
+                u16 offset = static_cast<u16>(stream_.size());
+                u16 chunk  = *nchunks_;
+                dir_ -= DIRECTORY_ENTRY_SIZE;
+                stream_.end_ = dir_ - sizeof(u16);
+                memcpy(dir_, &ts_writebuf_[0], sizeof(aku_Timestamp));
+                memcpy(dir_ + sizeof(aku_Timestamp), &offset, sizeof(u16));
+                memcpy(dir_ + sizeof(aku_Timestamp) + sizeof(u16), &chunk, sizeof(u16));
+                last_entry_ = offset;
+            }
             // put timestamps
             if (ts_stream_.tput(ts_writebuf_, CHUNK_SIZE)) {
-                if (val_stream_.tput(val_writebuf_, CHUNK_SIZE)) {
+                // Value predictor starts from scratch in indexed chunk so the
+                // reader could start decoding from it
+                if (put_values(indexed)) {
                     *nchunks_ += 1;
                     return AKU_SUCCESS;
                 }
@@ -659,6 +1367,12 @@ aku_Status DataBlockWriter::put(aku_Timestamp ts, double value) {
 }
 
 size_t DataBlockWriter::commit() {
+    if (codec_ == ValueCodec::ADAPTIVE) {
+        // Block contains less than `ADAPTIVE_NCHUNKS` chunks
+        auto status = select_codec();
+        AKU_UNUSED(status);
+        assert(status == AKU_SUCCESS);
+    }
     // It should be possible to store up to one million chunks in one block,
     // for 4K block size this is more then enough.
     auto nchunks = write_index_ / CHUNK_SIZE;
@@ -687,24 +1401,57 @@ size_t DataBlockWriter::commit() {
     }
     assert(nchunks <= 0xFFFF);
     *nchunks_ = static_cast<u16>(nchunks);
+    if (dir_) {
+        // Move directory right after the tail elements (entries are stored
+        // in reverse order at the end of the buffer)
+        std::vector<u8> dir(static_cast<const u8*>(dir_), buf_end_);
+        auto nentries = static_cast<u16>(dir.size() / DIRECTORY_ENTRY_SIZE);
+        auto dir_offset = static_cast<u16>(stream_.size());
+        stream_.end_ = buf_end_;
+        auto success = stream_.put_raw(nentries);
+        for (size_t i = nentries; i --> 0;) {
+            const u8* entry = dir.data() + i*DIRECTORY_ENTRY_SIZE;
+            for (int j = 0; j < DIRECTORY_ENTRY_SIZE; j++) {
+                success = stream_.put_raw(entry[j]) && success;
+            }
+        }
+        if (!success) {
+            // Space for the directory is reserved by `room_for_chunk`
+            AKU_PANIC("Can't write chunk directory");
+        }
+        *dir_offset_ = dir_offset;
+        dir_ = nullptr;
+    }
     return stream_.size();
 }
 
 bool DataBlockWriter::room_for_chunk() const {
-    static const size_t MARGIN = 10*16 + 9*16;  // worst case
     auto free_space = stream_.space_left();
-    if (free_space < MARGIN) {
+    size_t required = MAX_CHUNK_SIZE;
+    if (next_chunk_indexed()) {
+        // directory entry + predictor reset marker
+        required += DIRECTORY_ENTRY_SIZE + 1;
+    }
+    if (free_space < required) {
         return false;
     }
     return true;
 }
 
+bool DataBlockWriter::next_chunk_indexed() const {
+    return dir_ != nullptr && *nchunks_ != 0 && stream_.size() - last_entry_ >= DIRECTORY_SPACING;
+}
+
 void DataBlockWriter::read_tail_elements(std::vector<aku_Timestamp>* timestamps,
                                          std::vector<double>* values) const {
     // Note: this method can be used to read values from
     // write buffer. It sort of breaks incapsulation but
     // we don't need  to maintain  another  write buffer
     // anywhere else.
+    for (size_t i = 0; i < trial_ts_.size(); i++) {
+        timestamps->push_back(trial_ts_[i]);
+        values->push_back(trial_xs_[i]);
+    }
     auto tailsize = write_index_ & CHUNK_MASK;
     for (int i = 0; i < tailsize; i++) {
         timestamps->push_back(ts_writebuf_[i]);
@@ -716,7 +1463,7 @@ int DataBlockWriter::get_write_index() const {
     // Note: we need to be able to read this index to
     // get rid of write index inside NBTreeLeaf.
     if (!stream_.empty()) {
-        return *ntail_ + write_index_;
+        return *ntail_ + write_index_ + static_cast<int>(trial_ts_.size());
     }
     return 0;
 }
@@ -725,22 +1472,15 @@ int DataBlockWriter::get_write_index() const {
 // DataBlockReader implementation //
 // ////////////////////////////// //
 
-DataBlockReader::DataBlockReader(u8 const* buf, size_t bufsize)
-    : begin_(buf)
-    , stream_(buf + DataBlockWriter::HEADER_SIZE, buf + bufsize)
-    , ts_stream_(stream_)
-    , val_stream_(stream_)
-    , read_buffer_{}
-    , read_index_(0)
-{
-    assert(bufsize > 13);
-}
-
 static u16 get_block_version(const u8* pdata) {
     u16 version = *reinterpret_cast<const u16*>(pdata);
     return version;
 }
 
+static bool is_indexed(const u8* pdata) {
+    return (get_block_version(pdata) & DataBlockWriter::INDEXED_VERSION_FLAG) != 0;
+}
+
 static u32 get_main_size(const u8* pdata) {
     u16 main = *reinterpret_cast<const u16*>(pdata + 2);
     return static_cast<u32>(main) * DataBlockReader::CHUNK_SIZE;
@@ -757,16 +1497,123 @@ static aku_ParamId get_block_id(const u8* pdata) {
     return id;
 }
 
+static u16 get_directory_offset(const u8* pdata) {
+    u16 offset = *reinterpret_cast<const u16*>(pdata + 14);
+    return offset;
+}
+
+static ValueCodec get_value_codec(const u8* pdata) {
+    if (!is_indexed(pdata)) {
+        return ValueCodec::FCM;
+    }
+    u16 id = (get_block_version(pdata) & DataBlockWriter::CODEC_MASK) >> DataBlockWriter::CODEC_SHIFT;
+    switch (id) {
+    case static_cast<u16>(ValueCodec::FCM):
+    case static_cast<u16>(ValueCodec::GORILLA):
+    case static_cast<u16>(ValueCodec::CHIMP):
+        return static_cast<ValueCodec>(id);
+    };
+    AKU_PANIC("Unknown value codec " + std::to_string(id));
+}
+
+static size_t get_header_size(const u8* pdata) {
+    return is_indexed(pdata) ? DataBlockWriter::INDEXED_HEADER_SIZE
+                             : DataBlockWriter::HEADER_SIZE;
+}
+
+DataBlockReader::DataBlockReader(u8 const* buf, size_t bufsize)
+    : begin_(buf)
+    , stream_(buf + get_header_size(buf), buf + bufsize)
+    , ts_stream_(stream_)
+    , fcm_stream_(stream_)
+    , gorilla_stream_(stream_)
+    , chimp_stream_(stream_)
+    , codec_(get_value_codec(buf))
+    , read_buffer_{}
+    , read_index_(0)
+    , directory_(nullptr)
+    , dir_size_(0)
+{
+    assert(bufsize > 13);
+    // Directory offset is zero until the block is committed
+    size_t offset = is_indexed(buf) ? get_directory_offset(buf) : 0;
+    if (offset != 0 && offset + sizeof(u16) <= bufsize) {
+        u16 nentries;
+        memcpy(&nentries, buf + offset, sizeof(u16));
+        if (offset + sizeof(u16) + nentries*DataBlockWriter::DIRECTORY_ENTRY_SIZE <= bufsize) {
+            directory_ = buf + offset + sizeof(u16);
+            dir_size_ = nentries;
+        }
+    }
+}
+
+aku_Timestamp DataBlockReader::get_dir_timestamp(u32 ix) const {
+    aku_Timestamp ts;
+    memcpy(&ts, directory_ + ix*DataBlockWriter::DIRECTORY_ENTRY_SIZE, sizeof(aku_Timestamp));
+    return ts;
+}
+
+u16 DataBlockReader::get_dir_offset(u32 ix) const {
+    u16 offset;
+    memcpy(&offset, directory_ + ix*DataBlockWriter::DIRECTORY_ENTRY_SIZE + sizeof(aku_Timestamp), sizeof(u16));
+    return offset;
+}
+
+u16 DataBlockReader::get_dir_chunk(u32 ix) const {
+    u16 chunk;
+    memcpy(&chunk, directory_ + ix*DataBlockWriter::DIRECTORY_ENTRY_SIZE + sizeof(aku_Timestamp) + sizeof(u16), sizeof(u16));
+    return chunk;
+}
+
+u32 DataBlockReader::dir_upper_bound(aku_Timestamp ts) const {
+    u32 lo = 0, hi = dir_size_;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (get_dir_timestamp(mid) <= ts) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+double DataBlockReader::next_value() {
+    switch (codec_) {
+    case ValueCodec::GORILLA:
+        return gorilla_stream_.next();
+    case ValueCodec::CHIMP:
+        return chimp_stream_.next();
+    default:
+        return fcm_stream_.next();
+    };
+}
+
+void DataBlockReader::next_value_chunk(double* out) {
+    switch (codec_) {
+    case ValueCodec::GORILLA:
+        gorilla_stream_.next_chunk(out);
+        break;
+    case ValueCodec::CHIMP:
+        chimp_stream_.next_chunk(out);
+        break;
+    default:
+        fcm_stream_.next_chunk(out);
+        break;
+    };
+}
+
 std::tuple<aku_Status, aku_Timestamp, double> DataBlockReader::next() {
     if (read_index_ < get_main_size(begin_)) {
-        auto chunk_index = read_index_++ & CHUNK_MASK;
+        auto chunk_index = read_index_ & CHUNK_MASK;
         if (chunk_index == 0) {
             // read all timestamps
             for (int i = 0; i < CHUNK_SIZE; i++) {
                 read_buffer_[i] = ts_stream_.next();
             }
         }
-        double value = val_stream_.next();
+        read_index_++;
+        double value = next_value();
         return std::make_tuple(AKU_SUCCESS, read_buffer_[chunk_index], value);
     } else {
         // handle tail values
@@ -780,6 +1627,93 @@ std::tuple<aku_Status, aku_Timestamp, double> DataBlockReader::next() {
     return std::make_tuple(AKU_ENO_DATA, 0ull, 0.0);
 }
 
+std::tuple<aku_Status, size_t> DataBlockReader::read_all(aku_Timestamp* ts, double* xs, size_t n) {
+    size_t ix = 0;
+    const u32 main_size = get_main_size(begin_);
+    // Finish partially read chunk first
+    while (ix < n && (read_index_ & CHUNK_MASK) != 0 && read_index_ < main_size) {
+        aku_Status status;
+        std::tie(status, ts[ix], xs[ix]) = next();
+        AKU_UNUSED(status);
+        ix++;
+    }
+    // Decode whole chunks directly into the output
+    while (n - ix >= CHUNK_SIZE && read_index_ < main_size) {
+        ts_stream_.next_chunk(ts + ix);
+        next_value_chunk(xs + ix);
+        read_index_ += CHUNK_SIZE;
+        ix += CHUNK_SIZE;
+    }
+    // Uncompressed tail or the beginning of the chunk that doesn't fit
+    while (ix < n) {
+        aku_Status status;
+        std::tie(status, ts[ix], xs[ix]) = next();
+        if (status != AKU_SUCCESS) {
+            break;
+        }
+        ix++;
+    }
+    if (ix == 0 && n != 0) {
+        return std::make_tuple(AKU_ENO_DATA, 0ul);
+    }
+    return std::make_tuple(AKU_SUCCESS, ix);
+}
+
+void DataBlockReader::seek(aku_Timestamp ts) {
+    if (directory_ == nullptr || read_index_ != 0) {
+        return;
+    }
+    // Find last directory entry with timestamp < ts, previous chunk
+    // can contain elements with the same timestamp
+    u32 lo = ts == 0 ? 0 : dir_upper_bound(ts - 1);
+    if (lo == 0) {
+        // Should start from the first chunk anyway
+        return;
+    }
+    u32 ix = lo - 1;
+    const u8* chunk = begin_ + get_dir_offset(ix);
+    // Delta-delta decoder needs the previous timestamp. Decode first element
+    // of the chunk to find it.
+    VByteStreamReader peek(chunk, stream_.end_);
+    DeltaDeltaReader peek_ts(peek);
+    aku_Timestamp delta = peek_ts.next();
+    stream_ = VByteStreamReader(chunk, stream_.end_);
+    ts_stream_.prev_ = get_dir_timestamp(ix) - delta;
+    ts_stream_.counter_ = 0;
+    // Predictor will be reset by the marker stored in the chunk
+    switch (codec_) {
+    case ValueCodec::GORILLA:
+        gorilla_stream_.reset();
+        break;
+    case ValueCodec::CHIMP:
+        chimp_stream_.reset();
+        break;
+    default:
+        fcm_stream_.reset();
+        break;
+    };
+    read_index_ = get_dir_chunk(ix) * CHUNK_SIZE;
+}
+
+size_t DataBlockReader::nelements_until(aku_Timestamp ts) const {
+    size_t total = nelements();
+    if (directory_ == nullptr) {
+        return total;
+    }
+    // Find first directory entry with timestamp > ts
+    u32 lo = dir_upper_bound(ts);
+    if (lo == dir_size_) {
+        return total;
+    }
+    // Include one chunk after `ts`
+    size_t result = static_cast<size_t>(get_dir_chunk(lo)) * CHUNK_SIZE + CHUNK_SIZE;
+    return std::min(result, total);
+}
+
+size_t DataBlockReader::position() const {
+    return read_index_;
+}
+
 size_t DataBlockReader::nelements() const {
     return get_total_size(begin_);
 }
@@ -792,6 +1726,10 @@ u16 DataBlockReader::version() const {
     return get_block_version(begin_);
 }
 
+ValueCodec DataBlockReader::get_codec() const {
+    return codec_;
+}
+
 }
 
 }
@@ -502,6 +502,12 @@ struct VByteStreamReader {
         return acc;
     }
 
+    /** Decode whole chunk (CHUNK_SIZE values) written by VByteStreamWriter::tput.
+      * Stream should be positioned at the beginning of the chunk. Uses SIMD
+      * kernel if it's supported by the CPU.
+      */
+    void next_chunk(u64* out);
+
     template <class TVal> TVal next_base128() {
         Base128Int<TVal> value;
         auto             p = value.get(pos_, end_);
@@ -702,6 +708,20 @@ template <size_t Step, typename TVal> struct DeltaDeltaStreamReader {
         return value;
     }
 
+    //! Decode `Step` values at once. Can be called only on the chunk boundary.
+    void next_chunk(TVal* out) {
+        assert(counter_ % Step == 0);
+        min_ = stream_.next_base128<TVal>();
+        stream_.next_chunk(out);
+        TVal acc = prev_;
+        for (size_t i = 0; i < Step; i++) {
+            acc   += out[i] + min_;
+            out[i] = acc;
+        }
+        prev_     = acc;
+        counter_ += Step;
+    }
+
     const unsigned char* pos() const { return stream_.pos(); }
 };
 
@@ -825,6 +845,9 @@ struct DfcmPredictor {
     u64 predict_next() const;
 
     void update(u64 value);
+
+    //! Return to the initial state
+    void reset();
 };
 
 // 2nd order DFCM predictor
@@ -866,6 +889,11 @@ struct FcmStreamWriter {
     size_t size() const;
 
     bool commit();
+
+    /** Reset predictor state and write the marker that tells the decoder
+      * to do the same (should be called only on the chunk boundary).
+      */
+    bool reset();
 };
 
 //! FCM to double decoder
@@ -880,7 +908,116 @@ struct FcmStreamReader {
 
     double next();
 
+    //! Decode 16 values at once. Can be called only on the chunk boundary.
+    void next_chunk(double* out);
+
+    //! Reset predictor state (should be called only on the chunk boundary)
+    void reset();
+
     const u8* pos() const;
+
+private:
+    //! Reset predictor if the next chunk starts with the reset marker
+    void read_reset_marker();
+};
+
+/** Double to Gorilla XOR encoder.
+  * Each value is XOR-ed with the previous one and only meaningful bits of the result
+  * are stored. If meaningful bits fit into the window of the previous value, window
+  * is reused, otherwise new window (5-bit leading zeros count and 6-bit length) is
+  * stored. Every chunk is stored as a separate bit-string padded to the byte boundary.
+  * First bit of the chunk tells the decoder that encoder state was reset.
+  */
+struct GorillaStreamWriter {
+    VByteStreamWriter&   stream_;
+    u64                  prev_;
+    int                  lead_;   //! Leading zeros of the window (-1 if there is no window)
+    int                  trail_;  //! Trailing zeros of the window
+    bool                 reset_;  //! Next chunk should have reset flag
+
+    GorillaStreamWriter(VByteStreamWriter& stream);
+
+    //! Encode 16 values (transactional)
+    bool tput(double const* values, size_t n);
+
+    //! Reset encoder state (should be called only on the chunk boundary)
+    bool reset();
+};
+
+//! Gorilla XOR to double decoder
+struct GorillaStreamReader {
+    VByteStreamReader&   stream_;
+    u64                  prev_;
+    int                  lead_;
+    int                  trail_;
+    u32                  iter_;
+    double               buffer_[16];  //! Decoded chunk (used by `next`)
+
+    GorillaStreamReader(VByteStreamReader& stream);
+
+    double next();
+
+    //! Decode 16 values at once. Can be called only on the chunk boundary.
+    void next_chunk(double* out);
+
+    //! Reset decoder state (should be called only on the chunk boundary)
+    void reset();
+
+private:
+    //! Decode the next chunk
+    void decode(double* out);
+};
+
+/** Double to Chimp128 encoder.
+  * Improved version of the Gorilla encoding. Value is XOR-ed with one of the 128 previous
+  * values (the one that has the same low bits) or with the previous value. Number of
+  * leading zeros is rounded and stored using 3 bits, trailing zeros are stored only if
+  * there is a lot of them. Chunks are stored the same way as in Gorilla encoding.
+  */
+struct ChimpStreamWriter {
+    enum {
+        NPREV = 128,     //! Number of previous values
+        NPREV_LOG2 = 7,
+        TABLE_SIZE = 256,  //! Size of the low bits lookup table
+    };
+    VByteStreamWriter&   stream_;
+    std::vector<u64>     ring_;   //! Previous values (allocated on first use)
+    std::vector<u8>      table_;  //! Low bits hash -> position in `ring_`
+    u32                  index_;  //! Number of values encoded since reset
+    int                  lead_;   //! Stored leading zeros (65 if not set)
+    bool                 reset_;  //! Next chunk should have reset flag
+
+    ChimpStreamWriter(VByteStreamWriter& stream);
+
+    //! Encode 16 values (transactional)
+    bool tput(double const* values, size_t n);
+
+    //! Reset encoder state (should be called only on the chunk boundary)
+    bool reset();
+};
+
+//! Chimp128 to double decoder
+struct ChimpStreamReader {
+    VByteStreamReader&   stream_;
+    std::vector<u64>     ring_;
+    u32                  index_;
+    int                  lead_;
+    u32                  iter_;
+    double               buffer_[16];  //! Decoded chunk (used by `next`)
+
+    ChimpStreamReader(VByteStreamReader& stream);
+
+    double next();
+
+    //! Decode 16 values at once. Can be called only on the chunk boundary.
+    void next_chunk(double* out);
+
+    //! Reset decoder state (should be called only on the chunk boundary)
+    void reset();
+
+private:
+    //! Decode the next chunk
+    void decode(double* out);
 };
 
 
@@ -978,20 +1115,76 @@ typedef DeltaDeltaStreamWriter<16, u64> DeltaDeltaWriter;
 
 namespace StorageEngine {
 
+//! Codec used to compress values inside the data block
+enum class ValueCodec {
+    FCM      = 0,  //! FCM/DFCM predictor (default, the only codec used by older blocks)
+    GORILLA  = 1,  //! Gorilla XOR encoding
+    CHIMP    = 2,  //! Chimp128 encoding
+    /** Trial-encode first chunks using every codec and use the one that produced
+      * the smallest output. Never stored in the block header.
+      */
+    ADAPTIVE = 7,
+};
+
+/** Data block layout:
+  * @li header (version, number of chunks, number of tail elements, series id and,
+  *     for indexed blocks, offset of the chunk directory);
+  * @li compressed chunks (16 timestamps followed by 16 values);
+  * @li uncompressed tail elements;
+  * @li chunk directory (indexed blocks only).
+  *
+  * Chunk directory starts with the number of entries. Every entry references a chunk
+  * (timestamp of the first element, offset and index of the chunk). New entry is added
+  * when at least `DIRECTORY_SPACING` bytes were written after the previous one. Value
+  * predictor is reset in every indexed chunk so the reader can start decoding from any
+  * directory entry instead of the beginning of the block.
+  *
+  * Indexed blocks store id of the value codec in the version field (`CODEC_MASK` bits),
+  * older blocks always use FCM.
+  */
 struct DataBlockWriter {
     enum {
         CHUNK_SIZE  = 16,
         CHUNK_MASK  = 15,
         HEADER_SIZE = 14,  // 2 (version) + 2 (nchunks) + 2 (tail size) + 8 (series id)
+        //! Header size of the indexed block, 2 bytes are used to store directory offset
+        INDEXED_HEADER_SIZE = 16,
+        //! Version flag that marks indexed block (older blocks store plain AKUMULI_VERSION)
+        INDEXED_VERSION_FLAG = 0x8000,
+        //! Version bits that store value codec id (indexed blocks only)
+        CODEC_MASK  = 0x7000,
+        CODEC_SHIFT = 12,
+        //! Min distance between indexed chunks in bytes
+        DIRECTORY_SPACING = 1024,
+        //! Size of the directory entry: 8 (first timestamp) + 2 (chunk offset) + 2 (chunk index)
+        DIRECTORY_ENTRY_SIZE = 12,
+        //! Worst case size of the compressed chunk (16 timestamps and 16 values).
+        //! Timestamps take up to 146 bytes: 10 bytes for the base128 encoded minimal
+        //! delta, 8 control bytes and 16*8 bytes for deltas. Values take up to 155 bytes
+        //! with Gorilla codec: one reset bit and 2 + 5 + 6 + 64 bits per value (FCM and
+        //! Chimp need less). That's 301 bytes, rounded up to 19 bytes per element.
+        MAX_CHUNK_SIZE = 10*16 + 9*16,
+        //! Number of chunks used by adaptive mode to choose the codec
+        ADAPTIVE_NCHUNKS = 4,
     };
     VByteStreamWriter   stream_;
     DeltaDeltaWriter    ts_stream_;
-    FcmStreamWriter     val_stream_;
+    FcmStreamWriter     fcm_stream_;
+    GorillaStreamWriter gorilla_stream_;
+    ChimpStreamWriter   chimp_stream_;
+    ValueCodec          codec_;
     int                 write_index_;
     aku_Timestamp       ts_writebuf_[CHUNK_SIZE];   //! Write buffer for timestamps
     double              val_writebuf_[CHUNK_SIZE];  //! Write buffer for values
+    std::vector<aku_Timestamp> trial_ts_;  //! Elements buffered in adaptive mode
+    std::vector<double>        trial_xs_;
+    u16*                version_;
     u16*                nchunks_;
     u16*                ntail_;
+    u16*                dir_offset_;
+    u8*                 dir_;         //! Chunk directory, grows down from the end of the buffer
+    const u8*           buf_end_;     //! End of the buffer
+    size_t              last_entry_;  //! Offset of the last indexed chunk
 
     //! Empty c-tor. Constructs unwritable object.
     DataBlockWriter();
@@ -1000,8 +1193,9 @@ struct DataBlockWriter {
       * @param id Series id.
       * @param size Block size.
       * @param buf Pointer to buffer.
+      * @param codec Value codec.
       */
-    DataBlockWriter(aku_ParamId id, u8* buf, int size);
+    DataBlockWriter(aku_ParamId id, u8* buf, int size, ValueCodec codec = ValueCodec::FCM);
 
     /** Append value to block.
       * @param ts Timestamp.
@@ -1018,9 +1212,24 @@ struct DataBlockWriter {
 
     int get_write_index() const;
 
+    //! Return value codec (ADAPTIVE if codec is not chosen yet)
+    ValueCodec get_codec() const;
+
 private:
+    //! Use `codec` to compress values
+    void set_codec(ValueCodec codec);
+
+    //! Choose codec using buffered elements (adaptive mode) and write them to the block
+    aku_Status select_codec();
+
+    //! Write chunk of values using current codec
+    bool put_values(bool reset);
+
     //! Return true if there is enough free space to store `CHUNK_SIZE` compressed values
     bool room_for_chunk() const;
+
+    //! Return true if the next chunk should have directory entry
+    bool next_chunk_indexed() const;
 };
 
 struct DataBlockReader {
@@ -1031,19 +1240,70 @@ struct DataBlockReader {
     const u8*           begin_;
     VByteStreamReader   stream_;
     DeltaDeltaReader    ts_stream_;
-    FcmStreamReader     val_stream_;
+    FcmStreamReader     fcm_stream_;
+    GorillaStreamReader gorilla_stream_;
+    ChimpStreamReader   chimp_stream_;
+    ValueCodec          codec_;
     aku_Timestamp       read_buffer_[CHUNK_SIZE];
     u32                 read_index_;
+    //! Chunk directory (null if the block is not indexed or wasn't committed yet)
+    const u8*           directory_;
+    u32                 dir_size_;
 
     DataBlockReader(u8 const* buf, size_t bufsize);
 
     std::tuple<aku_Status, aku_Timestamp, double> next();
 
+    /** Read up to `n` elements into `ts` and `xs` arrays. Compressed chunks are
+      * decoded as a whole when possible, this is much faster than calling `next`
+      * for every element.
+      * @return status and number of elements read (AKU_ENO_DATA if nothing left)
+      */
+    std::tuple<aku_Status, size_t> read_all(aku_Timestamp* ts, double* xs, size_t n);
+
+    /** Skip chunks that can't contain elements with timestamp >= `ts` using the
+      * chunk directory. Elements with smaller timestamps still can be returned
+      * after this call. Does nothing if block doesn't have a directory or if
+      * some elements were already read.
+      */
+    void seek(aku_Timestamp ts);
+
+    /** Return number of elements (counting from the beginning of the block) that
+      * should be read to get all elements with timestamp <= `ts` and at least one
+      * element with larger timestamp if there is one.
+      */
+    size_t nelements_until(aku_Timestamp ts) const;
+
+    //! Return number of elements already read or skipped
+    size_t position() const;
+
     size_t nelements() const;
 
     aku_ParamId get_id() const;
 
     u16 version() const;
+
+    //! Return value codec used by the block
+    ValueCodec get_codec() const;
+
+private:
+    //! Decode next value using block's codec
+    double next_value();
+
+    //! Decode chunk of values using block's codec
+    void next_value_chunk(double* out);
+
+    //! Return timestamp of the first element of the chunk referenced by directory entry
+    aku_Timestamp get_dir_timestamp(u32 ix) const;
+
+    //! Return offset of the chunk referenced by directory entry
+    u16 get_dir_offset(u32 ix) const;
+
+    //! Return index of the chunk referenced by directory entry
+    u16 get_dir_chunk(u32 ix) const;
+
+    //! Return index of the first directory entry with timestamp > `ts`
+    u32 dir_upper_bound(aku_Timestamp ts) const;
 };
 
 }  // namespace V2
@@ -22,6 +22,7 @@
 #include <sstream>
 #include <stack>
 #include <array>
+#include <chrono>
 
 // App
 #include "nbtree.h"
@@ -30,6 +31,8 @@
 #include "log_iface.h"
 #include "operators/scan.h"
 #include "operators/aggregate.h"
+#include "profile.h"
+#include "query_context.h"
 
 
 namespace Akumuli {
@@ -93,8 +96,12 @@ static SubtreeRef const* subtree_cast(u8 const* p) {
 
 
 static std::tuple<aku_Status, std::shared_ptr<Block>> read_and_check(std::shared_ptr<BlockStore> bstore, LogicAddr curr) {
-    aku_Status status;
     std::shared_ptr<Block> block;
+    // Stop the query if it was cancelled or timed out (no-op outside of the query)
+    aku_Status status = QueryContext::check_current();
+    if (status != AKU_SUCCESS) {
+        return std::tie(status, block);
+    }
     std::tie(status, block) = bstore->read_block(curr);
     if (status != AKU_SUCCESS) {
         return std::tie(status, block);
@@ -107,6 +114,7 @@ static std::tuple<aku_Status, std::shared_ptr<Block>> read_and_check(std::shared
         std::stringstream fmt;
         fmt << "Invalid checksum (addr: " << curr << ", level: " << subtree->level << ")";
         Logger::msg(AKU_LOG_ERROR, fmt.str());
+        QueryProfile::count(&QueryProfile::checksum_failures);
         status = AKU_EBAD_DATA;
     }
     return std::tie(status, block);
@@ -134,6 +142,88 @@ static std::shared_ptr<Block> read_block_from_bstore(std::shared_ptr<BlockStore>
 }
 
 
+// --------------- //
+// Quantile sketch //
+// --------------- //
+
+/** Trailer of the superblock. Stored at the end of the block, contains address
+  * of the block with quantile sketch of the subtree.
+  */
+struct SketchTrailer {
+    u64       magic;
+    LogicAddr addr;
+} __attribute__((packed));
+
+static const u64 SKETCH_TRAILER_MAGIC = 0x484354454B53ull;  // "SKETCH"
+
+static_assert(sizeof(SubtreeRef)*(AKU_NBTREE_FANOUT + 1) + sizeof(SketchTrailer) <= AKU_BLOCK_SIZE,
+              "Superblock trailer overlaps with subtree refs");
+
+static_assert(sizeof(SubtreeRef) + QuantileSketch::MAX_SERIALIZED_SIZE <= AKU_BLOCK_SIZE,
+              "Quantile sketch doesn't fit the block");
+
+static SketchTrailer* trailer_cast(u8* p) {
+    return reinterpret_cast<SketchTrailer*>(p + AKU_BLOCK_SIZE - sizeof(SketchTrailer));
+}
+
+static SketchTrailer const* trailer_cast(u8 const* p) {
+    return reinterpret_cast<SketchTrailer const*>(p + AKU_BLOCK_SIZE - sizeof(SketchTrailer));
+}
+
+/** Write quantile sketch of the subtree to block-store. Sketch block starts with the
+  * copy of the subtree reference (used to check that the sketch matches the subtree)
+  * followed by the serialized sketch.
+  */
+static std::tuple<aku_Status, LogicAddr> write_sketch(std::shared_ptr<BlockStore> bstore,
+                                                      SubtreeRef const& ref,
+                                                      QuantileSketch const& sketch)
+{
+    auto block = std::make_shared<Block>();
+    u8* data = block->get_data();
+    size_t size = sketch.serialize(data + sizeof(SubtreeRef), AKU_BLOCK_SIZE - sizeof(SubtreeRef));
+    if (size == 0) {
+        return std::make_tuple(AKU_EOVERFLOW, EMPTY_ADDR);
+    }
+    SubtreeRef* header = subtree_cast(data);
+    *header = ref;
+    header->addr = EMPTY_ADDR;
+    header->type = NBTreeBlockType::SKETCH;
+    header->payload_size = static_cast<u16>(size);
+    header->version = AKUMULI_VERSION;
+    header->checksum = bstore->checksum(data + sizeof(SubtreeRef), size);
+    return bstore->append_block(block);
+}
+
+/** Read quantile sketch of the subtree.
+  * @param sblock is a root of the subtree
+  * @param ref is a reference to the subtree
+  * @return AKU_SUCCESS, AKU_ENOT_FOUND if subtree doesn't have valid sketch or error code
+  */
+static aku_Status read_sketch(std::shared_ptr<BlockStore> bstore,
+                              NBTreeSuperblock const& sblock,
+                              SubtreeRef const& ref,
+                              QuantileSketch* sketch)
+{
+    LogicAddr addr = sblock.get_sketch_addr();
+    if (addr == EMPTY_ADDR) {
+        return AKU_ENOT_FOUND;
+    }
+    aku_Status status;
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = read_and_check(bstore, addr);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    SubtreeRef const* header = subtree_cast(block->get_cdata());
+    if (header->type != NBTreeBlockType::SKETCH || header->id != ref.id || header->level != ref.level ||
+        header->count != ref.count || header->begin != ref.begin || header->end != ref.end)
+    {
+        // Sketch block was overwritten or belongs to the previous version of the node
+        return AKU_ENOT_FOUND;
+    }
+    return sketch->deserialize(block->get_cdata() + sizeof(SubtreeRef), header->payload_size);
+}
+
 //! Initialize object from leaf node
 aku_Status init_subtree_from_leaf(const NBTreeLeaf& leaf, SubtreeRef& out) {
     if (leaf.nelements() == 0) {
@@ -194,8 +284,9 @@ aku_Status init_subtree_from_subtree(const NBTreeSuperblock& node, SubtreeRef& b
 
 
 /** QueryOperator implementation for leaf node.
-  * This is very basic. All node's data is copied to
-  * the internal buffer by c-tor.
+  * This is very basic. Node's data is copied to the
+  * internal buffer by c-tor (chunks that doesn't overlap
+  * with the query range are skipped).
   */
 struct NBTreeLeafIterator : RealValuedOperator {
 
@@ -215,6 +306,8 @@ struct NBTreeLeafIterator : RealValuedOperator {
     aku_Status                 status_;
     //! Padding
     u32 pad_;
+    //! Memory used by buffers (accounted in the query budget)
+    QueryMemory                memory_;
 
     NBTreeLeafIterator(aku_Status status)
         : begin_()
@@ -246,7 +339,10 @@ struct NBTreeLeafIterator : RealValuedOperator {
             status_ = AKU_ENO_DATA;
             return;
         }
-        status_ = node.read_all(&tsbuf_, &xsbuf_);
+        status_ = node.read_range(min, max, &tsbuf_, &xsbuf_);
+        if (status_ == AKU_SUCCESS) {
+            status_ = memory_.resize(tsbuf_.capacity()*sizeof(aku_Timestamp) + xsbuf_.capacity()*sizeof(double));
+        }
         if (status_ == AKU_SUCCESS) {
             if (begin_ < end_) {
                 // FWD direction
@@ -310,6 +406,26 @@ RealValuedOperator::Direction NBTreeLeafIterator::get_direction() {
 }
 
 
+// ////////////////// //
+// class NBTreeBounds //
+// ////////////////// //
+
+void NBTreeBounds::add(SubtreeRef const& ref, bool inside) {
+    min = std::min(min, ref.min);
+    max = std::max(max, ref.max);
+    cnt += ref.count;
+    // Only part of the subtree can be inside the range, in this case
+    // sum of the values from the range is bounded by count*max (or zero)
+    sum += inside ? ref.sum : ref.count * std::max(ref.max, 0.0);
+}
+
+void NBTreeBounds::add(double value) {
+    min = std::min(min, value);
+    max = std::max(max, value);
+    cnt += 1;
+    sum += value;
+}
+
 // ////////////////////// //
 // class NBTreeLeafFilter //
 // ////////////////////// //
@@ -369,7 +485,7 @@ struct NBTreeLeafFilter : RealValuedOperator {
         }
         std::vector<aku_Timestamp> tss;
         std::vector<double>        xss;
-        status_ = node.read_all(&tss, &xss);
+        status_ = node.read_range(min, max, &tss, &xss);
         ssize_t from = 0, to = 0;
         if (status_ == AKU_SUCCESS) {
             if (begin_ < end_) {
@@ -464,6 +580,13 @@ static bool subtree_in_range(SubtreeRef const& ref, aku_Timestamp begin, aku_Tim
     return true;
 }
 
+//! Leaf read that takes longer than this is considered to be a cache miss
+static const std::chrono::microseconds PREFETCH_SLOW_READ(200);
+//! Leaf read that takes less than this is considered to be a cache hit
+static const std::chrono::microseconds PREFETCH_FAST_READ(50);
+//! Number of consecutive fast reads needed to decrease read-ahead depth
+static const u32 PREFETCH_DECAY_READS = AKU_NBTREE_FANOUT;
+
 template<class TVal>
 struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
     //! Starting timestamp
@@ -481,6 +604,14 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
     u32 fsm_pos_;
     i32 refs_pos_;
 
+    // Read-ahead
+    //! Number of leaf nodes to prefetch, adapts to observed read latency
+    u32 prefetch_depth_;
+    //! Number of consecutive fast reads
+    u32 fast_reads_;
+    //! Index of the first child node that wasn't prefetched yet
+    i32 prefetch_pos_;
+
     typedef std::unique_ptr<SeriesOperator<TVal>> TIter;
     typedef typename SeriesOperator<TVal>::Direction Direction;
 
@@ -491,6 +622,9 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
         , bstore_(bstore)
         , fsm_pos_(0)
         , refs_pos_(0)
+        , prefetch_depth_(0)
+        , fast_reads_(0)
+        , prefetch_pos_(0)
     {
     }
 
@@ -501,6 +635,9 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
         , bstore_(bstore)
         , fsm_pos_(1)  // FSM will bypass `init` step.
         , refs_pos_(0)
+        , prefetch_depth_(0)
+        , fast_reads_(0)
+        , prefetch_pos_(0)
     {
         aku_Status status = sblock.read_all(&refs_);
         if (status != AKU_SUCCESS) {
@@ -509,6 +646,7 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
         } else {
             refs_pos_ = begin_ < end_ ? 0 : static_cast<i32>(refs_.size()) - 1;
         }
+        prefetch_pos_ = refs_pos_;
     }
 
     aku_Status init() {
@@ -521,9 +659,55 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
         NBTreeSuperblock current(block);
         status = current.read_all(&refs_);
         refs_pos_ = begin_ < end_ ? 0 : static_cast<i32>(refs_.size()) - 1;
+        prefetch_pos_ = refs_pos_;
         return status;
     }
 
+    /** Issue read-ahead requests for the next `prefetch_depth_` leaf nodes.
+      * Superblocks are not prefetched because aggregators can use the
+      * values from SubtreeRef without reading them.
+      */
+    void prefetch() {
+        auto min = std::min(begin_, end_);
+        auto max = std::max(begin_, end_);
+        const i32 step = get_direction() == Direction::FORWARD ? 1 : -1;
+        const i32 last = refs_pos_ + step*static_cast<i32>(prefetch_depth_);
+        if ((prefetch_pos_ - refs_pos_)*step < 0) {
+            prefetch_pos_ = refs_pos_;
+        }
+        while ((last - prefetch_pos_)*step > 0) {
+            if (prefetch_pos_ < 0 || prefetch_pos_ >= static_cast<i32>(refs_.size())) {
+                break;
+            }
+            SubtreeRef const& ref = refs_[static_cast<size_t>(prefetch_pos_)];
+            if (ref.type == NBTreeBlockType::LEAF && subtree_in_range(ref, min, max) && !can_skip(ref)) {
+                bstore_->prefetch(ref.addr);
+            }
+            prefetch_pos_ += step;
+        }
+    }
+
+    /** Adapt read-ahead depth. Slow read means that the data is cold and
+      * read-ahead depth should be increased. Depth decays slowly when the data
+      * is hot (or read-ahead does its job).
+      */
+    void update_prefetch_depth(std::chrono::steady_clock::duration latency) {
+        if (latency > PREFETCH_SLOW_READ) {
+            prefetch_depth_ = std::min(std::max(1u, prefetch_depth_*2), static_cast<u32>(AKU_NBTREE_FANOUT));
+            fast_reads_ = 0;
+        } else if (latency < PREFETCH_FAST_READ && prefetch_depth_ > 0) {
+            if (++fast_reads_ == PREFETCH_DECAY_READS) {
+                prefetch_depth_--;
+                fast_reads_ = 0;
+            }
+        }
+    }
+
+    //! Return true if subtree shouldn't be read (used by `get_next_iter` template method).
+    virtual bool can_skip(const SubtreeRef&) const {
+        return false;
+    }
+
     //! Create leaf iterator (used by `get_next_iter` template method).
     virtual std::tuple<aku_Status, TIter> make_leaf_iterator(const SubtreeRef &ref) = 0;
 
@@ -553,12 +737,15 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
             ref = refs_.at(static_cast<size_t>(refs_pos_));
             refs_pos_--;
         }
+        prefetch();
         std::tuple<aku_Status, TIter> result;
-        if (!subtree_in_range(ref, min, max)) {
-            // Subtree not in [begin_, end_) range. Proceed to next.
+        if (!subtree_in_range(ref, min, max) || can_skip(ref)) {
+            // Subtree not in [begin_, end_) range or can be skipped. Proceed to next.
             result = std::make_tuple(AKU_ENOT_FOUND, std::move(empty));
         } else if (ref.type == NBTreeBlockType::LEAF) {
+            auto start = std::chrono::steady_clock::now();
             result = std::move(make_leaf_iterator(ref));
+            update_prefetch_depth(std::chrono::steady_clock::now() - start);
         } else {
             result = std::move(make_superblock_iterator(ref));
         }
@@ -871,51 +1058,6 @@ std::tuple<aku_Status, size_t> NBTreeLeafAggregator::read(aku_Timestamp *destts,
 // NBTreeSBlockAggregator //
 // ////////////////////// //
 
-/** Aggregator that returns precomputed value.
-  * Value should be set in c-tor.
-  */
-class ValueAggregator : public AggregateOperator {
-    aku_Timestamp ts_;
-    AggregationResult value_;
-    Direction dir_;
-    bool used_;
-public:
-    ValueAggregator(aku_Timestamp ts, AggregationResult value, Direction dir)
-        : ts_(ts)
-        , value_(value)
-        , dir_(dir)
-        , used_(false)
-    {
-    }
-
-    ValueAggregator()
-        : ts_()
-        , value_()
-        , dir_()
-        , used_(true)
-    {}
-
-    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) override;
-    virtual Direction get_direction() override;
-};
-
-std::tuple<aku_Status, size_t> ValueAggregator::read(aku_Timestamp *destts, AggregationResult *destval, size_t size) {
-    if (size == 0) {
-        return std::make_pair(AKU_EBAD_ARG, 0);
-    }
-    if (used_) {
-        return std::make_pair(AKU_ENO_DATA, 0);
-    }
-    used_ = true;
-    destval[0] = value_;
-    destts[0] = ts_;
-    return std::make_pair(AKU_SUCCESS, 1);
-}
-
-ValueAggregator::Direction ValueAggregator::get_direction() {
-    return dir_;
-}
-
 /** Superblock aggregator (iterator that computes different aggregates e.g. min/max/avg/sum).
   * Uses metadata stored in superblocks in some cases.
   */
@@ -1147,6 +1289,28 @@ std::tuple<aku_Status, size_t> NBTreeLeafGroupAggregator::read(aku_Timestamp *de
 
 //
 
+/** Return range of the buckets that can contain only values from the subtree
+  * (all buckets that overlap with the subtree except the first and the last one).
+  * Range is empty if there is no such buckets. Forward direction only.
+  */
+static std::tuple<aku_Timestamp, aku_Timestamp> get_inner_buckets(SubtreeRef const& ref,
+                                                                  aku_Timestamp begin,
+                                                                  aku_Timestamp end,
+                                                                  u64 step)
+{
+    aku_Timestamp lo = std::max(ref.begin, begin);
+    aku_Timestamp hi = std::min(ref.end, end - 1);
+    if (lo > hi) {
+        return std::make_tuple(0ull, 0ull);
+    }
+    auto first = (lo - begin) / step;
+    auto last  = (hi - begin) / step;
+    if (last < first + 2) {
+        return std::make_tuple(0ull, 0ull);
+    }
+    return std::make_tuple(begin + (first + 1)*step, begin + last*step);
+}
+
 /** Superblock aggregator (iterator that computes different aggregates e.g. min/max/avg/sum).
   * Uses metadata stored in superblocks in some cases.
   */
@@ -1156,6 +1320,12 @@ class NBTreeSBlockGroupAggregator : public NBTreeSBlockIteratorBase<AggregationR
     ReadBuffer rdbuf_;
     u32 rdpos_;
     bool done_;
+    // Subtree pruning (see `set_filter`)
+    typedef std::vector<std::pair<aku_Timestamp, aku_Timestamp>> SkipList;
+    bool prune_;
+    AggregateFilter filter_;
+    //! Buckets that starts inside these ranges can't match the filter
+    SkipList skip_;
     enum {
         RDBUF_SIZE = 0x100
     };
@@ -1169,6 +1339,7 @@ public:
         , step_(step)
         , rdpos_(0)
         , done_(false)
+        , prune_(false)
     {
     }
 
@@ -1181,9 +1352,78 @@ public:
         , step_(step)
         , rdpos_(0)
         , done_(false)
+        , prune_(false)
     {
     }
 
+    /** Enable subtree pruning (forward direction only). Buckets that starts inside
+      * one of the `skip` ranges can't match the filter (ranges are inherited from the
+      * parent node). Such buckets are not returned and subtrees that fit into one of
+      * the ranges are not read.
+      */
+    void set_filter(AggregateFilter const& filter, SkipList const& skip) {
+        prune_  = true;
+        filter_ = filter;
+        skip_   = skip;
+        if (fsm_pos_ != 0) {
+            add_skip_ranges();
+        }
+    }
+
+    /** Find runs of adjacent child nodes that can't match the filter (according to
+      * min/max values from the SubtreeRef). Values from the buckets that lie strictly
+      * inside the run can only come from these nodes, so such buckets can't match too.
+      */
+    void add_skip_ranges() {
+        if (!prune_ || get_direction() != Direction::FORWARD) {
+            return;
+        }
+        size_t i = 0;
+        while (i < refs_.size()) {
+            SubtreeRef run = refs_[i];
+            size_t j = i;
+            while (j < refs_.size()) {
+                SubtreeRef next = run;
+                next.min = std::min(run.min, refs_[j].min);
+                next.max = std::max(run.max, refs_[j].max);
+                next.end = refs_[j].end;
+                if (filter_.can_match(next)) {
+                    break;
+                }
+                run = next;
+                j++;
+            }
+            if (j == i) {
+                i++;
+                continue;
+            }
+            aku_Timestamp skip_begin, skip_end;
+            std::tie(skip_begin, skip_end) = get_inner_buckets(run, begin_, end_, step_);
+            if (skip_begin < skip_end) {
+                skip_.push_back(std::make_pair(skip_begin, skip_end));
+            }
+            i = j;
+        }
+    }
+
+    bool in_skip_range(aku_Timestamp ts) const {
+        for (auto const& range: skip_) {
+            if (ts >= range.first && ts < range.second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual bool can_skip(const SubtreeRef& ref) const override {
+        for (auto const& range: skip_) {
+            if (ref.begin >= range.first && ref.end < range.second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     //! Return true if `rdbuf_` is not empty and have some data to read.
     bool can_read() const {
         return rdpos_ < rdbuf_.size();
@@ -1229,11 +1469,15 @@ public:
             for (size_t i = 0; i < tocopy; i++) {
                 auto const& bottom = rdbuf_.at(rdpos_);
                 rdpos_++;
+                if (in_skip_range(bottom._begin)) {
+                    // Pruned bucket
+                    continue;
+                }
                 *desttx++ = bottom._begin;
                 *destxs++ = bottom;
                 size--;
+                copied++;
             }
-            copied += tocopy;
         }
         return std::make_tuple(status, copied);
     }
@@ -1339,6 +1583,7 @@ std::tuple<aku_Status, size_t> NBTreeSBlockGroupAggregator::read(aku_Timestamp *
             return std::make_pair(status, 0ul);
         }
         fsm_pos_++;
+        add_skip_ranges();
     }
     return copy_to(destts, destval, size);
 }
@@ -1380,7 +1625,18 @@ std::tuple<aku_Status, std::unique_ptr<AggregateOperator>> NBTreeSBlockGroupAggr
         agg.copy_from(ref);
         result.reset(new ValueAggregator(ref.end, agg, get_direction()));
     } else {
-        result.reset(new NBTreeSBlockGroupAggregator(bstore_, ref.addr, begin_, end_, step_));
+        std::unique_ptr<NBTreeSBlockGroupAggregator> iter;
+        iter.reset(new NBTreeSBlockGroupAggregator(bstore_, ref.addr, begin_, end_, step_));
+        if (prune_) {
+            SkipList skip;
+            for (auto const& range: skip_) {
+                if (range.first <= ref.end && ref.begin < range.second) {
+                    skip.push_back(range);
+                }
+            }
+            iter->set_filter(filter_, skip);
+        }
+        result = std::move(iter);
     }
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
@@ -1409,7 +1665,7 @@ public:
             aku_Status status;
             std::tie(status, outsz) = iter_->read(&ts, &agg, 1);
             if (status == AKU_SUCCESS || status == AKU_ENO_DATA) {
-                if (filter_.match(agg)) {
+                if (outsz != 0 && filter_.match(agg)) {
                     destts[i] = ts;
                     destval[i] = agg;
                     i++;
@@ -1431,6 +1687,314 @@ public:
     }
 };
 
+// //////////////////////// //
+// NBTreeRollupAggregator   //
+// //////////////////////// //
+
+/** Group-aggregate operator that reads buckets from the rollup tree.
+  * Each bucket is stored as NBTreeExtentsList::ROLLUP_TUPLE_SIZE values
+  * with consecutive timestamps. Rollup buckets are combined into `step`
+  * sized buckets of the query.
+  */
+class NBTreeRollupAggregator : public AggregateOperator {
+    enum {
+        RDBUF_SIZE = NBTreeExtentsList::ROLLUP_TUPLE_SIZE*0x40,
+    };
+    const aku_Timestamp begin_;
+    const aku_Timestamp step_;
+    const aku_Timestamp rollup_step_;
+    std::unique_ptr<RealValuedOperator> iter_;
+    std::vector<aku_Timestamp> rdts_;
+    std::vector<double> rdxs_;
+    size_t rdpos_;
+    size_t rdsize_;
+    bool eof_;
+    //! Query bucket that is being combined
+    AggregationResult acc_;
+    u64 accbin_;
+    bool hasacc_;
+
+    aku_Status refill() {
+        aku_Status status;
+        size_t size;
+        std::tie(status, size) = iter_->read(rdts_.data(), rdxs_.data(), rdts_.size());
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return status;
+        }
+        eof_ = status == AKU_ENO_DATA || size == 0;
+        rdpos_ = 0;
+        rdsize_ = size;
+        return AKU_SUCCESS;
+    }
+
+    //! Read next value from the rollup tree, return AKU_ENO_DATA if all values was consumed
+    aku_Status next(aku_Timestamp* ts, double* xs) {
+        if (rdpos_ == rdsize_) {
+            if (eof_) {
+                return AKU_ENO_DATA;
+            }
+            auto status = refill();
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            if (rdsize_ == 0) {
+                return AKU_ENO_DATA;
+            }
+        }
+        *ts = rdts_[rdpos_];
+        *xs = rdxs_[rdpos_];
+        rdpos_++;
+        return AKU_SUCCESS;
+    }
+
+    //! Read next rollup bucket
+    aku_Status next_bucket(aku_Timestamp* bucket, AggregationResult* res) {
+        double tup[NBTreeExtentsList::ROLLUP_TUPLE_SIZE];
+        aku_Timestamp base = 0;
+        for (u32 i = 0; i < NBTreeExtentsList::ROLLUP_TUPLE_SIZE; i++) {
+            aku_Timestamp ts;
+            auto status = next(&ts, &tup[i]);
+            if (status == AKU_ENO_DATA && i != 0) {
+                status = AKU_EBAD_DATA;
+            }
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            if (i == 0) {
+                base = ts;
+            }
+            if (ts != base + i || base % rollup_step_ != 0) {
+                Logger::msg(AKU_LOG_ERROR, "Rollup tree is corrupted, unexpected timestamp " + std::to_string(ts));
+                return AKU_EBAD_DATA;
+            }
+        }
+        QueryProfile::count(&QueryProfile::rollup_buckets);
+        *bucket = base;
+        res->cnt    = tup[0];
+        res->sum    = tup[1];
+        res->min    = tup[2];
+        res->max    = tup[3];
+        res->first  = tup[4];
+        res->last   = tup[5];
+        res->mints  = base + static_cast<aku_Timestamp>(tup[6]);
+        res->maxts  = base + static_cast<aku_Timestamp>(tup[7]);
+        res->_begin = base + static_cast<aku_Timestamp>(tup[8]);
+        res->_end   = base + static_cast<aku_Timestamp>(tup[9]);
+        return AKU_SUCCESS;
+    }
+
+public:
+    NBTreeRollupAggregator(aku_Timestamp begin,
+                           aku_Timestamp step,
+                           aku_Timestamp rollup_step,
+                           std::unique_ptr<RealValuedOperator>&& iter)
+        : begin_(begin)
+        , step_(step)
+        , rollup_step_(rollup_step)
+        , iter_(std::move(iter))
+        , rdts_(RDBUF_SIZE)
+        , rdxs_(RDBUF_SIZE)
+        , rdpos_(0)
+        , rdsize_(0)
+        , eof_(false)
+        , acc_(INIT_AGGRES)
+        , accbin_(0)
+        , hasacc_(false)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) {
+        if (size == 0) {
+            return std::make_tuple(AKU_EBAD_ARG, 0);
+        }
+        size_t outsz = 0;
+        while (outsz < size) {
+            aku_Timestamp bucket;
+            AggregationResult res;
+            auto status = next_bucket(&bucket, &res);
+            if (status == AKU_ENO_DATA) {
+                if (hasacc_) {
+                    destts[outsz] = acc_._begin;
+                    destval[outsz] = acc_;
+                    outsz++;
+                    hasacc_ = false;
+                }
+                return std::make_tuple(AKU_ENO_DATA, outsz);
+            } else if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+            u64 bin = (bucket - begin_) / step_;
+            if (hasacc_ && bin == accbin_) {
+                acc_.combine(res);
+                continue;
+            }
+            if (hasacc_) {
+                destts[outsz] = acc_._begin;
+                destval[outsz] = acc_;
+                outsz++;
+            }
+            acc_ = res;
+            accbin_ = bin;
+            hasacc_ = true;
+        }
+        return std::make_tuple(AKU_SUCCESS, outsz);
+    }
+
+    virtual Direction get_direction() {
+        return Direction::FORWARD;
+    }
+};
+
+// ///////////////////////////// //
+// NBTreeGroupQuantileAggregator //
+// ///////////////////////////// //
+
+/** Group-aggregate operator that computes percentiles. Subtrees are processed
+  * in time order. Subtree that fits into one bucket is summarized using its
+  * quantile sketch, other subtrees (and subtrees without sketches) are traversed.
+  * Leaf nodes are scanned. Works only in forward direction.
+  */
+class NBTreeGroupQuantileAggregator : public QuantileOperator {
+    std::shared_ptr<BlockStore> bstore_;
+    const aku_Timestamp begin_;
+    const aku_Timestamp end_;
+    const u64 step_;
+    //! Subtrees that wasn't processed yet (next subtree is on top)
+    std::vector<SubtreeRef> stack_;
+    //! Current bucket
+    u64 bin_;
+    QuantileResult curr_;
+    //! Complete buckets
+    std::deque<QuantileResult> ready_;
+    aku_Status status_;
+
+    bool inside_one_bucket(SubtreeRef const& ref) const {
+        return ref.begin >= begin_ && ref.end < end_ && (ref.begin - begin_) / step_ == (ref.end - begin_) / step_;
+    }
+
+    //! Start new bucket if `ts` doesn't belong to the current one
+    void select_bucket(aku_Timestamp ts) {
+        u64 bin = (ts - begin_) / step_;
+        if (bin != bin_ && curr_.agg.cnt != 0) {
+            ready_.push_back(std::move(curr_));
+            curr_ = QuantileResult();
+        }
+        bin_ = bin;
+    }
+
+    aku_Status add_leaf(NBTreeLeaf const& leaf) {
+        std::vector<aku_Timestamp> tss;
+        std::vector<double> xss;
+        aku_Status status = leaf.read_range(begin_, end_, &tss, &xss);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        for (size_t i = 0; i < tss.size(); i++) {
+            if (tss[i] >= begin_ && tss[i] < end_) {
+                select_bucket(tss[i]);
+                curr_.add(tss[i], xss[i]);
+            }
+        }
+        return AKU_SUCCESS;
+    }
+
+    aku_Status process(SubtreeRef const& ref) {
+        if (ref.end < begin_ || ref.begin >= end_) {
+            return AKU_SUCCESS;
+        }
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = read_and_check(bstore_, ref.addr);
+        if (status == AKU_EUNAVAILABLE) {
+            // Subtree was deleted by retention
+            return AKU_SUCCESS;
+        } else if (status != AKU_SUCCESS) {
+            return status;
+        }
+        if (ref.type == NBTreeBlockType::LEAF) {
+            NBTreeLeaf leaf(block);
+            return add_leaf(leaf);
+        }
+        NBTreeSuperblock sblock(block);
+        if (inside_one_bucket(ref)) {
+            QuantileSketch sketch;
+            if (read_sketch(bstore_, sblock, ref, &sketch) == AKU_SUCCESS) {
+                select_bucket(ref.begin);
+                curr_.add(ref, sketch);
+                return AKU_SUCCESS;
+            }
+        }
+        std::vector<SubtreeRef> refs;
+        status = sblock.read_all(&refs);
+        stack_.insert(stack_.end(), refs.rbegin(), refs.rend());
+        return status;
+    }
+
+public:
+    //! Create operator that reads subtrees from block-store (`refs` should be sorted by time)
+    NBTreeGroupQuantileAggregator(std::shared_ptr<BlockStore> bstore,
+                                  std::vector<SubtreeRef> const& refs,
+                                  aku_Timestamp begin,
+                                  aku_Timestamp end,
+                                  u64 step)
+        : bstore_(bstore)
+        , begin_(begin)
+        , end_(end)
+        , step_(step)
+        , stack_(refs.rbegin(), refs.rend())
+        , bin_(0)
+        , status_(AKU_SUCCESS)
+    {
+    }
+
+    //! Create operator that reads memory resident leaf node
+    NBTreeGroupQuantileAggregator(aku_Timestamp begin, aku_Timestamp end, u64 step, NBTreeLeaf const& leaf)
+        : begin_(begin)
+        , end_(end)
+        , step_(step)
+        , bin_(0)
+        , status_(AKU_SUCCESS)
+    {
+        if (begin < end && leaf.nelements() != 0) {
+            status_ = add_leaf(leaf);
+        }
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, QuantileResult *destval, size_t size) {
+        if (size == 0) {
+            return std::make_tuple(AKU_EBAD_ARG, 0);
+        }
+        if (status_ != AKU_SUCCESS) {
+            return std::make_tuple(status_, 0);
+        }
+        while (ready_.size() < size && !stack_.empty()) {
+            SubtreeRef ref = stack_.back();
+            stack_.pop_back();
+            auto status = process(ref);
+            if (status != AKU_SUCCESS) {
+                status_ = status;
+                return std::make_tuple(status, 0);
+            }
+        }
+        if (stack_.empty() && curr_.agg.cnt != 0) {
+            ready_.push_back(std::move(curr_));
+            curr_ = QuantileResult();
+        }
+        size_t outsz = std::min(size, ready_.size());
+        for (size_t i = 0; i < outsz; i++) {
+            destts[i]  = ready_.front().agg._begin;
+            destval[i] = std::move(ready_.front());
+            ready_.pop_front();
+        }
+        bool done = stack_.empty() && ready_.empty();
+        return std::make_tuple(done ? AKU_ENO_DATA : AKU_SUCCESS, outsz);
+    }
+
+    virtual Direction get_direction() {
+        return Direction::FORWARD;
+    }
+};
+
 // //////////////////////////// //
 // NBTreeSBlockCandlesticksIter //
 // //////////////////////////// //
@@ -1505,10 +2069,10 @@ std::tuple<aku_Status, size_t> NBTreeSBlockCandlesticsIter::read(aku_Timestamp *
 //    NBTreeLeaf    //
 // //////////////// //
 
-NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index)
+NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index, ValueCodec codec)
     : prev_(prev)
     , block_(std::make_shared<Block>())
-    , writer_(id, block_->get_data() + sizeof(SubtreeRef), AKU_BLOCK_SIZE - sizeof(SubtreeRef))
+    , writer_(id, block_->get_data() + sizeof(SubtreeRef), AKU_BLOCK_SIZE - sizeof(SubtreeRef), codec)
     , fanout_index_(fanout_index)
 {
     // Check that invariant holds.
@@ -1644,20 +2208,24 @@ aku_Status NBTreeLeaf::read_all(std::vector<aku_Timestamp>* timestamps,
                                 std::vector<double>* values) const
 {
     int windex = writer_.get_write_index();
-    DataBlockReader reader(block_->get_cdata() + sizeof(SubtreeRef), block_->get_size());
+    DataBlockReader reader(block_->get_cdata() + sizeof(SubtreeRef), block_->get_size() - sizeof(SubtreeRef));
     size_t sz = reader.nelements();
-    timestamps->reserve(sz);
-    values->reserve(sz);
-    for (size_t ix = 0; ix < sz; ix++) {
+    size_t offset = timestamps->size();
+    timestamps->resize(offset + sz);
+    values->resize(offset + sz);
+    if (sz != 0) {
         aku_Status status;
-        aku_Timestamp ts;
-        double value;
-        std::tie(status, ts, value) = reader.next();
+        size_t nread;
+        std::tie(status, nread) = reader.read_all(timestamps->data() + offset, values->data() + offset, sz);
+        QueryProfile::count(&QueryProfile::bytes_decompressed, nread*(sizeof(aku_Timestamp) + sizeof(double)));
+        if (status == AKU_SUCCESS && nread != sz) {
+            status = AKU_EBAD_DATA;
+        }
         if (status != AKU_SUCCESS) {
+            timestamps->resize(offset);
+            values->resize(offset);
             return status;
         }
-        timestamps->push_back(ts);
-        values->push_back(value);
     }
     // Read tail elements from `writer_`
     if (windex != 0) {
@@ -1666,6 +2234,42 @@ aku_Status NBTreeLeaf::read_all(std::vector<aku_Timestamp>* timestamps,
     return AKU_SUCCESS;
 }
 
+aku_Status NBTreeLeaf::read_range(aku_Timestamp min, aku_Timestamp max,
+                                  std::vector<aku_Timestamp>* timestamps,
+                                  std::vector<double>* values) const
+{
+    int windex = writer_.get_write_index();
+    DataBlockReader reader(block_->get_cdata() + sizeof(SubtreeRef), block_->get_size() - sizeof(SubtreeRef));
+    size_t total = reader.nelements();
+    reader.seek(min);
+    size_t first = reader.position();
+    size_t last = reader.nelements_until(max);
+    assert(first <= last);
+    size_t sz = last - first;
+    size_t offset = timestamps->size();
+    timestamps->resize(offset + sz);
+    values->resize(offset + sz);
+    if (sz != 0) {
+        aku_Status status;
+        size_t nread;
+        std::tie(status, nread) = reader.read_all(timestamps->data() + offset, values->data() + offset, sz);
+        QueryProfile::count(&QueryProfile::bytes_decompressed, nread*(sizeof(aku_Timestamp) + sizeof(double)));
+        if (status == AKU_SUCCESS && nread != sz) {
+            status = AKU_EBAD_DATA;
+        }
+        if (status != AKU_SUCCESS) {
+            timestamps->resize(offset);
+            values->resize(offset);
+            return status;
+        }
+    }
+    // Read tail elements from `writer_` if the whole block was read
+    if (windex != 0 && last == total) {
+        writer_.read_tail_elements(timestamps, values);
+    }
+    return AKU_SUCCESS;
+}
+
 aku_Status NBTreeLeaf::append(aku_Timestamp ts, double value) {
     aku_Status status = writer_.put(ts, value);
     if (status == AKU_SUCCESS) {
@@ -1966,6 +2570,8 @@ NBTreeSuperblock::NBTreeSuperblock(LogicAddr addr, std::shared_ptr<BlockStore> b
     assert(prev_ != 0);
     // We can't use zero-copy here because `block` belongs to other node.
     memcpy(block_->get_data(), block->get_cdata(), AKU_BLOCK_SIZE);
+    // Sketch of the original node doesn't match the new one
+    memset(trailer_cast(block_->get_data()), 0, sizeof(SketchTrailer));
 }
 
 SubtreeRef const* NBTreeSuperblock::get_sblockmeta() const {
@@ -2009,6 +2615,21 @@ LogicAddr NBTreeSuperblock::get_addr() const {
     return block_->get_addr();
 }
 
+void NBTreeSuperblock::set_sketch_addr(LogicAddr addr) {
+    assert(!immutable_);
+    SketchTrailer* trailer = trailer_cast(block_->get_data());
+    trailer->magic = addr == EMPTY_ADDR ? 0 : SKETCH_TRAILER_MAGIC;
+    trailer->addr  = addr;
+}
+
+LogicAddr NBTreeSuperblock::get_sketch_addr() const {
+    SketchTrailer const* trailer = trailer_cast(block_->get_cdata());
+    if (trailer->magic != SKETCH_TRAILER_MAGIC) {
+        return EMPTY_ADDR;
+    }
+    return trailer->addr;
+}
+
 aku_Status NBTreeSuperblock::append(const SubtreeRef &p) {
     if (is_full()) {
         return AKU_EOVERFLOW;
@@ -2299,6 +2920,8 @@ struct NBTreeLeafExtent : NBTreeExtent {
     aku_ParamId id_;
     LogicAddr last_;
     std::shared_ptr<NBTreeLeaf> leaf_;
+    //! Quantile sketch of the values stored in `leaf_`, updated on every append
+    QuantileSketch sketch_;
     u16 fanout_index_;
     // padding
     u16 pad0_;
@@ -2384,11 +3007,18 @@ struct NBTreeLeafExtent : NBTreeExtent {
     }
 
     void reset_leaf() {
-        leaf_.reset(new NBTreeLeaf(id_, last_, fanout_index_));
+        ValueCodec codec = ValueCodec::FCM;
+        auto roots = roots_.lock();
+        if (roots) {
+            codec = roots->get_value_codec();
+        }
+        leaf_.reset(new NBTreeLeaf(id_, last_, fanout_index_, codec));
+        sketch_ = QuantileSketch();
     }
 
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value) override;
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl) override;
+    virtual void append_sketch(QuantileSketch const* sketch) override;
     virtual std::tuple<bool, LogicAddr> commit(bool final) override;
     virtual std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end) const override;
     virtual std::unique_ptr<RealValuedOperator> filter(aku_Timestamp begin,
@@ -2397,6 +3027,14 @@ struct NBTreeLeafExtent : NBTreeExtent {
     virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const override;
     virtual std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const override;
     virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const override;
+    virtual std::unique_ptr<QuantileOperator> group_quantiles(aku_Timestamp begin, aku_Timestamp end, u64 step) const override;
+    virtual std::unique_ptr<AggregateOperator> group_aggregate_filter(aku_Timestamp begin,
+                                                                      aku_Timestamp end,
+                                                                      u64 step,
+                                                                      const AggregateFilter& filter) const override;
+    virtual void get_bounds(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const override;
+
+    virtual bool get_oldest_leaf(SubtreeRef* ref) const override;
     virtual bool is_dirty() const override;
     virtual void debug_dump(std::ostream& stream, int base_indent, std::function<std::string(aku_Timestamp)> tsformat, u32 mask) const override;
     virtual std::tuple<bool, LogicAddr> split(aku_Timestamp pivot) override;
@@ -2518,6 +3156,9 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::append(aku_Timestamp ts, double va
         append(ts, value);
         return std::make_tuple(parent_saved, addr);
     }
+    if (status == AKU_SUCCESS) {
+        sketch_.add(value);
+    }
     return std::make_tuple(false, EMPTY_ADDR);
 }
 
@@ -2548,7 +3189,8 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::commit(bool final) {
     size_t next_level = payload.level + 1;
     if (roots_collection) {
         if (!final || roots_collection->_get_roots().size() > next_level) {
-            parent_saved = roots_collection->append(payload);
+            // Leaf node doesn't have its own sketch, values are added to the sketch of the parent node
+            parent_saved = roots_collection->append(payload, &sketch_);
         }
     } else {
         // Invariant broken.
@@ -2593,11 +3235,55 @@ std::unique_ptr<AggregateOperator> NBTreeLeafExtent::group_aggregate(aku_Timesta
     return leaf_->group_aggregate(begin, end, step);
 }
 
-bool NBTreeLeafExtent::is_dirty() const {
-    if (leaf_) {
-        return leaf_->nelements() != 0;
-    }
-    return false;
+std::unique_ptr<QuantileOperator> NBTreeLeafExtent::group_quantiles(aku_Timestamp begin, aku_Timestamp end, u64 step) const {
+    std::unique_ptr<QuantileOperator> result;
+    result.reset(new NBTreeGroupQuantileAggregator(begin, end, step, *leaf_));
+    return result;
+}
+
+std::unique_ptr<AggregateOperator> NBTreeLeafExtent::group_aggregate_filter(aku_Timestamp begin,
+                                                                            aku_Timestamp end,
+                                                                            u64 step,
+                                                                            const AggregateFilter&) const
+{
+    // Leaf node is in memory, there is nothing to prune
+    return leaf_->group_aggregate(begin, end, step);
+}
+
+void NBTreeLeafExtent::get_bounds(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const {
+    std::vector<aku_Timestamp> tss;
+    std::vector<double> xss;
+    aku_Status status = leaf_->read_all(&tss, &xss);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("NBTreeLeaf.read_all failed, exit code: " + StatusUtil::str(status));
+    }
+    auto min = std::min(begin, end);
+    auto max = std::max(begin, end);
+    for (size_t i = 0; i < tss.size(); i++) {
+        if (tss[i] >= min && tss[i] <= max) {
+            bounds->add(xss[i]);
+        }
+    }
+}
+
+bool NBTreeLeafExtent::get_oldest_leaf(SubtreeRef* ref) const {
+    if (leaf_->nelements() == 0) {
+        return false;
+    }
+    aku_Timestamp begin, end;
+    std::tie(begin, end) = leaf_->get_timestamps();
+    *ref = {};
+    ref->begin = begin;
+    ref->end   = end;
+    ref->addr  = EMPTY_ADDR;
+    return true;
+}
+
+bool NBTreeLeafExtent::is_dirty() const {
+    if (leaf_) {
+        return leaf_->nelements() != 0;
+    }
+    return false;
 }
 
 std::tuple<bool, LogicAddr> NBTreeLeafExtent::split(aku_Timestamp pivot) {
@@ -2646,6 +3332,8 @@ struct NBTreeSBlockExtent : NBTreeExtent {
     std::shared_ptr<BlockStore> bstore_;
     std::weak_ptr<NBTreeExtentsList> roots_;
     std::unique_ptr<NBTreeSuperblock> curr_;
+    //! Quantile sketch of the `curr_` node (null if unknown, node is committed without the sketch)
+    std::unique_ptr<QuantileSketch> sketch_;
     aku_ParamId id_;
     LogicAddr last_;
     u16 fanout_index_;
@@ -2693,6 +3381,7 @@ struct NBTreeSBlockExtent : NBTreeExtent {
         } else {
             // `addr` is not set. Node should be created from scratch.
             curr_.reset(new NBTreeSuperblock(id, EMPTY_ADDR, 0, level));
+            sketch_.reset(new QuantileSketch());
         }
     }
 
@@ -2726,6 +3415,7 @@ struct NBTreeSBlockExtent : NBTreeExtent {
 
     void reset_subtree() {
         curr_.reset(new NBTreeSuperblock(id_, last_, fanout_index_, level_));
+        sketch_.reset(new QuantileSketch());
     }
 
     u16 get_fanout_index() const {
@@ -2742,6 +3432,7 @@ struct NBTreeSBlockExtent : NBTreeExtent {
 
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value) override;
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl) override;
+    virtual void append_sketch(QuantileSketch const* sketch) override;
     virtual std::tuple<bool, LogicAddr> commit(bool final) override;
     virtual std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end) const override;
     virtual std::unique_ptr<RealValuedOperator> filter(aku_Timestamp begin,
@@ -2750,6 +3441,14 @@ struct NBTreeSBlockExtent : NBTreeExtent {
     virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const override;
     virtual std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const override;
     virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const override;
+    virtual std::unique_ptr<QuantileOperator> group_quantiles(aku_Timestamp begin, aku_Timestamp end, u64 step) const override;
+    virtual std::unique_ptr<AggregateOperator> group_aggregate_filter(aku_Timestamp begin,
+                                                                      aku_Timestamp end,
+                                                                      u64 step,
+                                                                      const AggregateFilter& filter) const override;
+    virtual void get_bounds(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const override;
+
+    virtual bool get_oldest_leaf(SubtreeRef* ref) const override;
     virtual bool is_dirty() const override;
     virtual void debug_dump(std::ostream& stream, int base_indent, std::function<std::string(aku_Timestamp)> tsformat, u32 mask) const override;
     virtual std::tuple<bool, LogicAddr> split(aku_Timestamp pivot) override;
@@ -2875,24 +3574,45 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(SubtreeRef const& pl) {
     return std::make_tuple(false, EMPTY_ADDR);
 }
 
+void NBTreeSBlockExtent::append_sketch(QuantileSketch const* sketch) {
+    if (sketch && sketch_) {
+        sketch_->merge(*sketch);
+    } else {
+        sketch_.reset();
+    }
+}
+
 std::tuple<bool, LogicAddr> NBTreeSBlockExtent::commit(bool final) {
     // Invariant: after call to this method data from `curr_` should
     // endup in block store, upper level root node should be updated
     // and `curr_` variable should be reset.
     // Otherwise: panic should be triggered.
 
-    LogicAddr addr;
-    aku_Status status;
-    std::tie(status, addr) = curr_->commit(bstore_);
-    if (status != AKU_SUCCESS) {
-        AKU_PANIC("Can't write superblock to block-store, " + StatusUtil::str(status));
-    }
     // Gather stats and send them to upper-level node
     SubtreeRef payload = INIT_SUBTREE_REF;
-    status = init_subtree_from_subtree(*curr_, payload);
+    aku_Status status = init_subtree_from_subtree(*curr_, payload);
     if (status != AKU_SUCCESS) {
         AKU_PANIC("Can summarize current node - " + StatusUtil::str(status));
     }
+    // Quantile sketch is written before the node, node's trailer refers to it.
+    // Node without the sketch is still valid, queries will read its children.
+    std::unique_ptr<QuantileSketch> sketch = std::move(sketch_);
+    if (sketch) {
+        LogicAddr sketch_addr;
+        std::tie(status, sketch_addr) = write_sketch(bstore_, payload, *sketch);
+        if (status == AKU_SUCCESS) {
+            curr_->set_sketch_addr(sketch_addr);
+        } else {
+            Logger::msg(AKU_LOG_ERROR, "Can't write quantile sketch to block-store, " + StatusUtil::str(status));
+            sketch.reset();
+        }
+    }
+
+    LogicAddr addr;
+    std::tie(status, addr) = curr_->commit(bstore_);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("Can't write superblock to block-store, " + StatusUtil::str(status));
+    }
     payload.addr = addr;
     bool parent_saved = false;
     auto roots_collection = roots_.lock();
@@ -2900,7 +3620,7 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::commit(bool final) {
     if (roots_collection) {
         if (!final || roots_collection->_get_roots().size() > next_level) {
             // We shouldn't create new root if `commit` called from `close` method.
-            parent_saved = roots_collection->append(payload);
+            parent_saved = roots_collection->append(payload, sketch.get());
         }
     } else {
         // Invariant broken.
@@ -2943,6 +3663,84 @@ std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::group_aggregate(aku_Times
     return curr_->group_aggregate(begin, end, step, bstore_);
 }
 
+std::unique_ptr<QuantileOperator> NBTreeSBlockExtent::group_quantiles(aku_Timestamp begin, aku_Timestamp end, u64 step) const {
+    std::vector<SubtreeRef> refs;
+    aku_Status status = curr_->read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("NBTreeSuperblock.read_all failed, exit code: " + StatusUtil::str(status));
+    }
+    std::unique_ptr<QuantileOperator> result;
+    result.reset(new NBTreeGroupQuantileAggregator(bstore_, refs, begin, end, step));
+    return result;
+}
+
+std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::group_aggregate_filter(aku_Timestamp begin,
+                                                                              aku_Timestamp end,
+                                                                              u64 step,
+                                                                              const AggregateFilter& filter) const
+{
+    std::unique_ptr<NBTreeSBlockGroupAggregator> result;
+    result.reset(new NBTreeSBlockGroupAggregator(bstore_, *curr_, begin, end, step));
+    result->set_filter(filter, {});
+    return std::move(result);
+}
+
+void NBTreeSBlockExtent::get_bounds(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const {
+    std::vector<SubtreeRef> refs;
+    aku_Status status = curr_->read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("NBTreeSuperblock.read_all failed, exit code: " + StatusUtil::str(status));
+    }
+    auto min = std::min(begin, end);
+    auto max = std::max(begin, end);
+    for (auto const& ref: refs) {
+        if (subtree_in_range(ref, min, max)) {
+            bounds->add(ref, ref.begin > min && ref.end < max);
+        }
+    }
+}
+
+/** Find the oldest leaf node that wasn't deleted by retention. Blocks are deleted
+  * in the order they were written and child nodes are written before their parent,
+  * so only the first available node can have deleted children.
+  */
+static bool find_oldest_leaf(std::shared_ptr<BlockStore> const& bstore,
+                             std::vector<SubtreeRef> const& refs,
+                             SubtreeRef* result)
+{
+    for (auto const& ref: refs) {
+        if (!bstore->exists(ref.addr)) {
+            continue;
+        }
+        if (ref.type == NBTreeBlockType::LEAF) {
+            *result = ref;
+            return true;
+        }
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = read_and_check(bstore, ref.addr);
+        if (status != AKU_SUCCESS) {
+            // Node was deleted after the check
+            continue;
+        }
+        NBTreeSuperblock sblock(block);
+        std::vector<SubtreeRef> children;
+        if (sblock.read_all(&children) == AKU_SUCCESS && find_oldest_leaf(bstore, children, result)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NBTreeSBlockExtent::get_oldest_leaf(SubtreeRef* ref) const {
+    std::vector<SubtreeRef> refs;
+    aku_Status status = curr_->read_all(&refs);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("NBTreeSuperblock.read_all failed, exit code: " + StatusUtil::str(status));
+    }
+    return find_oldest_leaf(bstore_, refs, ref);
+}
+
 bool NBTreeSBlockExtent::is_dirty() const {
     if (curr_) {
         return curr_->nelements() != 0;
@@ -2962,6 +3760,7 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::split(aku_Timestamp pivot) {
         return empty_res;
     }
     curr_.swap(clone);
+    sketch_.reset();
     return std::make_tuple(false, last_child_addr);
 }
 
@@ -3113,6 +3912,9 @@ NBTreeExtentsList::NBTreeExtentsList(aku_ParamId id, std::vector<LogicAddr> addr
     , rescue_points_(std::move(addresses))
     , initialized_(false)
     , write_count_(0ul)
+    , codec_(ValueCodec::FCM)
+    , reorder_window_(0ull)
+    , max_ts_(0ull)
 #ifdef AKU_ENABLE_MUTATION_TESTING
     , rd_()
     , rand_gen_(rd_())
@@ -3125,10 +3927,194 @@ NBTreeExtentsList::NBTreeExtentsList(aku_ParamId id, std::vector<LogicAddr> addr
     }
 }
 
+void NBTreeExtentsList::set_value_codec(ValueCodec codec) {
+    UniqueLock lock(lock_);
+    codec_ = codec;
+}
+
+void NBTreeExtentsList::set_reorder_window(aku_Timestamp window) {
+    UniqueLock lock(lock_);
+    reorder_window_ = window;
+}
+
+std::tuple<u64, aku_Timestamp> NBTreeExtentsList::get_write_version() const {
+    SharedLock lock(lock_);
+    return std::make_tuple(write_count_, last_);
+}
+
 void NBTreeExtentsList::force_init() {
     UniqueLock lock(lock_);
     if (!initialized_) {
         init();
+        init_rollups();
+    }
+}
+
+void NBTreeExtentsList::add_rollup(aku_Timestamp step, std::shared_ptr<NBTreeExtentsList> tree) {
+    UniqueLock lock(lock_);
+    if (initialized_) {
+        AKU_PANIC("Rollup can't be added to initialized tree");
+    }
+    Rollup rollup = {};
+    rollup.step = step;
+    rollup.tree = std::move(tree);
+    rollup.bucket = INIT_AGGRES;
+    rollups_.push_back(std::move(rollup));
+}
+
+void NBTreeExtentsList::get_rollup_roots(std::unordered_map<aku_ParamId, std::vector<LogicAddr>>* dest) {
+    UniqueLock lock(lock_);
+    for (auto& rollup: rollups_) {
+        if (rollup.dirty) {
+            (*dest)[rollup.tree->get_id()] = rollup.tree->get_roots();
+            rollup.dirty = false;
+        }
+    }
+}
+
+std::vector<std::pair<aku_ParamId, std::vector<LogicAddr>>> NBTreeExtentsList::close_rollups() {
+    std::vector<std::pair<aku_ParamId, std::vector<LogicAddr>>> result;
+    UniqueLock lock(lock_);
+    for (auto& rollup: rollups_) {
+        result.push_back(std::make_pair(rollup.tree->get_id(), rollup.tree->close()));
+    }
+    return result;
+}
+
+void NBTreeExtentsList::add_to_rollup(Rollup& rollup, aku_Timestamp ts, double value) {
+    if (rollup.frozen || ts < rollup.watermark) {
+        return;
+    }
+    if (rollup.bucket.cnt != 0) {
+        aku_Timestamp bucket = rollup.bucket._begin - rollup.bucket._begin % rollup.step;
+        if (ts >= bucket + rollup.step) {
+            rollup.pending.push_back(rollup.bucket);
+            rollup.bucket = INIT_AGGRES;
+        }
+    }
+    rollup.bucket.add(ts, value, true);
+}
+
+void NBTreeExtentsList::flush_rollup(Rollup& rollup) {
+    if (rollup.pending.empty()) {
+        return;
+    }
+    std::vector<aku_Timestamp> ts;
+    std::vector<double> xs;
+    ts.reserve(rollup.pending.size()*ROLLUP_TUPLE_SIZE);
+    xs.reserve(rollup.pending.size()*ROLLUP_TUPLE_SIZE);
+    aku_Timestamp bucket = 0;
+    for (auto const& agg: rollup.pending) {
+        bucket = agg._begin - agg._begin % rollup.step;
+        double tup[ROLLUP_TUPLE_SIZE] = {
+            agg.cnt,
+            agg.sum,
+            agg.min,
+            agg.max,
+            agg.first,
+            agg.last,
+            static_cast<double>(agg.mints - bucket),
+            static_cast<double>(agg.maxts - bucket),
+            static_cast<double>(agg._begin - bucket),
+            static_cast<double>(agg._end - bucket),
+        };
+        for (u32 i = 0; i < ROLLUP_TUPLE_SIZE; i++) {
+            ts.push_back(bucket + i);
+            xs.push_back(tup[i]);
+        }
+    }
+    rollup.pending.clear();
+    size_t nlate = 0;
+    if (rollup.tree->append(ts.data(), xs.data(), ts.size(), &nlate) == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+        rollup.dirty = true;
+    }
+    if (nlate != 0) {
+        Logger::msg(AKU_LOG_ERROR, std::to_string(id_) + " Can't update rollup tree " +
+                                   std::to_string(rollup.tree->get_id()));
+        rollup.frozen = true;
+        return;
+    }
+    rollup.watermark = bucket + rollup.step;
+}
+
+void NBTreeExtentsList::init_rollups() {
+    if (rollups_.empty()) {
+        return;
+    }
+    // NOTE: lock should be held by the caller.
+    // `last_` is not restored when the tree is opened normally. Writes that
+    // precede the data that was added to rollup trees shouldn't be accepted,
+    // so `last_` should be restored here.
+    bool empty = true;
+    for (auto const& extent: extents_) {
+        auto it = extent->search(AKU_MAX_TIMESTAMP, 0);
+        aku_Timestamp ts;
+        double xs;
+        aku_Status status;
+        size_t size;
+        std::tie(status, size) = it->read(&ts, &xs, 1);
+        if ((status == AKU_SUCCESS || status == AKU_ENO_DATA) && size == 1) {
+            last_ = std::max(last_, ts);
+            empty = false;
+        }
+    }
+    max_ts_ = std::max(max_ts_, last_);
+    for (auto& rollup: rollups_) {
+        rollup.tree->force_init();
+        rollup.bucket = INIT_AGGRES;
+        rollup.pending.clear();
+        rollup.watermark = 0;
+        rollup.frozen = false;
+        // Find the last bucket stored in the rollup tree
+        auto it = rollup.tree->search(AKU_MAX_TIMESTAMP, 0);
+        aku_Timestamp ts;
+        double xs;
+        aku_Status status;
+        size_t size;
+        std::tie(status, size) = it->read(&ts, &xs, 1);
+        if ((status == AKU_SUCCESS || status == AKU_ENO_DATA) && size == 1) {
+            aku_Timestamp bucket = ts - ts % rollup.step;
+            if (ts - bucket == ROLLUP_TUPLE_SIZE - 1) {
+                rollup.watermark = bucket + rollup.step;
+            } else {
+                // Last bucket wasn't fully written
+                rollup.watermark = bucket;
+                rollup.frozen = true;
+            }
+        }
+        if (!empty && rollup.watermark > last_ - last_ % rollup.step) {
+            // Rollup tree contains data that was lost
+            rollup.watermark = last_ - last_ % rollup.step;
+            rollup.frozen = true;
+        }
+        if (rollup.frozen) {
+            Logger::msg(AKU_LOG_ERROR, std::to_string(id_) + " Rollup tree " + std::to_string(rollup.tree->get_id()) +
+                                       " is inconsistent, it won't be updated");
+            continue;
+        }
+        if (empty) {
+            continue;
+        }
+        // Add data that is missing in the rollup tree
+        auto data = search_locked(rollup.watermark, last_ + 1);
+        std::vector<aku_Timestamp> rdts(0x1000);
+        std::vector<double> rdxs(0x1000);
+        while (true) {
+            std::tie(status, size) = data->read(rdts.data(), rdxs.data(), rdts.size());
+            if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+                Logger::msg(AKU_LOG_ERROR, std::to_string(id_) + " Can't read data to update rollup tree, " +
+                                           StatusUtil::str(status));
+                rollup.frozen = true;
+                break;
+            }
+            for (size_t i = 0; i < size; i++) {
+                add_to_rollup(rollup, rdts[i], rdxs[i]);
+            }
+            if (status == AKU_ENO_DATA || size == 0) {
+                break;
+            }
+        }
+        flush_rollup(rollup);
     }
 }
 
@@ -3139,9 +4125,10 @@ size_t NBTreeExtentsList::_get_uncommitted_size() const {
             // Small check to make coverity scan happy
             AKU_PANIC("Bad extent at level 0, leaf node expected");
         }
-        return leaf->leaf_->_get_uncommitted_size();
+        return leaf->leaf_->_get_uncommitted_size()
+             + reorder_buf_.size()*sizeof(std::pair<aku_Timestamp, double>);
     }
-    return 0;
+    return reorder_buf_.size()*sizeof(std::pair<aku_Timestamp, double>);
 }
 
 bool NBTreeExtentsList::is_initialized() const {
@@ -3330,9 +4317,106 @@ NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, double value) {
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
+    return append_locked(ts, value);
+}
+
+NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp const* ts, double const* xs, size_t size, size_t* nlate,
+                                             size_t* first_late)
+{
+    UniqueLock lock(lock_);
+    if (!initialized_) {
+        AKU_PANIC("NB+tree not imitialized");
+    }
+    auto result = NBTreeAppendResult::OK;
+    size_t nskipped = 0;
+    for (size_t i = 0; i < size; i++) {
+        auto res = append_locked(ts[i], xs[i]);
+        if (res == NBTreeAppendResult::FAIL_LATE_WRITE) {
+            if (nskipped == 0 && first_late) {
+                *first_late = i;
+            }
+            nskipped++;
+        } else if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            result = res;
+        }
+    }
+    *nlate = nskipped;
+    return result;
+}
+
+NBTreeAppendResult NBTreeExtentsList::append_locked(aku_Timestamp ts, double value) {
     if (ts < last_) {
         return NBTreeAppendResult::FAIL_LATE_WRITE;
     }
+    if (reorder_window_ == 0 && reorder_buf_.empty()) {
+        return append_to_tree(ts, value);
+    }
+    aku_Timestamp hwm = std::max(last_, max_ts_);
+    if (ts < hwm && hwm - ts > reorder_window_) {
+        return NBTreeAppendResult::FAIL_LATE_WRITE;
+    }
+    max_ts_ = std::max(max_ts_, ts);
+    write_count_++;
+    auto it = std::upper_bound(reorder_buf_.begin(), reorder_buf_.end(), ts,
+                               [](aku_Timestamp lhs, std::pair<aku_Timestamp, double> const& rhs) {
+                                   return lhs < rhs.first;
+                               });
+    reorder_buf_.insert(it, std::make_pair(ts, value));
+    // Values that fell out of the window can't be preceded by any new value
+    // so they can be moved to the tree.
+    size_t count = 0;
+    for (auto const& kv: reorder_buf_) {
+        if (max_ts_ - kv.first <= reorder_window_) {
+            break;
+        }
+        count++;
+    }
+    if (reorder_buf_.size() - count > REORDER_BUFFER_MAX_SIZE) {
+        count = reorder_buf_.size() - REORDER_BUFFER_MAX_SIZE;
+    }
+    return flush_reorder_buffer(count);
+}
+
+NBTreeAppendResult NBTreeExtentsList::flush_reorder_buffer(size_t count) {
+    auto result = NBTreeAppendResult::OK;
+    for (size_t i = 0; i < count; i++) {
+        auto const& kv = reorder_buf_.at(i);
+        auto res = append_to_tree(kv.first, kv.second);
+        if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+            result = res;
+        }
+    }
+    reorder_buf_.erase(reorder_buf_.begin(), reorder_buf_.begin() + static_cast<std::ptrdiff_t>(count));
+    return result;
+}
+
+std::vector<std::unique_ptr<NBTreeLeaf>> NBTreeExtentsList::reorder_buffer_leaves(aku_Timestamp begin,
+                                                                                  aku_Timestamp end) const
+{
+    std::vector<std::unique_ptr<NBTreeLeaf>> result;
+    aku_Timestamp min = std::min(begin, end);
+    aku_Timestamp max = std::max(begin, end);
+    std::unique_ptr<NBTreeLeaf> leaf;
+    for (auto const& kv: reorder_buf_) {
+        if (kv.first < min || kv.first > max) {
+            continue;
+        }
+        if (!leaf) {
+            leaf.reset(new NBTreeLeaf(id_, EMPTY_ADDR, 0, codec_));
+        }
+        if (leaf->append(kv.first, kv.second) == AKU_EOVERFLOW) {
+            result.push_back(std::move(leaf));
+            leaf.reset(new NBTreeLeaf(id_, EMPTY_ADDR, 0, codec_));
+            leaf->append(kv.first, kv.second);
+        }
+    }
+    if (leaf) {
+        result.push_back(std::move(leaf));
+    }
+    return result;
+}
+
+NBTreeAppendResult NBTreeExtentsList::append_to_tree(aku_Timestamp ts, double value) {
     last_ = ts;
     write_count_++;
     if (extents_.size() == 0) {
@@ -3357,10 +4441,17 @@ NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, double value) {
         }
         result = NBTreeAppendResult::OK_FLUSH_NEEDED;
     }
+    for (auto& rollup: rollups_) {
+        add_to_rollup(rollup, ts, value);
+        if (addr != EMPTY_ADDR) {
+            // Leaf node was committed, closed buckets can be added to the rollup tree
+            flush_rollup(rollup);
+        }
+    }
     return result;
 }
 
-bool NBTreeExtentsList::append(const SubtreeRef &pl) {
+bool NBTreeExtentsList::append(const SubtreeRef &pl, QuantileSketch const* sketch) {
     // NOTE: this method should be called by extents which
     //       is called by another `append` overload recursively
     //       and lock will be held already so no lock here!
@@ -3383,6 +4474,7 @@ bool NBTreeExtentsList::append(const SubtreeRef &pl) {
     bool parent_saved = false;
     LogicAddr addr = EMPTY_ADDR;
     std::tie(parent_saved, addr) = root->append(pl);
+    root->append_sketch(sketch);
     if (addr != EMPTY_ADDR) {
         // NOTE: `addr != EMPTY_ADDR` means that something was saved to disk (current node or parent node).
         //addr = parent_saved ? EMPTY_ADDR : addr;
@@ -3610,12 +4702,23 @@ std::unique_ptr<RealValuedOperator> NBTreeExtentsList::search(aku_Timestamp begi
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
+    return search_locked(begin, end);
+}
+
+std::unique_ptr<RealValuedOperator> NBTreeExtentsList::search_locked(aku_Timestamp begin, aku_Timestamp end) const {
     std::vector<std::unique_ptr<RealValuedOperator>> iterators;
+    auto buffered = reorder_buffer_leaves(begin, end);
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
             iterators.push_back((*it)->search(begin, end));
         }
+        for (auto const& leaf: buffered) {
+            iterators.push_back(leaf->range(begin, end));
+        }
     } else {
+        for (auto it = buffered.rbegin(); it != buffered.rend(); it++) {
+            iterators.push_back((*it)->range(begin, end));
+        }
         for (auto const& root: extents_) {
             iterators.push_back(root->search(begin, end));
         }
@@ -3637,11 +4740,18 @@ std::unique_ptr<RealValuedOperator> NBTreeExtentsList::filter(aku_Timestamp begi
         AKU_PANIC("NB+tree not imitialized");
     }
     std::vector<std::unique_ptr<RealValuedOperator>> iterators;
+    auto buffered = reorder_buffer_leaves(begin, end);
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
             iterators.push_back((*it)->filter(begin, end, filter));
         }
+        for (auto const& leaf: buffered) {
+            iterators.push_back(leaf->filter(begin, end, filter));
+        }
     } else {
+        for (auto it = buffered.rbegin(); it != buffered.rend(); it++) {
+            iterators.push_back((*it)->filter(begin, end, filter));
+        }
         for (auto const& root: extents_) {
             iterators.push_back(root->filter(begin, end, filter));
         }
@@ -3660,11 +4770,18 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::aggregate(aku_Timestamp be
         AKU_PANIC("NB+tree not imitialized");
     }
     std::vector<std::unique_ptr<AggregateOperator>> iterators;
+    auto buffered = reorder_buffer_leaves(begin, end);
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
             iterators.push_back((*it)->aggregate(begin, end));
         }
+        for (auto const& leaf: buffered) {
+            iterators.push_back(leaf->aggregate(begin, end));
+        }
     } else {
+        for (auto it = buffered.rbegin(); it != buffered.rend(); it++) {
+            iterators.push_back((*it)->aggregate(begin, end));
+        }
         for (auto const& root: extents_) {
             iterators.push_back(root->aggregate(begin, end));
         }
@@ -3683,18 +4800,92 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::group_aggregate(aku_Timest
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
+    if (begin < end && step != 0) {
+        Rollup const* rollup = find_rollup(begin, step);
+        aku_Timestamp mid = rollup ? std::min(rollup->watermark, end - end % rollup->step) : begin;
+        if (mid > begin) {
+            std::vector<std::unique_ptr<AggregateOperator>> iterators;
+            iterators.emplace_back(new NBTreeRollupAggregator(begin, step, rollup->step,
+                                                              rollup->tree->search(begin, mid)));
+            if (mid < end) {
+                // The rest of the range is read from the tree. Bucket that is split between
+                // the rollup and the tree is read separately to preserve buckets alignment.
+                aku_Timestamp next = std::min(end, begin + (mid - begin + step - 1) / step * step);
+                if (mid < next) {
+                    group_aggregate_locked(mid, next, step, &iterators);
+                }
+                if (next < end) {
+                    group_aggregate_locked(next, end, step, &iterators);
+                }
+            }
+            std::unique_ptr<AggregateOperator> concat;
+            concat.reset(new CombineGroupAggregateOperator(begin, step, std::move(iterators)));
+            return concat;
+        }
+    }
     std::vector<std::unique_ptr<AggregateOperator>> iterators;
+    group_aggregate_locked(begin, end, step, &iterators);
+    std::unique_ptr<AggregateOperator> concat;
+    concat.reset(new CombineGroupAggregateOperator(begin, step, std::move(iterators)));
+    return concat;
+}
+
+NBTreeExtentsList::Rollup const* NBTreeExtentsList::find_rollup(aku_Timestamp begin, aku_Timestamp step) const {
+    // Use the largest rollup that is aligned with the query buckets
+    Rollup const* rollup = nullptr;
+    for (auto const& it: rollups_) {
+        if (step % it.step == 0 && begin % it.step == 0 && it.watermark > begin) {
+            if (rollup == nullptr || rollup->step < it.step) {
+                rollup = &it;
+            }
+        }
+    }
+    return rollup;
+}
+
+void NBTreeExtentsList::group_aggregate_locked(aku_Timestamp begin,
+                                               aku_Timestamp end,
+                                               aku_Timestamp step,
+                                               std::vector<std::unique_ptr<AggregateOperator>>* iterators) const
+{
+    auto buffered = reorder_buffer_leaves(begin, end);
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
-            iterators.push_back((*it)->group_aggregate(begin, end, step));
+            iterators->push_back((*it)->group_aggregate(begin, end, step));
+        }
+        for (auto const& leaf: buffered) {
+            iterators->push_back(leaf->group_aggregate(begin, end, step));
         }
     } else {
+        for (auto it = buffered.rbegin(); it != buffered.rend(); it++) {
+            iterators->push_back((*it)->group_aggregate(begin, end, step));
+        }
         for (auto const& root: extents_) {
-            iterators.push_back(root->group_aggregate(begin, end, step));
+            iterators->push_back(root->group_aggregate(begin, end, step));
         }
     }
-    std::unique_ptr<AggregateOperator> concat;
-    concat.reset(new CombineGroupAggregateOperator(begin, step, std::move(iterators)));
+}
+
+std::unique_ptr<QuantileOperator> NBTreeExtentsList::group_quantiles(aku_Timestamp begin,
+                                                                     aku_Timestamp end,
+                                                                     aku_Timestamp step) const
+{
+    SharedLock lock(lock_);
+    if (!initialized_) {
+        AKU_PANIC("NB+tree not imitialized");
+    }
+    std::vector<std::unique_ptr<QuantileOperator>> iterators;
+    if (begin < end) {
+        auto buffered = reorder_buffer_leaves(begin, end);
+        for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
+            iterators.push_back((*it)->group_quantiles(begin, end, step));
+        }
+        for (auto const& leaf: buffered) {
+            iterators.emplace_back(new NBTreeGroupQuantileAggregator(begin, end, step, *leaf));
+        }
+    }
+    std::unique_ptr<QuantileOperator> concat;
+    concat.reset(new CombineGroupQuantileOperator(begin, step, std::move(iterators)));
     return concat;
 }
 
@@ -3703,23 +4894,110 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::group_aggregate_filter(aku
                                                                              aku_Timestamp step,
                                                                              const AggregateFilter &filter) const
 {
+    if (begin < end && step != 0) {
+        SharedLock lock(lock_);
+        if (!initialized_) {
+            AKU_PANIC("NB+tree not imitialized");
+        }
+        // Subtrees can be pruned only if buckets are computed using the tree alone,
+        // rollups and reorder buffer are handled by the generic path.
+        bool buffered = std::any_of(reorder_buf_.begin(), reorder_buf_.end(),
+                                    [begin, end](std::pair<aku_Timestamp, double> const& kv) {
+                                        return kv.first >= begin && kv.first < end;
+                                    });
+        if (!buffered && find_rollup(begin, step) == nullptr) {
+            std::unique_ptr<AggregateOperator> result;
+            NBTreeBounds bounds = INIT_BOUNDS;
+            get_bounds_locked(begin, end, &bounds);
+            SubtreeRef ref = INIT_SUBTREE_REF;
+            ref.min = bounds.min;
+            ref.max = bounds.max;
+            if (bounds.cnt == 0 || !filter.can_match(ref)) {
+                // None of the buckets can match the filter
+                result.reset(new ValueAggregator());
+                return result;
+            }
+            std::vector<std::unique_ptr<AggregateOperator>> iterators;
+            for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
+                iterators.push_back((*it)->group_aggregate_filter(begin, end, step, filter));
+            }
+            std::unique_ptr<AggregateOperator> concat;
+            concat.reset(new CombineGroupAggregateOperator(begin, step, std::move(iterators)));
+            result.reset(new NBTreeGroupAggregateFilter(filter, std::move(concat)));
+            return result;
+        }
+    }
     auto iter = group_aggregate(begin, end, step);
     std::unique_ptr<AggregateOperator> result;
     result.reset(new NBTreeGroupAggregateFilter(filter, std::move(iter)));
     return result;
 }
 
+std::tuple<aku_Status, NBTreeBounds> NBTreeExtentsList::get_bounds(aku_Timestamp begin, aku_Timestamp end) const {
+    SharedLock lock(lock_);
+    if (!initialized_) {
+        AKU_PANIC("NB+tree not imitialized");
+    }
+    NBTreeBounds bounds = INIT_BOUNDS;
+    get_bounds_locked(begin, end, &bounds);
+    return std::make_tuple(bounds.cnt == 0 ? AKU_ENO_DATA : AKU_SUCCESS, bounds);
+}
+
+void NBTreeExtentsList::get_bounds_locked(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const {
+    for (auto const& extent: extents_) {
+        extent->get_bounds(begin, end, bounds);
+    }
+    auto min = std::min(begin, end);
+    auto max = std::max(begin, end);
+    for (auto const& kv: reorder_buf_) {
+        if (kv.first >= min && kv.first <= max) {
+            bounds->add(kv.second);
+        }
+    }
+}
+
+std::tuple<aku_Status, aku_Timestamp, LogicAddr> NBTreeExtentsList::get_retention_boundary() const {
+    SharedLock lock(lock_);
+    if (!initialized_) {
+        AKU_PANIC("NB+tree not imitialized");
+    }
+    // Extents are ordered from the leaf level to the root, the root extent has the oldest data
+    SubtreeRef ref;
+    for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
+        if ((*it)->get_oldest_leaf(&ref)) {
+            aku_Timestamp begin = ref.begin;
+            LogicAddr addr = ref.addr;
+            return std::make_tuple(AKU_SUCCESS, begin, addr);
+        }
+    }
+    if (!reorder_buf_.empty()) {
+        return std::make_tuple(AKU_SUCCESS, reorder_buf_.begin()->first, EMPTY_ADDR);
+    }
+    return std::make_tuple(AKU_ENO_DATA, 0ull, EMPTY_ADDR);
+}
+
+bool NBTreeExtentsList::is_available(LogicAddr addr) const {
+    return bstore_->exists(addr);
+}
+
 std::unique_ptr<AggregateOperator> NBTreeExtentsList::candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const {
     SharedLock lock(lock_);
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
     std::vector<std::unique_ptr<AggregateOperator>> iterators;
+    auto buffered = reorder_buffer_leaves(begin, end);
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
             iterators.push_back((*it)->candlesticks(begin, end, hint));
         }
+        for (auto const& leaf: buffered) {
+            iterators.push_back(leaf->candlesticks(begin, end, hint));
+        }
     } else {
+        for (auto it = buffered.rbegin(); it != buffered.rend(); it++) {
+            iterators.push_back((*it)->candlesticks(begin, end, hint));
+        }
         for (auto const& root: extents_) {
             iterators.push_back(root->candlesticks(begin, end, hint));
         }
@@ -3737,6 +5015,9 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::candlesticks(aku_Timestamp
 std::vector<LogicAddr> NBTreeExtentsList::close() {
     UniqueLock lock(lock_);
     if (initialized_) {
+        // Values from the reorder buffer should be added to the tree before commit
+        flush_reorder_buffer(reorder_buf_.size());
+        max_ts_ = last_;
         if (write_count_) {
             Logger::msg(AKU_LOG_TRACE, std::to_string(id_) + " Going to close the tree.");
             LogicAddr addr = EMPTY_ADDR;
@@ -3751,6 +5032,9 @@ std::vector<LogicAddr> NBTreeExtentsList::close() {
             std::vector<LogicAddr> result(rescue_points_.size(), EMPTY_ADDR);
             result.back() = addr;
             std::swap(rescue_points_, result);
+            for (auto& rollup: rollups_) {
+                flush_rollup(rollup);
+            }
         } else {
             // Special case, tree was opened but left unmodified
             if (rescue_points_.size() == 2 && rescue_points_.back() == EMPTY_ADDR) {
@@ -75,6 +75,7 @@
 
 // C++ headers
 #include <deque>
+#include <unordered_map>
 
 // App headers
 #include "nbtree_def.h"
@@ -95,6 +96,33 @@ struct NBTreeCandlestickHint {
 };
 
 
+/** Conservative bounds of the values stored in the time range.
+  * Computed using subtree references without reading the data.
+  */
+struct NBTreeBounds {
+    //! Lower bound of the values
+    double min;
+    //! Upper bound of the values
+    double max;
+    //! Upper bound of the number of values
+    double cnt;
+    //! Upper bound of the sum of the values
+    double sum;
+
+    //! Extend bounds using subtree reference, `inside` should be set if subtree is inside the range
+    void add(SubtreeRef const& ref, bool inside);
+    //! Extend bounds using the value
+    void add(double value);
+};
+
+static const NBTreeBounds INIT_BOUNDS = {
+    std::numeric_limits<double>::max(),
+    std::numeric_limits<double>::lowest(),
+    .0,
+    .0,
+};
+
+
 class NBTreeSuperblock;
 
 /** NBTree leaf node. Supports append operation.
@@ -127,8 +155,9 @@ public:
       * @param link to block store.
       * @param prev Prev element of the tree.
       * @param fanout_index Index inside current fanout
+      * @param codec Value codec.
       */
-    NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index);
+    NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index, ValueCodec codec = ValueCodec::FCM);
 
     /** Load from block store.
       * @param block Leaf's serialized data.
@@ -178,6 +207,19 @@ public:
       */
     aku_Status read_all(std::vector<aku_Timestamp>* timestamps, std::vector<double>* values) const;
 
+    /** Read elements from the leaf node that can belong to [min, max] time range.
+      * Chunk directory is used to skip the data outside of the range, result is
+      * a continuous subrange of `read_all` output that contains all elements from
+      * [min, max] time range and their nearest neighbours (if they exist).
+      * @param min Begining of the time range.
+      * @param max End of the time range.
+      * @param timestamps Destination for timestamps.
+      * @param values Destination for values.
+      * @return status.
+      */
+    aku_Status read_range(aku_Timestamp min, aku_Timestamp max,
+                          std::vector<aku_Timestamp>* timestamps, std::vector<double>* values) const;
+
     //! Append values to NBTree
     aku_Status append(aku_Timestamp ts, double value);
 
@@ -311,6 +353,14 @@ public:
     //! Return address of the node itself (or EMPTY_ADDR if not saved yet)
     LogicAddr get_addr() const;
 
+    /** Set address of the quantile sketch of the subtree (works only on mutable node).
+      * Address is stored in the trailer of the node.
+      */
+    void set_sketch_addr(LogicAddr addr);
+
+    //! Return address of the quantile sketch of the subtree (or EMPTY_ADDR if node doesn't have one)
+    LogicAddr get_sketch_addr() const;
+
     //! Read timestamps
     std::tuple<aku_Timestamp, aku_Timestamp> get_timestamps() const;
 
@@ -389,6 +439,13 @@ struct NBTreeExtent {
       */
     virtual std::tuple<bool, LogicAddr> append(SubtreeRef const& pl) = 0;
 
+    /** Add quantile sketch of the last appended subtree to the sketch of the root
+      * (doesn't work with leaf nodes). Null pointer means that the sketch of the
+      * subtree is not known, in this case the root is committed without the sketch
+      * and queries read its children instead.
+      */
+    virtual void append_sketch(QuantileSketch const* sketch) = 0;
+
     /** Write all changes to the block-store, even if node is not full.
       * @param final Should be set to false during normal operation and set to true during commit.
       * @return boolean value that is set to true when higher level node was saved as a
@@ -421,6 +478,27 @@ struct NBTreeExtent {
     //! Return group-aggregate query results iterator
     virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const = 0;
 
+    //! Return group-aggregate iterator that computes percentiles (forward direction only)
+    virtual std::unique_ptr<QuantileOperator> group_quantiles(aku_Timestamp begin, aku_Timestamp end, u64 step) const = 0;
+
+    /** Return group-aggregate query results iterator that can skip subtrees which
+      * can't match the filter (forward direction only). Buckets that can't match
+      * the filter can be incomplete or missing, output should be filtered.
+      */
+    virtual std::unique_ptr<AggregateOperator> group_aggregate_filter(aku_Timestamp begin,
+                                                                      aku_Timestamp end,
+                                                                      u64 step,
+                                                                      const AggregateFilter& filter) const = 0;
+
+    //! Extend bounds using data from [min(begin, end), max(begin, end)] range (doesn't read any blocks).
+    virtual void get_bounds(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const = 0;
+
+    /** Find the oldest leaf node of the extent that wasn't deleted by retention.
+      * Address of the in-memory leaf node is EMPTY_ADDR.
+      * @return false if the extent doesn't have any available data
+      */
+    virtual bool get_oldest_leaf(SubtreeRef* ref) const = 0;
+
     // Service functions //
 
     virtual void debug_dump(std::ostream& stream,
@@ -476,6 +554,33 @@ class NBTreeExtentsList : public std::enable_shared_from_this<NBTreeExtentsList>
     bool initialized_;
     //! Number of write operations performed on object
     u64 write_count_;
+    //! Value codec used by new leaf nodes
+    ValueCodec codec_;
+    //! Reorder window size (0 - out of order writes are not allowed)
+    aku_Timestamp reorder_window_;
+    //! Largest timestamp accepted by the `append` method
+    aku_Timestamp max_ts_;
+    //! Sorted list of late values that wasn't added to the tree yet
+    std::vector<std::pair<aku_Timestamp, double>> reorder_buf_;
+
+    //! Group-aggregate results materialized for one bucket size
+    struct Rollup {
+        //! Bucket size
+        aku_Timestamp step;
+        //! Rollup tree
+        std::shared_ptr<NBTreeExtentsList> tree;
+        //! Aggregate of the current (open) bucket
+        AggregationResult bucket;
+        //! Closed buckets that will be added to the rollup tree on next commit
+        std::vector<AggregationResult> pending;
+        //! All buckets before this timestamp are stored in the rollup tree
+        aku_Timestamp watermark;
+        //! Rollup tree is inconsistent with the data and can't be updated
+        bool frozen;
+        //! Rescue points of the rollup tree were changed and not persisted yet
+        bool dirty;
+    };
+    std::vector<Rollup> rollups_;
 
     void open();
 
@@ -501,7 +606,57 @@ class NBTreeExtentsList : public std::enable_shared_from_this<NBTreeExtentsList>
     std::tuple<aku_Status, AggregationResult> get_aggregates(u32 ixnode) const;
 
     void check_rescue_points(u32 i) const;
+
+    //! Append value to the tree (lock should be held)
+    NBTreeAppendResult append_locked(aku_Timestamp ts, double value);
+
+    //! Append value to the tree bypassing the reorder buffer
+    NBTreeAppendResult append_to_tree(aku_Timestamp ts, double value);
+
+    //! Move `count` oldest values from the reorder buffer to the tree
+    NBTreeAppendResult flush_reorder_buffer(size_t count);
+
+    /** Build in-memory leaf nodes from the content of the reorder buffer.
+      * Only values from [min(begin, end), max(begin, end)] range are used.
+      * Leaf nodes are returned in time order.
+      */
+    std::vector<std::unique_ptr<NBTreeLeaf>> reorder_buffer_leaves(aku_Timestamp begin, aku_Timestamp end) const;
+
+    //! Add value to the current bucket of the rollup
+    static void add_to_rollup(Rollup& rollup, aku_Timestamp ts, double value);
+
+    //! Move closed buckets of the rollup to the rollup tree
+    void flush_rollup(Rollup& rollup);
+
+    //! Initialize rollups, add data that is missing in rollup trees
+    void init_rollups();
+
+    //! Search implementation (lock should be held)
+    std::unique_ptr<RealValuedOperator> search_locked(aku_Timestamp begin, aku_Timestamp end) const;
+
+    //! Return the largest rollup that can be used by group-aggregate query (lock should be held)
+    Rollup const* find_rollup(aku_Timestamp begin, aku_Timestamp step) const;
+
+    //! Extend bounds using the data from extents and reorder buffer (lock should be held)
+    void get_bounds_locked(aku_Timestamp begin, aku_Timestamp end, NBTreeBounds* bounds) const;
+
+    /** Add group-aggregate iterators of all extents to the list (lock should be held).
+      * Iterators should be combined using CombineGroupAggregateOperator.
+      */
+    void group_aggregate_locked(aku_Timestamp begin,
+                                aku_Timestamp end,
+                                aku_Timestamp step,
+                                std::vector<std::unique_ptr<AggregateOperator>>* iterators) const;
 public:
+    //! Max number of values that can be stored in the reorder buffer
+    enum {
+        REORDER_BUFFER_MAX_SIZE = 1024,
+    };
+
+    //! Number of values used to store one bucket in the rollup tree
+    enum {
+        ROLLUP_TUPLE_SIZE = 10,
+    };
 
     std::tuple<aku_Status, LogicAddr> _split(aku_Timestamp pivot);
 
@@ -513,19 +668,78 @@ public:
 
     aku_ParamId get_id() const { return id_; }
 
+    /** Set value codec. Codec is used by new leaf nodes, current leaf node
+      * (if any) keeps using the old one until it's committed.
+      */
+    void set_value_codec(ValueCodec codec);
+
+    ValueCodec get_value_codec() const { return codec_; }
+
+    /** Set reorder window. Values that are late by no more than `window`
+      * (relative to the largest timestamp seen so far) are accepted and kept
+      * in the small sorted buffer until they can be added to the tree in order.
+      * Values that are late by more than `window` are rejected with FAIL_LATE_WRITE.
+      * Zero window disables the reordering.
+      */
+    void set_reorder_window(aku_Timestamp window);
+
+    aku_Timestamp get_reorder_window() const { return reorder_window_; }
+
+    /** Return number of write operations performed on the tree and the last
+      * timestamp added to the tree. Values older than the last timestamp
+      * can't be added, so data before it never changes.
+      */
+    std::tuple<u64, aku_Timestamp> get_write_version() const;
+
+    /** Add rollup tree. Rollup tree stores aggregates of the `step`-sized buckets
+      * aligned to multiples of the `step`. Each bucket is stored as ROLLUP_TUPLE_SIZE
+      * values with consecutive timestamps starting from the beginning of the bucket
+      * (count, sum, min, max, first, last, min timestamp, max timestamp, first timestamp,
+      * last timestamp, timestamps are stored relative to the beginning of the bucket).
+      * Closed buckets are added to the rollup tree when leaf node is committed.
+      * Group-aggregate queries that are aligned with the buckets are answered using
+      * the rollup tree. Should be called before the tree is initialized.
+      * @param step is a bucket size
+      * @param tree is a rollup tree
+      */
+    void add_rollup(aku_Timestamp step, std::shared_ptr<NBTreeExtentsList> tree);
+
+    /** Add rescue points of the rollup trees that were changed since the previous
+      * call to `dest`. Rollup trees are updated when the leaf node is committed, so
+      * this should be called when `append` returns OK_FLUSH_NEEDED.
+      */
+    void get_rollup_roots(std::unordered_map<aku_ParamId, std::vector<LogicAddr>>* dest);
+
+    /** Close all rollup trees.
+      * Should be called after `close`.
+      * @return list of rollup tree ids and addresses
+      */
+    std::vector<std::pair<aku_ParamId, std::vector<LogicAddr>>> close_rollups();
+
     /** Append new subtree reference to extents list.
       * This operation can't fail and should be used only by NB-tree itself (from node-commit functions).
       * This property is not enforced by the typesystem.
       * Result is OK or OK_FLUSH_NEEDED (if rescue points list was changed).
+      * @param pl is a subtree reference
+      * @param sketch is a quantile sketch of the subtree (null if not available)
       */
-    bool append(SubtreeRef const& pl);
+    bool append(SubtreeRef const& pl, QuantileSketch const* sketch = nullptr);
 
     /** Append new value to extents list.
-      * This operation can fail if value is out of order.
+      * This operation can fail if value is out of order (and out of reorder window).
       * On success result is OK or OK_FLUSH_NEEDED (if rescue points list was changed).
       */
     NBTreeAppendResult append(aku_Timestamp ts, double value);
 
+    /** Append run of values to extents list. Lock is acquired only once.
+      * Values that can't be added because they're out of order are skipped,
+      * number of skipped values is returned through `nlate` and index of the
+      * first skipped value through `first_late` (if not null).
+      * Result is OK or OK_FLUSH_NEEDED (if rescue points list was changed).
+      */
+    NBTreeAppendResult append(aku_Timestamp const* ts, double const* xs, size_t size, size_t* nlate,
+                              size_t* first_late = nullptr);
+
     /**
      * @brief search function
      * @param begin is a start of the search interval
@@ -550,6 +764,25 @@ public:
      */
     std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
 
+    /**
+     * @brief Compute bounds of the values from the search interval without reading the data
+     * @param begin is a start of the search interval
+     * @param end is a next after the last element of the search interval
+     * @return AKU_ENO_DATA if interval doesn't contain data, bounds otherwise
+     */
+    std::tuple<aku_Status, NBTreeBounds> get_bounds(aku_Timestamp begin, aku_Timestamp end) const;
+
+    /** Return the first timestamp of the oldest leaf node that wasn't deleted by retention
+      * and the address of the leaf node (EMPTY_ADDR if the leaf node is not committed yet).
+      * Data older than this timestamp can't be read. Few superblocks are read from the
+      * block-store to find the leaf node.
+      * @return AKU_ENO_DATA if the tree doesn't have any available data
+      */
+    std::tuple<aku_Status, aku_Timestamp, LogicAddr> get_retention_boundary() const;
+
+    //! Return true if the node wasn't deleted by retention
+    bool is_available(LogicAddr addr) const;
+
     std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const;
 
     /**
@@ -561,8 +794,22 @@ public:
      */
     std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step) const;
 
+    /**
+     * @brief Group values into buckets and compute percentiles for each one of them.
+     * Subtrees that fit into one bucket are summarized using their quantile sketches,
+     * only the leaf nodes and subtrees without sketches are scanned.
+     * @param begin start of the search interval
+     * @param end end of the search interval (should be greater than `begin`)
+     * @param step bucket size
+     * @return iterator
+     */
+    std::unique_ptr<QuantileOperator> group_quantiles(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step) const;
+
     /**
      * @brief Group values into buckets and return aggregate from each one of them
+     * Only buckets that match the filter are returned. In forward direction subtrees
+     * that can't match the filter are skipped (only the buckets shared with other
+     * subtrees are computed).
      * @param begin start of the search interval
      * @param end end of the search interval
      * @param step bucket size
@@ -16,6 +16,7 @@ namespace StorageEngine {
 enum class NBTreeBlockType : u16 {
     LEAF,   // data block
     INNER,  // super block
+    SKETCH, // quantile sketch of the subtree
 };
 
 
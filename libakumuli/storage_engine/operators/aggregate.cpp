@@ -7,6 +7,23 @@
 namespace Akumuli {
 namespace StorageEngine {
 
+std::tuple<aku_Status, size_t> ValueAggregator::read(aku_Timestamp *destts, AggregationResult *destval, size_t size) {
+    if (size == 0) {
+        return std::make_pair(AKU_EBAD_ARG, 0);
+    }
+    if (used_) {
+        return std::make_pair(AKU_ENO_DATA, 0);
+    }
+    used_ = true;
+    destval[0] = value_;
+    destts[0] = ts_;
+    return std::make_pair(AKU_SUCCESS, 1);
+}
+
+ValueAggregator::Direction ValueAggregator::get_direction() {
+    return dir_;
+}
+
 void CombineAggregateOperator::add(std::unique_ptr<AggregateOperator>&& it) {
     iter_.push_back(std::move(it));
 }
@@ -258,6 +275,16 @@ std::tuple<aku_Status, size_t> AggregateMaterializer::read(u8* dest, size_t size
             sample.timestamp = destval._end;
             sample.payload.float64 = destval.sum/destval.cnt;
         break;
+        case AggregationFunction::P50:
+        case AggregationFunction::P75:
+        case AggregationFunction::P90:
+        case AggregationFunction::P95:
+        case AggregationFunction::P99:
+        case AggregationFunction::P999:
+            // Query planner doesn't allow percentiles here
+            sample.timestamp = destval._end;
+            sample.payload.float64 = std::numeric_limits<double>::quiet_NaN();
+        break;
         }
         memcpy(dest, &sample, sizeof(sample));
         // move to next
@@ -332,4 +359,119 @@ std::tuple<aku_Status, size_t> SeriesOrderAggregateMaterializer::read(u8 *dest,
 
 }
 
+
+// ---------------------------- //
+// CombineGroupQuantileOperator //
+// ---------------------------- //
+
+std::tuple<aku_Status, size_t> CombineGroupQuantileOperator::read(aku_Timestamp *destts,
+                                                                  QuantileResult *destval,
+                                                                  size_t size)
+{
+    if (size == 0) {
+        return std::make_tuple(AKU_EBAD_ARG, 0);
+    }
+    size_t outsz = 0;
+    std::vector<aku_Timestamp> ts;
+    std::vector<QuantileResult> xs;
+    while (outsz < size && iter_index_ < iter_.size()) {
+        // Every bucket that was read can push at most one bucket to the output
+        size_t n = size - outsz;
+        ts.resize(n);
+        xs.resize(n);
+        aku_Status status;
+        std::tie(status, n) = iter_[iter_index_]->read(ts.data(), xs.data(), n);
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return std::make_tuple(status, 0);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (has_pending_ && (pending_ts_ - begin_) / step_ == (ts[i] - begin_) / step_) {
+                pending_.combine(xs[i]);
+                continue;
+            }
+            if (has_pending_) {
+                destts[outsz]  = pending_ts_;
+                destval[outsz] = std::move(pending_);
+                outsz++;
+            }
+            pending_    = std::move(xs[i]);
+            pending_ts_ = ts[i];
+            has_pending_ = true;
+        }
+        if (status == AKU_ENO_DATA || n == 0) {
+            iter_index_++;
+        }
+    }
+    if (iter_index_ == iter_.size()) {
+        if (has_pending_ && outsz < size) {
+            destts[outsz]  = pending_ts_;
+            destval[outsz] = std::move(pending_);
+            outsz++;
+            has_pending_ = false;
+        }
+        if (!has_pending_) {
+            return std::make_tuple(AKU_ENO_DATA, outsz);
+        }
+    }
+    return std::make_tuple(AKU_SUCCESS, outsz);
+}
+
+CombineGroupQuantileOperator::Direction CombineGroupQuantileOperator::get_direction() {
+    return Direction::FORWARD;
+}
+
+// ------------------------------- //
+// SeriesOrderQuantileMaterializer //
+// ------------------------------- //
+
+std::tuple<aku_Status, size_t> SeriesOrderQuantileMaterializer::read(u8 *dest, size_t dest_size) {
+    aku_Status status = AKU_ENO_DATA;
+    size_t ressz = 0;  // current size
+    size_t accsz = 0;  // accumulated size
+    size_t sample_size = get_tuple_size(tuple_);
+    size_t size = dest_size / sample_size;
+    std::vector<aku_Timestamp> destts_vec(size, 0);
+    std::vector<QuantileResult> destval_vec(size);
+    std::vector<aku_ParamId> outids(size, 0);
+    aku_Timestamp* destts = destts_vec.data();
+    QuantileResult* destval = destval_vec.data();
+    while(pos_ < iters_.size() && size != 0) {
+        aku_ParamId curr = ids_[pos_];
+        std::tie(status, ressz) = iters_[pos_]->read(destts, destval, size);
+        for (size_t i = accsz; i < accsz+ressz; i++) {
+            outids[i] = curr;
+        }
+        destts += ressz;
+        destval += ressz;
+        size -= ressz;
+        accsz += ressz;
+        if (status == AKU_ENO_DATA) {
+            // this iterator is done, continue with next
+            pos_++;
+            continue;
+        }
+        if (status != AKU_SUCCESS) {
+            // Stop iteration on error!
+            break;
+        }
+    }
+    // Convert vectors to series of samples
+    for (size_t i = 0; i < accsz; i++) {
+        double* tup;
+        aku_Sample* sample;
+        std::tie(sample, tup)   = cast(dest);
+        dest                   += sample_size;
+        sample->payload.type    = AKU_PAYLOAD_TUPLE|aku_PData::REGULLAR;
+        sample->payload.size    = static_cast<u16>(sample_size);
+        sample->paramid         = outids[i];
+        sample->timestamp       = destts_vec[i];
+        sample->payload.float64 = get_flags(tuple_);
+        set_tuple(tup, tuple_, destval_vec[i]);
+    }
+    if (status == AKU_ENO_DATA && pos_ < iters_.size()) {
+        status = AKU_SUCCESS;
+    }
+    return std::make_tuple(status, accsz*sample_size);
+}
+
 }}
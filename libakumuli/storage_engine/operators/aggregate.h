@@ -10,6 +10,34 @@ namespace Akumuli {
 namespace StorageEngine {
 
 
+/** Aggregator that returns precomputed value.
+  * Value should be set in c-tor. Default constructed aggregator is empty.
+  */
+class ValueAggregator : public AggregateOperator {
+    aku_Timestamp ts_;
+    AggregationResult value_;
+    Direction dir_;
+    bool used_;
+public:
+    ValueAggregator(aku_Timestamp ts, AggregationResult value, Direction dir)
+        : ts_(ts)
+        , value_(value)
+        , dir_(dir)
+        , used_(false)
+    {
+    }
+
+    ValueAggregator()
+        : ts_()
+        , value_()
+        , dir_()
+        , used_(true)
+    {}
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) override;
+    virtual Direction get_direction() override;
+};
+
 /** Aggregating operator.
   * Accepts list of iterators in the c-tor. All iterators then
   * can be seen as one iterator that returns single value.
@@ -109,6 +137,39 @@ struct CombineGroupAggregateOperator : AggregateOperator {
 };
 
 
+/** Percentile aggregating operator (group-by + percentiles).
+  * Joins several iterators into one, time intervals covered by the iterators
+  * shouldn't overlap. The last bucket of the iterator is joined with the first
+  * bucket of the next one if they belong to the same time interval. Works only
+  * in forward direction.
+  */
+struct CombineGroupQuantileOperator : QuantileOperator {
+    typedef std::vector<std::unique_ptr<QuantileOperator>> IterVec;
+    const aku_Timestamp begin_;
+    const u64           step_;
+    IterVec             iter_;
+    u32                 iter_index_;
+    //! Last bucket that was read (it can be continued by the next iterator)
+    QuantileResult      pending_;
+    aku_Timestamp       pending_ts_;
+    bool                has_pending_;
+
+    template<class TVec>
+    CombineGroupQuantileOperator(aku_Timestamp begin, u64 step, TVec&& iter)
+        : begin_(begin)
+        , step_(step)
+        , iter_(std::forward<TVec>(iter))
+        , iter_index_(0)
+        , pending_ts_(0)
+        , has_pending_(false)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, QuantileResult *destval, size_t size);
+    virtual Direction get_direction();
+};
+
+
 /**
  * Performs materialization for aggregate queries
  */
@@ -177,4 +238,51 @@ struct TimeOrderAggregateMaterializer : TupleOutputUtils, ColumnMaterializer {
     }
 };
 
+
+//! Materializer for percentile group-aggregate queries (order by series)
+struct SeriesOrderQuantileMaterializer : TupleOutputUtils, ColumnMaterializer {
+    std::vector<std::unique_ptr<QuantileOperator>> iters_;
+    std::vector<aku_ParamId> ids_;
+    std::vector<AggregationFunction> tuple_;
+    u32 pos_;
+
+    SeriesOrderQuantileMaterializer(std::vector<aku_ParamId>&& ids,
+                                    std::vector<std::unique_ptr<QuantileOperator>>&& it,
+                                    const std::vector<AggregationFunction>& components)
+        : iters_(std::move(it))
+        , ids_(std::move(ids))
+        , tuple_(components)
+        , pos_(0)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) override;
+};
+
+
+//! Materializer for percentile group-aggregate queries (order by time)
+struct TimeOrderQuantileMaterializer : TupleOutputUtils, ColumnMaterializer {
+    typedef MergeJoinMaterializer<MergeJoinUtil::OrderByTimestamp> Materializer;
+    std::unique_ptr<Materializer> join_iter_;
+
+    TimeOrderQuantileMaterializer(const std::vector<aku_ParamId>& ids,
+                                  std::vector<std::unique_ptr<QuantileOperator>> &it,
+                                  const std::vector<AggregationFunction>& components)
+    {
+        std::vector<std::unique_ptr<ColumnMaterializer>> iters;
+        for (size_t i = 0; i < ids.size(); i++) {
+            std::unique_ptr<ColumnMaterializer> iter;
+            std::vector<std::unique_ptr<QuantileOperator>> qlist;
+            qlist.push_back(std::move(it.at(i)));
+            iter.reset(new SeriesOrderQuantileMaterializer({ ids[i] }, std::move(qlist), components));
+            iters.push_back(std::move(iter));
+        }
+        join_iter_.reset(new Materializer(std::move(iters), true));
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) override {
+        return join_iter_->read(dest, size);
+    }
+};
+
 }}
@@ -1,28 +1,31 @@
 #pragma once
 
 #include "operator.h"
+#include "../query_context.h"
 
-#include <boost/heap/skew_heap.hpp>
-#include <boost/range.hpp>
-#include <boost/range/iterator_range.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
 
 
 namespace Akumuli {
 namespace StorageEngine {
 
 
+//! Merge key packed into single integer (two 64-bit components)
+typedef unsigned __int128 PackedKey;
+
+static inline PackedKey pack_key(u64 hi, u64 lo) {
+    return (static_cast<PackedKey>(hi) << 64) | lo;
+}
+
 template<int dir>  // 0 - forward, 1 - backward
 struct TimeOrder {
-    typedef std::tuple<aku_Timestamp, aku_ParamId> KeyType;
-    typedef std::tuple<KeyType, double, u32> HeapItem;
-    std::greater<KeyType> greater_;
-    std::less<KeyType> less_;
-
-    bool operator () (HeapItem const& lhs, HeapItem const& rhs) const {
-        if (dir == 0) {
-            return greater_(std::get<0>(lhs), std::get<0>(rhs));
-        }
-        return less_(std::get<0>(lhs), std::get<0>(rhs));
+    //! Backward order is implemented by inverting the key
+    static PackedKey pack(aku_Timestamp ts, aku_ParamId id) {
+        auto key = pack_key(ts, id);
+        return dir == 0 ? key : ~key;
     }
 };
 
@@ -30,50 +33,141 @@ struct TimeOrder {
 /**
  * This predicate is used by the join materializer.
  * Merge join should preserve order of the series supplied by the user.
+ * Only timestamps are compared, ties are resolved using the order of inputs.
  */
 template<int dir>  // 0 - forward, 1 - backward
 struct MergeJoinOrder {
-    typedef std::tuple<aku_Timestamp, aku_ParamId> KeyType;
-    typedef std::tuple<KeyType, double, u32> HeapItem;
-
-    bool operator () (HeapItem const& lhs, HeapItem const& rhs) const {
-        if (dir == 0) {
-            return std::get<0>(std::get<0>(lhs)) > std::get<0>(std::get<0>(rhs));
-        }
-        return std::get<0>(std::get<0>(lhs)) < std::get<0>(std::get<0>(rhs));
+    static PackedKey pack(aku_Timestamp ts, aku_ParamId) {
+        auto key = pack_key(ts, 0);
+        return dir == 0 ? key : ~key;
     }
 };
 
 
 template<int dir>  // 0 - forward, 1 - backward
 struct SeriesOrder {
-    typedef std::tuple<aku_Timestamp, aku_ParamId> KeyType;
-    typedef std::tuple<KeyType, double, u32> HeapItem;
-    typedef std::tuple<aku_ParamId, aku_Timestamp> InvKeyType;
-    std::greater<InvKeyType> greater_;
-    std::less<InvKeyType> less_;
-
-    bool operator () (HeapItem const& lhs, HeapItem const& rhs) const {
-        auto lkey = std::get<0>(lhs);
-        InvKeyType ilhs = std::make_tuple(std::get<1>(lkey), std::get<0>(lkey));
-        auto rkey = std::get<0>(rhs);
-        InvKeyType irhs = std::make_tuple(std::get<1>(rkey), std::get<0>(rkey));
-        if (dir == 0) {
-            return greater_(ilhs, irhs);
+    static PackedKey pack(aku_Timestamp ts, aku_ParamId id) {
+        auto key = pack_key(id, ts);
+        return dir == 0 ? key : ~key;
+    }
+};
+
+
+/**
+ * Tournament tree (loser tree) used by k-way merge.
+ * Internal nodes store the losers of the matches, the overall winner is stored
+ * in the node 0. When the key of the winner changes only the matches on the path
+ * from the leaf to the root should be replayed (log2(k) comparisons, binary heap
+ * needs twice as many). Ties are resolved using input index, so the merge is stable.
+ * Exhausted inputs lose to everything else.
+ */
+struct LoserTree {
+    std::vector<PackedKey> keys_;
+    std::vector<u8>        done_;
+    std::vector<u32>       tree_;
+    u32                    size_;
+
+    LoserTree()
+        : size_(0)
+    {
+    }
+
+    //! Initialize the tree, all inputs are exhausted initially
+    void reset(u32 size) {
+        size_ = size;
+        keys_.assign(size, ~PackedKey(0));
+        done_.assign(size, 1);
+        tree_.assign(std::max(size, 1u), 0);
+    }
+
+    u32 size() const {
+        return size_;
+    }
+
+    void set_key(u32 ix, PackedKey key) {
+        keys_[ix] = key;
+        done_[ix] = 0;
+    }
+
+    void set_done(u32 ix) {
+        done_[ix] = 1;
+        keys_[ix] = ~PackedKey(0);
+    }
+
+    //! Check whether input `a` wins over input `b`
+    bool beats(u32 a, u32 b) const {
+        auto ka = keys_[a];
+        auto kb = keys_[b];
+        if (ka != kb) {
+            return ka < kb;
+        }
+        if (done_[a] != done_[b]) {
+            return done_[b] != 0;
         }
-        return less_(ilhs, irhs);
+        return a < b;
+    }
+
+    //! Play all matches, should be called after all keys are set
+    void build() {
+        if (size_ == 0) {
+            return;
+        }
+        // Node `n` has children `2n` and `2n+1`, leaf of the input `i` is `size_ + i`
+        std::vector<u32> winners(2*size_);
+        for (u32 i = 0; i < size_; i++) {
+            winners[size_ + i] = i;
+        }
+        for (u32 n = size_ - 1; n > 0; n--) {
+            u32 lhs = winners[2*n];
+            u32 rhs = winners[2*n + 1];
+            bool lwins = beats(lhs, rhs);
+            winners[n] = lwins ? lhs : rhs;
+            tree_[n]   = lwins ? rhs : lhs;
+        }
+        tree_[0] = size_ == 1 ? 0 : winners[1];
+    }
+
+    //! Replay matches of the input `ix` (should be called after the key of the winner is changed)
+    void replay(u32 ix) {
+        u32 winner = ix;
+        for (u32 n = (size_ + ix) / 2; n > 0; n /= 2) {
+            u32 other = tree_[n];
+            if (beats(other, winner)) {
+                tree_[n] = winner;
+                winner = other;
+            }
+        }
+        tree_[0] = winner;
+    }
+
+    //! Index of the winner
+    u32 top() const {
+        return tree_[0];
+    }
+
+    //! Returns true if all inputs are exhausted
+    bool empty() const {
+        return size_ == 0 || done_[tree_[0]] != 0;
     }
 };
 
 
-template<template <int dir> class CmpPred, bool IsStable=false>
+/**
+ * Merges several series into one (stable k-way merge)
+ */
+template<template <int dir> class CmpPred>
 struct MergeMaterializer : ColumnMaterializer {
     std::vector<std::unique_ptr<RealValuedOperator>> iters_;
     std::vector<aku_ParamId> ids_;
     bool forward_;
 
     enum {
-        RANGE_SIZE=1024
+        //! Max number of elements that can be read from the input at once
+        RANGE_SIZE=4096,
+        //! Min number of elements that can be read from the input at once
+        MIN_RANGE_SIZE=64,
+        //! Max memory used by all input buffers
+        MEMORY_BUDGET=64*1024*1024,
     };
 
     struct Range {
@@ -83,43 +177,43 @@ struct MergeMaterializer : ColumnMaterializer {
         size_t size;
         size_t pos;
 
-        Range(aku_ParamId id)
+        Range(aku_ParamId id, size_t capacity)
             : id(id)
             , size(0)
             , pos(0)
         {
-            ts.resize(RANGE_SIZE);
-            xs.resize(RANGE_SIZE);
+            ts.resize(capacity);
+            xs.resize(capacity);
         }
 
         void advance() {
             pos++;
         }
 
-        void retreat() {
-            assert(pos);
-            pos--;
-        }
-
         bool empty() const {
             return !(pos < size);
         }
 
-        std::tuple<aku_Timestamp, aku_ParamId> top_key() const {
-            return std::make_tuple(ts.at(pos), id);
+        aku_Timestamp top_timestamp() const {
+            return ts[pos];
         }
 
         double top_value() const {
-            return xs.at(pos);
+            return xs[pos];
         }
     };
 
     std::vector<Range> ranges_;
+    LoserTree tree_;
+    bool initialized_;
+    //! Memory used by `ranges_` (accounted in the query budget)
+    QueryMemory memory_;
 
     MergeMaterializer(std::vector<aku_ParamId>&& ids, std::vector<std::unique_ptr<RealValuedOperator>>&& it)
         : iters_(std::move(it))
         , ids_(std::move(ids))
         , forward_(true)
+        , initialized_(false)
     {
         if (!iters_.empty()) {
             forward_ = iters_.front()->get_direction() == RealValuedOperator::Direction::FORWARD;
@@ -136,93 +230,83 @@ struct MergeMaterializer : ColumnMaterializer {
         return kway_merge<1>(dest, size);
     }
 
+    //! Read next portion of data from the input, returns error status
+    template<int dir>
+    aku_Status refill(u32 index) {
+        auto& range = ranges_[index];
+        aku_Status status;
+        size_t outsize;
+        std::tie(status, outsize) = iters_[index]->read(range.ts.data(), range.xs.data(), range.ts.size());
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return status;
+        }
+        range.size = outsize;
+        range.pos  = 0;
+        if (range.empty()) {
+            tree_.set_done(index);
+        } else {
+            tree_.set_key(index, CmpPred<dir>::pack(range.top_timestamp(), range.id));
+        }
+        return AKU_SUCCESS;
+    }
+
     template<int dir>
     std::tuple<aku_Status, size_t> kway_merge(u8* dest, size_t size) {
         if (iters_.empty()) {
             return std::make_tuple(AKU_ENO_DATA, 0);
         }
-        size_t outpos = 0;
-        if (ranges_.empty()) {
+        if (!initialized_) {
             // `ranges_` array should be initialized on first call
-            for (size_t i = 0; i < iters_.size(); i++) {
-                Range range(ids_[i]);
-                aku_Status status;
-                size_t outsize;
-                std::tie(status, outsize) = iters_[i]->read(range.ts.data(), range.xs.data(), RANGE_SIZE);
-                if (status == AKU_SUCCESS || (status == AKU_ENO_DATA && outsize != 0)) {
-                    range.size = outsize;
-                    range.pos  = 0;
-                    ranges_.push_back(std::move(range));
-                }
-                if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            size_t capacity = MEMORY_BUDGET / (iters_.size()*(sizeof(aku_Timestamp) + sizeof(double)));
+            capacity = std::max(static_cast<size_t>(MIN_RANGE_SIZE), std::min(static_cast<size_t>(RANGE_SIZE), capacity));
+            auto status = memory_.resize(iters_.size()*capacity*(sizeof(aku_Timestamp) + sizeof(double)));
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+            ranges_.reserve(iters_.size());
+            tree_.reset(static_cast<u32>(iters_.size()));
+            for (u32 i = 0; i < iters_.size(); i++) {
+                ranges_.emplace_back(ids_[i], capacity);
+                auto status = refill<dir>(i);
+                if (status != AKU_SUCCESS) {
                     return std::make_tuple(status, 0);
                 }
             }
+            tree_.build();
+            initialized_ = true;
         }
 
-        typedef CmpPred<dir> Comp;
-        typedef typename Comp::HeapItem HeapItem;
-        typedef typename Comp::KeyType KeyType;
-        typedef boost::heap::skew_heap<HeapItem, boost::heap::compare<Comp>, boost::heap::stable<IsStable>> Heap;
-        Heap heap;
-
-        int index = 0;
-        for(auto& range: ranges_) {
-            if (!range.empty()) {
-                KeyType key = range.top_key();
-                heap.push(std::make_tuple(key, range.top_value(), index));
-            }
-            index++;
-        }
-
-        enum {
-            KEY = 0,
-            VALUE = 1,
-            INDEX = 2,
-            TIME = 0,
-            ID = 1,
-        };
-
-        while(!heap.empty()) {
-            HeapItem item = heap.top();
-            KeyType point = std::get<KEY>(item);
-            u32 index = std::get<INDEX>(item);
-            aku_Sample sample;
-            sample.paramid = std::get<ID>(point);
-            sample.timestamp = std::get<TIME>(point);
-            sample.payload.type = AKU_PAYLOAD_FLOAT;
-            sample.payload.size = sizeof(aku_Sample);
-            sample.payload.float64 = std::get<VALUE>(item);
-            if (size - outpos >= sizeof(aku_Sample)) {
-                memcpy(dest + outpos, &sample, sizeof(sample));
-                outpos += sizeof(sample);
-            } else {
+        size_t outpos = 0;
+        while(!tree_.empty()) {
+            if (size - outpos < sizeof(aku_Sample)) {
                 // Output buffer is fully consumed
-                return std::make_tuple(AKU_SUCCESS, size);
+                return std::make_tuple(AKU_SUCCESS, outpos);
             }
-            heap.pop();
-            ranges_[index].advance();
-            if (ranges_[index].empty()) {
+            u32 index = tree_.top();
+            auto& range = ranges_[index];
+            aku_Sample* sample = reinterpret_cast<aku_Sample*>(dest + outpos);
+            sample->paramid = range.id;
+            sample->timestamp = range.top_timestamp();
+            sample->payload.type = AKU_PAYLOAD_FLOAT;
+            sample->payload.size = sizeof(aku_Sample);
+            sample->payload.float64 = range.top_value();
+            outpos += sizeof(aku_Sample);
+            range.advance();
+            if (range.empty()) {
                 // Refill range if possible
-                aku_Status status;
-                size_t outsize;
-                std::tie(status, outsize) = iters_[index]->read(ranges_[index].ts.data(), ranges_[index].xs.data(), RANGE_SIZE);
-                if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+                auto status = refill<dir>(index);
+                if (status != AKU_SUCCESS) {
                     return std::make_tuple(status, 0);
                 }
-                ranges_[index].size = outsize;
-                ranges_[index].pos  = 0;
-            }
-            if (!ranges_[index].empty()) {
-                KeyType point = ranges_[index].top_key();
-                heap.push(std::make_tuple(point, ranges_[index].top_value(), index));
+            } else {
+                tree_.set_key(index, CmpPred<dir>::pack(range.top_timestamp(), range.id));
             }
-        }
-        if (heap.empty()) {
-            iters_.clear();
-            ranges_.clear();
+            tree_.replay(index);
         }
         // All iterators are fully consumed
+        iters_.clear();
+        ranges_.clear();
+        memory_.resize(0);
         return std::make_tuple(AKU_ENO_DATA, outpos);
     }
 
@@ -242,24 +326,15 @@ namespace {
     template<int dir, class TKey, TKey (*fnmake)(const aku_Sample*)>  // TKey expected to be tuple
     struct OrderBy {
         typedef TKey KeyType;
-        struct HeapItem {
-            KeyType key;
-            aku_Sample const* sample;
-            size_t index;
-        };
-        std::greater<KeyType> greater_;
-        std::less<KeyType> less_;
-
-        bool operator () (HeapItem const& lhs, HeapItem const& rhs) const {
-            if (dir == 0) {
-                return greater_(lhs.key, rhs.key);
-            }
-            return less_(lhs.key, rhs.key);
-        }
 
         static KeyType make_key(aku_Sample const* sample) {
             return fnmake(sample);
         }
+
+        static PackedKey pack(aku_Sample const* sample) {
+            auto key = pack_key(std::get<0>(fnmake(sample)), std::get<1>(fnmake(sample)));
+            return dir == 0 ? key : ~key;
+        }
     };
 
     template<int dir>
@@ -283,36 +358,22 @@ struct MergeJoinMaterializer : ColumnMaterializer {
         std::vector<u8> buffer;
         u32 size;
         u32 pos;
-        u32 last_advance;
 
         Range()
             : size(0u)
             , pos(0u)
-            , last_advance(0u)
         {
             buffer.resize(RANGE_SIZE*sizeof(aku_Sample));
         }
 
         void advance(u32 sz) {
             pos += sz;
-            last_advance = sz;
-        }
-
-        void retreat() {
-            assert(pos > last_advance);
-            pos -= last_advance;
         }
 
         bool empty() const {
             return !(pos < size);
         }
 
-        std::tuple<aku_Timestamp, aku_ParamId> top_key() const {
-            u8 const* top = buffer.data() + pos;
-            aku_Sample const* sample = reinterpret_cast<aku_Sample const*>(top);
-            return CmpPred<0>::make_key(sample);  // Direction doesn't matter here
-        }
-
         aku_Sample const* top() const {
             u8 const* top = buffer.data() + pos;
             return reinterpret_cast<aku_Sample const*>(top);
@@ -322,63 +383,73 @@ struct MergeJoinMaterializer : ColumnMaterializer {
     std::vector<std::unique_ptr<ColumnMaterializer>> iters_;
     bool forward_;
     std::vector<Range> ranges_;
+    LoserTree tree_;
+    bool initialized_;
+    //! Memory used by `ranges_` (accounted in the query budget)
+    QueryMemory memory_;
 
     MergeJoinMaterializer(std::vector<std::unique_ptr<ColumnMaterializer>>&& it, bool forward)
         : iters_(std::move(it))
         , forward_(forward)
+        , initialized_(false)
     {
     }
 
-    virtual std::tuple<aku_Status, size_t> read(u8* dest, size_t size) {
+    virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) {
         if (forward_) {
             return kway_merge<0>(dest, size);
         }
         return kway_merge<1>(dest, size);
     }
 
+    //! Read next portion of data from the input, returns error status
+    template<int dir>
+    aku_Status refill(u32 index) {
+        auto& range = ranges_[index];
+        aku_Status status;
+        size_t outsize;
+        std::tie(status, outsize) = iters_[index]->read(range.buffer.data(), range.buffer.size());
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return status;
+        }
+        range.size = static_cast<u32>(outsize);
+        range.pos  = 0;
+        if (range.empty()) {
+            tree_.set_done(index);
+        } else {
+            tree_.set_key(index, CmpPred<dir>::pack(range.top()));
+        }
+        return AKU_SUCCESS;
+    }
+
     template<int dir>
     std::tuple<aku_Status, size_t> kway_merge(u8* dest, size_t size) {
         if (iters_.empty()) {
             return std::make_tuple(AKU_ENO_DATA, 0);
         }
-        size_t outpos = 0;
-        if (ranges_.empty()) {
+        if (!initialized_) {
             // `ranges_` array should be initialized on first call
-            for (size_t i = 0; i < iters_.size(); i++) {
-                Range range;
-                aku_Status status;
-                size_t outsize;
-                std::tie(status, outsize) = iters_[i]->read(range.buffer.data(), range.buffer.size());
-                if (status == AKU_SUCCESS || (status == AKU_ENO_DATA && outsize != 0)) {
-                    range.size = static_cast<u32>(outsize);
-                    range.pos  = 0;
-                    ranges_.push_back(std::move(range));
-                }
-                if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            auto status = memory_.resize(iters_.size()*RANGE_SIZE*sizeof(aku_Sample));
+            if (status != AKU_SUCCESS) {
+                return std::make_tuple(status, 0);
+            }
+            ranges_.resize(iters_.size());
+            tree_.reset(static_cast<u32>(iters_.size()));
+            for (u32 i = 0; i < iters_.size(); i++) {
+                auto status = refill<dir>(i);
+                if (status != AKU_SUCCESS) {
                     return std::make_tuple(status, 0);
                 }
             }
+            tree_.build();
+            initialized_ = true;
         }
 
-        typedef CmpPred<dir> Comp;
-        typedef typename Comp::HeapItem HeapItem;
-        typedef typename Comp::KeyType KeyType;
-        typedef boost::heap::skew_heap<HeapItem, boost::heap::compare<Comp>> Heap;
-        Heap heap;
-
-        size_t index = 0;
-        for(auto& range: ranges_) {
-            if (!range.empty()) {
-                KeyType key = range.top_key();
-                heap.push({key, range.top(), index});
-            }
-            index++;
-        }
-
-        while(!heap.empty()) {
-            HeapItem item = heap.top();
-            size_t index = item.index;
-            aku_Sample const* sample = item.sample;
+        size_t outpos = 0;
+        while(!tree_.empty()) {
+            u32 index = tree_.top();
+            auto& range = ranges_[index];
+            aku_Sample const* sample = range.top();
             if (size - outpos >= sample->payload.size) {
                 memcpy(dest + outpos, sample, sample->payload.size);
                 outpos += sample->payload.size;
@@ -386,29 +457,22 @@ struct MergeJoinMaterializer : ColumnMaterializer {
                 // Output buffer is fully consumed
                 return std::make_tuple(AKU_SUCCESS, outpos);
             }
-            heap.pop();
-            ranges_[index].advance(sample->payload.size);
-            if (ranges_[index].empty()) {
+            range.advance(sample->payload.size);
+            if (range.empty()) {
                 // Refill range if possible
-                aku_Status status;
-                size_t outsize;
-                std::tie(status, outsize) = iters_[index]->read(ranges_[index].buffer.data(), ranges_[index].buffer.size());
-                if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+                auto status = refill<dir>(index);
+                if (status != AKU_SUCCESS) {
                     return std::make_tuple(status, 0);
                 }
-                ranges_[index].size = static_cast<u32>(outsize);
-                ranges_[index].pos  = 0;
-            }
-            if (!ranges_[index].empty()) {
-                KeyType point = ranges_[index].top_key();
-                heap.push({point, ranges_[index].top(), index});
+            } else {
+                tree_.set_key(index, CmpPred<dir>::pack(range.top()));
             }
-        }
-        if (heap.empty()) {
-            iters_.clear();
-            ranges_.clear();
+            tree_.replay(index);
         }
         // All iterators are fully consumed
+        iters_.clear();
+        ranges_.clear();
+        memory_.resize(0);
         return std::make_tuple(AKU_ENO_DATA, outpos);
     }
 
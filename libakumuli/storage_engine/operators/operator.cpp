@@ -1,6 +1,11 @@
 #include "operator.h"
+#include "util.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 namespace Akumuli {
 namespace StorageEngine {
@@ -95,6 +100,286 @@ void AggregationResult::combine(const AggregationResult& other) {
     }
 }
 
+bool is_quantile(AggregationFunction func) {
+    switch (func) {
+    case AggregationFunction::P50:
+    case AggregationFunction::P75:
+    case AggregationFunction::P90:
+    case AggregationFunction::P95:
+    case AggregationFunction::P99:
+    case AggregationFunction::P999:
+        return true;
+    default:
+        return false;
+    }
+}
+
+double get_quantile_rank(AggregationFunction func) {
+    switch (func) {
+    case AggregationFunction::P50:
+        return 0.5;
+    case AggregationFunction::P75:
+        return 0.75;
+    case AggregationFunction::P90:
+        return 0.9;
+    case AggregationFunction::P95:
+        return 0.95;
+    case AggregationFunction::P99:
+        return 0.99;
+    case AggregationFunction::P999:
+        return 0.999;
+    default:
+        break;
+    }
+    AKU_PANIC("Not a percentile");
+}
+
+// -------------- //
+// QuantileSketch //
+// -------------- //
+
+namespace {
+
+//! Serialized sketch header, followed by positive and negative bins
+struct SketchHeader {
+    u32 magic;
+    //! Accuracy of the sketch in parts per million
+    u32 alpha;
+    u64 count;
+    u64 zero_count;
+    i32 positive_offset;
+    u32 positive_size;
+    i32 negative_offset;
+    u32 negative_size;
+} __attribute__((packed));
+
+static_assert(sizeof(SketchHeader) + 2*QuantileSketch::MAX_BINS*sizeof(u64) == QuantileSketch::MAX_SERIALIZED_SIZE,
+              "Invalid QuantileSketch::MAX_SERIALIZED_SIZE");
+
+static const u32 SKETCH_MAGIC = 0x4B534444;  // "DDSK"
+static const u32 SKETCH_ALPHA = static_cast<u32>(QuantileSketch::ALPHA*1000000);
+static const double SKETCH_GAMMA = (1.0 + QuantileSketch::ALPHA) / (1.0 - QuantileSketch::ALPHA);
+static const double SKETCH_LOG_GAMMA = std::log(SKETCH_GAMMA);
+//! Bin index range (infinities are mapped to the boundaries)
+static const double SKETCH_MAX_INDEX = 1 << 20;
+
+}
+
+constexpr double QuantileSketch::ALPHA;
+
+QuantileSketch::Store::Store()
+    : offset(0)
+{
+}
+
+void QuantileSketch::Store::add(i32 index, u64 count) {
+    if (counts.empty()) {
+        offset = index;
+        counts.push_back(count);
+        return;
+    }
+    i32 lo = std::min(offset, index);
+    i32 hi = std::max(offset + static_cast<i32>(counts.size()) - 1, index);
+    // Collapse the lowest bins if the range is too wide
+    lo = std::max(lo, hi - static_cast<i32>(MAX_BINS) + 1);
+    if (lo != offset || static_cast<size_t>(hi - lo + 1) != counts.size()) {
+        std::vector<u64> tmp(static_cast<size_t>(hi - lo + 1), 0);
+        for (size_t i = 0; i < counts.size(); i++) {
+            i32 ix = std::max(offset + static_cast<i32>(i), lo);
+            tmp[static_cast<size_t>(ix - lo)] += counts[i];
+        }
+        counts.swap(tmp);
+        offset = lo;
+    }
+    counts[static_cast<size_t>(std::max(index, lo) - lo)] += count;
+}
+
+void QuantileSketch::Store::merge(Store const& other) {
+    if (other.counts.empty()) {
+        return;
+    }
+    // Extend the range first to avoid reallocations
+    add(other.offset + static_cast<i32>(other.counts.size()) - 1, 0);
+    add(other.offset, 0);
+    for (size_t i = 0; i < other.counts.size(); i++) {
+        if (other.counts[i]) {
+            add(other.offset + static_cast<i32>(i), other.counts[i]);
+        }
+    }
+}
+
+QuantileSketch::QuantileSketch()
+    : zero_count_(0)
+    , count_(0)
+{
+}
+
+i32 QuantileSketch::get_index(double value) {
+    double ix = std::ceil(std::log(value) / SKETCH_LOG_GAMMA);
+    ix = std::min(std::max(ix, -SKETCH_MAX_INDEX), SKETCH_MAX_INDEX);
+    return static_cast<i32>(ix);
+}
+
+double QuantileSketch::get_value(i32 index) {
+    return 2.0 * std::exp(index * SKETCH_LOG_GAMMA) / (SKETCH_GAMMA + 1.0);
+}
+
+void QuantileSketch::add(double value) {
+    if (std::isnan(value)) {
+        return;
+    }
+    if (value > 0) {
+        positive_.add(get_index(value), 1);
+    } else if (value < 0) {
+        negative_.add(get_index(-value), 1);
+    } else {
+        zero_count_++;
+    }
+    count_++;
+}
+
+void QuantileSketch::merge(QuantileSketch const& other) {
+    positive_.merge(other.positive_);
+    negative_.merge(other.negative_);
+    zero_count_ += other.zero_count_;
+    count_ += other.count_;
+}
+
+u64 QuantileSketch::count() const {
+    return count_;
+}
+
+double QuantileSketch::quantile(double q) const {
+    if (count_ == 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    double rank = std::min(std::max(q, 0.0), 1.0) * static_cast<double>(count_ - 1);
+    double acc = 0;
+    // Negative values in ascending order (largest index first)
+    for (size_t i = negative_.counts.size(); i --> 0;) {
+        acc += static_cast<double>(negative_.counts[i]);
+        if (acc > rank) {
+            return -get_value(negative_.offset + static_cast<i32>(i));
+        }
+    }
+    acc += static_cast<double>(zero_count_);
+    if (acc > rank) {
+        return 0.0;
+    }
+    for (size_t i = 0; i < positive_.counts.size(); i++) {
+        acc += static_cast<double>(positive_.counts[i]);
+        if (acc > rank) {
+            return get_value(positive_.offset + static_cast<i32>(i));
+        }
+    }
+    // Unreachable unless counters are inconsistent
+    return positive_.counts.empty() ? 0.0 : get_value(positive_.offset + static_cast<i32>(positive_.counts.size()) - 1);
+}
+
+size_t QuantileSketch::get_serialized_size() const {
+    return sizeof(SketchHeader) + (positive_.counts.size() + negative_.counts.size())*sizeof(u64);
+}
+
+size_t QuantileSketch::serialize(u8* dest, size_t size) const {
+    size_t total = get_serialized_size();
+    if (total > size) {
+        return 0;
+    }
+    SketchHeader header = {
+        SKETCH_MAGIC,
+        SKETCH_ALPHA,
+        count_,
+        zero_count_,
+        positive_.offset,
+        static_cast<u32>(positive_.counts.size()),
+        negative_.offset,
+        static_cast<u32>(negative_.counts.size()),
+    };
+    memcpy(dest, &header, sizeof(header));
+    dest += sizeof(header);
+    size_t nbytes = positive_.counts.size()*sizeof(u64);
+    memcpy(dest, positive_.counts.data(), nbytes);
+    dest += nbytes;
+    memcpy(dest, negative_.counts.data(), negative_.counts.size()*sizeof(u64));
+    return total;
+}
+
+aku_Status QuantileSketch::deserialize(u8 const* src, size_t size) {
+    SketchHeader header;
+    if (size < sizeof(header)) {
+        return AKU_EBAD_DATA;
+    }
+    memcpy(&header, src, sizeof(header));
+    if (header.magic != SKETCH_MAGIC || header.alpha != SKETCH_ALPHA ||
+        header.positive_size > MAX_BINS || header.negative_size > MAX_BINS ||
+        size < sizeof(header) + (header.positive_size + header.negative_size)*sizeof(u64))
+    {
+        return AKU_EBAD_DATA;
+    }
+    src += sizeof(header);
+    QuantileSketch result;
+    result.count_ = header.count;
+    result.zero_count_ = header.zero_count;
+    result.positive_.offset = header.positive_offset;
+    result.positive_.counts.resize(header.positive_size);
+    memcpy(result.positive_.counts.data(), src, header.positive_size*sizeof(u64));
+    src += header.positive_size*sizeof(u64);
+    result.negative_.offset = header.negative_offset;
+    result.negative_.counts.resize(header.negative_size);
+    memcpy(result.negative_.counts.data(), src, header.negative_size*sizeof(u64));
+    u64 total = result.zero_count_;
+    for (auto cnt: result.positive_.counts) {
+        total += cnt;
+    }
+    for (auto cnt: result.negative_.counts) {
+        total += cnt;
+    }
+    if (total != result.count_) {
+        return AKU_EBAD_DATA;
+    }
+    *this = std::move(result);
+    return AKU_SUCCESS;
+}
+
+// -------------- //
+// QuantileResult //
+// -------------- //
+
+QuantileResult::QuantileResult()
+    : agg(INIT_AGGRES)
+{
+}
+
+void QuantileResult::add(aku_Timestamp ts, double value) {
+    agg.add(ts, value, true);
+    sketch.add(value);
+}
+
+void QuantileResult::add(SubtreeRef const& ref, QuantileSketch const& other) {
+    AggregationResult res = INIT_AGGRES;
+    res.copy_from(ref);
+    agg.combine(res);
+    sketch.merge(other);
+}
+
+void QuantileResult::combine(QuantileResult const& other) {
+    agg.combine(other.agg);
+    sketch.merge(other.sketch);
+}
+
+double QuantileResult::quantile(double q) const {
+    if (agg.cnt == 0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    // Extremes are known exactly
+    if (q <= 0.0) {
+        return agg.min;
+    } else if (q >= 1.0) {
+        return agg.max;
+    }
+    return std::min(std::max(sketch.quantile(q), agg.min), agg.max);
+}
+
 // ----------- //
 // ValueFilter //
 // ----------- //
@@ -262,4 +547,200 @@ bool AggregateFilter::match(const AggregationResult& res) const {
     return result;
 }
 
+bool AggregateFilter::can_match(const SubtreeRef& ref) const {
+    // All supported aggregates (avg, min, max, first, last) of the values
+    // from the subtree lie in the [ref.min, ref.max] range.
+    bool result = mode == Mode::ALL;
+    for (u32 bit = 0; bit < N; bit++) {
+        if (bitmap & (1 << bit)) {
+            bool overlap = filters[bit].get_overlap(ref) != RangeOverlap::NO_OVERLAP;
+            if (mode == Mode::ALL) {
+                result &= overlap;
+            } else {
+                result |= overlap;
+            }
+        }
+    }
+    return result;
+}
+
+// ----------- //
+// SampleBatch //
+// ----------- //
+
+SampleBatch::SampleBatch()
+    : paramids(CAPACITY)
+    , timestamps(CAPACITY)
+    , bitmaps(CAPACITY)
+    , size(0)
+    , ncolumns(0)
+    , type(0)
+    , pending_pos_(0)
+    , pending_status_(AKU_SUCCESS)
+{
+}
+
+void SampleBatch::clear() {
+    size = 0;
+}
+
+void SampleBatch::set_layout(u16 newtype, u32 newncolumns) {
+    assert(size == 0);
+    type = newtype;
+    ncolumns = newncolumns;
+    if (columns.size() < ncolumns) {
+        columns.resize(ncolumns, std::vector<double>(CAPACITY));
+    }
+}
+
+bool SampleBatch::is_tuple() const {
+    return (type & aku_PData::TUPLE_BIT) != 0;
+}
+
+void SampleBatch::truncate(size_t newsize) {
+    size = std::min(size, newsize);
+}
+
+double* SampleBatch::column(u32 ix) {
+    return columns[ix].data();
+}
+
+double const* SampleBatch::column(u32 ix) const {
+    return columns[ix].data();
+}
+
+bool SampleBatch::is_present(size_t row, u32 col) const {
+    return !is_tuple() || ((bitmaps[row] >> col) & 1) != 0;
+}
+
+void SampleBatch::collapse() {
+    if (!is_tuple() || ncolumns == 1) {
+        return;
+    }
+    ncolumns = 1;
+    std::fill(bitmaps.begin(), bitmaps.begin() + static_cast<std::ptrdiff_t>(size), 1ull);
+}
+
+//! Tuple header is stored in float64 field, 58 lower bits is a bitmap, the rest is a size
+static std::tuple<u32, u64> decode_tuple_header(double value) {
+    union {
+        double d;
+        u64 u;
+    } bits;
+    bits.d = value;
+    return std::make_tuple(static_cast<u32>(bits.u >> 58), bits.u & 0x3ffffffffffffffull);
+}
+
+static double encode_tuple_header(u32 size, u64 bitmap) {
+    union {
+        double d;
+        u64 u;
+    } bits;
+    bits.u = bitmap | (static_cast<u64>(size) << 58);
+    return bits.d;
+}
+
+bool SampleBatch::append(aku_Sample const* sample) {
+    if (size == CAPACITY) {
+        return false;
+    }
+    u16 stype = sample->payload.type;
+    u32 ncol = 1;
+    u64 bitmap = 1;
+    if (stype & aku_PData::TUPLE_BIT) {
+        std::tie(ncol, bitmap) = decode_tuple_header(sample->payload.float64);
+        if (ncol == 0 || ncol > MAX_COLUMNS) {
+            return false;
+        }
+    } else if ((stype & aku_PData::FLOAT_BIT) == 0) {
+        // Only scalars and tuples can be stored in columnar format
+        return false;
+    }
+    if (size == 0) {
+        set_layout(stype, ncol);
+    } else if (stype != type || ncol != ncolumns) {
+        return false;
+    }
+    paramids[size] = sample->paramid;
+    timestamps[size] = sample->timestamp;
+    if (stype & aku_PData::TUPLE_BIT) {
+        bitmaps[size] = bitmap;
+        auto tuple = reinterpret_cast<double const*>(sample->payload.data);
+        for (u32 col = 0; col < ncol; col++) {
+            if ((bitmap >> col) & 1) {
+                columns[col][size] = *tuple++;
+            }
+        }
+    } else {
+        bitmaps[size] = 1;
+        columns[0][size] = sample->payload.float64;
+    }
+    size++;
+    return true;
+}
+
+size_t SampleBatch::get_sample(size_t row, u8* dest) const {
+    aku_Sample* sample = reinterpret_cast<aku_Sample*>(dest);
+    sample->paramid = paramids[row];
+    sample->timestamp = timestamps[row];
+    sample->payload.type = type;
+    if (!is_tuple()) {
+        sample->payload.size = sizeof(aku_Sample);
+        sample->payload.float64 = columns[0][row];
+        return sizeof(aku_Sample);
+    }
+    u64 bitmap = bitmaps[row];
+    sample->payload.float64 = encode_tuple_header(ncolumns, bitmap);
+    double* tuple = reinterpret_cast<double*>(sample->payload.data);
+    u32 nvalues = 0;
+    for (u32 col = 0; col < ncolumns; col++) {
+        if ((bitmap >> col) & 1) {
+            tuple[nvalues++] = columns[col][row];
+        }
+    }
+    size_t ssize = sizeof(aku_Sample) + sizeof(double)*nvalues;
+    sample->payload.size = static_cast<u16>(ssize);
+    return ssize;
+}
+
+// ------------------ //
+// ColumnMaterializer //
+// ------------------ //
+
+std::tuple<aku_Status, size_t> ColumnMaterializer::read_batch(SampleBatch* batch) {
+    batch->clear();
+    while (true) {
+        // Move samples that was read previously to the batch
+        while (batch->pending_pos_ < batch->pending_.size()) {
+            auto sample = reinterpret_cast<aku_Sample const*>(batch->pending_.data() + batch->pending_pos_);
+            if (!batch->append(sample)) {
+                if (batch->size == 0) {
+                    // Sample can't be represented in columnar format
+                    return std::make_tuple(AKU_EBAD_DATA, 0);
+                }
+                return std::make_tuple(AKU_SUCCESS, batch->size);
+            }
+            batch->pending_pos_ += std::max(static_cast<size_t>(sample->payload.size), sizeof(aku_Sample));
+        }
+        if (batch->pending_status_ != AKU_SUCCESS) {
+            return std::make_tuple(batch->pending_status_, batch->size);
+        }
+        batch->pending_.resize(SampleBatch::CAPACITY*sizeof(aku_Sample));
+        batch->pending_pos_ = 0;
+        aku_Status status;
+        size_t size;
+        std::tie(status, size) = read(batch->pending_.data(), batch->pending_.size());
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA && status != AKU_EUNAVAILABLE) {
+            batch->pending_.clear();
+            return std::make_tuple(status, 0);
+        }
+        batch->pending_.resize(size);
+        batch->pending_status_ = status;
+        if (status == AKU_SUCCESS && size == 0) {
+            // Nothing to read yet
+            return std::make_tuple(AKU_SUCCESS, batch->size);
+        }
+    }
+}
+
 }}
@@ -13,6 +13,8 @@
 #include "akumuli_def.h"
 #include "../nbtree_def.h"
 
+#include <vector>
+
 
 namespace Akumuli {
 namespace StorageEngine {
@@ -24,9 +26,21 @@ enum class AggregationFunction {
     CNT,
     MIN_TIMESTAMP,
     MAX_TIMESTAMP,
-    MEAN
+    MEAN,
+    P50,
+    P75,
+    P90,
+    P95,
+    P99,
+    P999,
 };
 
+//! Return true if aggregation function is a percentile
+bool is_quantile(AggregationFunction func);
+
+//! Return rank of the percentile (from 0 to 1)
+double get_quantile_rank(AggregationFunction func);
+
 //! Result of the aggregation operation that has several components.
 struct AggregationResult {
     double cnt;
@@ -70,6 +84,95 @@ static const AggregationResult INIT_AGGRES = {
 };
 
 
+/** Mergeable quantile sketch (DDSketch).
+  * Values are mapped to bins with logarithmically growing size, bin `i` contains
+  * values from (gamma^(i-1), gamma^i] range. Positive and negative values are
+  * stored separately, zeroes are counted without binning. Quantile estimate has
+  * relative error of ALPHA. Sketches can be merged without loss of accuracy, so
+  * sketch of the subtree is a merge of sketches of its children.
+  * Number of bins is limited by MAX_BINS (per sign). If this limit is reached
+  * the lowest bins are collapsed (only the smallest values lose accuracy).
+  */
+class QuantileSketch {
+public:
+    enum {
+        MAX_BINS = 240,
+        //! Max size of the serialized sketch
+        MAX_SERIALIZED_SIZE = 40 + 2*MAX_BINS*sizeof(u64),
+    };
+
+    static constexpr double ALPHA = 0.02;
+
+private:
+    //! Dense run of bins
+    struct Store {
+        i32 offset;
+        std::vector<u64> counts;
+
+        Store();
+        void add(i32 index, u64 count);
+        void merge(Store const& other);
+    };
+
+    Store positive_;
+    Store negative_;
+    u64 zero_count_;
+    u64 count_;
+
+    static i32 get_index(double value);
+    static double get_value(i32 index);
+
+public:
+    QuantileSketch();
+
+    //! Add value to the sketch (NaN values are ignored)
+    void add(double value);
+
+    //! Merge other sketch into this one
+    void merge(QuantileSketch const& other);
+
+    //! Number of values added to the sketch
+    u64 count() const;
+
+    /** Estimate quantile.
+      * @param q is a quantile rank (from 0 to 1)
+      * @return estimate or NaN if sketch is empty
+      */
+    double quantile(double q) const;
+
+    //! Number of bytes needed to serialize the sketch
+    size_t get_serialized_size() const;
+
+    /** Serialize sketch.
+      * @return number of bytes written to `dest` or 0 if buffer is too small
+      */
+    size_t serialize(u8* dest, size_t size) const;
+
+    /** Deserialize sketch.
+      * @return AKU_SUCCESS or AKU_EBAD_DATA if buffer doesn't contain valid sketch
+      */
+    aku_Status deserialize(u8 const* src, size_t size);
+};
+
+
+//! Result of the percentile aggregation
+struct QuantileResult {
+    AggregationResult agg;
+    QuantileSketch sketch;
+
+    QuantileResult();
+
+    //! Add value (values should be added in time order)
+    void add(aku_Timestamp ts, double value);
+    //! Add subtree that has precomputed sketch
+    void add(SubtreeRef const& ref, QuantileSketch const& sketch);
+    //! Combine this value with the other one (inplace update).
+    void combine(QuantileResult const& other);
+    //! Estimate quantile (result is clamped to [min, max] range, extremes are exact)
+    double quantile(double q) const;
+};
+
+
 /** Single series operator.
   * @note all ranges is semi-open. This means that if we're
   *       reading data from A to B, operator should return
@@ -105,6 +208,75 @@ using RealValuedOperator = SeriesOperator<double>;
 //! Base class for all aggregating iterators. Return single value.
 using AggregateOperator = SeriesOperator<AggregationResult>;
 
+//! Base class for all percentile aggregating iterators.
+using QuantileOperator = SeriesOperator<QuantileResult>;
+
+
+/** Batch of samples in columnar (struct of arrays) format.
+  * All samples in the batch have the same layout, either scalar values or
+  * tuples with the same number of elements. Missing tuple elements are marked
+  * by the per-row bitmap (value of the missing element is undefined).
+  */
+struct SampleBatch {
+    enum {
+        CAPACITY = 1024,
+        MAX_COLUMNS = 58,
+        MAX_SAMPLE_SIZE = sizeof(aku_Sample) + sizeof(double)*MAX_COLUMNS,
+    };
+
+    std::vector<aku_ParamId>         paramids;
+    std::vector<aku_Timestamp>       timestamps;
+    std::vector<std::vector<double>> columns;   //< columns[col][row]
+    std::vector<u64>                 bitmaps;   //< present tuple elements (tuples only)
+    size_t                           size;      //< number of rows
+    u32                              ncolumns;  //< number of columns (1 for scalar values)
+    u16                              type;      //< payload type of all samples in the batch
+
+    // Row to batch conversion state (used by ColumnMaterializer::read_batch)
+    std::vector<u8>                  pending_;
+    size_t                           pending_pos_;
+    aku_Status                       pending_status_;
+
+    SampleBatch();
+
+    //! Remove all rows
+    void clear();
+
+    /** Set layout of the batch, should be called on empty batch.
+      * @param type is a payload type (AKU_PAYLOAD_FLOAT or AKU_PAYLOAD_TUPLE)
+      * @param ncolumns is a number of elements in tuple (should be 1 for scalars)
+      */
+    void set_layout(u16 type, u32 ncolumns);
+
+    bool is_tuple() const;
+
+    //! Remove all rows starting from `newsize`
+    void truncate(size_t newsize);
+
+    //! Pointer to column data
+    double* column(u32 ix);
+
+    double const* column(u32 ix) const;
+
+    //! Check that tuple element is present
+    bool is_present(size_t row, u32 col) const;
+
+    /** Collapse tuples to single value (value of the first column should
+      * be updated by the caller).
+      */
+    void collapse();
+
+    /** Add sample to the batch.
+      * @return false if the batch is full or sample has different layout
+      */
+    bool append(aku_Sample const* sample);
+
+    /** Convert row to aku_Sample.
+      * @param dest should be at least MAX_SAMPLE_SIZE bytes long and properly aligned
+      * @return size of the sample in bytes
+      */
+    size_t get_sample(size_t row, u8* dest) const;
+};
 
 /** This interface is used by column-store internally.
   * It materializes tuples/values and produces a series of aku_Sample values.
@@ -120,6 +292,15 @@ struct ColumnMaterializer {
       * @return status of the operation (success or error code) and number of written bytes
       */
     virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) = 0;
+
+    /** Read samples in columnar format.
+      * Default implementation converts output of the `read` method. Batch shouldn't
+      * be shared between materializers because it can hold samples that was read but
+      * didn't fit the batch.
+      * @param dest is a batch that will receive the samples (previous content is removed)
+      * @return status of the operation (same as `read`) and number of rows in the batch
+      */
+    virtual std::tuple<aku_Status, size_t> read_batch(SampleBatch* dest);
 };
 
 enum class RangeOverlap {
@@ -204,6 +385,12 @@ struct AggregateFilter {
     bool set_filter(u32 op, const ValueFilter& filter);
 
     bool match(const AggregationResult& res) const;
+
+    /** Return false if aggregate of the values from the subtree (or any part
+      * of the subtree) can't match the filter. Only `min` and `max` fields of
+      * the reference are used.
+      */
+    bool can_match(const SubtreeRef& ref) const;
 };
 
 }
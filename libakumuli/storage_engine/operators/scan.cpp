@@ -87,4 +87,38 @@ std::tuple<aku_Status, size_t> ChainMaterializer::read(u8 *dest, size_t dest_siz
     return std::make_tuple(status, accsz*sizeof(aku_Sample));
 }
 
+std::tuple<aku_Status, size_t> ChainMaterializer::read_batch(SampleBatch* batch) {
+    aku_Status status = AKU_ENO_DATA;
+    size_t ressz = 0;  // current size
+    size_t accsz = 0;  // accumulated size
+    size_t size = SampleBatch::CAPACITY;
+    batch->clear();
+    batch->set_layout(AKU_PAYLOAD_FLOAT, 1);
+    aku_Timestamp* destts = batch->timestamps.data();
+    double* destval = batch->column(0);
+    while(pos_ < iters_.size()) {
+        aku_ParamId curr = ids_[pos_];
+        std::tie(status, ressz) = iters_[pos_]->read(destts + accsz, destval + accsz, size);
+        std::fill(batch->paramids.begin() + static_cast<std::ptrdiff_t>(accsz),
+                  batch->paramids.begin() + static_cast<std::ptrdiff_t>(accsz + ressz),
+                  curr);
+        size -= ressz;
+        accsz += ressz;
+        if (size == 0) {
+            break;
+        }
+        pos_++;
+        if (status == AKU_ENO_DATA) {
+            // this iterator is done, continue with next
+            continue;
+        }
+        if (status != AKU_SUCCESS) {
+            // Stop iteration on error!
+            break;
+        }
+    }
+    batch->size = accsz;
+    return std::make_tuple(status, accsz);
+}
+
 }}  // namespace
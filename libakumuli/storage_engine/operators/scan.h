@@ -50,6 +50,7 @@ class ChainMaterializer : public ColumnMaterializer {
 public:
     ChainMaterializer(std::vector<aku_ParamId>&& ids, std::vector<std::unique_ptr<RealValuedOperator>>&& it);
     virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size);
+    virtual std::tuple<aku_Status, size_t> read_batch(SampleBatch* dest);
 };
 
 }}  // namespace
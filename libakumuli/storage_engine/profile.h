@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+
+// Stdlib
+#include <chrono>
+#include <string>
+
+// Project
+#include "akumuli_def.h"
+
+namespace Akumuli {
+namespace StorageEngine {
+
+/** Execution statistics of the query plan step.
+  * Storage engine updates counters of the profile that is set for the current
+  * thread (see ProfileScope). Nothing is counted if the profile is not set, so
+  * the overhead is one thread-local read per block.
+  */
+struct QueryProfile {
+    //! Wall time in microseconds
+    u64 wall_time_us;
+    //! Number of blocks read from the volume
+    u64 blocks_read;
+    //! Number of blocks found in the block cache
+    u64 cache_hits;
+    //! Size of the decompressed data in bytes
+    u64 bytes_decompressed;
+    //! Number of samples emitted by the step
+    u64 samples;
+    //! Number of blocks with invalid checksum
+    u64 checksum_failures;
+    //! Number of buckets read from the rollup trees
+    u64 rollup_buckets;
+    //! Number of series that weren't read because their bounds can't match the query
+    u64 series_pruned;
+
+    //! Return profile of the current thread (null if profiling is not enabled)
+    static QueryProfile*& current() {
+        static thread_local QueryProfile* profile = nullptr;
+        return profile;
+    }
+
+    //! Increment the counter of the current thread's profile
+    static void count(u64 QueryProfile::*counter, u64 value = 1) {
+        QueryProfile* profile = current();
+        if (profile) {
+            profile->*counter += value;
+        }
+    }
+
+    std::string to_string() const {
+        return "time: " + std::to_string(wall_time_us) + "us"
+             + ", blocks read: " + std::to_string(blocks_read)
+             + ", cache hits: " + std::to_string(cache_hits)
+             + ", decompressed: " + std::to_string(bytes_decompressed) + " bytes"
+             + ", samples: " + std::to_string(samples)
+             + ", checksum failures: " + std::to_string(checksum_failures)
+             + ", rollup buckets: " + std::to_string(rollup_buckets)
+             + ", series pruned: " + std::to_string(series_pruned);
+    }
+};
+
+/** Set the profile of the current thread while in scope (previous profile is
+  * restored on exit). Elapsed time is added to the profile. Scope does nothing
+  * if the profile is null.
+  */
+class ProfileScope {
+    QueryProfile* profile_;
+    QueryProfile* prev_;
+    std::chrono::steady_clock::time_point start_;
+public:
+    ProfileScope(QueryProfile* profile)
+        : profile_(profile)
+        , prev_(nullptr)
+    {
+        if (profile_) {
+            prev_  = QueryProfile::current();
+            start_ = std::chrono::steady_clock::now();
+            QueryProfile::current() = profile_;
+        }
+    }
+
+    ~ProfileScope() {
+        if (profile_) {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            profile_->wall_time_us += static_cast<u64>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+            QueryProfile::current() = prev_;
+        }
+    }
+
+    ProfileScope(ProfileScope const&) = delete;
+    ProfileScope& operator = (ProfileScope const&) = delete;
+};
+
+}}  // namespace
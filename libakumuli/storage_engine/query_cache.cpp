@@ -0,0 +1,370 @@
+#include "query_cache.h"
+
+#include <algorithm>
+
+namespace Akumuli {
+namespace StorageEngine {
+
+namespace {
+
+//! Return beginning of the bucket that contains `ts`
+aku_Timestamp align(aku_Timestamp ts, aku_Timestamp offset, aku_Timestamp step) {
+    return ts - (ts - offset) % step;
+}
+
+/** Group-aggregate operator that returns cached buckets first and then
+  * reads the rest of the range from the tree. Buckets that was read from
+  * the tree are added to the cache when the operator is fully consumed.
+  */
+struct CachedGroupAggregateOperator : AggregateOperator {
+    typedef GroupAggregateCache::PSegment PSegment;
+
+    //! Part of the cached segment that should be returned
+    struct Range {
+        PSegment segment;
+        size_t   begin;
+        size_t   end;
+    };
+
+    std::shared_ptr<GroupAggregateCache> cache_;
+    GroupAggregateCache::Key key_;
+    std::vector<Range> ranges_;
+    size_t range_ix_;
+    std::unique_ptr<AggregateOperator> tail_;
+
+    // Cache update
+    bool update_;
+    //! Closed segments of the new cache entry
+    std::vector<PSegment> closed_;
+    //! Beginning of the range that is read from the tree
+    aku_Timestamp mid_;
+    //! End of the closed buckets
+    aku_Timestamp closed_end_;
+    aku_Timestamp end_;
+    u64 version_;
+    aku_Timestamp boundary_;
+    LogicAddr oldest_;
+    std::vector<aku_Timestamp> ts_;
+    std::vector<AggregationResult> xs_;
+
+    CachedGroupAggregateOperator(std::shared_ptr<GroupAggregateCache> cache, GroupAggregateCache::Key key)
+        : cache_(cache)
+        , key_(key)
+        , range_ix_(0)
+        , update_(false)
+        , mid_(0)
+        , closed_end_(0)
+        , end_(0)
+        , version_(0)
+        , boundary_(0)
+        , oldest_(EMPTY_ADDR)
+    {
+    }
+
+    //! Add part of the segment that overlaps with [begin, end) to the output
+    void add_segment(PSegment const& segment, aku_Timestamp begin, aku_Timestamp end) {
+        auto const& ts = segment->ts;
+        size_t lo = static_cast<size_t>(std::lower_bound(ts.begin(), ts.end(), begin) - ts.begin());
+        size_t hi = static_cast<size_t>(std::lower_bound(ts.begin(), ts.end(), end) - ts.begin());
+        if (lo < hi) {
+            ranges_.push_back({ segment, lo, hi });
+        }
+    }
+
+    //! Return number of buckets that will be returned from cache
+    u64 get_cached_size() const {
+        u64 result = 0;
+        for (auto const& range: ranges_) {
+            result += range.end - range.begin;
+        }
+        return result;
+    }
+
+    void commit() {
+        GroupAggregateCache::Entry entry;
+        entry.closed = std::move(closed_);
+        auto split = std::lower_bound(ts_.begin(), ts_.end(), closed_end_) - ts_.begin();
+        if (closed_end_ > mid_) {
+            auto segment = std::make_shared<GroupAggregateCache::Segment>();
+            segment->begin = mid_;
+            segment->end   = closed_end_;
+            segment->ts.assign(ts_.begin(), ts_.begin() + split);
+            segment->xs.assign(xs_.begin(), xs_.begin() + split);
+            entry.closed.push_back(std::move(segment));
+        }
+        if (entry.closed.size() > GroupAggregateCache::MAX_SEGMENTS) {
+            auto segment = std::make_shared<GroupAggregateCache::Segment>();
+            segment->begin = entry.closed.front()->begin;
+            segment->end   = entry.closed.back()->end;
+            for (auto const& it: entry.closed) {
+                segment->ts.insert(segment->ts.end(), it->ts.begin(), it->ts.end());
+                segment->xs.insert(segment->xs.end(), it->xs.begin(), it->xs.end());
+            }
+            entry.closed.clear();
+            entry.closed.push_back(std::move(segment));
+        }
+        auto tail = std::make_shared<GroupAggregateCache::Segment>();
+        tail->begin = closed_end_;
+        tail->end   = end_;
+        tail->ts.assign(ts_.begin() + split, ts_.end());
+        tail->xs.assign(xs_.begin() + split, xs_.end());
+        entry.tail     = std::move(tail);
+        entry.version  = version_;
+        entry.boundary = boundary_;
+        entry.oldest   = oldest_;
+        cache_->update(key_, std::move(entry));
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) {
+        if (size == 0) {
+            return std::make_tuple(AKU_EBAD_ARG, 0);
+        }
+        size_t outsz = 0;
+        while (outsz < size && range_ix_ < ranges_.size()) {
+            auto& range = ranges_[range_ix_];
+            size_t n = std::min(size - outsz, range.end - range.begin);
+            std::copy_n(range.segment->ts.begin() + static_cast<std::ptrdiff_t>(range.begin), n, destts + outsz);
+            std::copy_n(range.segment->xs.begin() + static_cast<std::ptrdiff_t>(range.begin), n, destval + outsz);
+            range.begin += n;
+            outsz += n;
+            if (range.begin == range.end) {
+                range_ix_++;
+            }
+        }
+        if (!tail_) {
+            return std::make_tuple(range_ix_ < ranges_.size() ? AKU_SUCCESS : AKU_ENO_DATA, outsz);
+        }
+        if (outsz == size) {
+            return std::make_tuple(AKU_SUCCESS, outsz);
+        }
+        aku_Status status;
+        size_t n;
+        std::tie(status, n) = tail_->read(destts + outsz, destval + outsz, size - outsz);
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            return std::make_tuple(status, 0);
+        }
+        if (update_) {
+            ts_.insert(ts_.end(), destts + outsz, destts + outsz + n);
+            xs_.insert(xs_.end(), destval + outsz, destval + outsz + n);
+        }
+        // Group-aggregate operator returns less than requested only if it's
+        // fully consumed (materializers don't read the operator after that).
+        bool done = status == AKU_ENO_DATA || n < size - outsz;
+        outsz += n;
+        if (done) {
+            tail_.reset();
+            if (update_) {
+                commit();
+            }
+            status = AKU_ENO_DATA;
+        }
+        return std::make_tuple(status, outsz);
+    }
+
+    virtual Direction get_direction() {
+        return Direction::FORWARD;
+    }
+};
+
+}  // namespace
+
+
+// ------- //
+// Segment //
+// ------- //
+
+size_t GroupAggregateCache::Segment::get_size_in_bytes() const {
+    return sizeof(Segment) + ts.size()*(sizeof(aku_Timestamp) + sizeof(AggregationResult));
+}
+
+size_t GroupAggregateCache::Entry::get_size_in_bytes() const {
+    size_t result = sizeof(Entry);
+    for (auto const& segment: closed) {
+        result += segment->get_size_in_bytes();
+    }
+    if (tail) {
+        result += tail->get_size_in_bytes();
+    }
+    return result;
+}
+
+bool GroupAggregateCache::Key::operator == (Key const& other) const {
+    return id == other.id && step == other.step && offset == other.offset;
+}
+
+size_t GroupAggregateCache::KeyHash::operator () (Key const& key) const {
+    std::hash<u64> hash;
+    size_t result = hash(key.id);
+    result ^= hash(key.step) + 0x9e3779b9 + (result << 6) + (result >> 2);
+    result ^= hash(key.offset) + 0x9e3779b9 + (result << 6) + (result >> 2);
+    return result;
+}
+
+
+// ------------------- //
+// GroupAggregateCache //
+// ------------------- //
+
+GroupAggregateCache::GroupAggregateCache(size_t capacity)
+    : capacity_(capacity)
+    , size_(0)
+    , stats_()
+{
+}
+
+std::unique_ptr<AggregateOperator> GroupAggregateCache::group_aggregate(const NBTreeExtentsList& elist,
+                                                                        aku_Timestamp begin,
+                                                                        aku_Timestamp end,
+                                                                        aku_Timestamp step)
+{
+    if (begin >= end || step == 0) {
+        return elist.group_aggregate(begin, end, step);
+    }
+    Key key = { elist.get_id(), step, begin % step };
+    // Version should be obtained before the tree is accessed, tail of the
+    // result can't be cached with the version that it doesn't correspond to.
+    u64 version;
+    aku_Timestamp last;
+    std::tie(version, last) = elist.get_write_version();
+
+    Entry entry = {};
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = items_.find(key);
+        if (it != items_.end()) {
+            found = true;
+            entry = it->second.entry;
+            lru_.splice(lru_.begin(), lru_, it->second.lru);
+        }
+    }
+    bool expired = false;
+    if (!found || entry.oldest == EMPTY_ADDR || !elist.is_available(entry.oldest)) {
+        // Data could be deleted by retention since the entry was created
+        aku_Status status;
+        aku_Timestamp boundary;
+        LogicAddr oldest;
+        std::tie(status, boundary, oldest) = elist.get_retention_boundary();
+        if (status != AKU_SUCCESS) {
+            boundary = 0;
+        }
+        if (found && (!entry.closed.empty() || entry.tail)) {
+            aku_Timestamp cached = entry.closed.empty() ? entry.tail->begin : entry.closed.front()->begin;
+            // Entry is stale if the data between the old and the new boundary was cached
+            expired = boundary > std::max(entry.boundary, cached);
+            std::lock_guard<std::mutex> guard(lock_);
+            auto it = items_.find(key);
+            if (it != items_.end()) {
+                if (expired) {
+                    size_ -= it->second.entry.get_size_in_bytes();
+                    lru_.erase(it->second.lru);
+                    items_.erase(it);
+                } else {
+                    it->second.entry.boundary = boundary;
+                    it->second.entry.oldest   = oldest;
+                }
+            }
+            found = !expired;
+        }
+        entry.boundary = boundary;
+        entry.oldest   = oldest;
+    }
+
+    std::unique_ptr<CachedGroupAggregateOperator> result;
+    result.reset(new CachedGroupAggregateOperator(shared_from_this(), key));
+    aku_Timestamp cbegin = 0, cend = 0;
+    if (!entry.closed.empty()) {
+        cbegin = entry.closed.front()->begin;
+        cend   = entry.closed.back()->end;
+    } else if (entry.tail) {
+        cbegin = cend = entry.tail->begin;
+    } else {
+        found = false;
+    }
+    bool hit = found && cbegin <= begin && begin <= cend;
+    aku_Timestamp mid = begin;
+    if (hit) {
+        mid = std::min(cend, align(end, key.offset, step));
+        for (auto const& segment: entry.closed) {
+            if (segment->end > begin && segment->begin < mid) {
+                result->add_segment(segment, begin, mid);
+            }
+        }
+        if (mid == cend && entry.tail && entry.version == version && entry.tail->end == end) {
+            // Tree wasn't updated since the previous query
+            result->add_segment(entry.tail, mid, end);
+            mid = end;
+        }
+    }
+    if (mid < end) {
+        result->tail_ = elist.group_aggregate(mid, end, step);
+        // Cache entry is updated only if the query extends it
+        if (!hit || mid == cend) {
+            result->update_ = true;
+            if (hit) {
+                for (auto const& segment: entry.closed) {
+                    if (segment->end > begin) {
+                        result->closed_.push_back(segment);
+                    }
+                }
+            }
+            aku_Timestamp closed_end = std::min(last, end);
+            result->mid_        = mid;
+            result->closed_end_ = closed_end > mid ? align(closed_end, key.offset, step) : mid;
+            result->end_        = end;
+            result->version_    = version;
+            result->boundary_   = entry.boundary;
+            result->oldest_     = entry.oldest;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (hit) {
+            stats_.hits++;
+            stats_.cached_buckets += result->get_cached_size();
+        } else {
+            stats_.misses++;
+        }
+        if (expired) {
+            stats_.expired++;
+        }
+    }
+    return std::move(result);
+}
+
+void GroupAggregateCache::update(Key const& key, Entry&& entry) {
+    size_t size = entry.get_size_in_bytes();
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = items_.find(key);
+    if (it != items_.end()) {
+        size_ -= it->second.entry.get_size_in_bytes();
+        it->second.entry = std::move(entry);
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+    } else {
+        lru_.push_front(key);
+        Item item = { std::move(entry), lru_.begin() };
+        items_.insert(std::make_pair(key, std::move(item)));
+    }
+    size_ += size;
+    evict();
+}
+
+void GroupAggregateCache::evict() {
+    while (size_ > capacity_ && !lru_.empty()) {
+        auto it = items_.find(lru_.back());
+        size_ -= it->second.entry.get_size_in_bytes();
+        items_.erase(it);
+        lru_.pop_back();
+    }
+}
+
+
+GroupAggregateCache::Stats GroupAggregateCache::get_stats() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    Stats result = stats_;
+    result.size = size_;
+    return result;
+}
+
+}}  // namespace
@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+
+// Stdlib
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Project
+#include "akumuli_def.h"
+#include "storage_engine/nbtree.h"
+
+namespace Akumuli {
+namespace StorageEngine {
+
+/** Cache of the group-aggregate query results.
+  *
+  * Results are cached per series. Cache entry is identified by series id, bucket
+  * size and bucket grid offset (begin % step). Queries with different time ranges
+  * share the entry as long as their buckets are aligned the same way. Aggregation
+  * result contains all aggregates, so queries with different aggregation functions
+  * share the entry too.
+  *
+  * Bucket is closed if it ends before the last timestamp of the series. NB+tree
+  * rejects values older than its last timestamp, so closed buckets never change and
+  * never invalidated. Open tail of the result is cached along with the write count
+  * of the tree and is used only if the tree wasn't updated since then. Query that
+  * starts inside the cached range reads from the tree only the part of the range
+  * that is not covered by closed buckets.
+  *
+  * Closed buckets can still change when their data is deleted by retention. Entry
+  * remembers the oldest leaf node of the tree that was available when the entry was
+  * created. The entry is dropped if this node is deleted and the new retention
+  * boundary is inside the cached range.
+  *
+  * Only forward queries are cached. Instances of this class are thread-safe.
+  */
+class GroupAggregateCache : public std::enable_shared_from_this<GroupAggregateCache> {
+public:
+    enum {
+        //! Segments are merged together when the entry has more than this number of segments
+        MAX_SEGMENTS = 16,
+    };
+
+    //! Run of consecutive buckets
+    struct Segment {
+        //! Beginning of the first bucket
+        aku_Timestamp begin;
+        //! End of the last bucket
+        aku_Timestamp end;
+        //! Timestamps of the non-empty buckets
+        std::vector<aku_Timestamp> ts;
+        std::vector<AggregationResult> xs;
+
+        size_t get_size_in_bytes() const;
+    };
+
+    typedef std::shared_ptr<const Segment> PSegment;
+
+    struct Key {
+        aku_ParamId   id;
+        aku_Timestamp step;
+        aku_Timestamp offset;
+
+        bool operator == (Key const& other) const;
+    };
+
+    struct Entry {
+        //! Closed buckets (segments are adjacent and sorted by time)
+        std::vector<PSegment> closed;
+        //! Open tail of the last query result (can be null)
+        PSegment tail;
+        //! Write count of the tree at the moment when tail was computed
+        u64 version;
+        //! Retention boundary of the tree (data before it was deleted)
+        aku_Timestamp boundary;
+        //! Oldest available leaf node of the tree (EMPTY_ADDR if not committed)
+        LogicAddr oldest;
+
+        size_t get_size_in_bytes() const;
+    };
+
+    struct Stats {
+        //! Number of queries that used cached data
+        u64 hits;
+        //! Number of queries that read all data from the tree
+        u64 misses;
+        //! Total number of buckets returned from cache
+        u64 cached_buckets;
+        //! Number of entries dropped because their data was deleted by retention
+        u64 expired;
+        //! Memory used by cache entries
+        size_t size;
+    };
+
+private:
+    struct KeyHash {
+        size_t operator () (Key const& key) const;
+    };
+
+    typedef std::list<Key> LRUList;
+
+    struct Item {
+        Entry entry;
+        LRUList::iterator lru;
+    };
+
+    mutable std::mutex lock_;
+    const size_t capacity_;
+    size_t size_;
+    std::unordered_map<Key, Item, KeyHash> items_;
+    //! Most recently used items are at the front
+    LRUList lru_;
+    Stats stats_;
+
+    void evict();
+
+public:
+    /** C-tor
+      * @param capacity is a memory limit in bytes
+      */
+    GroupAggregateCache(size_t capacity);
+
+    /** Create group-aggregate operator for the series. Operator returns cached buckets
+      * and reads the rest from the tree. It updates the cache when all data is read.
+      * @param elist is a tree to read data from
+      * @param begin start of the search interval
+      * @param end end of the search interval
+      * @param step bucket size
+      */
+    std::unique_ptr<AggregateOperator> group_aggregate(const NBTreeExtentsList& elist,
+                                                       aku_Timestamp begin,
+                                                       aku_Timestamp end,
+                                                       aku_Timestamp step);
+
+    //! Add or replace cache entry
+    void update(Key const& key, Entry&& entry);
+
+    Stats get_stats() const;
+};
+
+}}  // namespace
@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2016 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+
+// Stdlib
+#include <atomic>
+#include <chrono>
+
+// Project
+#include "akumuli_def.h"
+
+namespace Akumuli {
+namespace StorageEngine {
+
+/** Execution limits of the query: cancellation flag, deadline and memory budget.
+  * Context is owned by the cursor and shared with the query plan. Query plan sets
+  * it for the current thread (see QueryContextScope) while it runs, storage engine
+  * checks it on every block read and accounts large buffers (see QueryMemory).
+  * Instances of this class are thread-safe, deadline and memory limit should be set
+  * before the query is started.
+  */
+class QueryContext {
+    typedef std::chrono::steady_clock Clock;
+
+    std::atomic<bool> cancelled_;
+    bool              has_deadline_;
+    Clock::time_point deadline_;
+    //! Memory limit in bytes (0 - unlimited)
+    u64               memory_limit_;
+    std::atomic<u64>  memory_used_;
+public:
+    QueryContext()
+        : cancelled_{false}
+        , has_deadline_(false)
+        , memory_limit_(0)
+        , memory_used_{0}
+    {
+    }
+
+    QueryContext(QueryContext const&) = delete;
+    QueryContext& operator = (QueryContext const&) = delete;
+
+    //! Return context of the current thread (null if not set)
+    static QueryContext*& current() {
+        static thread_local QueryContext* context = nullptr;
+        return context;
+    }
+
+    //! Check the context of the current thread
+    static aku_Status check_current() {
+        QueryContext* context = current();
+        return context ? context->check() : AKU_SUCCESS;
+    }
+
+    //! Cancel the query (can be called from any thread)
+    void cancel() {
+        cancelled_ = true;
+    }
+
+    //! Set deadline relative to the current time
+    void set_timeout(std::chrono::milliseconds timeout) {
+        has_deadline_ = true;
+        deadline_ = Clock::now() + timeout;
+    }
+
+    void set_memory_limit(u64 bytes) {
+        memory_limit_ = bytes;
+    }
+
+    //! Return AKU_ECANCELLED or AKU_EDEADLINE if the query should be stopped
+    aku_Status check() const {
+        if (cancelled_.load(std::memory_order_relaxed)) {
+            return AKU_ECANCELLED;
+        }
+        if (has_deadline_ && Clock::now() > deadline_) {
+            return AKU_EDEADLINE;
+        }
+        return AKU_SUCCESS;
+    }
+
+    //! Account `bytes` of memory, return AKU_EMEMORY_LIMIT if budget is exceeded
+    aku_Status reserve(u64 bytes) {
+        u64 used = memory_used_.fetch_add(bytes) + bytes;
+        if (memory_limit_ != 0 && used > memory_limit_) {
+            memory_used_.fetch_sub(bytes);
+            return AKU_EMEMORY_LIMIT;
+        }
+        return AKU_SUCCESS;
+    }
+
+    void release(u64 bytes) {
+        memory_used_.fetch_sub(bytes);
+    }
+
+    u64 get_memory_used() const {
+        return memory_used_;
+    }
+};
+
+/** Set the context of the current thread while in scope (previous context
+  * is restored on exit). Scope does nothing if the context is null.
+  */
+class QueryContextScope {
+    QueryContext* context_;
+    QueryContext* prev_;
+public:
+    QueryContextScope(QueryContext* context)
+        : context_(context)
+        , prev_(nullptr)
+    {
+        if (context_) {
+            prev_ = QueryContext::current();
+            QueryContext::current() = context_;
+        }
+    }
+
+    ~QueryContextScope() {
+        if (context_) {
+            QueryContext::current() = prev_;
+        }
+    }
+
+    QueryContextScope(QueryContextScope const&) = delete;
+    QueryContextScope& operator = (QueryContextScope const&) = delete;
+};
+
+/** Memory accounted in the budget of the query. Memory is reserved in the
+  * context of the current thread and released when the object is destroyed.
+  * Nothing is accounted if the context is not set.
+  */
+class QueryMemory {
+    QueryContext* context_;
+    u64 size_;
+public:
+    QueryMemory()
+        : context_(nullptr)
+        , size_(0)
+    {
+    }
+
+    ~QueryMemory() {
+        if (context_) {
+            context_->release(size_);
+        }
+    }
+
+    QueryMemory(QueryMemory&& other)
+        : context_(other.context_)
+        , size_(other.size_)
+    {
+        other.context_ = nullptr;
+        other.size_ = 0;
+    }
+
+    QueryMemory(QueryMemory const&) = delete;
+    QueryMemory& operator = (QueryMemory const&) = delete;
+
+    //! Resize the reservation, return AKU_EMEMORY_LIMIT if budget is exceeded
+    aku_Status resize(u64 bytes) {
+        if (!context_) {
+            context_ = QueryContext::current();
+            if (!context_) {
+                return AKU_SUCCESS;
+            }
+        }
+        if (bytes > size_) {
+            auto status = context_->reserve(bytes - size_);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+        } else {
+            context_->release(size_ - bytes);
+        }
+        size_ = bytes;
+        return AKU_SUCCESS;
+    }
+};
+
+}}  // namespace
@@ -5,6 +5,7 @@
 #include <tuple>
 #include <vector>
 #include <cassert>
+#include <limits>
 
 namespace Akumuli {
 
@@ -66,11 +67,28 @@ struct TupleOutputUtils {
         case StorageEngine::AggregationFunction::MEAN:
             out = res.sum / res.cnt;
             break;
+        case StorageEngine::AggregationFunction::P50:
+        case StorageEngine::AggregationFunction::P75:
+        case StorageEngine::AggregationFunction::P90:
+        case StorageEngine::AggregationFunction::P95:
+        case StorageEngine::AggregationFunction::P99:
+        case StorageEngine::AggregationFunction::P999:
+            // Percentiles can't be computed without the sketch
+            out = std::numeric_limits<double>::quiet_NaN();
+            break;
         }
         return out;
     }
 
-    static void set_tuple(double* tuple, std::vector<StorageEngine::AggregationFunction> const& comp, StorageEngine::AggregationResult const& res) {
+    static double get(StorageEngine::QuantileResult const& res, StorageEngine::AggregationFunction afunc) {
+        if (StorageEngine::is_quantile(afunc)) {
+            return res.quantile(StorageEngine::get_quantile_rank(afunc));
+        }
+        return get(res.agg, afunc);
+    }
+
+    template<class TRes>
+    static void set_tuple(double* tuple, std::vector<StorageEngine::AggregationFunction> const& comp, TRes const& res) {
         for (size_t i = 0; i < comp.size(); i++) {
             auto elem = comp[i];
             *tuple = get(res, elem);
@@ -19,8 +19,28 @@
 #include <apr.h>
 #include <apr_general.h>
 #include <apr_file_io.h>
+#include <apr_portable.h>
 #include <set>
 
+#include <sys/mman.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AKU_HAVE_PWRITEV
+#include <sys/uio.h>
+#include <limits.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define AKU_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#endif
+
 #include <boost/exception/all.hpp>
 
 #include "log_iface.h"
@@ -282,16 +302,282 @@ aku_Status MetaVolume::flush(u32 id) {
     return AKU_SUCCESS;
 }
 
+//--------------------------- IOUring ----------------------------------//
+
+#ifdef AKU_HAVE_IO_URING
+
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nargs) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nargs));
+}
+
+/** Minimal io_uring wrapper (liburing is not required).
+  * Uses its own file descriptor and a set of registered page-aligned buffers,
+  * one per submission queue entry. Data is copied to/from registered buffers so
+  * caller's memory doesn't need to be aligned (this is required by O_DIRECT).
+  * Not thread safe, Volume is protected by the FileStorage lock.
+  */
+class IOUring {
+    enum {
+        QUEUE_DEPTH = 64,
+    };
+    int ring_fd_;
+    int file_fd_;
+    // Submission queue
+    void*         sq_ptr_;
+    size_t        sq_size_;
+    u32*          sq_tail_;
+    u32*          sq_mask_;
+    u32*          sq_array_;
+    io_uring_sqe* sqes_;
+    size_t        sqes_size_;
+    // Completion queue
+    void*         cq_ptr_;
+    size_t        cq_size_;
+    u32*          cq_head_;
+    u32*          cq_tail_;
+    u32*          cq_mask_;
+    io_uring_cqe* cqes_;
+    // Registered buffers
+    std::vector<void*> buffers_;
+
+    IOUring()
+        : ring_fd_(-1)
+        , file_fd_(-1)
+        , sq_ptr_(MAP_FAILED)
+        , sq_size_(0)
+        , sq_tail_(nullptr)
+        , sq_mask_(nullptr)
+        , sq_array_(nullptr)
+        , sqes_(static_cast<io_uring_sqe*>(MAP_FAILED))
+        , sqes_size_(0)
+        , cq_ptr_(MAP_FAILED)
+        , cq_size_(0)
+        , cq_head_(nullptr)
+        , cq_tail_(nullptr)
+        , cq_mask_(nullptr)
+        , cqes_(nullptr)
+    {
+    }
+
+    bool init(const char* path, bool direct) {
+        int flags = O_RDWR;
+        if (direct) {
+            flags |= O_DIRECT;
+        }
+        file_fd_ = ::open(path, flags);
+        if (file_fd_ < 0) {
+            return false;
+        }
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd_ = io_uring_setup(QUEUE_DEPTH, &params);
+        if (ring_fd_ < 0) {
+            return false;
+        }
+        sq_size_ = params.sq_off.array + params.sq_entries*sizeof(u32);
+        sq_ptr_  = mmap(nullptr, sq_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            return false;
+        }
+        auto sq  = static_cast<u8*>(sq_ptr_);
+        sq_tail_  = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+        sq_mask_  = reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<u32*>(sq + params.sq_off.array);
+
+        sqes_size_ = params.sq_entries*sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                                                ring_fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            return false;
+        }
+
+        cq_size_ = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+        cq_ptr_  = mmap(nullptr, cq_size_, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            return false;
+        }
+        auto cq  = static_cast<u8*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<u32*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+        cqes_    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        std::vector<iovec> iovecs;
+        for (int i = 0; i < QUEUE_DEPTH; i++) {
+            void* buf = nullptr;
+            if (posix_memalign(&buf, AKU_BLOCK_SIZE, AKU_BLOCK_SIZE) != 0) {
+                return false;
+            }
+            buffers_.push_back(buf);
+            iovec vec = { buf, AKU_BLOCK_SIZE };
+            iovecs.push_back(vec);
+        }
+        if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(), QUEUE_DEPTH) < 0) {
+            return false;
+        }
+        return true;
+    }
+
+    /** Submit `n` (n <= QUEUE_DEPTH) requests and wait for completion.
+      * Request `i` uses registered buffer `i`.
+      */
+    void submit_and_wait(u8 opcode, const u64* offsets, u32 n) {
+        u32 tail = *sq_tail_;  // only this thread can update the tail
+        for (u32 i = 0; i < n; i++) {
+            u32 idx = tail & *sq_mask_;
+            io_uring_sqe* sqe = &sqes_[idx];
+            memset(sqe, 0, sizeof(io_uring_sqe));
+            sqe->opcode    = opcode;
+            sqe->fd        = file_fd_;
+            sqe->off       = offsets[i];
+            sqe->addr      = reinterpret_cast<u64>(buffers_[i]);
+            sqe->len       = AKU_BLOCK_SIZE;
+            sqe->buf_index = static_cast<u16>(i);
+            sqe->user_data = i;
+            sq_array_[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        u32 submitted = 0;
+        u32 completed = 0;
+        int error = 0;
+        while (completed < n) {
+            int ret = io_uring_enter(ring_fd_, n - submitted, 1, IORING_ENTER_GETEVENTS);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                Logger::msg(AKU_LOG_ERROR, std::string("io_uring_enter error: ") + strerror(errno));
+                AKU_PANIC("Volume I/O error");
+            }
+            submitted += static_cast<u32>(ret);
+            u32 head = *cq_head_;
+            while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+                if (cqe->res != AKU_BLOCK_SIZE && error == 0) {
+                    error = cqe->res < 0 ? -cqe->res : EIO;
+                }
+                head++;
+                completed++;
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+        if (error) {
+            Logger::msg(AKU_LOG_ERROR, std::string("io_uring request failed: ") + strerror(error));
+            AKU_PANIC(opcode == IORING_OP_READ_FIXED ? "Volume read error" : "Volume write error");
+        }
+    }
+
+public:
+    ~IOUring() {
+        if (cq_ptr_ != MAP_FAILED) {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (sq_ptr_ != MAP_FAILED) {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (ring_fd_ >= 0) {
+            close(ring_fd_);
+        }
+        if (file_fd_ >= 0) {
+            close(file_fd_);
+        }
+        for (auto buf: buffers_) {
+            free(buf);
+        }
+    }
+
+    //! Open file and create the ring, return nullptr if io_uring is not available
+    static std::unique_ptr<IOUring> open(const char* path, bool direct) {
+        std::unique_ptr<IOUring> result(new IOUring());
+        if (!result->init(path, direct)) {
+            Logger::msg(AKU_LOG_ERROR, std::string("Can't initialize io_uring: ") + strerror(errno));
+            result.reset();
+        }
+        return result;
+    }
+
+    void read_blocks(const u32* ix, u8* const* dest, size_t n) {
+        u64 offsets[QUEUE_DEPTH];
+        for (size_t i = 0; i < n; i += QUEUE_DEPTH) {
+            u32 batch = static_cast<u32>(std::min(n - i, static_cast<size_t>(QUEUE_DEPTH)));
+            for (u32 j = 0; j < batch; j++) {
+                offsets[j] = static_cast<u64>(ix[i + j]) * AKU_BLOCK_SIZE;
+            }
+            submit_and_wait(IORING_OP_READ_FIXED, offsets, batch);
+            for (u32 j = 0; j < batch; j++) {
+                memcpy(dest[i + j], buffers_[j], AKU_BLOCK_SIZE);
+            }
+        }
+    }
+
+    void write_blocks(u32 first, const u8* const* source, size_t n) {
+        u64 offsets[QUEUE_DEPTH];
+        for (size_t i = 0; i < n; i += QUEUE_DEPTH) {
+            u32 batch = static_cast<u32>(std::min(n - i, static_cast<size_t>(QUEUE_DEPTH)));
+            for (u32 j = 0; j < batch; j++) {
+                offsets[j] = static_cast<u64>(first + i + j) * AKU_BLOCK_SIZE;
+                memcpy(buffers_[j], source[i + j], AKU_BLOCK_SIZE);
+            }
+            submit_and_wait(IORING_OP_WRITE_FIXED, offsets, batch);
+        }
+    }
+};
+
+#else
+
+//! Stub for systems without io_uring
+class IOUring {
+public:
+    static std::unique_ptr<IOUring> open(const char*, bool) {
+        Logger::msg(AKU_LOG_ERROR, "io_uring is not supported on this platform");
+        return std::unique_ptr<IOUring>();
+    }
+
+    void read_blocks(const u32*, u8* const*, size_t) {
+        AKU_PANIC("io_uring is not supported");
+    }
+
+    void write_blocks(u32, const u8* const*, size_t) {
+        AKU_PANIC("io_uring is not supported");
+    }
+};
+
+#endif
+
 //--------------------------- Volume -----------------------------------//
 
-Volume::Volume(const char* path, size_t write_pos)
+Volume::Volume(const char* path, size_t write_pos, VolumeIO io)
     : apr_pool_(_make_apr_pool())
     , apr_file_handle_(_open_file(path, apr_pool_.get()))
     , file_size_(static_cast<u32>(_get_file_size(apr_file_handle_.get())/AKU_BLOCK_SIZE))
     , write_pos_(static_cast<u32>(write_pos))
     , path_(path)
     , mmap_ptr_(nullptr)
+    , io_(io)
 {
+    if (io != VolumeIO::APR) {
+        uring_ = IOUring::open(path, io == VolumeIO::IO_URING_DIRECT);
+        if (!uring_) {
+            Logger::msg(AKU_LOG_ERROR, path_ + " io_uring is not available, fallback to APR");
+            io_ = VolumeIO::APR;
+        } else if (io == VolumeIO::IO_URING_DIRECT) {
+            // Page cache is bypassed, mmap can't be used
+            return;
+        }
+    }
 #if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
     // 64-bit architecture, we can use mmap for speed
     mmap_.reset(new MemoryMappedFile(path, false));
@@ -312,6 +598,9 @@ Volume::Volume(const char* path, size_t write_pos)
 #endif
 }
 
+Volume::~Volume() {
+}
+
 void Volume::reset() {
     write_pos_ = 0;
 }
@@ -321,9 +610,9 @@ void Volume::create_new(const char* path, size_t capacity) {
     _create_file(path, size);
 }
 
-std::unique_ptr<Volume> Volume::open_existing(const char* path, size_t pos) {
+std::unique_ptr<Volume> Volume::open_existing(const char* path, size_t pos, VolumeIO io) {
     std::unique_ptr<Volume> result;
-    result.reset(new Volume(path, pos));
+    result.reset(new Volume(path, pos, io));
     return result;
 }
 
@@ -332,6 +621,9 @@ std::tuple<aku_Status, BlockAddr> Volume::append_block(const u8* source) {
     if (write_pos_ >= file_size_) {
         return std::make_tuple(AKU_EOVERFLOW, 0u);
     }
+    if (uring_) {
+        return append_blocks(&source, 1);
+    }
     apr_off_t seek_off = write_pos_ * AKU_BLOCK_SIZE;
     apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &seek_off);
     panic_on_error(status, "Volume seek error");
@@ -342,6 +634,64 @@ std::tuple<aku_Status, BlockAddr> Volume::append_block(const u8* source) {
     return std::make_tuple(AKU_SUCCESS, result);
 }
 
+std::tuple<aku_Status, BlockAddr> Volume::append_blocks(const u8* const* source, size_t n) {
+    if (n == 0 || write_pos_ + n > file_size_) {
+        return std::make_tuple(n == 0 ? AKU_EBAD_ARG : AKU_EOVERFLOW, 0u);
+    }
+    auto result = write_pos_;
+    if (uring_) {
+        uring_->write_blocks(write_pos_, source, n);
+    } else {
+#ifdef AKU_HAVE_PWRITEV
+        // Blocks are adjacent so they can be written using vectored write
+        apr_os_file_t fd;
+        apr_status_t status = apr_os_file_get(&fd, apr_file_handle_.get());
+        panic_on_error(status, "Can't get volume file descriptor");
+        std::vector<iovec> iov;
+        off_t offset = static_cast<off_t>(write_pos_) * AKU_BLOCK_SIZE;
+        for (size_t i = 0; i < n; i++) {
+            iov.push_back({ const_cast<u8*>(source[i]), AKU_BLOCK_SIZE });
+        }
+        size_t ix = 0;
+        while (ix < iov.size()) {
+            int cnt = static_cast<int>(std::min(iov.size() - ix, static_cast<size_t>(IOV_MAX)));
+            ssize_t res = pwritev(fd, iov.data() + ix, cnt, offset);
+            if (res < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                panic_on_error(APR_FROM_OS_ERROR(errno), "Volume write error");
+            }
+            // Skip fully written blocks and adjust partially written one
+            offset += res;
+            while (res > 0) {
+                auto len = static_cast<ssize_t>(iov[ix].iov_len);
+                if (res >= len) {
+                    res -= len;
+                    ix++;
+                } else {
+                    iov[ix].iov_base = static_cast<u8*>(iov[ix].iov_base) + res;
+                    iov[ix].iov_len -= static_cast<size_t>(res);
+                    res = 0;
+                }
+            }
+        }
+#else
+        // Blocks are adjacent so one seek is enough
+        apr_off_t seek_off = write_pos_ * AKU_BLOCK_SIZE;
+        apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &seek_off);
+        panic_on_error(status, "Volume seek error");
+        for (size_t i = 0; i < n; i++) {
+            apr_size_t bytes_written = 0;
+            status = apr_file_write_full(apr_file_handle_.get(), source[i], AKU_BLOCK_SIZE, &bytes_written);
+            panic_on_error(status, "Volume write error");
+        }
+#endif
+    }
+    write_pos_ += static_cast<u32>(n);
+    return std::make_tuple(AKU_SUCCESS, result);
+}
+
 //! Read filxed size block from file
 aku_Status Volume::read_block(u32 ix, u8* dest) const {
     if (ix >= write_pos_) {
@@ -353,6 +703,10 @@ aku_Status Volume::read_block(u32 ix, u8* dest) const {
         memcpy(dest, mmap_ptr_ + offset, AKU_BLOCK_SIZE);
         return AKU_SUCCESS;
     }
+    if (uring_) {
+        uring_->read_blocks(&ix, &dest, 1);
+        return AKU_SUCCESS;
+    }
     apr_off_t offset = ix * AKU_BLOCK_SIZE;
     apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &offset);
     panic_on_error(status, "Volume seek error");
@@ -362,6 +716,25 @@ aku_Status Volume::read_block(u32 ix, u8* dest) const {
     return AKU_SUCCESS;
 }
 
+aku_Status Volume::read_blocks(const u32* ix, u8* const* dest, size_t n) const {
+    for (size_t i = 0; i < n; i++) {
+        if (ix[i] >= write_pos_) {
+            return AKU_EBAD_ARG;
+        }
+    }
+    if (uring_ && !mmap_ptr_) {
+        uring_->read_blocks(ix, dest, n);
+        return AKU_SUCCESS;
+    }
+    for (size_t i = 0; i < n; i++) {
+        aku_Status status = read_block(ix[i], dest[i]);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    return AKU_SUCCESS;
+}
+
 std::tuple<aku_Status, const u8*> Volume::read_block_zero_copy(u32 ix) const {
     if (ix >= write_pos_) {
         return std::make_tuple(AKU_EBAD_ARG, nullptr);
@@ -375,6 +748,21 @@ std::tuple<aku_Status, const u8*> Volume::read_block_zero_copy(u32 ix) const {
     return std::make_tuple(AKU_EUNAVAILABLE, nullptr);
 }
 
+aku_Status Volume::prefetch_block(u32 ix) const {
+    if (ix >= write_pos_) {
+        return AKU_EBAD_ARG;
+    }
+    if (mmap_ptr_) {
+        size_t offset = ix * AKU_BLOCK_SIZE;
+        auto ptr = align_to_page(mmap_ptr_ + offset, get_page_size());
+        size_t len = static_cast<size_t>(mmap_ptr_ + offset + AKU_BLOCK_SIZE - static_cast<const u8*>(ptr));
+        // Pointer is aligned and it's only a hint so the result can be ignored
+        posix_madvise(const_cast<void*>(ptr), len, POSIX_MADV_WILLNEED);
+        return AKU_SUCCESS;
+    }
+    return AKU_EUNAVAILABLE;
+}
+
 void Volume::flush() {
     apr_status_t status = apr_file_flush(apr_file_handle_.get());
     panic_on_error(status, "Volume flush error");
@@ -384,8 +772,16 @@ u32 Volume::get_size() const {
     return file_size_;
 }
 
+u32 Volume::get_nblocks() const {
+    return write_pos_;
+}
+
 std::string Volume::get_path() const {
   return path_;
 }
 
+VolumeIO Volume::get_io_backend() const {
+    return io_;
+}
+
 }}  // namespace
@@ -41,6 +41,18 @@ enum { AKU_BLOCK_SIZE = 4096 };
 typedef std::unique_ptr<apr_pool_t, void (*)(apr_pool_t*)> AprPoolPtr;
 typedef std::unique_ptr<apr_file_t, void (*)(apr_file_t*)> AprFilePtr;
 
+//! Volume I/O backend
+enum class VolumeIO {
+    //! Synchronous APR file calls
+    APR,
+    //! io_uring with registered buffers (Linux only, falls back to APR if not available)
+    IO_URING,
+    //! io_uring with O_DIRECT, page cache and mmap are not used
+    IO_URING_DIRECT,
+};
+
+class IOUring;
+
 
 /** Class that represents metadata volume.
   * MetaVolume is a file that contains some information
@@ -119,10 +131,15 @@ class Volume {
     // Optional mmap
     std::unique_ptr<MemoryMappedFile> mmap_;
     const u8* mmap_ptr_;
+    // Optional io_uring
+    std::unique_ptr<IOUring> uring_;
+    VolumeIO io_;
 
-    Volume(const char* path, size_t write_pos);
+    Volume(const char* path, size_t write_pos, VolumeIO io);
     
 public:
+    ~Volume();
+
     /** Create new volume.
       * @param path Path to volume.
       * @param capacity Size of the volume in blocks.
@@ -134,9 +151,10 @@ public:
       * @throw std::runtime_error on error.
       * @param path Path to volume file.
       * @param pos Write position inside volume (in blocks).
+      * @param io I/O backend.
       * @return New instance of V2::Volume.
       */
-    static std::unique_ptr<Volume> open_existing(const char* path, size_t pos);
+    static std::unique_ptr<Volume> open_existing(const char* path, size_t pos, VolumeIO io = VolumeIO::APR);
 
     // Mutators
 
@@ -145,6 +163,12 @@ public:
     //! Append block to file (source size should be 4 at least BLOCK_SIZE)
     std::tuple<aku_Status, BlockAddr> append_block(const u8* source);
 
+    /** Append `n` blocks to file using one write request if possible (pwritev or io_uring).
+      * @return status and address of the first block (AKU_EOVERFLOW if
+      *         there is not enough space for all blocks, nothing is written in this case)
+      */
+    std::tuple<aku_Status, BlockAddr> append_blocks(const u8* const* source, size_t n);
+
     //! Flush volume
     void flush();
 
@@ -153,6 +177,9 @@ public:
     //! Read filxed size block from file
     aku_Status read_block(u32 ix, u8* dest) const;
 
+    //! Read `n` blocks from file using one read request if possible
+    aku_Status read_blocks(const u32* ix, u8* const* dest, size_t n) const;
+
     /**
      * @brief Read block without copying the data (only works if mmap available)
      * @param ix is an index of the page
@@ -160,11 +187,24 @@ public:
      */
     std::tuple<aku_Status, const u8*> read_block_zero_copy(u32 ix) const;
 
+    /**
+     * @brief Ask OS to read block into page cache asynchronously (only works if mmap available)
+     * @param ix is an index of the page
+     * @return status (AKU_EUNAVAILABLE if mmap is not present)
+     */
+    aku_Status prefetch_block(u32 ix) const;
+
     //! Return size in blocks
     u32 get_size() const;
 
+    //! Return number of blocks written (write position)
+    u32 get_nblocks() const;
+
     //! Return path of volume
     std::string get_path() const;
+
+    //! Return I/O backend actually used by the volume
+    VolumeIO get_io_backend() const;
 };
 
 }  // namespace V2
@@ -0,0 +1,71 @@
+/** Reference client of the binary ingestion protocol.
+  * Sends dictionary frames for every series and then data frames with
+  * `npoints` samples per series.
+  * Usage: perf_binary_client [host] [port] [nseries] [npoints] [flags]
+  */
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "binaryframe.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+
+int main(int argc, char *argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    std::string port = argc > 2 ? argv[2] : "8484";
+    u32 nseries      = argc > 3 ? static_cast<u32>(std::stoul(argv[3])) : 1000;
+    u32 npoints      = argc > 4 ? static_cast<u32>(std::stoul(argv[4])) : 1000;
+    u32 flags        = argc > 5 ? static_cast<u32>(std::stoul(argv[5]))
+                                : BinaryFrame::TIMESTAMPS_DELTA|BinaryFrame::VALUES_XOR;
+    const u32 batch  = 1000;
+
+    boost::asio::io_service io;
+    boost::asio::ip::tcp::resolver resolver(io);
+    boost::asio::ip::tcp::socket socket(io);
+    boost::asio::connect(socket, resolver.resolve({host, port}));
+
+    PerfTimer tm;
+    std::vector<u8> buffer;
+    for (u32 i = 0; i < nseries; i++) {
+        std::string name = "perf.binary id=" + std::to_string(i);
+        if (BinaryFrame::encode_dict(i, name.data(), name.size(), &buffer) != AKU_SUCCESS) {
+            std::cout << "Can't encode dictionary frame" << std::endl;
+            return 1;
+        }
+    }
+    boost::asio::write(socket, boost::asio::buffer(buffer));
+    size_t nbytes = buffer.size();
+
+    std::vector<aku_Timestamp> ts(batch);
+    std::vector<double> xs(batch);
+    for (u32 begin = 0; begin < npoints; begin += batch) {
+        u32 size = std::min(batch, npoints - begin);
+        buffer.clear();
+        for (u32 i = 0; i < nseries; i++) {
+            for (u32 j = 0; j < size; j++) {
+                ts[j] = 1000000000ull*(begin + j);
+                xs[j] = static_cast<double>(i) + 0.01*((begin + j) % 100);
+            }
+            auto status = BinaryFrame::encode_data(i, ts.data(), xs.data(), size, flags, &buffer);
+            if (status != AKU_SUCCESS) {
+                std::cout << "Can't encode data frame" << std::endl;
+                return 1;
+            }
+        }
+        boost::asio::write(socket, boost::asio::buffer(buffer));
+        nbytes += buffer.size();
+    }
+    socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send);
+
+    double elapsed = tm.elapsed();
+    double total = static_cast<double>(nseries)*npoints;
+    std::cout << "Sent " << static_cast<u64>(total) << " points in " << elapsed << "s, "
+              << static_cast<u64>(total/elapsed) << " points/sec, "
+              << nbytes/total << " bytes/point" << std::endl;
+    return 0;
+}
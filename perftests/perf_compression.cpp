@@ -10,6 +10,8 @@
 #include <zlib.h>
 #include <cstring>
 #include <map>
+#include <random>
+#include <functional>
 
 #include <boost/filesystem.hpp>
 
@@ -147,10 +149,175 @@ TestRunResults run_tests(fs::path path) {
     return runresults;
 }
 
+//! Compression stats of the value codec
+struct CodecRunResults {
+    std::string dataset;
+    std::string codec;
+    size_t nelements;
+    size_t nblocks;
+    size_t compressed;
+    double bytes_per_element;
+    double write_rate;  // elements per second
+    double read_rate;   // elements per second
+};
+
+/** Write series into the sequence of leaf-sized data blocks using `codec`
+  * and read it back.
+  */
+CodecRunResults run_codec(std::string dataset,
+                          std::vector<aku_Timestamp> const& ts,
+                          std::vector<double> const& xs,
+                          StorageEngine::ValueCodec codec,
+                          std::string codec_name)
+{
+    CodecRunResults result = {};
+    result.dataset = dataset;
+    result.codec = codec_name;
+    result.nelements = ts.size();
+    std::vector<std::vector<u8>> blocks;
+    std::vector<size_t> sizes;
+    PerfTimer tm;
+    size_t ix = 0;
+    // Same size as in NBTreeLeaf
+    const int block_size = StorageEngine::AKU_BLOCK_SIZE - sizeof(StorageEngine::SubtreeRef);
+    while (ix < ts.size()) {
+        blocks.emplace_back(block_size);
+        StorageEngine::DataBlockWriter writer(1, blocks.back().data(), block_size, codec);
+        while (ix < ts.size() && writer.put(ts[ix], xs[ix]) == AKU_SUCCESS) {
+            ix++;
+        }
+        sizes.push_back(writer.commit());
+    }
+    result.write_rate = ts.size() / tm.elapsed();
+    result.nblocks = blocks.size();
+    for (auto sz: sizes) {
+        result.compressed += sz;
+    }
+    result.bytes_per_element = double(result.compressed) / ts.size();
+
+    std::vector<aku_Timestamp> outts(ts.size());
+    std::vector<double> outxs(ts.size());
+    tm.restart();
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        StorageEngine::DataBlockReader reader(blocks[i].data(), sizes[i]);
+        aku_Status status;
+        size_t nread;
+        std::tie(status, nread) = reader.read_all(outts.data() + total, outxs.data() + total,
+                                                  reader.nelements());
+        total += nread;
+    }
+    result.read_rate = ts.size() / tm.elapsed();
+    if (total != ts.size() || outts != ts || memcmp(outxs.data(), xs.data(), xs.size()*sizeof(double)) != 0) {
+        std::cout << "Decoding error, dataset: " << dataset << ", codec: " << codec_name << std::endl;
+    }
+    return result;
+}
+
+std::vector<CodecRunResults> compare_codecs(std::string dataset,
+                                            std::vector<aku_Timestamp> const& ts,
+                                            std::vector<double> const& xs)
+{
+    std::vector<CodecRunResults> results;
+    results.push_back(run_codec(dataset, ts, xs, StorageEngine::ValueCodec::FCM, "fcm"));
+    results.push_back(run_codec(dataset, ts, xs, StorageEngine::ValueCodec::GORILLA, "gorilla"));
+    results.push_back(run_codec(dataset, ts, xs, StorageEngine::ValueCodec::CHIMP, "chimp"));
+    results.push_back(run_codec(dataset, ts, xs, StorageEngine::ValueCodec::ADAPTIVE, "adaptive"));
+    return results;
+}
+
+//! Generate synthetic series and compare value codecs
+std::vector<CodecRunResults> compare_codecs_synthetic() {
+    const size_t N = 1000000;
+    std::mt19937 gen(42);
+    std::normal_distribution<double> noise(0, 1);
+    std::vector<aku_Timestamp> ts;
+    aku_Timestamp its = 1000000000;
+    for (size_t i = 0; i < N; i++) {
+        its += 1000 + gen() % 3;
+        ts.push_back(its);
+    }
+    std::vector<CodecRunResults> results;
+    auto run = [&](std::string name, std::function<double(size_t)> const& fn) {
+        std::vector<double> xs;
+        for (size_t i = 0; i < N; i++) {
+            xs.push_back(fn(i));
+        }
+        auto res = compare_codecs(name, ts, xs);
+        std::copy(res.begin(), res.end(), std::back_inserter(results));
+    };
+    double acc = 100;
+    run("random walk", [&](size_t) { acc += noise(gen); return acc; });
+    acc = 100;
+    run("rounded random walk", [&](size_t) { acc += noise(gen); return std::round(acc*100)/100; });
+    run("counter", [&](size_t i) { return static_cast<double>(i); });
+    run("constant", [&](size_t) { return 42.0; });
+    run("noisy sine", [&](size_t i) { return std::sin(i*0.01)*100 + noise(gen)*0.01; });
+    run("enum", [&](size_t) { return static_cast<double>(gen() % 8); });
+    return results;
+}
+
+//! Read recorded dataset and compare value codecs series by series
+std::vector<CodecRunResults> compare_codecs_recorded(fs::path path) {
+    auto header = read_data(path);
+    std::map<aku_ParamId, std::pair<std::vector<aku_Timestamp>, std::vector<double>>> series;
+    for (size_t i = 0; i < header.paramids.size(); i++) {
+        auto& s = series[header.paramids[i]];
+        s.first.push_back(header.timestamps[i]);
+        s.second.push_back(header.values[i]);
+    }
+    std::map<std::string, CodecRunResults> total;
+    for (auto const& kv: series) {
+        for (auto const& res: compare_codecs(fs::basename(path), kv.second.first, kv.second.second)) {
+            auto it = total.find(res.codec);
+            if (it == total.end()) {
+                total[res.codec] = res;
+                continue;
+            }
+            auto& acc = it->second;
+            // Rates are combined using total elapsed time
+            double elapsed_write = acc.nelements / acc.write_rate + res.nelements / res.write_rate;
+            double elapsed_read = acc.nelements / acc.read_rate + res.nelements / res.read_rate;
+            acc.nelements  += res.nelements;
+            acc.nblocks    += res.nblocks;
+            acc.compressed += res.compressed;
+            acc.write_rate  = acc.nelements / elapsed_write;
+            acc.read_rate   = acc.nelements / elapsed_read;
+        }
+    }
+    std::vector<CodecRunResults> results;
+    for (auto const& name: { "fcm", "gorilla", "chimp", "adaptive" }) {
+        auto it = total.find(name);
+        if (it != total.end()) {
+            it->second.bytes_per_element = double(it->second.compressed) / it->second.nelements;
+            results.push_back(it->second);
+        }
+    }
+    return results;
+}
+
+void print_codec_results(std::vector<CodecRunResults> const& results) {
+    std::cout << "| Dataset | codec | num elements | blocks | compressed | bytes/el | write el/s | read el/s |" << std::endl;
+    std::cout << "| ----- | ---- | ---- | ---- | ----- | ---- | ---- | ---- |" << std::endl;
+    for (auto const& run: results) {
+        std::cout << run.dataset << " | " <<
+                     run.codec << " | " <<
+                     run.nelements << " | " <<
+                     run.nblocks << " | " <<
+                     run.compressed << " | " <<
+                     run.bytes_per_element << " | " <<
+                     static_cast<u64>(run.write_rate) << " | " <<
+                     static_cast<u64>(run.read_rate) << " | " <<
+                     std::endl;
+    }
+}
+
 int main(int argc, char** argv) {
+    // Value codecs comparison on synthetic data
+    print_codec_results(compare_codecs_synthetic());
     if (argc < 2) {
-        std::cout << "Path to dataset required" << std::endl;
-        exit(1);
+        std::cout << "Path to dataset required to run the rest of the tests" << std::endl;
+        return 0;
     }
 
     // Iter directory
@@ -182,4 +349,12 @@ int main(int argc, char** argv) {
                      std::endl;
     }
 
+    // Value codecs comparison on recorded data
+    std::vector<CodecRunResults> codec_results;
+    for (auto fname: files) {
+        auto res = compare_codecs_recorded(fname);
+        std::copy(res.begin(), res.end(), std::back_inserter(codec_results));
+    }
+    std::cout << std::endl;
+    print_codec_results(codec_results);
 }
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <zlib.h>
 #include <cstring>
+#include <functional>
 
 using namespace Akumuli;
 
@@ -74,4 +75,61 @@ int main(int argc, char** argv) {
     std::cout << "Total bytes: " << total_bytes << std::endl;
     std::cout << "Compression: " << (double(UNCOMPRESSED_SIZE)/double(total_bytes/nruns)) << std::endl;
     std::cout << "Bytes/point: " << (double(total_bytes/nruns)/TEST_SIZE) << std::endl;
+
+    // Decoding throughput. Data is split into 4KB blocks like in NBTree leaf nodes.
+    std::vector<ByteVector> blocks;
+    std::vector<size_t> block_sizes;
+    size_t ix = 0;
+    while (ix < header.timestamps.size()) {
+        ByteVector block(4096);
+        Akumuli::StorageEngine::DataBlockWriter writer(42, block.data(), static_cast<int>(block.size()));
+        while (ix < header.timestamps.size()) {
+            if (writer.put(header.timestamps[ix], header.values[ix]) == AKU_EOVERFLOW) {
+                break;
+            }
+            ix++;
+        }
+        block_sizes.push_back(writer.commit());
+        blocks.push_back(std::move(block));
+    }
+
+    std::vector<aku_Timestamp> tsout(4096);
+    std::vector<double> xsout(4096);
+    auto decode_one_by_one = [&]() {
+        size_t n = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            Akumuli::StorageEngine::DataBlockReader reader(blocks[i].data(), block_sizes[i]);
+            size_t sz = reader.nelements();
+            for (size_t j = 0; j < sz; j++) {
+                aku_Status status;
+                std::tie(status, tsout[j], xsout[j]) = reader.next();
+            }
+            n += sz;
+        }
+        return n;
+    };
+    auto decode_batch = [&]() {
+        size_t n = 0;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            Akumuli::StorageEngine::DataBlockReader reader(blocks[i].data(), block_sizes[i]);
+            aku_Status status;
+            size_t sz;
+            std::tie(status, sz) = reader.read_all(tsout.data(), xsout.data(), reader.nelements());
+            n += sz;
+        }
+        return n;
+    };
+    auto measure = [&](const char* name, std::function<size_t()> const& fn) {
+        double fastest = 1E10;
+        size_t npoints = 0;
+        for (size_t k = 0; k < nruns; k++) {
+            PerfTimer tm;
+            npoints = fn();
+            fastest = std::min(fastest, tm.elapsed());
+        }
+        std::cout << name << ": " << static_cast<u64>(npoints/fastest) << " points/sec, "
+                  << static_cast<u64>(npoints*16/fastest/(1024*1024)) << " MB/sec (uncompressed)" << std::endl;
+    };
+    measure("Decode (next)", decode_one_by_one);
+    measure("Decode (read_all)", decode_batch);
 }
@@ -1,31 +1,98 @@
+#include <cstdlib>
+#include <cstring>
+
 #include "datetime.h"
+#include "numparser.h"
 #include "perftest_tools.h"
 
 using namespace Akumuli;
 
-int main() {
+static const char* test_strings[] = {
+    "20060102T100405.999999999",
+    "20060202T110406.888888888",
+    "20060302T120407.777777777",
+    "20060402T130408.666666666",
+    "20060502T140409.555555555",
+    "20060602T150400.444444444",
+    "20060702T160401.333333333",
+    "20060802T170402.222222222",
+    "20060902T180403.111111111",
+    "20061002T190404.000000000"
+};
+
+static const char* test_values[] = {
+    "3.14159",
+    "-12.6",
+    "100",
+    "0.000125",
+    "12345.6789",
+    "1e10",
+    "-2.5e-3",
+    "42.0",
+    "99.99",
+    "7"
+};
 
-    const char* test_strings[] = {
-        "20060102T100405.999999999",
-        "20060202T110406.888888888",
-        "20060302T120407.777777777",
-        "20060402T130408.666666666",
-        "20060502T140409.555555555",
-        "20060602T150400.444444444",
-        "20060702T160401.333333333",
-        "20060802T170402.222222222",
-        "20060902T180403.111111111",
-        "20061002T190404.000000000"
-    };
+int main() {
+    const int N = 100000;
     aku_Timestamp tsacc = 0;
     PerfTimer timer;
-    for(int k = 100000; k --> 0;) {
+    for(int k = N; k --> 0;) {
         for(int i = 10; i --> 0;) {
             tsacc += DateTimeUtil::from_iso_string(test_strings[i]);
         }
     }
     double elapsed = timer.elapsed();
+    std::cout << "from_iso_string" << std::endl;
+    std::cout << "Summ: " << tsacc << std::endl;
+    std::cout << "Elapsed: " << elapsed << std::endl;
+
+    tsacc = 0;
+    timer.restart();
+    for(int k = N; k --> 0;) {
+        for(int i = 10; i --> 0;) {
+            aku_Timestamp ts;
+            const char* str = test_strings[i];
+            if (!DateTimeUtil::parse_timestamp_fast(str, str + strlen(str), &ts)) {
+                std::cout << "Can't parse " << str << std::endl;
+                return 1;
+            }
+            tsacc += ts;
+        }
+    }
+    elapsed = timer.elapsed();
+    std::cout << "parse_timestamp_fast" << std::endl;
     std::cout << "Summ: " << tsacc << std::endl;
     std::cout << "Elapsed: " << elapsed << std::endl;
+
+    double xsacc = 0;
+    timer.restart();
+    for(int k = N; k --> 0;) {
+        for(int i = 10; i --> 0;) {
+            xsacc += strtod(test_values[i], nullptr);
+        }
+    }
+    elapsed = timer.elapsed();
+    std::cout << "strtod" << std::endl;
+    std::cout << "Summ: " << xsacc << std::endl;
+    std::cout << "Elapsed: " << elapsed << std::endl;
+
+    xsacc = 0;
+    timer.restart();
+    for(int k = N; k --> 0;) {
+        for(int i = 10; i --> 0;) {
+            double x;
+            const char* str = test_values[i];
+            if (!parse_double(str, str + strlen(str), &x)) {
+                std::cout << "Can't parse " << str << std::endl;
+                return 1;
+            }
+            xsacc += x;
+        }
+    }
+    elapsed = timer.elapsed();
+    std::cout << "parse_double" << std::endl;
+    std::cout << "Summ: " << xsacc << std::endl;
+    std::cout << "Elapsed: " << elapsed << std::endl;
     return 0;
 }
@@ -0,0 +1,118 @@
+// C++ headers
+#include <iostream>
+#include <vector>
+
+// App headers
+#include "storage_engine/operators/merge.h"
+#include "log_iface.h"
+#include "util.h"
+#include "perftest_tools.h"
+
+
+using namespace Akumuli;
+using namespace Akumuli::StorageEngine;
+
+static void console_logger(aku_LogLevel lvl, const char* msg) {
+    switch(lvl) {
+    case AKU_LOG_ERROR:
+        std::cerr << "ERROR: " << msg << std::endl;
+        break;
+    case AKU_LOG_INFO:
+    case AKU_LOG_TRACE:
+        break;
+    };
+}
+
+/** In-memory series. Generates `npoints` samples with timestamps
+  * `offset, offset + step, offset + 2*step, ...` so that all series
+  * are interleaved when merged by time.
+  */
+struct GeneratorOperator : RealValuedOperator {
+    aku_Timestamp offset_;
+    aku_Timestamp step_;
+    u64 npoints_;
+    u64 pos_;
+
+    GeneratorOperator(aku_Timestamp offset, aku_Timestamp step, u64 npoints)
+        : offset_(offset)
+        , step_(step)
+        , npoints_(npoints)
+        , pos_(0)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp* destts, double* destval, size_t size) override {
+        size_t n = std::min(size, static_cast<size_t>(npoints_ - pos_));
+        for (size_t i = 0; i < n; i++) {
+            destts[i]  = offset_ + (pos_ + i)*step_;
+            destval[i] = static_cast<double>(pos_ + i);
+        }
+        pos_ += n;
+        return std::make_tuple(pos_ == npoints_ ? AKU_ENO_DATA : AKU_SUCCESS, n);
+    }
+
+    virtual Direction get_direction() override {
+        return Direction::FORWARD;
+    }
+};
+
+/** Merge `ninputs` series with `npoints` samples in total.
+  * @return number of samples merged per second
+  */
+static double run(u32 ninputs, u64 npoints) {
+    std::vector<aku_ParamId> ids;
+    std::vector<std::unique_ptr<RealValuedOperator>> iters;
+    u64 per_input = npoints / ninputs;
+    for (u32 i = 0; i < ninputs; i++) {
+        ids.push_back(i + 1);
+        iters.emplace_back(new GeneratorOperator(i, ninputs, per_input));
+    }
+    MergeMaterializer<TimeOrder> merge(std::move(ids), std::move(iters));
+
+    std::vector<u8> buffer(0x1000*sizeof(aku_Sample));
+    u64 total = 0;
+    aku_Timestamp prev = 0;
+    PerfTimer tm;
+    while (true) {
+        aku_Status status;
+        size_t size;
+        std::tie(status, size) = merge.read(buffer.data(), buffer.size());
+        if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
+            std::cerr << "Merge error " << status << std::endl;
+            return 0;
+        }
+        for (size_t pos = 0; pos < size; pos += sizeof(aku_Sample)) {
+            auto sample = reinterpret_cast<aku_Sample const*>(buffer.data() + pos);
+            if (sample->timestamp < prev) {
+                std::cerr << "Merge error, samples are out of order" << std::endl;
+                return 0;
+            }
+            prev = sample->timestamp;
+        }
+        total += size / sizeof(aku_Sample);
+        if (status == AKU_ENO_DATA) {
+            break;
+        }
+    }
+    double elapsed = tm.elapsed();
+    if (total != per_input*ninputs) {
+        std::cerr << "Merge error, " << total << " samples merged, "
+                  << per_input*ninputs << " expected" << std::endl;
+    }
+    return static_cast<double>(total) / elapsed;
+}
+
+int main(int argc, char** argv) {
+    Akumuli::Logger::set_logger(console_logger);
+
+    u64 npoints = 10000000;
+    if (argc > 1) {
+        npoints = std::stoull(argv[1]);
+    }
+
+    for (u32 ninputs: { 10u, 1000u, 100000u }) {
+        double throughput = run(ninputs, npoints);
+        std::cout << ninputs << " input(s): " << static_cast<u64>(throughput) << " samples/sec" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// C++ headers
+#include <iostream>
+#include <vector>
+#include <thread>
+
+// Lib headers
+#include <apr.h>
+
+// App headers
+#include "storage_engine/blockstore.h"
+#include "storage_engine/column_store.h"
+#include "log_iface.h"
+#include "util.h"
+#include "perftest_tools.h"
+
+
+using namespace Akumuli;
+using namespace Akumuli::StorageEngine;
+
+static void console_logger(aku_LogLevel lvl, const char* msg) {
+    switch(lvl) {
+    case AKU_LOG_ERROR:
+        std::cerr << "ERROR: " << msg << std::endl;
+        break;
+    case AKU_LOG_INFO:
+    case AKU_LOG_TRACE:
+        break;
+    };
+}
+
+/** Write `npoints` samples into `nseries` columns using `nthreads` writers.
+  * Each writer owns its own subset of series (like TCP workers do) and writes
+  * through ColumnStore::write directly to bypass CStoreSession cache. This way
+  * every sample goes through the series table lookup.
+  * @return number of samples written per second
+  */
+static double run(u32 nthreads, u32 nseries, u64 npoints) {
+    auto bstore = BlockStoreBuilder::create_memstore();
+    auto cstore = std::make_shared<ColumnStore>(bstore);
+    for (u32 id = 1; id <= nseries; id++) {
+        cstore->create_new_column(id);
+    }
+
+    auto writer = [&](u32 ix) {
+        std::vector<LogicAddr> rpoints;
+        u64 per_thread = npoints / nthreads;
+        u32 series_per_thread = nseries / nthreads;
+        u32 first_id = 1 + ix*series_per_thread;
+        aku_Sample sample = {};
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        for (u64 i = 0; i < per_thread; i++) {
+            sample.paramid = first_id + static_cast<u32>(i % series_per_thread);
+            sample.timestamp = i / series_per_thread;
+            sample.payload.float64 = static_cast<double>(i);
+            auto res = cstore->write(sample, &rpoints);
+            if (res != NBTreeAppendResult::OK && res != NBTreeAppendResult::OK_FLUSH_NEEDED) {
+                std::cerr << "Write error at " << i << std::endl;
+                return;
+            }
+        }
+    };
+
+    PerfTimer tm;
+    std::vector<std::thread> threads;
+    for (u32 i = 0; i < nthreads; i++) {
+        threads.emplace_back(writer, i);
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    double elapsed = tm.elapsed();
+    cstore->close();
+    return static_cast<double>(npoints) / elapsed;
+}
+
+int main(int argc, char** argv) {
+    apr_initialize();
+
+    Akumuli::Logger::set_logger(console_logger);
+
+    u32 maxthreads = std::thread::hardware_concurrency();
+    if (argc > 1) {
+        maxthreads = static_cast<u32>(std::stoul(argv[1]));
+    }
+    const u32 nseries  = 10000;
+    const u64 npoints  = 10000000;
+
+    double baseline = 0;
+    for (u32 nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        double throughput = run(nthreads, nseries, npoints);
+        if (nthreads == 1) {
+            baseline = throughput;
+        }
+        std::cout << nthreads << " thread(s): " << static_cast<u64>(throughput) << " samples/sec, speedup "
+                  << throughput / baseline << "x" << std::endl;
+    }
+    return 0;
+}
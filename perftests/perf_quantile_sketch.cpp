@@ -0,0 +1,112 @@
+// C++ headers
+#include <iostream>
+#include <vector>
+
+// App headers
+#include "storage_engine/blockstore.h"
+#include "storage_engine/nbtree.h"
+#include "storage_engine/operators/operator.h"
+#include "log_iface.h"
+#include "util.h"
+#include "perftest_tools.h"
+
+
+using namespace Akumuli;
+using namespace Akumuli::StorageEngine;
+
+static void console_logger(aku_LogLevel lvl, const char* msg) {
+    switch(lvl) {
+    case AKU_LOG_ERROR:
+        std::cerr << "ERROR: " << msg << std::endl;
+        break;
+    case AKU_LOG_INFO:
+    case AKU_LOG_TRACE:
+        break;
+    };
+}
+
+static double gen_value(u64 i) {
+    return static_cast<double>((i * 2654435761ull) % 100000) / 10.0;
+}
+
+//! Cost of the QuantileSketch::add call (paid by NBTreeLeafExtent::append)
+static double perf_sketch_add(u64 N) {
+    QuantileSketch sketch;
+    PerfTimer tm;
+    for (u64 i = 0; i < N; i++) {
+        sketch.add(gen_value(i));
+    }
+    double elapsed = tm.elapsed();
+    if (sketch.count() != N) {
+        std::cerr << "ERROR: invalid sketch count " << sketch.count() << std::endl;
+    }
+    return elapsed;
+}
+
+//! Cost of the leaf node decoding (paid by the leaf commit if the sketch is built from the node)
+static double perf_leaf_decode(u64 N) {
+    u64 nvalues = 0;
+    double elapsed = 0;
+    while (nvalues < N) {
+        NBTreeLeaf leaf(42, EMPTY_ADDR, 0);
+        while (leaf.append(nvalues, gen_value(nvalues)) == AKU_SUCCESS) {
+            nvalues++;
+        }
+        PerfTimer tm;
+        std::vector<aku_Timestamp> tss;
+        std::vector<double> xss;
+        aku_Status status = leaf.read_all(&tss, &xss);
+        QuantileSketch sketch;
+        for (auto x: xss) {
+            sketch.add(x);
+        }
+        elapsed += tm.elapsed();
+        if (status != AKU_SUCCESS) {
+            std::cerr << "ERROR: can't decode leaf node" << std::endl;
+            break;
+        }
+    }
+    return elapsed;
+}
+
+//! Cost of the NBTreeExtentsList::append call, sketches are updated incrementally
+static double perf_nbtree_append(u64 N, u64 nseries) {
+    auto bstore = BlockStoreBuilder::create_memstore();
+    std::vector<std::shared_ptr<NBTreeExtentsList>> trees;
+    for (u64 i = 0; i < nseries; i++) {
+        std::vector<LogicAddr> empty;
+        auto ext = std::make_shared<NBTreeExtentsList>(i, empty, bstore);
+        ext->force_init();
+        trees.push_back(std::move(ext));
+    }
+    PerfTimer tm;
+    for (u64 i = 0; i < N; i++) {
+        trees[i % nseries]->append(i / nseries, gen_value(i));
+    }
+    double elapsed = tm.elapsed();
+    for (auto& tree: trees) {
+        tree->close();
+    }
+    return elapsed;
+}
+
+int main() {
+    Logger::set_logger(console_logger);
+
+    const u64 N = 20000000;
+    const u64 nseries = 100;
+
+    double tadd    = perf_sketch_add(N);
+    double tdecode = perf_leaf_decode(N);
+    double tappend = perf_nbtree_append(N, nseries);
+
+    auto ns_per_value = [N](double sec) {
+        return sec * 1000000000.0 / N;
+    };
+
+    std::cout << "QuantileSketch::add:          " << ns_per_value(tadd)    << " ns/value" << std::endl;
+    std::cout << "Leaf decode and sketch build: " << ns_per_value(tdecode) << " ns/value" << std::endl;
+    std::cout << "NBTreeExtentsList::append:    " << ns_per_value(tappend) << " ns/value" << std::endl;
+    std::cout << "Sketch share of append cost:  " << 100.0 * tadd / tappend << "%" << std::endl;
+    return 0;
+}
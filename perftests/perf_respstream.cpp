@@ -2,6 +2,8 @@
 #include "perftest_tools.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 const int TEST_ITERATIONS = 100000;
 const int N_TESTS = 1000;
@@ -14,50 +16,49 @@ int main(int argc, char *argv[]) {
     if (argc == 2) {
         push_to_graphite = std::string(argv[1]) == "graphite";
     }
-    const char* pattern = ":1234567\r\n+3.14159\r\n";
+    const char* pattern = "+cpu.user host=machine1 region=NW\r\n:1418224205000000000\r\n+3.14159\r\n";
     std::string input;
-    for (int i = 0; i < TEST_ITERATIONS/2; i++) {
+    for (int i = 0; i < TEST_ITERATIONS/3; i++) {
         input += pattern;
     }
     std::vector<double> timedeltas;
+    bool success;
     u64 intvalue;
+    int len;
     Byte buffer[RESPStream::STRING_LENGTH_MAX];
     for (int i = N_TESTS; i --> 0;) {
         PerfTimer tm;
         MemStreamReader stream(input.data(), input.size());
         RESPStream protocol(&stream);
-        for (int j = TEST_ITERATIONS; j --> 0;) {
-            auto type = protocol.next_type();
-            switch(type) {
-            case RESPStream::INTEGER:
-                intvalue = protocol.read_int();
-                if (intvalue != 1234567) {
-                    std::cerr << "Bad int value at " << j << std::endl;
-                    return -1;
-                }
-                break;
-            case RESPStream::STRING: {
-                    int len = protocol.read_string(buffer, sizeof(buffer));
-                    if (len != 7) {
-                        std::cerr << "Bad string value at " << j << std::endl;
-                        return -1;
-                    }
-                    char *p = buffer;
-                    double res = strtod(buffer, &p);
-                    if (abs(res - 3.14159) > 0.0001) {
-                        std::cerr << "Can't parse float at " << j << std::endl;
-                        return -1;
-                    }
-                }
-                break;
-            case RESPStream::ARRAY:
-            case RESPStream::_BAD:
-            case RESPStream::BULK_STR:
-            case RESPStream::ERROR:
-            default:
-                std::cerr << "Error at " << j << std::endl;
+        for (int j = TEST_ITERATIONS/3; j --> 0;) {
+            if (protocol.next_type() != RESPStream::STRING) {
+                std::cerr << "Bad series name type at " << j << std::endl;
                 return -1;
-            };
+            }
+            const Byte* name;
+            std::tie(success, name, len) = protocol.read_string_view();
+            if (!success || len != 32) {
+                std::cerr << "Bad series name at " << j << std::endl;
+                return -1;
+            }
+            if (protocol.next_type() != RESPStream::INTEGER) {
+                std::cerr << "Bad timestamp type at " << j << std::endl;
+                return -1;
+            }
+            std::tie(success, intvalue) = protocol.read_int();
+            if (!success || intvalue != 1418224205000000000ull) {
+                std::cerr << "Bad int value at " << j << std::endl;
+                return -1;
+            }
+            if (protocol.next_type() != RESPStream::STRING) {
+                std::cerr << "Bad value type at " << j << std::endl;
+                return -1;
+            }
+            std::tie(success, len) = protocol.read_string(buffer, sizeof(buffer));
+            if (!success || len != 7) {
+                std::cerr << "Bad string value at " << j << std::endl;
+                return -1;
+            }
         }
         timedeltas.push_back(tm.elapsed());
     }
@@ -1,4 +1,8 @@
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <set>
+#include <thread>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -9,6 +13,7 @@
 #include "akumuli.h"
 #include "storage_engine/blockstore.h"
 #include "storage_engine/volume.h"
+#include "storage_engine/nbtree_def.h"
 #include "log_iface.h"
 
 using namespace Akumuli;
@@ -17,6 +22,8 @@ struct VolumeRegistryMock : VolumeRegistry {
 
     std::vector<VolumeDesc> volumes;
     std::string dbname;
+    //! Number of subsequent `update_volume` calls that should fail
+    int update_failures = 0;
 
     std::vector<VolumeDesc> get_volumes() const {
         return volumes;
@@ -27,6 +34,10 @@ struct VolumeRegistryMock : VolumeRegistry {
     }
 
     void update_volume(const VolumeDesc &vol) {
+        if (update_failures > 0) {
+            update_failures--;
+            throw std::runtime_error("update_volume failure");
+        }
         auto ix = vol.id;
         auto volume = volumes.at(ix);
         volume.capacity = vol.capacity;
@@ -70,24 +81,25 @@ static void create_expandable_storage() {
     Volume::create_new(EXP_VOLPATH[0].c_str(), CAPACITIES[0]);
 }
 
-static std::shared_ptr<FixedSizeFileStorage> open_blockstore() {
+static std::shared_ptr<FixedSizeFileStorage> open_blockstore(VolumeIO io = VolumeIO::APR) {
     std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
     vrmock->volumes = {
         { 0, VOLPATH[0], 0, 0, CAPACITIES[0], 0 },
-        { 1, VOLPATH[1], 0, 0, CAPACITIES[1], 0 },
+        { 1, VOLPATH[1], 0, 0, CAPACITIES[1], 1 },
     };
     vrmock->dbname = "test";
-    auto bstore = FixedSizeFileStorage::open(vrmock);
+    auto bstore = FixedSizeFileStorage::open(vrmock, FileStorage::DEFAULT_CACHE_SIZE, io);
     return bstore;
 }
 
-static std::shared_ptr<ExpandableFileStorage> open_expandable_storage(std::shared_ptr<VolumeRegistryMock> *mock = 0) {
+static std::shared_ptr<ExpandableFileStorage> open_expandable_storage(std::shared_ptr<VolumeRegistryMock> *mock = 0,
+                                                                     VolumeIO io = VolumeIO::APR) {
     std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
     vrmock->volumes = {
         { 0, EXP_VOLPATH[0], 0, 0, CAPACITIES[0], 0 },
     };
     vrmock->dbname = "test";
-    auto bstore = ExpandableFileStorage::open(vrmock);
+    auto bstore = ExpandableFileStorage::open(vrmock, FileStorage::DEFAULT_CACHE_SIZE, io);
     if (mock) {
         *mock = vrmock;
     }
@@ -110,11 +122,47 @@ static void delete_expandable_storage() {
     apr_pool_destroy(pool);
 }
 
+//! Check that the backend can be used (io_uring could be disabled by the kernel)
+static bool is_io_backend_available(VolumeIO io) {
+    delete_blockstore();
+    create_blockstore();
+    auto backend = Volume::open_existing(VOLPATH[0].c_str(), 0, io)->get_io_backend();
+    delete_blockstore();
+    return backend == io;
+}
 
-BOOST_AUTO_TEST_CASE(Test_blockstore_0) {
+static const char* io_backend_name(VolumeIO io) {
+    switch (io) {
+    case VolumeIO::APR:
+        return "APR";
+    case VolumeIO::IO_URING:
+        return "io_uring";
+    case VolumeIO::IO_URING_DIRECT:
+        return "io_uring (O_DIRECT)";
+    };
+    return "unknown";
+}
+
+/** Run test using every I/O backend. Backends that are not available
+  * are skipped with a message.
+  */
+static void test_all_io_backends(std::function<void(VolumeIO)> const& fn) {
+    for (auto io: { VolumeIO::APR, VolumeIO::IO_URING, VolumeIO::IO_URING_DIRECT }) {
+        if (!is_io_backend_available(io)) {
+            BOOST_TEST_MESSAGE(std::string(io_backend_name(io)) + " backend is not available, skipped");
+            continue;
+        }
+        BOOST_TEST_CHECKPOINT(io_backend_name(io));
+        fn(io);
+    }
+}
+
+
+static void test_blockstore_0(VolumeIO io) {
     delete_blockstore();
     create_blockstore();
-    auto bstore = open_blockstore();
+    auto bstore = open_blockstore(io);
+    BOOST_REQUIRE(bstore->get_io_backend() == io);
     std::shared_ptr<Block> block;
     aku_Status status;
     // Should be unreadable
@@ -144,10 +192,15 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_0) {
     delete_blockstore();
 }
 
-BOOST_AUTO_TEST_CASE(Test_blockstore_1) {
+BOOST_AUTO_TEST_CASE(Test_blockstore_0) {
+    test_all_io_backends(&test_blockstore_0);
+}
+
+static void test_blockstore_1(VolumeIO io) {
     delete_blockstore();
     create_blockstore();
-    auto bstore = open_blockstore();
+    auto bstore = open_blockstore(io);
+    BOOST_REQUIRE(bstore->get_io_backend() == io);
 
 
     // Fill data in
@@ -181,10 +234,15 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_1) {
     delete_blockstore();
 }
 
-BOOST_AUTO_TEST_CASE(Test_blockstore_3) {
+BOOST_AUTO_TEST_CASE(Test_blockstore_1) {
+    test_all_io_backends(&test_blockstore_1);
+}
+
+static void test_blockstore_3(VolumeIO io) {
     delete_expandable_storage();
     create_expandable_storage();
-    auto bstore = open_expandable_storage();
+    auto bstore = open_expandable_storage(nullptr, io);
+    BOOST_REQUIRE(bstore->get_io_backend() == io);
     std::shared_ptr<Block> block;
     aku_Status status;
 
@@ -213,13 +271,18 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_3) {
     delete_expandable_storage();
 }
 
-BOOST_AUTO_TEST_CASE(Test_blockstore_4) {
+BOOST_AUTO_TEST_CASE(Test_blockstore_3) {
+    test_all_io_backends(&test_blockstore_3);
+}
+
+static void test_blockstore_4(VolumeIO io) {
     delete_expandable_storage();
     const char* expected_path = "test_1.vol";
     boost::filesystem::remove(expected_path);
     create_expandable_storage();
     std::shared_ptr<VolumeRegistryMock> mock;
-    auto bstore = open_expandable_storage(&mock);
+    auto bstore = open_expandable_storage(&mock, io);
+    BOOST_REQUIRE(bstore->get_io_backend() == io);
     std::shared_ptr<Block> block;
     aku_Status status;
     bool exist = boost::filesystem::exists(expected_path);
@@ -261,3 +324,330 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_4) {
     boost::filesystem::remove(expected_path);
     delete_expandable_storage();
 }
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_4) {
+    test_all_io_backends(&test_blockstore_4);
+}
+
+static std::shared_ptr<Block> make_cached_block(LogicAddr addr, NBTreeBlockType type) {
+    std::vector<u8> data(AKU_BLOCK_SIZE, 0);
+    SubtreeRef* ref = reinterpret_cast<SubtreeRef*>(data.data());
+    ref->type = type;
+    return std::make_shared<Block>(addr, std::move(data));
+}
+
+// All addresses used in this tests are multiples of 16 so they
+// will end up in the same shard.
+static const size_t CACHE_SHARD_BLOCKS = 4;
+static const size_t CACHE_SIZE = 16*CACHE_SHARD_BLOCKS*AKU_BLOCK_SIZE;
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_scan_resistance) {
+    BlockCache cache(CACHE_SIZE);
+    // Two hot blocks accessed twice
+    for (LogicAddr addr: { 0ul, 16ul }) {
+        cache.insert(make_cached_block(addr, NBTreeBlockType::LEAF));
+        BOOST_REQUIRE(cache.lookup(addr));
+    }
+    // One-off scan
+    for (LogicAddr addr = 32; addr < 32*16; addr += 16) {
+        BOOST_REQUIRE(!cache.lookup(addr));
+        cache.insert(make_cached_block(addr, NBTreeBlockType::LEAF));
+    }
+    BOOST_REQUIRE(cache.lookup(0));
+    BOOST_REQUIRE(cache.lookup(16));
+    auto stats = cache.get_stats();
+    BOOST_REQUIRE_EQUAL(stats.hits, 4);
+    BOOST_REQUIRE_EQUAL(stats.misses, 30);
+    BOOST_REQUIRE(stats.evictions > 0);
+    BOOST_REQUIRE(stats.size <= CACHE_SHARD_BLOCKS*AKU_BLOCK_SIZE);
+    BOOST_REQUIRE_EQUAL(stats.capacity, CACHE_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_inner_nodes) {
+    BlockCache cache(CACHE_SIZE);
+    cache.insert(make_cached_block(0, NBTreeBlockType::INNER));
+    for (LogicAddr addr = 16; addr < 32*16; addr += 16) {
+        auto block = make_cached_block(addr, NBTreeBlockType::LEAF);
+        cache.insert(block);
+        BOOST_REQUIRE(cache.lookup(addr));
+    }
+    BOOST_REQUIRE(cache.lookup(0));
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_prefetched) {
+    BlockCache cache(CACHE_SIZE);
+    // Blocks that was read ahead, first one is accessed twice and the second one only once
+    cache.insert(make_cached_block(0, NBTreeBlockType::LEAF), true);
+    cache.insert(make_cached_block(16, NBTreeBlockType::LEAF), true);
+    BOOST_REQUIRE(cache.contains(0));
+    BOOST_REQUIRE(cache.lookup(0));
+    BOOST_REQUIRE(cache.lookup(0));
+    BOOST_REQUIRE(cache.lookup(16));
+    // One-off scan
+    for (LogicAddr addr = 32; addr < 32*16; addr += 16) {
+        cache.insert(make_cached_block(addr, NBTreeBlockType::LEAF));
+    }
+    BOOST_REQUIRE(cache.lookup(0));
+    BOOST_REQUIRE(!cache.contains(16));
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_prefetch) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+    aku_Status status;
+    LogicAddr addr;
+    auto buffer = std::make_shared<Block>();
+    buffer->get_data()[0] = 1;
+    std::tie(status, addr) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    // Prefetch is only a hint, bad addresses should be ignored
+    bstore->prefetch(addr);
+    bstore->prefetch(addr + 1);
+    bstore->prefetch(EMPTY_ADDR);
+
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = bstore->read_block(addr);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_cdata()[0], 1);
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_cache_stats) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore();
+    aku_Status status;
+    LogicAddr addr;
+    auto buffer = std::make_shared<Block>();
+    buffer->get_data()[0] = 1;
+    std::tie(status, addr) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    std::shared_ptr<Block> block;
+    for (int i = 0; i < 3; i++) {
+        std::tie(status, block) = bstore->read_block(addr);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_cdata()[0], 1);
+    }
+    auto stats = bstore->get_stats();
+    BOOST_REQUIRE_EQUAL(stats.cache.misses, 1);
+    BOOST_REQUIRE_EQUAL(stats.cache.hits, 2);
+    delete_blockstore();
+}
+
+static void test_blockstore_io_backend(VolumeIO io) {
+    if (!is_io_backend_available(io)) {
+        BOOST_TEST_MESSAGE(std::string(io_backend_name(io)) + " backend is not available, skipped");
+        return;
+    }
+    delete_blockstore();
+    create_blockstore();
+    {
+        auto bstore = open_blockstore(io);
+        BOOST_REQUIRE(bstore->get_io_backend() == io);
+        aku_Status status;
+        LogicAddr addr;
+        std::vector<LogicAddr> addrlist;
+        for (int i = 0; i < 12; i++) {
+            auto buffer = std::make_shared<Block>();
+            buffer->get_data()[0] = static_cast<u8>(i);
+            buffer->get_data()[AKU_BLOCK_SIZE - 1] = static_cast<u8>(i + 1);
+            std::tie(status, addr) = bstore->append_block(buffer);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            addrlist.push_back(addr);
+        }
+        bstore->flush();
+        for (auto it: addrlist) {
+            bstore->prefetch(it);
+        }
+        for (int i = 0; i < 12; i++) {
+            std::shared_ptr<Block> block;
+            std::tie(status, block) = bstore->read_block(addrlist.at(i));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            BOOST_REQUIRE_EQUAL(block->get_cdata()[0], i);
+            BOOST_REQUIRE_EQUAL(block->get_cdata()[AKU_BLOCK_SIZE - 1], i + 1);
+        }
+    }
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_io_uring) {
+    test_blockstore_io_backend(VolumeIO::IO_URING);
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_io_uring_direct) {
+    test_blockstore_io_backend(VolumeIO::IO_URING_DIRECT);
+}
+
+static void test_volume_batch_io(VolumeIO io) {
+    if (!is_io_backend_available(io)) {
+        BOOST_TEST_MESSAGE(std::string(io_backend_name(io)) + " backend is not available, skipped");
+        return;
+    }
+    delete_blockstore();
+    create_blockstore();
+    {
+        auto volume = Volume::open_existing(VOLPATH[0].c_str(), 0, io);
+        BOOST_REQUIRE(volume->get_io_backend() == io);
+        std::vector<std::vector<u8>> blocks;
+        std::vector<const u8*> src;
+        for (u32 i = 0; i < CAPACITIES[0]; i++) {
+            blocks.emplace_back(AKU_BLOCK_SIZE, static_cast<u8>(i + 1));
+        }
+        for (auto const& it: blocks) {
+            src.push_back(it.data());
+        }
+        aku_Status status;
+        BlockAddr first;
+        std::tie(status, first) = volume->append_blocks(src.data(), 3);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(first, 0);
+        std::tie(status, first) = volume->append_blocks(src.data() + 3, src.size());
+        BOOST_REQUIRE_EQUAL(status, AKU_EOVERFLOW);
+        std::tie(status, first) = volume->append_blocks(src.data() + 3, src.size() - 3);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(first, 3);
+        volume->flush();
+
+        // Read blocks in reverse order
+        std::vector<u32> ix;
+        std::vector<std::vector<u8>> out;
+        std::vector<u8*> dest;
+        for (u32 i = CAPACITIES[0]; i --> 0;) {
+            ix.push_back(i);
+            out.emplace_back(AKU_BLOCK_SIZE, 0);
+        }
+        for (auto& it: out) {
+            dest.push_back(it.data());
+        }
+        status = volume->read_blocks(ix.data(), dest.data(), ix.size());
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        for (size_t i = 0; i < ix.size(); i++) {
+            BOOST_REQUIRE(out.at(i) == blocks.at(ix.at(i)));
+        }
+    }
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_volume_batch_io_apr) {
+    test_volume_batch_io(VolumeIO::APR);
+}
+
+BOOST_AUTO_TEST_CASE(Test_volume_batch_io_uring) {
+    test_volume_batch_io(VolumeIO::IO_URING);
+}
+
+BOOST_AUTO_TEST_CASE(Test_volume_batch_io_uring_direct) {
+    test_volume_batch_io(VolumeIO::IO_URING_DIRECT);
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_group_commit) {
+    delete_blockstore();
+    create_blockstore();
+    {
+        // Concurrent writers should fill both volumes without gaps
+        auto bstore = open_blockstore();
+        const int nthreads = 4;
+        const int nblocks = 4;  // per thread, 16 blocks total
+        std::vector<std::vector<LogicAddr>> addrlist(nthreads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < nblocks; i++) {
+                    auto buffer = std::make_shared<Block>();
+                    buffer->get_data()[0] = static_cast<u8>(t);
+                    buffer->get_data()[1] = static_cast<u8>(i);
+                    aku_Status status;
+                    LogicAddr addr;
+                    std::tie(status, addr) = bstore->append_block(buffer);
+                    if (status == AKU_SUCCESS) {
+                        addrlist[t].push_back(addr);
+                    }
+                }
+            });
+        }
+        for (auto& it: threads) {
+            it.join();
+        }
+        std::set<LogicAddr> unique;
+        for (int t = 0; t < nthreads; t++) {
+            BOOST_REQUIRE_EQUAL(addrlist[t].size(), nblocks);
+            for (int i = 0; i < nblocks; i++) {
+                auto addr = addrlist[t][i];
+                unique.insert(addr);
+                aku_Status status;
+                std::shared_ptr<Block> block;
+                std::tie(status, block) = bstore->read_block(addr);
+                BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+                BOOST_REQUIRE_EQUAL(block->get_cdata()[0], t);
+                BOOST_REQUIRE_EQUAL(block->get_cdata()[1], i);
+            }
+        }
+        BOOST_REQUIRE_EQUAL(unique.size(), nthreads*nblocks);
+        auto stats = bstore->get_stats();
+        BOOST_REQUIRE_EQUAL(stats.nblocks, nthreads*nblocks);
+    }
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_group_commit_failure) {
+    delete_blockstore();
+    create_blockstore();
+    {
+        std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
+        vrmock->volumes = {
+            { 0, VOLPATH[0], 0, 0, CAPACITIES[0], 0 },
+            { 1, VOLPATH[1], 0, 0, CAPACITIES[1], 1 },
+        };
+        vrmock->dbname = "test";
+        auto bstore = FixedSizeFileStorage::open(vrmock);
+        // The batch that fails to update the metadata throws in the leader, other
+        // appends should return (with an error if they were in the failed batch).
+        vrmock->update_failures = 1;
+        const int nthreads = 4;
+        const int nblocks = 2;
+        std::atomic<int> nthrown(0), nerrors(0), nwritten(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([&]() {
+                for (int i = 0; i < nblocks; i++) {
+                    auto buffer = std::make_shared<Block>();
+                    aku_Status status;
+                    LogicAddr addr;
+                    try {
+                        std::tie(status, addr) = bstore->append_block(buffer);
+                    } catch (std::runtime_error const&) {
+                        nthrown++;
+                        continue;
+                    }
+                    if (status == AKU_SUCCESS) {
+                        nwritten++;
+                    } else {
+                        BOOST_REQUIRE_EQUAL(status, AKU_EGENERAL);
+                        nerrors++;
+                    }
+                }
+            });
+        }
+        for (auto& it: threads) {
+            it.join();
+        }
+        BOOST_REQUIRE_EQUAL(nthrown, 1);
+        BOOST_REQUIRE_EQUAL(nthrown + nerrors + nwritten, nthreads*nblocks);
+
+        // Block store should be usable after the failure
+        aku_Status status;
+        LogicAddr addr;
+        auto buffer = std::make_shared<Block>();
+        buffer->get_data()[0] = 42;
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = bstore->read_block(addr);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_cdata()[0], 42);
+    }
+    delete_blockstore();
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <thread>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -11,6 +12,7 @@
 #include "akumuli.h"
 #include "storage_engine/column_store.h"
 #include "query_processing/queryplan.h"
+#include "cursor.h"
 #include "log_iface.h"
 #include "status_util.h"
 
@@ -81,6 +83,68 @@ BOOST_AUTO_TEST_CASE(Test_column_store_add_values_3) {
     BOOST_REQUIRE(status == NBTreeAppendResult::FAIL_BAD_ID);
 }
 
+BOOST_AUTO_TEST_CASE(Test_column_store_write_batch_1) {
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> ids = { 10, 11, 12 };
+    for (auto id: ids) {
+        cstore->create_new_column(id);
+    }
+    // Samples of different series are interleaved
+    std::vector<aku_Sample> samples;
+    for (u32 i = 0; i < 3000; i++) {
+        aku_Sample sample;
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        sample.paramid = ids[i % 3];
+        sample.timestamp = 100 + i / 3;
+        sample.payload.float64 = i;
+        samples.push_back(sample);
+    }
+    std::unordered_map<aku_ParamId, std::vector<LogicAddr>> rpoints;
+    auto status = session->write_batch(samples.data(), samples.size(), &rpoints);
+    BOOST_REQUIRE(status == NBTreeAppendResult::OK || status == NBTreeAppendResult::OK_FLUSH_NEEDED);
+
+    // Late sample, unknown id and bad value, the rest of the batch should be written
+    std::vector<aku_Sample> bad(4, samples.front());
+    bad[0].timestamp = 1;  // late write
+    bad[1].paramid = 111;  // unknown id
+    bad[1].timestamp = 2000;
+    bad[2].payload.type = aku_PData::PARAMID_BIT | aku_PData::TIMESTAMP_BIT;
+    bad[2].timestamp = 2000;
+    bad[3].timestamp = 2000;
+    status = session->write_batch(bad.data(), bad.size(), &rpoints);
+    BOOST_REQUIRE(status == NBTreeAppendResult::FAIL_LATE_WRITE);
+
+    // Status of the first failed sample in the input order is returned,
+    // the unknown id is processed after the late write.
+    std::swap(bad[0], bad[1]);
+    status = session->write_batch(bad.data(), 2, &rpoints);
+    BOOST_REQUIRE(status == NBTreeAppendResult::FAIL_BAD_ID);
+    std::swap(bad[0], bad[2]);
+    status = session->write_batch(bad.data(), 3, &rpoints);
+    BOOST_REQUIRE(status == NBTreeAppendResult::FAIL_BAD_VALUE);
+
+    auto columns = cstore->_get_columns();
+    for (auto id: ids) {
+        auto it = columns.at(id)->search(0, 2001);
+        std::vector<aku_Timestamp> ts(2000, 0);
+        std::vector<double> xs(2000, 0);
+        aku_Status rstatus;
+        size_t sz;
+        std::tie(rstatus, sz) = it->read(ts.data(), xs.data(), ts.size());
+        BOOST_REQUIRE(rstatus == AKU_SUCCESS || rstatus == AKU_ENO_DATA);
+        u32 expected = id == ids.front() ? 1001 : 1000;
+        BOOST_REQUIRE_EQUAL(sz, expected);
+        for (u32 i = 0; i < 1000; i++) {
+            BOOST_REQUIRE_EQUAL(ts[i], 100 + i);
+            BOOST_REQUIRE_EQUAL(xs[i], i*3 + (id - ids.front()));
+        }
+        if (id == ids.front()) {
+            BOOST_REQUIRE_EQUAL(ts[1000], 2000);
+        }
+    }
+}
+
 struct QueryProcessorMock : QP::IStreamProcessor {
     bool started = false;
     bool stopped = false;
@@ -118,6 +182,29 @@ void execute(std::shared_ptr<ColumnStore> cstore, IStreamProcessor* proc, Reshap
     }
 }
 
+//! Profile the query and return the sum of the counter `name` over all steps
+u64 get_profile_counter(std::shared_ptr<ColumnStore> cstore, ReshapeRequest const& req, std::string const& name) {
+    aku_Status status;
+    std::unique_ptr<QP::IQueryPlan> query_plan;
+    std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req);
+    BOOST_REQUIRE(status == AKU_SUCCESS);
+    query_plan->enable_profiling();
+    QueryPlanExecutor qexec;
+    status = qexec.profile(*cstore, *query_plan);
+    BOOST_REQUIRE(status == AKU_SUCCESS);
+    std::vector<std::string> lines;
+    query_plan->explain("", &lines);
+    std::string prefix = name + ": ";
+    u64 result = 0;
+    for (auto const& line: lines) {
+        auto pos = line.find(prefix);
+        if (pos != std::string::npos) {
+            result += std::stoull(line.substr(pos + prefix.size()));
+        }
+    }
+    return result;
+}
+
 BOOST_AUTO_TEST_CASE(Test_column_store_query_1) {
     auto cstore = create_cstore();
     auto session = create_session(cstore);
@@ -787,6 +874,693 @@ BOOST_AUTO_TEST_CASE(Test_column_store_group_aggregate_2) {
     test_group_aggregate(1000, 11000);
 }
 
+void test_group_quantiles(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step) {
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> col = { 10, 11, 12 };
+    std::vector<u64> rpoints;
+    for (auto id: col) {
+        cstore->create_new_column(id);
+    }
+    auto value = [](aku_ParamId id, aku_Timestamp ts) {
+        return 1.0 + static_cast<double>((ts*7919 + id) % 1000);
+    };
+    for (aku_Timestamp ts = begin; ts < end; ts++) {
+        for (auto id: col) {
+            aku_Sample sample = {};
+            sample.paramid = id;
+            sample.timestamp = ts;
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.float64 = value(id, ts);
+            session->write(sample, &rpoints);
+        }
+    }
+    auto quantile = [&](aku_ParamId id, aku_Timestamp bucket, double q) {
+        std::vector<double> xs;
+        for (aku_Timestamp ts = bucket; ts < std::min(bucket + step, end); ts++) {
+            xs.push_back(value(id, ts));
+        }
+        std::sort(xs.begin(), xs.end());
+        return xs.at(static_cast<size_t>(q*(xs.size() - 1)));
+    };
+    auto check = [&](OrderBy order) {
+        TupleQueryProcessorMock mock(3);
+        ReshapeRequest req = {};
+        req.agg.enabled = true;
+        req.agg.step = step;
+        req.agg.func = { AggregationFunction::P50, AggregationFunction::P99, AggregationFunction::MAX };
+        req.group_by.enabled = false;
+        req.order_by = order;
+        req.select.begin = begin;
+        req.select.end = end;
+        req.select.columns.push_back({col});
+
+        execute(cstore, &mock, req);
+
+        BOOST_REQUIRE(mock.error == AKU_SUCCESS);
+        size_t nbuckets = (end - begin + step - 1) / step;
+        BOOST_REQUIRE_EQUAL(mock.paramids.size(), nbuckets*col.size());
+        for (size_t ix = 0; ix < mock.paramids.size(); ix++) {
+            size_t bucket = order == OrderBy::SERIES ? ix % nbuckets : ix / col.size();
+            auto id = col.at(order == OrderBy::SERIES ? ix / nbuckets : ix % col.size());
+            aku_Timestamp ts = begin + bucket*step;
+            BOOST_REQUIRE_EQUAL(mock.paramids.at(ix), id);
+            BOOST_REQUIRE_EQUAL(mock.timestamps.at(ix), ts);
+            BOOST_REQUIRE_CLOSE(mock.columns[0].at(ix), quantile(id, ts, 0.50), 2.1);
+            BOOST_REQUIRE_CLOSE(mock.columns[1].at(ix), quantile(id, ts, 0.99), 2.1);
+            BOOST_REQUIRE_EQUAL(mock.columns[2].at(ix), quantile(id, ts, 1.0));
+        }
+    };
+    check(OrderBy::SERIES);
+    check(OrderBy::TIME);
+
+    // Percentiles can't be used in aggregate queries
+    ReshapeRequest req = {};
+    req.agg.enabled = true;
+    req.agg.step = 0;
+    req.agg.func = { AggregationFunction::P50 };
+    req.group_by.enabled = false;
+    req.order_by = OrderBy::SERIES;
+    req.select.begin = begin;
+    req.select.end = end;
+    req.select.columns.push_back({col});
+    aku_Status status;
+    std::unique_ptr<QP::IQueryPlan> query_plan;
+    std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req);
+    BOOST_REQUIRE(status != AKU_SUCCESS);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_group_quantiles_1) {
+    test_group_quantiles(100, 1100, 100);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_group_quantiles_2) {
+    test_group_quantiles(1000, 101000, 30000);
+}
+
+//! Top-N aggregate query should return the same values as the full aggregate query
+void test_top_aggregate(size_t nseries, aku_Timestamp npoints, u64 top) {
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> col;
+    std::vector<u64> rpoints;
+    aku_Timestamp begin = 1000;
+    for (aku_ParamId id = 1; id <= nseries; id++) {
+        col.push_back(id);
+        cstore->create_new_column(id);
+        // Series have different length and value ranges
+        double base = 10.0*((id*37) % 101);
+        for (aku_Timestamp ts = begin; ts < begin + npoints + id*3; ts++) {
+            aku_Sample sample = {};
+            sample.paramid = id;
+            sample.timestamp = ts;
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.float64 = base + static_cast<double>((ts*7919) % 10);
+            session->write(sample, &rpoints);
+        }
+    }
+    aku_Timestamp end = begin + npoints + nseries*3;
+    for (auto func: { AggregationFunction::MAX, AggregationFunction::MIN, AggregationFunction::MEAN,
+                      AggregationFunction::CNT, AggregationFunction::SUM })
+    {
+        ReshapeRequest req = {};
+        req.agg.enabled = true;
+        req.agg.step = 0;
+        req.agg.func = { func };
+        req.group_by.enabled = false;
+        req.order_by = OrderBy::SERIES;
+        req.select.begin = begin;
+        req.select.end = end;
+        req.select.columns.push_back({col});
+
+        QueryProcessorMock full;
+        execute(cstore, &full, req);
+        BOOST_REQUIRE(full.error == AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(full.samples.size(), nseries);
+        std::vector<aku_Sample> expected = full.samples;
+        std::stable_sort(expected.begin(), expected.end(), [](aku_Sample const& lhs, aku_Sample const& rhs) {
+            return lhs.payload.float64 > rhs.payload.float64;
+        });
+        expected.resize(std::min(expected.size(), static_cast<size_t>(top)));
+        // Output is ordered by series
+        std::sort(expected.begin(), expected.end(), [](aku_Sample const& lhs, aku_Sample const& rhs) {
+            return lhs.paramid < rhs.paramid;
+        });
+
+        req.agg.top = top;
+        QueryProcessorMock mock;
+        execute(cstore, &mock, req);
+        BOOST_REQUIRE(mock.error == AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(mock.samples.size(), expected.size());
+        for (size_t ix = 0; ix < expected.size(); ix++) {
+            BOOST_REQUIRE_EQUAL(mock.samples.at(ix).paramid, expected.at(ix).paramid);
+            BOOST_REQUIRE_EQUAL(mock.samples.at(ix).timestamp, expected.at(ix).timestamp);
+            BOOST_REQUIRE_EQUAL(mock.samples.at(ix).payload.float64, expected.at(ix).payload.float64);
+        }
+        // Value ranges of the series don't overlap, so only the top series are read
+        BOOST_REQUIRE_EQUAL(get_profile_counter(cstore, req, "series pruned"), nseries - expected.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_top_aggregate_1) {
+    test_top_aggregate(10, 100, 3);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_top_aggregate_2) {
+    test_top_aggregate(50, 20000, 5);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_top_aggregate_3) {
+    test_top_aggregate(10, 1000, 20);
+}
+
+//! Stores output of the query (samples can be of variable size)
+struct RawQueryProcessorMock : QP::IStreamProcessor {
+    std::vector<u8> data;
+    size_t count = 0;
+    aku_Status error = AKU_SUCCESS;
+
+    template<class T>
+    void append(T const& value) {
+        auto begin = reinterpret_cast<u8 const*>(&value);
+        data.insert(data.end(), begin, begin + sizeof(T));
+    }
+
+    virtual bool start() override {
+        return true;
+    }
+    virtual void stop() override {
+    }
+    virtual bool put(const aku_Sample &sample) override {
+        // Struct padding is not initialized, only the fields are compared
+        append(sample.paramid);
+        append(sample.timestamp);
+        append(sample.payload.type);
+        append(sample.payload.size);
+        append(sample.payload.float64);
+        auto tail = reinterpret_cast<u8 const*>(sample.payload.data);
+        data.insert(data.end(), tail, tail + (sample.payload.size - sizeof(aku_Sample)));
+        count++;
+        return true;
+    }
+    virtual void set_error(aku_Status err) override {
+        error = err;
+    }
+};
+
+void execute_parallel(std::shared_ptr<ColumnStore> cstore,
+                      IStreamProcessor* proc,
+                      ReshapeRequest const& req,
+                      QueryExecutor& executor,
+                      size_t npartitions)
+{
+    aku_Status status;
+    std::unique_ptr<QP::IQueryPlan> query_plan;
+    std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req, executor, npartitions);
+    if (status != AKU_SUCCESS) {
+        throw std::runtime_error("Can't create query plan");
+    }
+    if (proc->start()) {
+        QueryPlanExecutor qexec;
+        qexec.execute(*cstore, std::move(query_plan), *proc);
+        proc->stop();
+    }
+}
+
+//! Parallel query plan should produce the same output as serial query plan
+void test_parallel_query(aku_Timestamp begin, aku_Timestamp end) {
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> col;
+    for (aku_ParamId id = 200; id > 100; id--) {
+        col.push_back(id);
+        fill_data_in(cstore, session, id, begin + id % 7, end - id % 5);
+    }
+    QueryExecutor executor(4);
+
+    auto compare = [&](ReshapeRequest const& req) {
+        RawQueryProcessorMock serial;
+        execute(cstore, &serial, req);
+        BOOST_REQUIRE(serial.error == AKU_SUCCESS);
+        BOOST_REQUIRE(serial.count != 0);
+        for (size_t npartitions: { 2, 3, 7, 100 }) {
+            RawQueryProcessorMock parallel;
+            execute_parallel(cstore, &parallel, req, executor, npartitions);
+            BOOST_REQUIRE(parallel.error == AKU_SUCCESS);
+            BOOST_REQUIRE_EQUAL(parallel.count, serial.count);
+            BOOST_REQUIRE(parallel.data == serial.data);
+        }
+    };
+
+    for (auto order: { OrderBy::SERIES, OrderBy::TIME }) {
+        // Scan
+        ReshapeRequest req = {};
+        req.group_by.enabled = false;
+        req.order_by = order;
+        req.select.begin = begin;
+        req.select.end = end;
+        req.select.columns.push_back({col});
+        compare(req);
+
+        // Backward scan
+        req.select.begin = end;
+        req.select.end = begin;
+        compare(req);
+
+        // Group aggregate
+        req.select.begin = begin;
+        req.select.end = end;
+        req.agg.enabled = true;
+        req.agg.step = 10;
+        req.agg.func = { AggregationFunction::MIN, AggregationFunction::MAX };
+        compare(req);
+    }
+
+    // Aggregate
+    ReshapeRequest req = {};
+    req.agg.enabled = true;
+    req.agg.func = { AggregationFunction::SUM };
+    req.group_by.enabled = false;
+    req.order_by = OrderBy::SERIES;
+    req.select.begin = begin;
+    req.select.end = end;
+    req.select.columns.push_back({col});
+    compare(req);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_parallel_query_1) {
+    test_parallel_query(100, 1100);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_parallel_query_2) {
+    test_parallel_query(1000, 11000);
+}
+
+//! Execute query plan with the context, return status of the query
+static aku_Status execute_with_context(std::shared_ptr<ColumnStore> cstore,
+                                       ReshapeRequest const& req,
+                                       QueryExecutor& executor,
+                                       size_t npartitions,
+                                       std::shared_ptr<QueryContext> context)
+{
+    aku_Status status;
+    std::unique_ptr<QP::IQueryPlan> query_plan;
+    std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req, executor, npartitions);
+    if (status != AKU_SUCCESS) {
+        throw std::runtime_error("Can't create query plan");
+    }
+    query_plan->set_context(context);
+    QueryPlanExecutor qexec;
+    return qexec.profile(*cstore, *query_plan);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_query_context_1) {
+    aku_Timestamp begin = 1000, end = 11000;
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> col;
+    for (aku_ParamId id = 100; id < 200; id++) {
+        col.push_back(id);
+        fill_data_in(cstore, session, id, begin, end);
+    }
+    QueryExecutor executor(4);
+
+    ReshapeRequest req = {};
+    req.group_by.enabled = false;
+    req.order_by = OrderBy::TIME;
+    req.select.begin = begin;
+    req.select.end = end;
+    req.select.columns.push_back({col});
+
+    for (size_t npartitions: { 1, 4 }) {
+        // No limits
+        auto context = std::make_shared<QueryContext>();
+        BOOST_REQUIRE_EQUAL(execute_with_context(cstore, req, executor, npartitions, context), AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(context->get_memory_used(), 0);
+
+        // Cancelled query
+        context = std::make_shared<QueryContext>();
+        context->cancel();
+        BOOST_REQUIRE_EQUAL(execute_with_context(cstore, req, executor, npartitions, context), AKU_ECANCELLED);
+
+        // Deadline
+        context = std::make_shared<QueryContext>();
+        context->set_timeout(std::chrono::milliseconds(0));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        BOOST_REQUIRE_EQUAL(execute_with_context(cstore, req, executor, npartitions, context), AKU_EDEADLINE);
+
+        // Memory limit is too small for the merge buffers
+        context = std::make_shared<QueryContext>();
+        context->set_memory_limit(0x1000);
+        BOOST_REQUIRE_EQUAL(execute_with_context(cstore, req, executor, npartitions, context), AKU_EMEMORY_LIMIT);
+        BOOST_REQUIRE_EQUAL(context->get_memory_used(), 0);
+    }
+}
+
+//! Return true if one of the lines contains the string
+static bool contains(std::vector<std::string> const& lines, std::string const& str) {
+    for (auto const& line: lines) {
+        if (line.find(str) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_explain_1) {
+    aku_Timestamp begin = 1000, end = 11000;
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> col;
+    for (aku_ParamId id = 100; id < 110; id++) {
+        col.push_back(id);
+        fill_data_in(cstore, session, id, begin, end);
+    }
+    QueryExecutor executor(4);
+
+    ReshapeRequest req = {};
+    req.group_by.enabled = false;
+    req.order_by = OrderBy::TIME;
+    req.select.begin = begin;
+    req.select.end = end;
+    req.select.columns.push_back({col});
+
+    // Explain without profiling
+    aku_Status status;
+    std::unique_ptr<QP::IQueryPlan> query_plan;
+    std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req);
+    BOOST_REQUIRE(status == AKU_SUCCESS);
+    std::vector<std::string> lines;
+    query_plan->explain("", &lines);
+    BOOST_REQUIRE(contains(lines, "TwoStepQueryPlan"));
+    BOOST_REQUIRE(contains(lines, "ScanProcessingStep"));
+    BOOST_REQUIRE(contains(lines, "MergeBy<TIME>"));
+    BOOST_REQUIRE(!contains(lines, "samples:"));
+
+    // Profile serial and parallel query plans
+    for (size_t npartitions: { 1, 3 }) {
+        std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req, executor, npartitions);
+        BOOST_REQUIRE(status == AKU_SUCCESS);
+        query_plan->enable_profiling();
+        QueryPlanExecutor qexec;
+        status = qexec.profile(*cstore, *query_plan);
+        BOOST_REQUIRE(status == AKU_SUCCESS);
+        lines.clear();
+        query_plan->explain("", &lines);
+        if (npartitions > 1) {
+            BOOST_REQUIRE(lines.at(0).find("ParallelQueryPlan<TIME>, 3 partitions") == 0);
+            BOOST_REQUIRE(lines.at(0).find("samples: " + std::to_string(col.size()*(end - begin))) != std::string::npos);
+        }
+        BOOST_REQUIRE(contains(lines, "checksum failures: 0"));
+        u64 nsamples = 0;
+        u64 nblocks = 0;
+        for (auto const& line: lines) {
+            auto pos = line.find("samples: ");
+            if (pos != std::string::npos && line.find("MergeBy") != std::string::npos) {
+                nsamples += std::stoull(line.substr(pos + 9));
+            }
+            pos = line.find("blocks read: ");
+            if (pos != std::string::npos) {
+                nblocks += std::stoull(line.substr(pos + 13));
+            }
+        }
+        BOOST_REQUIRE_EQUAL(nsamples, col.size()*(end - begin));
+        BOOST_REQUIRE(nblocks != 0);
+    }
+}
+
+//! Group-aggregate query should return the same output with and without query cache
+void test_query_cache(aku_Timestamp begin, aku_Timestamp step) {
+    auto cached = create_cstore();
+    cached->set_query_cache_size(0x100000);
+    auto reference = create_cstore();
+    auto csession = create_session(cached);
+    auto rsession = create_session(reference);
+    std::vector<aku_ParamId> col = { 10, 11, 12, 13 };
+    for (auto id: col) {
+        cached->create_new_column(id);
+        reference->create_new_column(id);
+    }
+    aku_Timestamp last = begin;
+    auto write = [&](aku_Timestamp until) {
+        std::vector<u64> rpoints;
+        aku_Sample sample = {};
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        for (; last < until; last++) {
+            for (auto id: col) {
+                sample.paramid = id;
+                sample.timestamp = last;
+                sample.payload.float64 = (last % 97)*0.5 + id;
+                csession->write(sample, &rpoints);
+                rsession->write(sample, &rpoints);
+            }
+        }
+    };
+    // Returns number of output samples
+    auto compare = [&](aku_Timestamp qbegin, aku_Timestamp qend, OrderBy order) {
+        ReshapeRequest req = {};
+        req.agg.enabled = true;
+        req.agg.step = step;
+        req.agg.func = { AggregationFunction::MIN, AggregationFunction::MAX,
+                         AggregationFunction::SUM, AggregationFunction::CNT };
+        req.group_by.enabled = false;
+        req.order_by = order;
+        req.select.begin = qbegin;
+        req.select.end = qend;
+        req.select.columns.push_back({col});
+        RawQueryProcessorMock expected;
+        execute(reference, &expected, req);
+        RawQueryProcessorMock actual;
+        execute(cached, &actual, req);
+        BOOST_REQUIRE(expected.error == AKU_SUCCESS);
+        BOOST_REQUIRE(actual.error == AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(actual.count, expected.count);
+        BOOST_REQUIRE(actual.data == expected.data);
+        return actual.count;
+    };
+
+    write(begin + step*50);
+    // Sliding window, end of the range is not aligned
+    for (aku_Timestamp i = 0; i < 20; i++) {
+        aku_Timestamp qbegin = begin + i*step;
+        compare(qbegin, last + step/2 + 1, OrderBy::SERIES);
+        compare(qbegin, last + step/2 + 1, OrderBy::TIME);
+        write(last + step*3 + 7);
+    }
+    // Repeated query, tree wasn't updated
+    auto stats = cached->get_query_cache()->get_stats();
+    BOOST_REQUIRE(stats.hits != 0);
+    BOOST_REQUIRE(stats.misses != 0);
+    aku_Timestamp qbegin = begin + 20*step;
+    compare(qbegin, last, OrderBy::SERIES);
+    auto before = cached->get_query_cache()->get_stats();
+    auto count = compare(qbegin, last, OrderBy::SERIES);
+    auto after = cached->get_query_cache()->get_stats();
+    BOOST_REQUIRE_EQUAL(after.cached_buckets - before.cached_buckets, count);
+    // Write to the open bucket
+    write(last + 1);
+    compare(qbegin, last, OrderBy::SERIES);
+    // Range that starts before the cached range
+    compare(begin, last, OrderBy::TIME);
+    // Range that ends inside the cached range
+    compare(qbegin + step, qbegin + step*5, OrderBy::SERIES);
+    compare(qbegin + step, qbegin + step*5 + 3, OrderBy::TIME);
+    // Different bucket grid
+    compare(qbegin + 3, last, OrderBy::SERIES);
+    compare(qbegin + 3, last + 1, OrderBy::SERIES);
+    // Backward query isn't cached
+    compare(last, qbegin, OrderBy::SERIES);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_query_cache_1) {
+    test_query_cache(100, 10);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_query_cache_2) {
+    test_query_cache(1000, 100);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_query_cache_retention) {
+    // Cached buckets should be dropped when their data is deleted by retention
+    size_t nblocks = 0;
+    auto bstore = BlockStoreBuilder::create_memstore([&nblocks](LogicAddr) { nblocks++; });
+    std::shared_ptr<ColumnStore> cstore;
+    cstore.reset(new ColumnStore(bstore));
+    cstore->set_query_cache_size(0x100000);
+    auto session = create_session(cstore);
+    cstore->create_new_column(42);
+    std::vector<u64> rpoints;
+    aku_Sample sample = {};
+    sample.paramid = 42;
+    sample.payload.type = AKU_PAYLOAD_FLOAT;
+    for (aku_Timestamp ts = 100; ts < 200000; ts++) {
+        sample.timestamp = ts;
+        sample.payload.float64 = (ts % 97)*0.5;
+        session->write(sample, &rpoints);
+    }
+    BOOST_REQUIRE(nblocks > 4);
+    ReshapeRequest req = {};
+    req.agg.enabled = true;
+    req.agg.step = 1000;
+    req.agg.func = { AggregationFunction::MIN, AggregationFunction::CNT };
+    req.group_by.enabled = false;
+    req.order_by = OrderBy::SERIES;
+    req.select.begin = 0;
+    req.select.end = 200000;
+    req.select.columns.push_back({{ 42 }});
+    RawQueryProcessorMock before;
+    execute(cstore, &before, req);
+    RawQueryProcessorMock cached;
+    execute(cstore, &cached, req);
+    BOOST_REQUIRE(cached.data == before.data);
+    BOOST_REQUIRE_EQUAL(cstore->get_query_cache()->get_stats().hits, 1);
+
+    std::dynamic_pointer_cast<MemStore, BlockStore>(bstore)->remove(nblocks/2);
+    RawQueryProcessorMock actual;
+    execute(cstore, &actual, req);
+    BOOST_REQUIRE_EQUAL(cstore->get_query_cache()->get_stats().expired, 1);
+    BOOST_REQUIRE(actual.error == AKU_SUCCESS);
+    BOOST_REQUIRE(actual.count < before.count);
+
+    cstore->set_query_cache_size(0);
+    RawQueryProcessorMock expected;
+    execute(cstore, &expected, req);
+    BOOST_REQUIRE_EQUAL(actual.count, expected.count);
+    BOOST_REQUIRE(actual.data == expected.data);
+}
+
+void test_rollups(aku_Timestamp begin) {
+    const aku_Timestamp second = 1000000000ull;
+    const aku_Timestamp interval = 10000000ull;  // 10ms
+    auto rbstore = BlockStoreBuilder::create_memstore();
+    auto bstore = BlockStoreBuilder::create_memstore();
+    std::shared_ptr<ColumnStore> rollups, reference;
+    std::unique_ptr<CStoreSession> rsession, csession;
+    std::unordered_map<aku_ParamId, std::vector<LogicAddr>> rmapping, cmapping;
+    // Rescue points that are persisted during normal operation
+    std::unordered_map<aku_ParamId, std::vector<LogicAddr>> rsynced, csynced;
+    auto open = [&]() {
+        rollups.reset(new ColumnStore(rbstore));
+        rollups->set_rollup_steps({ second, 10*second });
+        rollups->open_or_restore(rmapping, true);
+        reference.reset(new ColumnStore(bstore));
+        reference->open_or_restore(cmapping, true);
+        rsession = create_session(rollups);
+        csession = create_session(reference);
+        rsynced = rmapping;
+        csynced = cmapping;
+    };
+    auto close = [&]() {
+        rsession.reset();
+        csession.reset();
+        rmapping = rollups->close();
+        cmapping = reference->close();
+    };
+    open();
+    std::vector<aku_ParamId> col = { 10, 11, 12, 13 };
+    for (auto id: col) {
+        rollups->create_new_column(id);
+        reference->create_new_column(id);
+    }
+    aku_Timestamp last = begin;
+    auto write = [&](aku_Timestamp until) {
+        std::vector<u64> rpoints;
+        aku_Sample sample = {};
+        sample.payload.type = AKU_PAYLOAD_FLOAT;
+        for (; last < until; last += interval) {
+            for (auto id: col) {
+                sample.paramid = id;
+                sample.timestamp = last;
+                // Values are exact in binary so sums doesn't depend on the order of additions
+                sample.payload.float64 = ((last / interval) % 97)*0.5 + id;
+                if (rsession->write(sample, &rpoints) == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+                    rsynced[id] = rpoints;
+                    rsession->get_rollup_roots(id, &rsynced);
+                }
+                if (csession->write(sample, &rpoints) == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+                    csynced[id] = rpoints;
+                }
+            }
+        }
+    };
+    auto compare = [&](aku_Timestamp qbegin, aku_Timestamp qend, aku_Timestamp step, OrderBy order, bool rollup) {
+        ReshapeRequest req = {};
+        req.agg.enabled = true;
+        req.agg.step = step;
+        req.agg.func = { AggregationFunction::MIN, AggregationFunction::MAX,
+                         AggregationFunction::SUM, AggregationFunction::CNT,
+                         AggregationFunction::MIN_TIMESTAMP, AggregationFunction::MAX_TIMESTAMP };
+        req.group_by.enabled = false;
+        req.order_by = order;
+        req.select.begin = qbegin;
+        req.select.end = qend;
+        req.select.columns.push_back({col});
+        RawQueryProcessorMock expected;
+        execute(reference, &expected, req);
+        RawQueryProcessorMock actual;
+        execute(rollups, &actual, req);
+        BOOST_REQUIRE(expected.error == AKU_SUCCESS);
+        BOOST_REQUIRE(actual.error == AKU_SUCCESS);
+        BOOST_REQUIRE(expected.count != 0);
+        BOOST_REQUIRE_EQUAL(actual.count, expected.count);
+        BOOST_REQUIRE(actual.data == expected.data);
+        BOOST_REQUIRE_EQUAL(get_profile_counter(rollups, req, "rollup buckets") != 0, rollup);
+        BOOST_REQUIRE_EQUAL(get_profile_counter(reference, req, "rollup buckets"), 0);
+    };
+    const aku_Timestamp base = begin - begin % (60*second);
+    auto check = [&]() {
+        // Aligned with the rollups, end of the range is not aligned
+        compare(base, last + second/2, 10*second, OrderBy::SERIES, true);
+        compare(base, last + second/2, 10*second, OrderBy::TIME, true);
+        compare(base + 60*second, last, 60*second, OrderBy::SERIES, true);
+        compare(base + 3*second, last, 2*second, OrderBy::TIME, true);
+        compare(base + 3*second, base + 50*second + interval, 10*second, OrderBy::SERIES, true);
+        // Not aligned with the rollups
+        compare(base + interval, last, 10*second, OrderBy::SERIES, false);
+        compare(begin, last, 3*second/2, OrderBy::SERIES, false);
+        // Backward query
+        compare(last, begin, 10*second, OrderBy::SERIES, false);
+    };
+
+    write(begin + 200*second + 5*interval);
+    check();
+    write(last + 7*second);
+    check();
+    // Reopen
+    close();
+    open();
+    check();
+    write(last + 100*second + 3*interval);
+    check();
+    close();
+    open();
+    check();
+    // Crash, rollup trees are restored from the rescue points that were
+    // persisted along with the rescue points of the series
+    write(last + 300*second);
+    size_t nupdated = 0;
+    for (auto const& kv: rsynced) {
+        if (std::find(col.begin(), col.end(), kv.first) == col.end() && rmapping.at(kv.first) != kv.second) {
+            nupdated++;
+        }
+    }
+    // Only the rollup trees with the smaller step have enough data to commit a leaf node
+    BOOST_REQUIRE_EQUAL(nupdated, col.size());
+    rmapping = rsynced;
+    cmapping = csynced;
+    open();
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_rollups_1) {
+    test_rollups(1000000000000ull);
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_rollups_2) {
+    // Beginning of the data is not aligned with the rollup buckets
+    test_rollups(1000000000000ull + 12345678ull);
+}
+
 //! Tests aggregate query in conjunction with group-by clause
 void test_aggregate_and_group_by(aku_Timestamp begin, aku_Timestamp end) {
     auto cstore = create_cstore();
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "storage_engine/compression.h"
+#include "akumuli_version.h"
 
 
 using namespace Akumuli;
@@ -432,7 +433,9 @@ BOOST_AUTO_TEST_CASE(Test_float_compression_5) {
     test_float_compression(0, &samples);
 }
 
-void test_block_compression(double start, unsigned N=10000, bool regullar=false) {
+void test_block_compression(double start, unsigned N=10000, bool regullar=false,
+                            StorageEngine::ValueCodec codec=StorageEngine::ValueCodec::FCM)
+{
     RandomWalk rwalk(start, 1., .11);
     std::vector<aku_Timestamp> timestamps;
     std::vector<double> values;
@@ -459,7 +462,7 @@ void test_block_compression(double start, unsigned N=10000, bool regullar=false)
 
     // compress
 
-    StorageEngine::DataBlockWriter writer(42, block.data(), block.size());
+    StorageEngine::DataBlockWriter writer(42, block.data(), block.size(), codec);
 
     size_t actual_nelements = 0ull;
     bool writer_overflow = false;
@@ -490,6 +493,10 @@ void test_block_compression(double start, unsigned N=10000, bool regullar=false)
     BOOST_REQUIRE_NE(nelem, 0);
 
     BOOST_REQUIRE_EQUAL(reader.get_id(), 42);
+    BOOST_REQUIRE(reader.get_codec() == writer.get_codec());
+    if (codec != StorageEngine::ValueCodec::ADAPTIVE) {
+        BOOST_REQUIRE(reader.get_codec() == codec);
+    }
     for (size_t ix = 0ull; ix < reader.nelements(); ix++) {
         aku_Status status;
         aku_Timestamp  ts;
@@ -517,6 +524,33 @@ void test_block_compression(double start, unsigned N=10000, bool regullar=false)
                        ", actual: " << out_values.at(i));
         }
     }
+
+    // Batch decoding should produce the same output, batch sizes are
+    // chosen to be both aligned and unaligned to chunk boundaries.
+    StorageEngine::DataBlockReader batch_reader(block.data(), size_used);
+    std::vector<aku_Timestamp> batch_timestamps(nelem);
+    std::vector<double> batch_values(nelem);
+    const size_t batch_sizes[] = { 3, 16, 45, 32, 1, 100 };
+    size_t total = 0;
+    for (size_t i = 0; total < nelem; i++) {
+        size_t batch = std::min(batch_sizes[i % 6], nelem - total);
+        size_t nread;
+        std::tie(status, nread) = batch_reader.read_all(batch_timestamps.data() + total,
+                                                        batch_values.data() + total,
+                                                        batch);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(nread, batch);
+        total += nread;
+    }
+    size_t nread;
+    std::tie(status, nread) = batch_reader.read_all(&ts, &value, 1);
+    BOOST_REQUIRE_EQUAL(status, AKU_ENO_DATA);
+    BOOST_REQUIRE_EQUAL(nread, 0);
+
+    for (size_t i = 0; i < nelem; i++) {
+        BOOST_REQUIRE_EQUAL(batch_timestamps.at(i), out_timestamps.at(i));
+        BOOST_REQUIRE_EQUAL(batch_values.at(i), out_values.at(i));
+    }
 }
 
 BOOST_AUTO_TEST_CASE(Test_block_compression_00) {
@@ -599,6 +633,285 @@ BOOST_AUTO_TEST_CASE(Test_block_compression_19) {
     test_block_compression(0, 0x111, true);
 }
 
+void test_block_codec(StorageEngine::ValueCodec codec) {
+    test_block_compression(0, 10000, false, codec);
+    test_block_compression(1E100, 10000, false, codec);
+    test_block_compression(-1E-100, 10000, false, codec);
+    test_block_compression(0, 1, false, codec);
+    test_block_compression(0, 16, false, codec);
+    test_block_compression(0, 100, false, codec);
+    test_block_compression(0, 0x111, true, codec);
+    test_block_compression(-1E100, 10000, true, codec);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_compression_gorilla) {
+    test_block_codec(StorageEngine::ValueCodec::GORILLA);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_compression_chimp) {
+    test_block_codec(StorageEngine::ValueCodec::CHIMP);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_compression_adaptive) {
+    test_block_codec(StorageEngine::ValueCodec::ADAPTIVE);
+}
+
+template<class Writer, class Reader>
+void test_value_codec(std::vector<double> const& values) {
+    BOOST_REQUIRE(values.size() % 16 == 0);
+    std::vector<u8> buffer(values.size()*10 + 16);
+    VByteStreamWriter wstream(buffer.data(), buffer.data() + buffer.size());
+    Writer writer(wstream);
+    for (size_t i = 0; i < values.size(); i += 16) {
+        if (i == 64) {
+            BOOST_REQUIRE(writer.reset());
+        }
+        BOOST_REQUIRE(writer.tput(values.data() + i, 16));
+    }
+    // Element-wise and chunk decoding
+    VByteStreamReader rstream(buffer.data(), buffer.data() + wstream.size());
+    Reader reader(rstream);
+    VByteStreamReader chunk_rstream(buffer.data(), buffer.data() + wstream.size());
+    Reader chunk_reader(chunk_rstream);
+    for (size_t i = 0; i < values.size(); i += 16) {
+        double chunk[16];
+        chunk_reader.next_chunk(chunk);
+        for (size_t j = 0; j < 16; j++) {
+            double x = reader.next();
+            BOOST_REQUIRE_EQUAL(memcmp(&x, &values.at(i + j), sizeof(double)), 0);
+            BOOST_REQUIRE_EQUAL(memcmp(&chunk[j], &values.at(i + j), sizeof(double)), 0);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(rstream.space_left(), 0);
+    BOOST_REQUIRE_EQUAL(chunk_rstream.space_left(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_value_codecs_special_values) {
+    std::vector<double> values = {
+        0.0, -0.0, 1.0, 1.0, std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::quiet_NaN(),
+        std::numeric_limits<double>::denorm_min(), std::numeric_limits<double>::max(),
+        std::numeric_limits<double>::lowest(), std::numeric_limits<double>::epsilon(),
+    };
+    RandomWalk rwalk(100.0, 1., .11);
+    while (values.size() < 256) {
+        // Repeated values, rounded values and noise
+        double x = rwalk.generate();
+        values.push_back(x);
+        values.push_back(std::round(x*100)/100);
+        values.push_back(values.at(values.size()/2));
+    }
+    values.resize(256);
+    test_value_codec<GorillaStreamWriter, GorillaStreamReader>(values);
+    test_value_codec<ChimpStreamWriter, ChimpStreamReader>(values);
+    test_value_codec<FcmStreamWriter, FcmStreamReader>(values);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_adaptive_codec) {
+    std::vector<u8> block(4096);
+    StorageEngine::DataBlockWriter writer(42, block.data(), static_cast<int>(block.size()),
+                                          StorageEngine::ValueCodec::ADAPTIVE);
+    // Values are taken from the small set in random order
+    std::mt19937 gen(42);
+    std::vector<double> values;
+    for (int i = 0; i < 0x200; i++) {
+        values.push_back(0.1*(gen() % 8));
+    }
+    // Elements are buffered until the codec is chosen
+    for (int i = 0; i < 20; i++) {
+        BOOST_REQUIRE_EQUAL(writer.put(1000 + i, values.at(i)), AKU_SUCCESS);
+    }
+    BOOST_REQUIRE(writer.get_codec() == StorageEngine::ValueCodec::ADAPTIVE);
+    BOOST_REQUIRE_EQUAL(writer.get_write_index(), 20);
+    std::vector<aku_Timestamp> tail_ts;
+    std::vector<double> tail_xs;
+    writer.read_tail_elements(&tail_ts, &tail_xs);
+    BOOST_REQUIRE_EQUAL(tail_ts.size(), 20);
+    BOOST_REQUIRE_EQUAL(tail_ts.back(), 1019);
+    BOOST_REQUIRE_EQUAL(tail_xs.back(), values.at(19));
+    int nelements = 20;
+    while (writer.get_codec() == StorageEngine::ValueCodec::ADAPTIVE) {
+        BOOST_REQUIRE_EQUAL(writer.put(1000 + nelements, values.at(nelements)), AKU_SUCCESS);
+        nelements++;
+    }
+    BOOST_REQUIRE_EQUAL(nelements, StorageEngine::DataBlockWriter::ADAPTIVE_NCHUNKS*16);
+    BOOST_REQUIRE_EQUAL(writer.get_write_index(), nelements);
+    // Chimp stores only the reference to one of the previous values
+    BOOST_REQUIRE(writer.get_codec() == StorageEngine::ValueCodec::CHIMP);
+    size_t size_used = writer.commit();
+    StorageEngine::DataBlockReader reader(block.data(), size_used);
+    BOOST_REQUIRE(reader.get_codec() == StorageEngine::ValueCodec::CHIMP);
+    BOOST_REQUIRE_EQUAL(reader.nelements(), nelements);
+    for (int i = 0; i < nelements; i++) {
+        aku_Status status;
+        aku_Timestamp ts;
+        double value;
+        std::tie(status, ts, value) = reader.next();
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(ts, 1000 + i);
+        BOOST_REQUIRE_EQUAL(value, values.at(i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_read_all_shortcuts) {
+    // Regular timestamps and constant values are encoded using shortcuts
+    std::vector<u8> block(4096);
+    StorageEngine::DataBlockWriter writer(42, block.data(), static_cast<int>(block.size()));
+    const size_t N = 100;
+    for (size_t i = 0; i < N; i++) {
+        BOOST_REQUIRE_EQUAL(writer.put(1000 + i*10, 3.14159), AKU_SUCCESS);
+    }
+    size_t size_used = writer.commit();
+
+    StorageEngine::DataBlockReader reader(block.data(), size_used);
+    std::vector<aku_Timestamp> timestamps(N);
+    std::vector<double> values(N);
+    aku_Status status;
+    size_t nread;
+    std::tie(status, nread) = reader.read_all(timestamps.data(), values.data(), N);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(nread, N);
+    for (size_t i = 0; i < N; i++) {
+        BOOST_REQUIRE_EQUAL(timestamps.at(i), 1000 + i*10);
+        BOOST_REQUIRE_EQUAL(values.at(i), 3.14159);
+    }
+}
+
+void test_block_seek(double value_step, StorageEngine::ValueCodec codec=StorageEngine::ValueCodec::FCM) {
+    std::vector<u8> block(4096);
+    StorageEngine::DataBlockWriter writer(42, block.data(), static_cast<int>(block.size()), codec);
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<double> values;
+    RandomWalk rwalk(10.0, 1.0, 1.0);
+    for (u32 i = 0; true; i++) {
+        aku_Timestamp ts = 1000 + i*10;
+        double value = value_step == 0 ? rwalk.generate() : i*value_step;
+        if (writer.put(ts, value) != AKU_SUCCESS) {
+            break;
+        }
+        timestamps.push_back(ts);
+        values.push_back(value);
+    }
+    size_t size_used = writer.commit();
+    const size_t N = timestamps.size();
+
+    // Without seek
+    StorageEngine::DataBlockReader full_reader(block.data(), size_used);
+    BOOST_REQUIRE_EQUAL(full_reader.nelements(), N);
+    BOOST_REQUIRE_EQUAL(full_reader.nelements_until(timestamps.back()), N);
+
+    bool skipped = false;
+    for (size_t target = 0; target < N; target += 37) {
+        aku_Timestamp ts = timestamps.at(target);
+        StorageEngine::DataBlockReader reader(block.data(), size_used);
+        reader.seek(ts);
+        size_t pos = reader.position();
+        BOOST_REQUIRE_LE(pos, target);
+        BOOST_REQUIRE_EQUAL(pos % StorageEngine::DataBlockReader::CHUNK_SIZE, 0);
+        skipped |= pos != 0;
+        std::vector<aku_Timestamp> outts(N - pos);
+        std::vector<double> outxs(N - pos);
+        aku_Status status;
+        size_t nread;
+        std::tie(status, nread) = reader.read_all(outts.data(), outxs.data(), N - pos);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(nread, N - pos);
+        for (size_t i = 0; i < nread; i++) {
+            BOOST_REQUIRE_EQUAL(outts.at(i), timestamps.at(pos + i));
+            BOOST_REQUIRE_EQUAL(outxs.at(i), values.at(pos + i));
+        }
+        // Seek followed by element-wise reading
+        StorageEngine::DataBlockReader reader2(block.data(), size_used);
+        reader2.seek(ts);
+        BOOST_REQUIRE_EQUAL(reader2.position(), pos);
+        for (size_t i = pos; i < N; i++) {
+            aku_Timestamp its;
+            double ival;
+            std::tie(status, its, ival) = reader2.next();
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            BOOST_REQUIRE_EQUAL(its, timestamps.at(i));
+            BOOST_REQUIRE_EQUAL(ival, values.at(i));
+        }
+        // Upper bound should include all elements <= ts and at least one element after
+        size_t until = full_reader.nelements_until(ts);
+        BOOST_REQUIRE_GT(until, target);
+        if (target + 1 < N) {
+            BOOST_REQUIRE_GT(until, target + 1);
+        }
+    }
+    BOOST_REQUIRE(skipped);
+
+    // Seek before the first element
+    StorageEngine::DataBlockReader reader(block.data(), size_used);
+    reader.seek(0);
+    BOOST_REQUIRE_EQUAL(reader.position(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_seek_0) {
+    test_block_seek(0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_seek_1) {
+    test_block_seek(1.0);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_seek_gorilla) {
+    test_block_seek(0, StorageEngine::ValueCodec::GORILLA);
+    test_block_seek(1.0, StorageEngine::ValueCodec::GORILLA);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_seek_chimp) {
+    test_block_seek(0, StorageEngine::ValueCodec::CHIMP);
+    test_block_seek(1.0, StorageEngine::ValueCodec::CHIMP);
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_legacy_format) {
+    // Blocks written by previous versions don't have chunk directory
+    std::vector<u8> block(4096);
+    VByteStreamWriter stream(block.data(), block.data() + block.size());
+    DeltaDeltaWriter ts_stream(stream);
+    FcmStreamWriter val_stream(stream);
+    BOOST_REQUIRE(stream.put_raw<u16>(AKUMULI_VERSION));
+    u16* nchunks = stream.allocate<u16>();
+    u16* ntail = stream.allocate<u16>();
+    BOOST_REQUIRE(stream.put_raw<aku_ParamId>(42));
+    const u16 NCHUNKS = 20, NTAIL = 5;
+    std::vector<aku_Timestamp> timestamps;
+    std::vector<double> values;
+    for (u32 i = 0; i < NCHUNKS*16u + NTAIL; i++) {
+        timestamps.push_back(1000 + i*i);
+        values.push_back(i % 3 == 0 ? 0.5*i : 1.0);
+    }
+    for (u16 i = 0; i < NCHUNKS; i++) {
+        BOOST_REQUIRE(ts_stream.tput(timestamps.data() + i*16, 16));
+        BOOST_REQUIRE(val_stream.tput(values.data() + i*16, 16));
+    }
+    for (u16 i = 0; i < NTAIL; i++) {
+        BOOST_REQUIRE(stream.put_raw(timestamps.at(NCHUNKS*16 + i)));
+        BOOST_REQUIRE(stream.put_raw(values.at(NCHUNKS*16 + i)));
+    }
+    *nchunks = NCHUNKS;
+    *ntail = NTAIL;
+
+    StorageEngine::DataBlockReader reader(block.data(), stream.size());
+    BOOST_REQUIRE_EQUAL(reader.version(), AKUMULI_VERSION);
+    BOOST_REQUIRE_EQUAL(reader.get_id(), 42);
+    BOOST_REQUIRE_EQUAL(reader.nelements(), timestamps.size());
+    // Seek is not supported without directory
+    reader.seek(timestamps.back());
+    BOOST_REQUIRE_EQUAL(reader.position(), 0);
+    BOOST_REQUIRE_EQUAL(reader.nelements_until(timestamps.front()), timestamps.size());
+    std::vector<aku_Timestamp> outts(timestamps.size());
+    std::vector<double> outxs(timestamps.size());
+    aku_Status status;
+    size_t nread;
+    std::tie(status, nread) = reader.read_all(outts.data(), outxs.data(), outts.size());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(nread, timestamps.size());
+    BOOST_REQUIRE(outts == timestamps);
+    BOOST_REQUIRE(outxs == values);
+}
+
 void test_chunk_header_compression(double start) {
 
     UncompressedChunk expected;
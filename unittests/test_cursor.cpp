@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "cursor.h"
+#include "storage_engine/query_context.h"
 #include "akumuli_def.h"
 
 
@@ -13,6 +14,7 @@ using namespace Akumuli;
 
 
 void test_cursor(int n_iter, int buf_size) {
+    QueryExecutor executor(2);
     ConcurrentCursor cursor;
     std::vector<aku_Sample> expected;
     auto generator = [n_iter, &expected, &cursor]() {
@@ -27,7 +29,7 @@ void test_cursor(int n_iter, int buf_size) {
         cursor.complete();
     };
     std::vector<aku_Sample> actual;
-    cursor.start(generator);
+    cursor.start(executor, generator);
     while(!cursor.is_done()) {
         char results[buf_size*sizeof(aku_Sample)];
         int n_read = cursor.read(results, buf_size*sizeof(aku_Sample));
@@ -49,6 +51,7 @@ void test_cursor(int n_iter, int buf_size) {
 }
 
 void test_cursor_error(int n_iter, int buf_size) {
+    QueryExecutor executor(2);
     ConcurrentCursor cursor;
     std::vector<aku_Sample> expected;
     auto generator = [n_iter, &expected, &cursor]() {
@@ -63,7 +66,7 @@ void test_cursor_error(int n_iter, int buf_size) {
         cursor.set_error((aku_Status)-1);
     };
     std::vector<aku_Sample> actual;
-    cursor.start(generator);
+    cursor.start(executor, generator);
     while(!cursor.is_done()) {
         char results[buf_size*sizeof(aku_Sample)];
         int n_read = cursor.read(results, buf_size*sizeof(aku_Sample));
@@ -135,3 +138,158 @@ BOOST_AUTO_TEST_CASE(Test_cursor_error_100_7)
     test_cursor_error(100, 7);
 }
 
+
+BOOST_AUTO_TEST_CASE(Test_cursor_100000_1000)
+{
+    // Reader should wait for the writer and the other way around
+    test_cursor(100000, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_executor_admission)
+{
+    // Single worker thread and queue of size 1
+    QueryExecutor executor(1, 1);
+    std::mutex mutex;
+    std::unique_lock<std::mutex> lock(mutex);
+    std::atomic<bool> started = {false};
+    std::atomic<int> nrun = {0};
+    auto blocker = std::make_shared<QueryTask>([&]() {
+        started = true;
+        std::lock_guard<std::mutex> guard(mutex);
+        nrun++;
+    });
+    auto queued = std::make_shared<QueryTask>([&]() {
+        nrun++;
+    });
+    auto rejected = std::make_shared<QueryTask>([&]() {
+        nrun++;
+    });
+    BOOST_REQUIRE_EQUAL(executor.submit(blocker), AKU_SUCCESS);
+    while (!started) {
+        std::this_thread::yield();
+    }
+    BOOST_REQUIRE_EQUAL(executor.submit(queued), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(executor.submit(rejected), AKU_EBUSY);
+    lock.unlock();
+    blocker->wait();
+    queued->wait();
+    BOOST_REQUIRE_EQUAL(nrun.load(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Test_cursor_close_before_start)
+{
+    // Cursor that is closed before the query was started shouldn't wait for it
+    QueryExecutor executor(1, 4);
+    std::mutex mutex;
+    std::unique_lock<std::mutex> lock(mutex);
+    std::atomic<bool> started = {false};
+    auto blocker = std::make_shared<QueryTask>([&]() {
+        started = true;
+        std::lock_guard<std::mutex> guard(mutex);
+    });
+    BOOST_REQUIRE_EQUAL(executor.submit(blocker), AKU_SUCCESS);
+    while (!started) {
+        std::this_thread::yield();
+    }
+    bool executed = false;
+    ConcurrentCursor cursor;
+    cursor.start(executor, [&]() {
+        executed = true;
+        cursor.complete();
+    });
+    cursor.close();
+    lock.unlock();
+    blocker->wait();
+    executor.stop();
+    BOOST_REQUIRE(!executed);
+}
+
+BOOST_AUTO_TEST_CASE(Test_cursor_close_cancels_query)
+{
+    // Query that doesn't produce any output should be stopped when the cursor is closed
+    QueryExecutor executor(1);
+    std::atomic<bool> started = {false};
+    aku_Status status = AKU_SUCCESS;
+    ConcurrentCursor cursor;
+    cursor.start(executor, [&]() {
+        auto context = cursor.get_query_context();
+        started = true;
+        while (status == AKU_SUCCESS) {
+            status = context->check();
+            std::this_thread::yield();
+        }
+        cursor.set_error(status);
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    cursor.close();
+    BOOST_REQUIRE_EQUAL(status, AKU_ECANCELLED);
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_executor_stop_interrupts_query)
+{
+    // Query that is blocked by the client that doesn't read the results
+    // should be interrupted when the executor is stopped
+    QueryExecutor executor(1);
+    std::atomic<bool> started = {false};
+    u32 nsamples = 0;
+    ConcurrentCursor cursor;
+    cursor.start(executor, [&]() {
+        started = true;
+        aku_Sample r = {};
+        r.payload.type = AKU_PAYLOAD_FLOAT;
+        r.payload.size = sizeof(aku_Sample);
+        while (cursor.put(r)) {
+            nsamples++;
+        }
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+    executor.stop();
+    BOOST_REQUIRE(nsamples >= ConcurrentCursor::BUFFER_SIZE/sizeof(aku_Sample));
+    BOOST_REQUIRE_EQUAL(cursor.get_query_context()->check(), AKU_ECANCELLED);
+    // Results are incomplete
+    aku_Status status = AKU_SUCCESS;
+    BOOST_REQUIRE(cursor.is_error(&status));
+    BOOST_REQUIRE_EQUAL(status, AKU_ECANCELLED);
+    cursor.close();
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_executor_stop_cancels_queued_query)
+{
+    // Reader of the query that was never started shouldn't wait forever
+    // when the executor is stopped
+    QueryExecutor executor(1, 4);
+    std::mutex mutex;
+    std::unique_lock<std::mutex> lock(mutex);
+    std::atomic<bool> started = {false};
+    auto blocker = std::make_shared<QueryTask>([&]() {
+        started = true;
+        std::lock_guard<std::mutex> guard(mutex);
+    });
+    BOOST_REQUIRE_EQUAL(executor.submit(blocker), AKU_SUCCESS);
+    while (!started) {
+        std::this_thread::yield();
+    }
+    bool executed = false;
+    ConcurrentCursor cursor;
+    cursor.start(executor, [&]() {
+        executed = true;
+        cursor.complete();
+    });
+    // Executor can't be stopped until the blocker is released
+    std::thread stopper([&]() {
+        executor.stop();
+    });
+    aku_Sample buffer[10];
+    BOOST_REQUIRE_EQUAL(cursor.read(buffer, sizeof(buffer)), 0);
+    aku_Status status = AKU_SUCCESS;
+    BOOST_REQUIRE(cursor.is_error(&status));
+    BOOST_REQUIRE_EQUAL(status, AKU_ECANCELLED);
+    lock.unlock();
+    stopper.join();
+    cursor.close();
+    BOOST_REQUIRE(!executed);
+}
@@ -29,6 +29,55 @@ BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_conversion) {
 
 }
 
+static void check_fast_timestamp(std::string const& str) {
+    aku_Timestamp expected = 0;
+    bool valid = true;
+    try {
+        expected = DateTimeUtil::from_iso_string(str.c_str());
+    } catch (BadDateTimeFormat const&) {
+        valid = false;
+    }
+    aku_Timestamp actual = 0;
+    if (DateTimeUtil::parse_timestamp_fast(str.data(), str.data() + str.size(), &actual)) {
+        BOOST_REQUIRE(valid);
+        BOOST_REQUIRE_EQUAL(actual, expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_fast_timestamp_parsing_1) {
+    aku_Timestamp ts;
+    const char* iso = "20060102T150405.999999999";
+    BOOST_REQUIRE(DateTimeUtil::parse_timestamp_fast(iso, iso + strlen(iso), &ts));
+    BOOST_REQUIRE_EQUAL(ts, 1136214245999999999ul);
+    const char* raw = "1136214245999999999";
+    BOOST_REQUIRE(DateTimeUtil::parse_timestamp_fast(raw, raw + strlen(raw), &ts));
+    BOOST_REQUIRE_EQUAL(ts, 1136214245999999999ul);
+    // Layouts that should be handled by the slow path
+    const char* unsupported[] = {
+        "", "20060102T150405.1234567890", "18446744073709551615", " 123", "20060230T150405", "16000102T150405",
+    };
+    for (auto str: unsupported) {
+        BOOST_REQUIRE(!DateTimeUtil::parse_timestamp_fast(str, str + strlen(str), &ts));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_fast_timestamp_parsing_2) {
+    const char* values[] = {
+        "1", "0", "20060102T150405", "20060102T150405.", "20060102T150405,5", "19690101T000000.1",
+        "20000229T235959.000000001", "21000229T000000", "20060102T996099", "20060102T15040a",
+    };
+    for (auto str: values) {
+        check_fast_timestamp(str);
+    }
+    char buffer[64];
+    for (int i = 0; i < 100000; i++) {
+        snprintf(buffer, sizeof(buffer), "%04d%02d%02dT%02d%02d%02d.%0*d",
+                 1650 + rand() % 600, rand() % 14, rand() % 33, rand() % 100, rand() % 100, rand() % 100,
+                 1 + rand() % 9, rand() % 10);
+        check_fast_timestamp(buffer);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_string_to_duration_seconds) {
 
     const char* test_case = "10s";
@@ -8,12 +8,14 @@
 #include <apr.h>
 #include <queue>
 #include <fstream>
+#include <numeric>
 #include <stdlib.h>
 
 #include "akumuli.h"
 #include "storage_engine/blockstore.h"
 #include "storage_engine/volume.h"
 #include "storage_engine/nbtree.h"
+#include "storage_engine/profile.h"
 #include "log_iface.h"
 #include "status_util.h"
 
@@ -296,6 +298,176 @@ BOOST_AUTO_TEST_CASE(Test_nbtree_reopen_6) {
     test_reopen_storage(32*32, -1);
 }
 
+void test_value_codec(ValueCodec codec) {
+    const u32 N = 20000;
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->set_value_codec(codec);
+    collection->force_init();
+    for (u32 i = 0; i < N; i++) {
+        collection->append(i, i % 3 == 0 ? i*0.5 : 1.0/(i + 1));
+    }
+    auto check = [&]() {
+        std::unique_ptr<RealValuedOperator> it = collection->search(0, N);
+        std::vector<aku_Timestamp> ts(N, 0);
+        std::vector<double> xs(N, 0);
+        aku_Status status;
+        size_t sz;
+        std::tie(status, sz) = it->read(ts.data(), xs.data(), N);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(sz, N);
+        for (u32 i = 0; i < N; i++) {
+            BOOST_REQUIRE_EQUAL(ts[i], i);
+            BOOST_REQUIRE_EQUAL(xs[i], i % 3 == 0 ? i*0.5 : 1.0/(i + 1));
+        }
+    };
+    check();
+    addrlist = collection->close();
+    // Codec is stored in the leaf node, default codec should be used to reopen the tree
+    collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->force_init();
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_value_codec_gorilla) {
+    test_value_codec(ValueCodec::GORILLA);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_value_codec_chimp) {
+    test_value_codec(ValueCodec::CHIMP);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_value_codec_adaptive) {
+    test_value_codec(ValueCodec::ADAPTIVE);
+}
+
+//! Write values in blocks of 8 in reverse order, each value is late by up to 7 ticks
+void test_reorder_window(u32 N) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->set_reorder_window(10);
+    collection->force_init();
+    for (u32 i = 0; i < N; i += 8) {
+        for (u32 j = std::min(i + 8, N); j --> i;) {
+            auto res = collection->append(j, j*0.5);
+            BOOST_REQUIRE(res != NBTreeAppendResult::FAIL_LATE_WRITE);
+        }
+    }
+    auto check = [&]() {
+        // Forward
+        std::unique_ptr<RealValuedOperator> it = collection->search(0, N);
+        std::vector<aku_Timestamp> ts(N, 0);
+        std::vector<double> xs(N, 0);
+        aku_Status status;
+        size_t sz;
+        std::tie(status, sz) = it->read(ts.data(), xs.data(), N);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(sz, N);
+        for (u32 i = 0; i < N; i++) {
+            BOOST_REQUIRE_EQUAL(ts[i], i);
+            BOOST_REQUIRE_EQUAL(xs[i], i*0.5);
+        }
+        // Backward
+        it = collection->search(N, 0);
+        std::tie(status, sz) = it->read(ts.data(), xs.data(), N);
+        BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+        BOOST_REQUIRE_EQUAL(sz, N - 1);  // element with ts=0 is not included
+        for (u32 i = 0; i < N - 1; i++) {
+            BOOST_REQUIRE_EQUAL(ts[i], N - 1 - i);
+        }
+        // Aggregate
+        auto agg_iter = collection->aggregate(0, N);
+        aku_Timestamp agg_ts;
+        AggregationResult agg = INIT_AGGRES;
+        size_t agg_size;
+        std::tie(status, agg_size) = agg_iter->read(&agg_ts, &agg, 1);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(agg.cnt, N);
+        BOOST_REQUIRE_EQUAL(agg.first, 0);
+        BOOST_REQUIRE_EQUAL(agg.last, (N - 1)*0.5);
+    };
+    // Last values are still in the reorder buffer
+    check();
+    addrlist = collection->close();
+    collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->set_reorder_window(10);
+    collection->force_init();
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_window_1) {
+    test_reorder_window(100);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_window_2) {
+    test_reorder_window(100000);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_window_late_write) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->set_reorder_window(10);
+    collection->force_init();
+    for (u32 i = 0; i < 100; i++) {
+        collection->append(i, i);
+    }
+    BOOST_REQUIRE(collection->append(89, 89) != NBTreeAppendResult::FAIL_LATE_WRITE);
+    BOOST_REQUIRE(collection->append(88, 88) == NBTreeAppendResult::FAIL_LATE_WRITE);
+    BOOST_REQUIRE(collection->append(0, 0) == NBTreeAppendResult::FAIL_LATE_WRITE);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_append_batch) {
+    const u32 N = 10000;
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->force_init();
+    std::vector<aku_Timestamp> ts;
+    std::vector<double> xs;
+    for (u32 i = 0; i < N; i++) {
+        ts.push_back(i);
+        xs.push_back(i*0.5);
+    }
+    // Second element of each batch is late
+    for (u32 i = 0; i < N; i += 100) {
+        std::swap(ts[i], ts[i + 1]);
+        std::swap(xs[i], xs[i + 1]);
+    }
+    size_t nlate = 0;
+    for (u32 i = 0; i < N; i += 100) {
+        size_t n = 0;
+        auto res = collection->append(ts.data() + i, xs.data() + i, 100, &n);
+        BOOST_REQUIRE(res == NBTreeAppendResult::OK || res == NBTreeAppendResult::OK_FLUSH_NEEDED);
+        nlate += n;
+    }
+    BOOST_REQUIRE_EQUAL(nlate, N/100);
+    auto it = collection->search(0, N);
+    std::vector<aku_Timestamp> outts(N, 0);
+    std::vector<double> outxs(N, 0);
+    aku_Status status;
+    size_t sz;
+    std::tie(status, sz) = it->read(outts.data(), outxs.data(), N);
+    BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+    BOOST_REQUIRE_EQUAL(sz, N - N/100);
+    for (u32 i = 1; i < sz; i++) {
+        BOOST_REQUIRE(outts[i - 1] < outts[i]);
+        BOOST_REQUIRE_EQUAL(outxs[i], outts[i]*0.5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reorder_window_disabled) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> addrlist;
+    auto collection = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    collection->force_init();
+    BOOST_REQUIRE(collection->append(10, 10) == NBTreeAppendResult::OK);
+    BOOST_REQUIRE(collection->append(9, 9) == NBTreeAppendResult::FAIL_LATE_WRITE);
+    BOOST_REQUIRE(collection->append(10, 10) == NBTreeAppendResult::OK);
+}
+
 //! Reopen storage that has been closed without final commit.
 void test_storage_recovery_status(u32 N, u32 N_values) {
     LogicAddr last_block = EMPTY_ADDR;
@@ -585,37 +757,48 @@ void test_nbtree_leaf_iteration(aku_Timestamp begin, aku_Timestamp end) {
         }
         BOOST_FAIL(StatusUtil::c_str(status));
     }
+    auto check_range = [&](NBTreeLeaf const& leaf) {
+        auto iter = leaf.range(begin, end);
+        // Calculate output size
+        size_t sz = 0;
+        auto min = std::min(begin, end);
+        min = std::max(min, first_timestamp);
+        auto max = std::max(begin, end);
+        max = std::min(max, last_successfull);
+        sz = max - min;
+        // Perform read using iterator
+        std::vector<aku_Timestamp> tss(sz, 0);
+        std::vector<double> xss(sz, 0);
+        aku_Status status;
+        size_t outsz;
+        std::tie(status, outsz) = iter->read(tss.data(), xss.data(), sz);
+        // Check results
+        BOOST_REQUIRE_EQUAL(outsz, sz);
+        if(status != AKU_SUCCESS) {
+            BOOST_FAIL(StatusUtil::c_str(status));
+        }
+        if (end < begin) {
+            std::reverse(tss.begin(), tss.end());
+            std::reverse(xss.begin(), xss.end());
+            min++;
+        }
+        for(size_t ix = 0; ix < sz; ix++) {
+            // iter from min to max
+            BOOST_REQUIRE_EQUAL(tss.at(ix), min);
+            BOOST_REQUIRE_EQUAL(xss.at(ix), static_cast<double>(min));
+            min++;
+        }
+    };
     // Everytithing should work before commit
-    auto iter = leaf.range(begin, end);
-    // Calculate output size
-    size_t sz = 0;
-    auto min = std::min(begin, end);
-    min = std::max(min, first_timestamp);
-    auto max = std::max(begin, end);
-    max = std::min(max, last_successfull);
-    sz = max - min;
-    // Perform read using iterator
-    std::vector<aku_Timestamp> tss(sz, 0);
-    std::vector<double> xss(sz, 0);
+    check_range(leaf);
+    // Committed leaf has chunk directory that is used to skip data
+    auto bstore = BlockStoreBuilder::create_memstore();
     aku_Status status;
-    size_t outsz;
-    std::tie(status, outsz) = iter->read(tss.data(), xss.data(), sz);
-    // Check results
-    BOOST_REQUIRE_EQUAL(outsz, sz);
-    if(status != AKU_SUCCESS) {
-        BOOST_FAIL(StatusUtil::c_str(status));
-    }
-    if (end < begin) {
-        std::reverse(tss.begin(), tss.end());
-        std::reverse(xss.begin(), xss.end());
-        min++;
-    }
-    for(size_t ix = 0; ix < sz; ix++) {
-        // iter from min to max
-        BOOST_REQUIRE_EQUAL(tss.at(ix), min);
-        BOOST_REQUIRE_EQUAL(xss.at(ix), static_cast<double>(min));
-        min++;
-    }
+    LogicAddr addr;
+    std::tie(status, addr) = leaf.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    NBTreeLeaf committed(bstore, addr);
+    check_range(committed);
 }
 
 BOOST_AUTO_TEST_CASE(Test_nbtree_leaf_iteration_1) {
@@ -1429,6 +1612,300 @@ BOOST_AUTO_TEST_CASE(Test_group_aggregate_backward) {
     }
 }
 
+//! Exact percentile (same rank definition as in QuantileSketch)
+static double exact_quantile(std::vector<double> xs, double q) {
+    std::sort(xs.begin(), xs.end());
+    return xs.at(static_cast<size_t>(q*(xs.size() - 1)));
+}
+
+BOOST_AUTO_TEST_CASE(Test_quantile_sketch) {
+    const double qs[] = { 0.0, 0.1, 0.5, 0.75, 0.9, 0.99, 1.0 };
+    std::vector<double> xs;
+    QuantileSketch lhs, rhs, all;
+    for (int i = 0; i < 10000; i++) {
+        double x = ((i*7919) % 1000 - 200) * 0.37;
+        xs.push_back(x);
+        all.add(x);
+        if (i % 3) {
+            lhs.add(x);
+        } else {
+            rhs.add(x);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(all.count(), xs.size());
+    for (auto q: qs) {
+        double expected = exact_quantile(xs, q);
+        if (expected == 0.0) {
+            BOOST_REQUIRE_EQUAL(all.quantile(q), 0.0);
+        } else {
+            BOOST_REQUIRE_CLOSE(all.quantile(q), expected, 2.1);
+        }
+    }
+
+    // Merged sketch should be identical to the sketch built from all values
+    lhs.merge(rhs);
+    std::vector<u8> buf1(QuantileSketch::MAX_SERIALIZED_SIZE), buf2(QuantileSketch::MAX_SERIALIZED_SIZE);
+    auto size1 = all.serialize(buf1.data(), buf1.size());
+    auto size2 = lhs.serialize(buf2.data(), buf2.size());
+    BOOST_REQUIRE(size1 != 0);
+    BOOST_REQUIRE_EQUAL(size1, all.get_serialized_size());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(buf1.begin(), buf1.begin() + size1, buf2.begin(), buf2.begin() + size2);
+
+    // Serialization roundtrip
+    QuantileSketch copy;
+    BOOST_REQUIRE_EQUAL(copy.deserialize(buf1.data(), size1), AKU_SUCCESS);
+    for (auto q: qs) {
+        BOOST_REQUIRE_EQUAL(copy.quantile(q), all.quantile(q));
+    }
+    BOOST_REQUIRE_EQUAL(all.serialize(buf1.data(), size1 - 1), 0);
+    BOOST_REQUIRE(copy.deserialize(buf1.data(), size1 - 1) != AKU_SUCCESS);
+    buf1[0] ^= 0xFF;
+    BOOST_REQUIRE(copy.deserialize(buf1.data(), size1) != AKU_SUCCESS);
+
+    // Empty sketch
+    QuantileSketch empty;
+    BOOST_REQUIRE(std::isnan(empty.quantile(0.5)));
+}
+
+BOOST_AUTO_TEST_CASE(Test_quantile_sketch_bins_limit) {
+    // Values span more than MAX_BINS bins, lowest bins should be collapsed
+    // and high percentiles should remain accurate
+    QuantileSketch sketch;
+    std::vector<double> xs;
+    for (int i = 0; i < 2000; i++) {
+        double x = std::pow(10.0, (i % 200)*0.05);
+        xs.push_back(x);
+        sketch.add(x);
+    }
+    BOOST_REQUIRE(sketch.get_serialized_size() <= QuantileSketch::MAX_SERIALIZED_SIZE);
+    for (auto q: { 0.75, 0.9, 0.99, 1.0 }) {
+        BOOST_REQUIRE_CLOSE(sketch.quantile(q), exact_quantile(xs, q), 2.1);
+    }
+}
+
+void test_nbtree_group_quantiles(size_t commit_limit, u64 step, int start_offset) {
+    aku_Timestamp begin = 1000;
+    aku_Timestamp end = begin;
+    size_t ncommits = 0;
+    auto commit_counter = [&ncommits](LogicAddr) {
+        ncommits++;
+    };
+    auto bstore = BlockStoreBuilder::create_memstore(commit_counter);
+    std::vector<LogicAddr> empty;
+    std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
+    extents->force_init();
+    auto query_begin = static_cast<u64>(static_cast<i64>(begin) + start_offset);
+    std::vector<std::vector<double>> buckets;
+    while(ncommits < commit_limit) {
+        double value = 1.0 + (end*7919) % 1000;
+        aku_Timestamp ts = end++;
+        extents->append(ts, value);
+        if (ts >= query_begin) {
+            auto ix = (ts - query_begin) / step;
+            if (ix >= buckets.size()) {
+                buckets.resize(ix + 1);
+            }
+            buckets.at(ix).push_back(value);
+        }
+    }
+
+    auto check = [&]() {
+        auto it = extents->group_quantiles(query_begin, end, step);
+        size_t size = buckets.size();
+        std::vector<aku_Timestamp> destts(size + 1, 0);
+        std::vector<QuantileResult> destxs(size + 1);
+        aku_Status status;
+        size_t out_size;
+        std::tie(status, out_size) = it->read(destts.data(), destxs.data(), destxs.size());
+        BOOST_REQUIRE_EQUAL(status, AKU_ENO_DATA);
+        BOOST_REQUIRE_EQUAL(out_size, size);
+        for (size_t i = 0; i < size; i++) {
+            auto const& xs = buckets.at(i);
+            auto const& res = destxs.at(i);
+            BOOST_REQUIRE_EQUAL(destts.at(i), std::max(begin, query_begin + i*step));
+            BOOST_REQUIRE_EQUAL(res.agg.cnt, xs.size());
+            BOOST_REQUIRE_EQUAL(res.sketch.count(), xs.size());
+            BOOST_REQUIRE_EQUAL(res.quantile(0.0), exact_quantile(xs, 0.0));
+            BOOST_REQUIRE_EQUAL(res.quantile(1.0), exact_quantile(xs, 1.0));
+            for (auto q: { 0.5, 0.9, 0.99 }) {
+                BOOST_REQUIRE_CLOSE(res.quantile(q), exact_quantile(xs, q), 2.1);
+            }
+        }
+    };
+    check();
+
+    // Reopen, sketches of the restored nodes are rebuilt on commit
+    auto addrlist = extents->close();
+    extents = std::make_shared<NBTreeExtentsList>(42, addrlist, bstore);
+    extents->force_init();
+    check();
+    ncommits = 0;
+    commit_limit = std::max(commit_limit / 2, static_cast<size_t>(1));
+    while(ncommits < commit_limit) {
+        double value = 1.0 + (end*7919) % 1000;
+        aku_Timestamp ts = end++;
+        extents->append(ts, value);
+        auto ix = (ts - query_begin) / step;
+        if (ix >= buckets.size()) {
+            buckets.resize(ix + 1);
+        }
+        buckets.at(ix).push_back(value);
+    }
+    check();
+}
+
+BOOST_AUTO_TEST_CASE(Test_group_quantiles_forward) {
+    std::vector<std::tuple<u32, u32, int>> cases = {
+        std::make_tuple( 1,      100, 0),
+        std::make_tuple(10,      100, 0),
+        std::make_tuple(10,     1000, 1),
+        std::make_tuple(32*4,   1000,-1),
+        std::make_tuple(32*4,  10000, 0),
+        std::make_tuple(32*4, 100000, 0),
+        std::make_tuple(32*4, 100000, 7),
+        std::make_tuple(32*4, 100000,-7),
+    };
+    for (auto t: cases) {
+        test_nbtree_group_quantiles(std::get<0>(t), std::get<1>(t), std::get<2>(t));
+    }
+}
+
+void test_nbtree_group_aggregate_filter(size_t commit_limit, u64 step) {
+    aku_Timestamp begin = 1000;
+    aku_Timestamp end = begin;
+    size_t ncommits = 0;
+    auto commit_counter = [&ncommits](LogicAddr) {
+        ncommits++;
+    };
+    auto bstore = BlockStoreBuilder::create_memstore(commit_counter);
+    std::vector<LogicAddr> empty;
+    std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
+    extents->force_init();
+    std::vector<double> xs;
+    while(ncommits < commit_limit) {
+        // Long runs of small values with rare bursts of large values
+        aku_Timestamp ts = end++;
+        double value = (ts / 3000) % 5 == 0 ? 1000.0 + ts % 100 : static_cast<double>(ts % 100);
+        extents->append(ts, value);
+        xs.push_back(value);
+    }
+
+    // Bounds should contain all values from the range
+    for (auto range: { std::make_pair(begin, end), std::make_pair(begin + xs.size()/4, end - xs.size()/3) }) {
+        aku_Status status;
+        NBTreeBounds bounds;
+        std::tie(status, bounds) = extents->get_bounds(range.first, range.second);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        auto first = xs.begin() + static_cast<std::ptrdiff_t>(range.first - begin);
+        auto last  = xs.begin() + static_cast<std::ptrdiff_t>(range.second - begin);
+        BOOST_REQUIRE_LE(bounds.min, *std::min_element(first, last));
+        BOOST_REQUIRE_GE(bounds.max, *std::max_element(first, last));
+        BOOST_REQUIRE_GE(bounds.cnt, last - first);
+        BOOST_REQUIRE_GE(bounds.sum, std::accumulate(first, last, 0.0));
+        if (range.first == begin) {
+            BOOST_REQUIRE_EQUAL(bounds.cnt, xs.size());
+        }
+    }
+    aku_Status status;
+    std::tie(status, std::ignore) = extents->get_bounds(end + 10, end + 100);
+    BOOST_REQUIRE_EQUAL(status, AKU_ENO_DATA);
+
+    std::vector<AggregateFilter> filters;
+    AggregateFilter maxflt;
+    maxflt.set_filter(AggregateFilter::MAX, ValueFilter().greater_than(500));
+    filters.push_back(maxflt);
+    AggregateFilter minflt;
+    minflt.set_filter(AggregateFilter::MIN, ValueFilter().less_than(5));
+    filters.push_back(minflt);
+    AggregateFilter any;
+    any.mode = AggregateFilter::Mode::ANY;
+    any.set_filter(AggregateFilter::AVG, ValueFilter().greater_than(1050));
+    any.set_filter(AggregateFilter::MAX, ValueFilter().less_than(50));
+    filters.push_back(any);
+    AggregateFilter all;
+    all.set_filter(AggregateFilter::AVG, ValueFilter().greater_than(10).less_than(1050));
+    all.set_filter(AggregateFilter::MIN, ValueFilter().greater_than(0));
+    filters.push_back(all);
+    AggregateFilter none;
+    none.set_filter(AggregateFilter::MAX, ValueFilter().greater_than(5000));
+    filters.push_back(none);
+
+    auto read_all = [](AggregateOperator& it, std::vector<aku_Timestamp>* tss, std::vector<AggregationResult>* xss) {
+        while (true) {
+            aku_Timestamp ts;
+            AggregationResult agg;
+            aku_Status status;
+            size_t size;
+            std::tie(status, size) = it.read(&ts, &agg, 1);
+            BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+            if (size == 0) {
+                break;
+            }
+            tss->push_back(ts);
+            xss->push_back(agg);
+        }
+    };
+
+    for (auto const& filter: filters) {
+        for (auto query_begin: { begin, begin + xs.size()/3 }) {
+            std::vector<aku_Timestamp> expts, actts;
+            std::vector<AggregationResult> expxs, actxs;
+            // Unpruned group-aggregate filtered by hand
+            std::vector<aku_Timestamp> tss;
+            std::vector<AggregationResult> xss;
+            QueryProfile full = {};
+            {
+                ProfileScope scope(&full);
+                auto it = extents->group_aggregate(query_begin, end, step);
+                read_all(*it, &tss, &xss);
+            }
+            for (size_t i = 0; i < tss.size(); i++) {
+                if (filter.match(xss[i])) {
+                    expts.push_back(tss[i]);
+                    expxs.push_back(xss[i]);
+                }
+            }
+            QueryProfile pruned = {};
+            {
+                ProfileScope scope(&pruned);
+                auto fit = extents->group_aggregate_filter(query_begin, end, step, filter);
+                read_all(*fit, &actts, &actxs);
+            }
+            BOOST_REQUIRE_GT(full.blocks_read, 0);
+            BOOST_REQUIRE_LE(pruned.blocks_read, full.blocks_read);
+            if (&filter == &filters.back()) {
+                // Bounds of the series can't match the filter
+                BOOST_REQUIRE_EQUAL(pruned.blocks_read, 0);
+            } else if (&filter == &filters.front() && commit_limit > 1) {
+                // Subtrees without bursts of large values are skipped
+                BOOST_REQUIRE_LT(pruned.blocks_read, full.blocks_read);
+            }
+            BOOST_REQUIRE_EQUAL(actts.size(), expts.size());
+            for (size_t i = 0; i < expts.size(); i++) {
+                BOOST_REQUIRE_EQUAL(actts[i], expts[i]);
+                BOOST_REQUIRE_EQUAL(actxs[i].cnt, expxs[i].cnt);
+                BOOST_REQUIRE_EQUAL(actxs[i].sum, expxs[i].sum);
+                BOOST_REQUIRE_EQUAL(actxs[i].min, expxs[i].min);
+                BOOST_REQUIRE_EQUAL(actxs[i].max, expxs[i].max);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_group_aggregate_filter_pruning) {
+    std::vector<std::tuple<u32, u32>> cases = {
+        std::make_tuple( 1,    100),
+        std::make_tuple(10,    100),
+        std::make_tuple(10,   1000),
+        std::make_tuple(32*4,   10),
+        std::make_tuple(32*4, 1000),
+        std::make_tuple(32*4, 7000),
+    };
+    for (auto t: cases) {
+        test_nbtree_group_aggregate_filter(std::get<0>(t), std::get<1>(t));
+    }
+}
+
 template<class Cont>
 static void fill_leaf(NBTreeLeaf* leaf, Cont tss) {
     for (auto ts: tss) {
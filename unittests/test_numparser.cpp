@@ -0,0 +1,65 @@
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "numparser.h"
+
+using namespace Akumuli;
+
+static void check_same_as_strtod(std::string const& str) {
+    char* endptr = nullptr;
+    double expected = strtod(str.c_str(), &endptr);
+    bool expected_success = !str.empty() && endptr == str.c_str() + str.size();
+    double actual = 0;
+    bool success = parse_double(str.data(), str.data() + str.size(), &actual);
+    BOOST_REQUIRE_EQUAL(success, expected_success);
+    if (success) {
+        BOOST_REQUIRE(memcmp(&actual, &expected, sizeof(double)) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_1) {
+    const char* values[] = {
+        "0", "-0", "+0.0", "0.", ".5", "3.14159", "-12.6", "00001.25000", "1e5", "1E22", "1e23",
+        "1e-22", "1e-23", "0.000000000000000000000000001", "9007199254740992", "9007199254740993",
+        "123456789012345678901", "4.9e-324", "1.7976931348623157e308", "1e99999999999", "0e99999999999",
+    };
+    for (auto str: values) {
+        check_same_as_strtod(str);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_errors) {
+    const char* values[] = {
+        "", "+", "-", ".", "-.", "1e", "1e+", " 1", "1 ", "1.5abc", "1..2", "1.2.3", "e5", "1e5e5", ".e1",
+    };
+    for (auto str: values) {
+        check_same_as_strtod(str);
+    }
+    double value;
+    BOOST_REQUIRE(!parse_double("1.5abc", "1.5abc" + 6, &value));
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_slow_path) {
+    // Values that can't be parsed using fast path
+    const char* values[] = {
+        "inf", "-nan", "0x1p3", "1.7976931348623157e308", "12345678901234567890.5", "2.2250738585072014e-308",
+    };
+    for (auto str: values) {
+        check_same_as_strtod(str);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_parse_double_random) {
+    char buffer[64];
+    for (int i = 0; i < 100000; i++) {
+        double value = ldexp(static_cast<double>(rand()), rand() % 100 - 50);
+        int precision = 1 + rand() % 18;
+        snprintf(buffer, sizeof(buffer), (rand() % 2) ? "%.*g" : "%.*f", precision, value);
+        check_same_as_strtod(buffer);
+    }
+}
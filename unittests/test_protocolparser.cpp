@@ -8,6 +8,7 @@
 
 #include "ingestion_pipeline.h"
 #include "protocolparser.h"
+#include "binaryframe.h"
 #include "resp.h"
 
 using namespace Akumuli;
@@ -174,6 +175,24 @@ BOOST_AUTO_TEST_CASE(Test_protocol_parse_error_format) {
     BOOST_REQUIRE_THROW(parser.parse_next(buf, 29), RESPError);
 }
 
+BOOST_AUTO_TEST_CASE(Test_protocol_parse_error_writes_preceding_samples) {
+    // Samples that precede the malformed integer are written
+    const char *messages = "+1\r\n:2\r\n+34.5\r\n+6\r\n:7\r\n+8.9\r\n+10\r\n:1x\r\n+12.5\r\n";
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+    RESPProtocolParser parser(cons);
+    parser.start();
+    auto buf = parser.get_next_buffer();
+    memcpy(buf, messages, strlen(messages));
+    BOOST_REQUIRE_THROW(parser.parse_next(buf, static_cast<u32>(strlen(messages))), RESPError);
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[0], 1);
+    BOOST_REQUIRE_EQUAL(cons->ts_[0], 2);
+    BOOST_REQUIRE_EQUAL(cons->data_[0], 34.5);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 6);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 7);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 8.9);
+}
+
 
 BOOST_AUTO_TEST_CASE(Test_protocol_parse_dictionary_error_format) {
     {
@@ -475,6 +494,77 @@ void test_series_name_parsing(const char* messages, const char* expected_tags, i
     parser.parse_next(buf, buflen);
 }
 
+BOOST_AUTO_TEST_CASE(Test_read_buffer_wraparound) {
+    // Messages are split between buffers at random positions and the
+    // ring wraps around many times
+    std::string message;
+    for (int i = 0; i < 10000; i++) {
+        message += "+" + std::to_string(i) + "\r\n:" + std::to_string(i*10) + "\r\n+" + std::to_string(i) + ".5\r\n";
+    }
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+    RESPProtocolParser parser(cons);
+    parser.start();
+    size_t pos = 0;
+    while (pos < message.size()) {
+        size_t size = std::min(message.size() - pos, 1 + static_cast<size_t>(rand()) % RESPProtocolParser::RDBUF_SIZE);
+        auto buf = parser.get_next_buffer();
+        memcpy(buf, message.data() + pos, size);
+        parser.parse_next(buf, static_cast<u32>(size));
+        pos += size;
+    }
+    parser.close();
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 10000);
+    for (u32 i = 0; i < 10000; i++) {
+        BOOST_REQUIRE_EQUAL(cons->param_[i], i);
+        BOOST_REQUIRE_EQUAL(cons->ts_[i], i*10);
+        BOOST_REQUIRE_CLOSE_FRACTION(cons->data_[i], i + 0.5, 1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_read_buffer_grow) {
+    // Message doesn't fit the initial buffer
+    ReadBuffer rdbuf(RESPProtocolParser::RDBUF_SIZE);
+    std::string message = "+" + std::string(100000, 'x') + "\r\n";
+    size_t pos = 0;
+    while (pos < message.size()) {
+        size_t size = std::min(message.size() - pos, static_cast<size_t>(RESPProtocolParser::RDBUF_SIZE));
+        auto buf = rdbuf.pull();
+        memcpy(buf, message.data() + pos, size);
+        rdbuf.push(buf, static_cast<u32>(size));
+        pos += size;
+    }
+    const Byte* begin;
+    size_t size;
+    std::tie(begin, size) = rdbuf.get_window();
+    BOOST_REQUIRE_EQUAL(std::string(begin, begin + size), message);
+}
+
+BOOST_AUTO_TEST_CASE(Test_protocol_parser_reset) {
+    // Parser is reused after the error, incomplete message is dropped by reset
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock);
+    RESPProtocolParser parser(cons);
+    const char* bad = "+1\r\n:2\r\n+3.5\r\n+4\r\n:5\r\n@6\r\n+7\r\n";
+    auto buf = parser.get_next_buffer();
+    memcpy(buf, bad, strlen(bad));
+    BOOST_REQUIRE_THROW(parser.parse_next(buf, static_cast<u32>(strlen(bad))), StreamError);
+    parser.reset();
+    const char* incomplete = "+8\r\n:9\r\n";
+    buf = parser.get_next_buffer();
+    memcpy(buf, incomplete, strlen(incomplete));
+    parser.parse_next(buf, static_cast<u32>(strlen(incomplete)));
+    parser.reset();
+    const char* good = "+10\r\n:11\r\n+12.5\r\n";
+    buf = parser.get_next_buffer();
+    memcpy(buf, good, strlen(good));
+    parser.parse_next(buf, static_cast<u32>(strlen(good)));
+    parser.close();
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 2);
+    BOOST_REQUIRE_EQUAL(cons->param_[0], 1);
+    BOOST_REQUIRE_EQUAL(cons->param_[1], 10);
+    BOOST_REQUIRE_EQUAL(cons->ts_[1], 11);
+    BOOST_REQUIRE_EQUAL(cons->data_[1], 12.5);
+}
+
 BOOST_AUTO_TEST_CASE(Test_protocol_parse_series_name_error_with_carriage_return) {
     const char *messages = "+test tag1=value1 tag2=value2\r\n:2000\n+34.5\r\n+test tag1=value1 tag2=value2\r\n:3000\r\n+8.9\r\n";
     test_series_name_parsing(messages, "test tag1=value1 tag2=value2", 2);
@@ -594,3 +684,233 @@ BOOST_AUTO_TEST_CASE(Test_open_tsdb_protocol_parser_framing) {
         find_framing_issues<OpenTSDBProtocolParser>(message, msglen, pivot1, pivot2, pred, cons);
     }
 }
+
+BOOST_AUTO_TEST_CASE(Test_series_name_cache) {
+    SeriesNameCache cache;
+    aku_ParamId ids[4];
+    std::string foo = "cpu.user|cpu.sys host=foo";
+    std::string bar = "cpu.user host=bar";
+    BOOST_REQUIRE_EQUAL(cache.find(foo.data(), foo.data() + foo.size(), ids, 4), 0);
+    aku_ParamId fooids[] = { 10, 11 };
+    cache.insert(foo.data(), foo.data() + foo.size(), fooids, 2);
+    aku_ParamId barid = 12;
+    cache.insert(bar.data(), bar.data() + bar.size(), &barid, 1);
+
+    BOOST_REQUIRE_EQUAL(cache.find(foo.data(), foo.data() + foo.size(), ids, 4), 2);
+    BOOST_REQUIRE_EQUAL(ids[0], 10);
+    BOOST_REQUIRE_EQUAL(ids[1], 11);
+    BOOST_REQUIRE_EQUAL(cache.find(bar.data(), bar.data() + bar.size(), ids, 4), 1);
+    BOOST_REQUIRE_EQUAL(ids[0], 12);
+    // Names are not normalized
+    std::string baz = "cpu.user  host=bar";
+    BOOST_REQUIRE_EQUAL(cache.find(baz.data(), baz.data() + baz.size(), ids, 4), 0);
+    // Output array is too small
+    BOOST_REQUIRE_EQUAL(cache.find(foo.data(), foo.data() + foo.size(), ids, 1), 0);
+
+    auto stats = cache.get_stats();
+    BOOST_REQUIRE_EQUAL(stats.hits, 2);
+    BOOST_REQUIRE_EQUAL(stats.misses, 3);
+    BOOST_REQUIRE_EQUAL(stats.size, 2);
+}
+
+BOOST_AUTO_TEST_CASE(Test_series_name_cache_overflow) {
+    SeriesNameCache cache;
+    const u64 N = SeriesNameCache::CAPACITY*2;
+    for (u64 i = 0; i < N; i++) {
+        std::string name = "test tag=" + std::to_string(i);
+        cache.insert(name.data(), name.data() + name.size(), &i, 1);
+    }
+    auto stats = cache.get_stats();
+    BOOST_REQUIRE(stats.resets > 0);
+    BOOST_REQUIRE(stats.size <= SeriesNameCache::CAPACITY);
+    // Recently added names should be available, cached ids should always be correct
+    u64 nfound = 0;
+    for (u64 i = 0; i < N; i++) {
+        std::string name = "test tag=" + std::to_string(i);
+        aku_ParamId id = 0;
+        if (cache.find(name.data(), name.data() + name.size(), &id, 1)) {
+            BOOST_REQUIRE_EQUAL(id, i);
+            nfound++;
+        }
+    }
+    BOOST_REQUIRE(nfound > 0);
+    std::string last = "test tag=" + std::to_string(N - 1);
+    aku_ParamId id = 0;
+    BOOST_REQUIRE_EQUAL(cache.find(last.data(), last.data() + last.size(), &id, 1), 1);
+    BOOST_REQUIRE_EQUAL(id, N - 1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_protocol_parser_series_name_cache) {
+    const char *messages = "+1|2\r\n:1\r\n*2\r\n+3.4\r\n+5.6\r\n"
+                           "+7\r\n:2\r\n+8.9\r\n"
+                           "+1|2\r\n:3\r\n*2\r\n+3.5\r\n+5.7\r\n"
+                           "+7\r\n:4\r\n+9.1\r\n";
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    RESPProtocolParser parser(cons);
+    auto buf = parser.get_next_buffer();
+    size_t len = strlen(messages);
+    memcpy(buf, messages, len);
+    parser.start();
+    parser.parse_next(buf, static_cast<u32>(len));
+    parser.close();
+
+    std::vector<aku_ParamId> expected_ids = { 1, 2, 7, 1, 2, 7 };
+    std::vector<double> expected_xs = { 3.4, 5.6, 8.9, 3.5, 5.7, 9.1 };
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), expected_ids.size());
+    for (size_t i = 0; i < expected_ids.size(); i++) {
+        BOOST_REQUIRE_EQUAL(cons->param_.at(i), expected_ids.at(i));
+        BOOST_REQUIRE_EQUAL(cons->data_.at(i), expected_xs.at(i));
+    }
+    auto stats = parser.get_cache_stats();
+    BOOST_REQUIRE_EQUAL(stats.hits, 2);
+    BOOST_REQUIRE_EQUAL(stats.misses, 2);
+}
+
+BOOST_AUTO_TEST_CASE(Test_opentsdb_protocol_parser_series_name_cache) {
+    std::string messages =
+        "put test 2 34.5 tag=1\n"
+        "put test 7 89.0 tag=2\n"
+        "put test 10 11.1 tag=1\n"
+        "put test 13 14.5 tag=2\n";
+    std::vector<std::string> expected_names = {
+        "test tag=1", "test tag=2", "test tag=1", "test tag=2"
+    };
+    std::shared_ptr<NameCheckingConsumer> cons(new NameCheckingConsumer(expected_names, -1));
+    OpenTSDBProtocolParser parser(cons);
+    auto buf = parser.get_next_buffer();
+    memcpy(buf, messages.data(), messages.size());
+    parser.start();
+    parser.parse_next(buf, static_cast<u32>(messages.size()));
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(cons->ids.size(), 4);
+    for (int i = 0; i < 4; i++) {
+        BOOST_REQUIRE_EQUAL(cons->ids.at(i), cons->index[expected_names[i]]);
+    }
+    auto stats = parser.get_cache_stats();
+    BOOST_REQUIRE_EQUAL(stats.hits, 2);
+    BOOST_REQUIRE_EQUAL(stats.misses, 2);
+}
+
+static void send_to_binary_parser(BinaryProtocolParser& parser, std::vector<u8> const& data, size_t chunk) {
+    for (size_t pos = 0; pos < data.size(); pos += chunk) {
+        size_t len = std::min(chunk, data.size() - pos);
+        auto buf = parser.get_next_buffer();
+        memcpy(buf, data.data() + pos, len);
+        parser.parse_next(buf, static_cast<u32>(len));
+    }
+}
+
+static void test_binary_protocol_parser(u32 flags, size_t chunk) {
+    const u32 N = 100;
+    std::vector<u8> data;
+    BinaryFrame::encode_dict(10, "42", 2, &data);
+    BinaryFrame::encode_dict(11, "43", 2, &data);
+    std::vector<aku_Timestamp> ts;
+    std::vector<double> xs;
+    for (u32 i = 0; i < N; i++) {
+        ts.push_back(1000 + i*10 + (i % 3));
+        xs.push_back(0.1*i);
+    }
+    BOOST_REQUIRE_EQUAL(BinaryFrame::encode_data(10, ts.data(), xs.data(), N, flags, &data), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(BinaryFrame::encode_data(11, ts.data(), xs.data(), 7, flags, &data), AKU_SUCCESS);
+
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    BinaryProtocolParser parser(cons);
+    parser.start();
+    send_to_binary_parser(parser, data, chunk);
+    parser.close();
+
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), N + 7);
+    for (u32 i = 0; i < N + 7; i++) {
+        u32 ix = i < N ? i : i - N;
+        BOOST_REQUIRE_EQUAL(cons->param_.at(i), i < N ? 42 : 43);
+        BOOST_REQUIRE_EQUAL(cons->ts_.at(i), ts.at(ix));
+        BOOST_REQUIRE_EQUAL(cons->data_.at(i), xs.at(ix));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser) {
+    for (u32 flags = 0; flags < 4; flags++) {
+        test_binary_protocol_parser(flags, 0x10000);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser_framing) {
+    for (u32 flags = 0; flags < 4; flags++) {
+        test_binary_protocol_parser(flags, 1);
+        test_binary_protocol_parser(flags, 13);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser_unknown_id) {
+    std::vector<u8> data;
+    aku_Timestamp ts = 1;
+    double xs = 2.0;
+    BinaryFrame::encode_data(10, &ts, &xs, 1, 0, &data);
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    BinaryProtocolParser parser(cons);
+    parser.start();
+    BOOST_REQUIRE_THROW(send_to_binary_parser(parser, data, data.size()), ProtocolParserError);
+    BOOST_REQUIRE(cons->param_.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser_bad_frame_size) {
+    std::vector<u8> data = { 0, 0, 0, 0, BinaryFrame::DICTIONARY };
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    BinaryProtocolParser parser(cons);
+    parser.start();
+    BOOST_REQUIRE_THROW(send_to_binary_parser(parser, data, data.size()), ProtocolParserError);
+
+    u32 size = BinaryFrame::MAX_FRAME_SIZE + 1;
+    data.resize(BinaryFrame::PREFIX_SIZE);
+    memcpy(data.data(), &size, BinaryFrame::PREFIX_SIZE);
+    BinaryProtocolParser other(cons);
+    other.start();
+    BOOST_REQUIRE_THROW(send_to_binary_parser(other, data, data.size()), ProtocolParserError);
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_protocol_parser_malformed_frame) {
+    std::vector<u8> data;
+    BinaryFrame::encode_dict(1, "42", 2, &data);
+    size_t prefix = data.size();
+    std::vector<aku_Timestamp> ts = { 1, 2, 3, 4 };
+    std::vector<double> xs = { 1.0, 2.0, 3.0, 4.0 };
+    BinaryFrame::encode_data(1, ts.data(), xs.data(), 4, BinaryFrame::TIMESTAMPS_DELTA|BinaryFrame::VALUES_XOR, &data);
+    // Remove the last byte of the data frame
+    u32 size = BinaryFrame::get_frame_size(data.data() + prefix) - 1;
+    memcpy(data.data() + prefix, &size, BinaryFrame::PREFIX_SIZE);
+    data.pop_back();
+
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    BinaryProtocolParser parser(cons);
+    parser.start();
+    BOOST_REQUIRE_THROW(send_to_binary_parser(parser, data, data.size()), ProtocolParserError);
+    BOOST_REQUIRE(cons->param_.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_binary_frame_encode_overflow) {
+    // Frames that can't be encoded are not appended to the buffer
+    std::vector<u8> data;
+    BOOST_REQUIRE_EQUAL(BinaryFrame::encode_dict(1, "42", 2, &data), AKU_SUCCESS);
+    std::vector<u8> expected = data;
+    std::string name(BinaryFrame::MAX_FRAME_SIZE, 'x');
+    BOOST_REQUIRE_EQUAL(BinaryFrame::encode_dict(2, name.data(), name.size(), &data), AKU_EOVERFLOW);
+    BOOST_REQUIRE(data == expected);
+    // At least one byte per value in every encoding
+    const u32 N = BinaryFrame::MAX_FRAME_SIZE;
+    std::vector<aku_Timestamp> ts(N, 1);
+    std::vector<double> xs(N, 2.0);
+    for (u32 flags = 0; flags < 4; flags++) {
+        BOOST_REQUIRE_EQUAL(BinaryFrame::encode_data(1, ts.data(), xs.data(), N, flags, &data), AKU_EOVERFLOW);
+        BOOST_REQUIRE(data == expected);
+    }
+    BOOST_REQUIRE_EQUAL(BinaryFrame::encode_data(1, ts.data(), xs.data(), 1, 0, &data), AKU_SUCCESS);
+
+    std::shared_ptr<ConsumerMock> cons(new ConsumerMock());
+    BinaryProtocolParser parser(cons);
+    parser.start();
+    send_to_binary_parser(parser, data, data.size());
+    BOOST_REQUIRE_EQUAL(cons->param_.size(), 1);
+    BOOST_REQUIRE_EQUAL(cons->param_.at(0), 42);
+}
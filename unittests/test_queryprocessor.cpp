@@ -0,0 +1,233 @@
+#include <iostream>
+#include <cstring>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+
+#include "queryprocessor_framework.h"
+#include "query_processing/absolute.h"
+#include "query_processing/limiter.h"
+#include "query_processing/math.h"
+#include "query_processing/rate.h"
+#include "query_processing/scale.h"
+
+using namespace Akumuli;
+using namespace Akumuli::QP;
+
+//! Collects output of the processing topology
+struct NodeMock : Node {
+    //! Flattened output (id, timestamp, size, values)
+    std::vector<u64> output;
+    size_t count = 0;
+
+    void complete() {}
+
+    bool put(MutableSample& sample) {
+        output.push_back(sample.get_paramid());
+        output.push_back(sample.get_timestamp());
+        output.push_back(sample.size());
+        for (u32 ix = 0; ix < sample.size(); ix++) {
+            double const* value = sample[ix];
+            u64 bits = 0xFFFFFFFFFFFFFFFF;
+            if (value) {
+                memcpy(&bits, value, sizeof(bits));
+            }
+            output.push_back(bits);
+        }
+        count++;
+        return true;
+    }
+
+    void set_error(aku_Status) {}
+
+    int get_requirements() const {
+        return TERMINAL;
+    }
+};
+
+//! Generate scalar samples (two interleaved series)
+static std::vector<std::vector<u8>> make_scalars(size_t n) {
+    std::vector<std::vector<u8>> result;
+    for (size_t i = 0; i < n; i++) {
+        std::vector<u8> buf(sizeof(aku_Sample));
+        aku_Sample* sample = reinterpret_cast<aku_Sample*>(buf.data());
+        sample->paramid = 1 + (i / 10) % 2;
+        sample->timestamp = 1000 + i*10;
+        sample->payload.type = AKU_PAYLOAD_FLOAT;
+        sample->payload.size = sizeof(aku_Sample);
+        sample->payload.float64 = (i % 3 == 0 ? -1.0 : 1.0) * static_cast<double>(i*i);
+        result.push_back(std::move(buf));
+    }
+    return result;
+}
+
+//! Generate three element tuples with some missing elements
+static std::vector<std::vector<u8>> make_tuples(size_t n) {
+    const u64 bitmaps[] = { 7, 5, 3, 1 };
+    std::vector<std::vector<u8>> result;
+    for (size_t i = 0; i < n; i++) {
+        u64 bitmap = bitmaps[i % 4];
+        std::vector<u8> buf(sizeof(aku_Sample) + 3*sizeof(double));
+        aku_Sample* sample = reinterpret_cast<aku_Sample*>(buf.data());
+        sample->paramid = 10 + i % 3;
+        sample->timestamp = 1000 + i*10;
+        sample->payload.type = AKU_PAYLOAD_TUPLE;
+        union {
+            double d;
+            u64 u;
+        } bits;
+        bits.u = bitmap | (3ull << 58);
+        sample->payload.float64 = bits.d;
+        double* tuple = reinterpret_cast<double*>(sample->payload.data);
+        u32 nvalues = 0;
+        for (u32 col = 0; col < 3; col++) {
+            if (bitmap & (1 << col)) {
+                tuple[nvalues++] = -0.5 * static_cast<double>(i + col);
+            }
+        }
+        sample->payload.size = static_cast<u16>(sizeof(aku_Sample) + nvalues*sizeof(double));
+        result.push_back(std::move(buf));
+    }
+    return result;
+}
+
+typedef std::function<std::shared_ptr<Node>(std::shared_ptr<Node>)> NodeFactory;
+
+/** Process samples row by row and in batches, output should be the same.
+  * @return number of output samples
+  */
+static size_t compare_row_and_batch(std::vector<std::vector<u8>> const& input, NodeFactory make_node) {
+    auto rowmock = std::make_shared<NodeMock>();
+    auto rownode = make_node(rowmock);
+    bool rowres = true;
+    for (auto const& buf: input) {
+        MutableSample mut(reinterpret_cast<aku_Sample const*>(buf.data()));
+        if (!rownode->put(mut)) {
+            rowres = false;
+            break;
+        }
+    }
+
+    auto batchmock = std::make_shared<NodeMock>();
+    auto batchnode = make_node(batchmock);
+    bool batchres = true;
+    SampleBatch batch;
+    auto it = input.begin();
+    while (it != input.end() && batchres) {
+        // Use small batches to test processing state between batches
+        batch.clear();
+        while (it != input.end() && batch.size < 7) {
+            BOOST_REQUIRE(batch.append(reinterpret_cast<aku_Sample const*>(it->data())));
+            it++;
+        }
+        batchres = batchnode->put_batch(batch);
+    }
+
+    BOOST_REQUIRE_EQUAL(rowres, batchres);
+    BOOST_REQUIRE_EQUAL(rowmock->count, batchmock->count);
+    BOOST_REQUIRE(rowmock->output == batchmock->output);
+    return rowmock->count;
+}
+
+BOOST_AUTO_TEST_CASE(Test_sample_batch_roundtrip) {
+    for (auto const& input: { make_scalars(20), make_tuples(20) }) {
+        SampleBatch batch;
+        for (auto const& buf: input) {
+            BOOST_REQUIRE(batch.append(reinterpret_cast<aku_Sample const*>(buf.data())));
+        }
+        BOOST_REQUIRE_EQUAL(batch.size, input.size());
+        std::vector<u8> out(SampleBatch::MAX_SAMPLE_SIZE);
+        for (size_t ix = 0; ix < batch.size; ix++) {
+            size_t size = batch.get_sample(ix, out.data());
+            auto lhs = reinterpret_cast<aku_Sample const*>(out.data());
+            auto rhs = reinterpret_cast<aku_Sample const*>(input.at(ix).data());
+            BOOST_REQUIRE_EQUAL(size, rhs->payload.size);
+            BOOST_REQUIRE_EQUAL(lhs->paramid, rhs->paramid);
+            BOOST_REQUIRE_EQUAL(lhs->timestamp, rhs->timestamp);
+            BOOST_REQUIRE_EQUAL(lhs->payload.type, rhs->payload.type);
+            BOOST_REQUIRE_EQUAL(lhs->payload.size, rhs->payload.size);
+            BOOST_REQUIRE(memcmp(&lhs->payload.float64, &rhs->payload.float64, sizeof(double)) == 0);
+            BOOST_REQUIRE(memcmp(lhs->payload.data, rhs->payload.data, size - sizeof(aku_Sample)) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_sample_batch_layout) {
+    auto scalars = make_scalars(2);
+    auto tuples = make_tuples(2);
+    SampleBatch batch;
+    BOOST_REQUIRE(batch.append(reinterpret_cast<aku_Sample const*>(scalars.at(0).data())));
+    // Different layout can't be added to the batch
+    BOOST_REQUIRE(!batch.append(reinterpret_cast<aku_Sample const*>(tuples.at(0).data())));
+    batch.clear();
+    BOOST_REQUIRE(batch.append(reinterpret_cast<aku_Sample const*>(tuples.at(0).data())));
+    BOOST_REQUIRE(batch.append(reinterpret_cast<aku_Sample const*>(tuples.at(1).data())));
+    BOOST_REQUIRE(batch.is_present(1, 0));
+    BOOST_REQUIRE(!batch.is_present(1, 1));
+    BOOST_REQUIRE(batch.is_present(1, 2));
+}
+
+BOOST_AUTO_TEST_CASE(Test_scale_batch) {
+    auto factory = [](std::shared_ptr<Node> next) {
+        std::vector<double> weights = { 2.0, -3.0 };
+        return std::make_shared<Scale>(weights, next);
+    };
+    compare_row_and_batch(make_scalars(100), factory);
+    compare_row_and_batch(make_tuples(100), factory);
+}
+
+BOOST_AUTO_TEST_CASE(Test_absolute_batch) {
+    auto factory = [](std::shared_ptr<Node> next) {
+        return std::make_shared<Absolute>(next);
+    };
+    compare_row_and_batch(make_scalars(100), factory);
+    compare_row_and_batch(make_tuples(100), factory);
+}
+
+BOOST_AUTO_TEST_CASE(Test_math_batch) {
+    struct Sum {
+        double operator () (double lhs, double rhs) const {
+            return lhs + rhs;
+        }
+        double unit() const {
+            return 0.0;
+        }
+    };
+    for (bool ignore_missing: { true, false }) {
+        auto factory = [ignore_missing](std::shared_ptr<Node> next) {
+            return std::make_shared<MathOperation<Sum>>(ignore_missing, next);
+        };
+        compare_row_and_batch(make_scalars(100), factory);
+        compare_row_and_batch(make_tuples(100), factory);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_rate_batch) {
+    auto factory = [](std::shared_ptr<Node> next) {
+        return std::make_shared<SimpleRate>(next);
+    };
+    compare_row_and_batch(make_scalars(100), factory);
+    compare_row_and_batch(make_tuples(100), factory);
+}
+
+BOOST_AUTO_TEST_CASE(Test_limiter_batch) {
+    for (u64 limit: { 0, 5, 7, 50, 200 }) {
+        auto factory = [limit](std::shared_ptr<Node> next) {
+            return std::make_shared<Limiter>(limit, 0, next);
+        };
+        auto count = compare_row_and_batch(make_scalars(100), factory);
+        BOOST_REQUIRE_EQUAL(count, std::min(limit, static_cast<u64>(100)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_node_chain_batch) {
+    // Nodes with batch implementation followed by the node without it
+    auto factory = [](std::shared_ptr<Node> next) {
+        auto cusum = std::make_shared<CumulativeSum>(next);
+        auto abs = std::make_shared<Absolute>(cusum);
+        return std::make_shared<SimpleRate>(abs);
+    };
+    compare_row_and_batch(make_scalars(100), factory);
+    compare_row_and_batch(make_tuples(100), factory);
+}
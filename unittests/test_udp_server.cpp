@@ -0,0 +1,175 @@
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "udp_server.h"
+#include "signal_handler.h"
+#include "logger.h"
+
+using namespace Akumuli;
+
+
+static Logger logger_ = Logger("udp-server-test");
+typedef std::tuple<aku_ParamId, aku_Timestamp, double> ValueT;
+
+
+//! Session mock (workers write concurrently)
+struct SessionMock : DbSession {
+    std::vector<ValueT>& results;
+    std::mutex& mutex;
+
+    SessionMock(std::vector<ValueT>& results, std::mutex& mutex)
+        : results(results)
+        , mutex(mutex)
+    {
+    }
+
+    virtual aku_Status write(const aku_Sample &sample) override {
+        std::lock_guard<std::mutex> guard(mutex);
+        results.push_back(std::make_tuple(sample.paramid, sample.timestamp, sample.payload.float64));
+        return AKU_SUCCESS;
+    }
+
+    virtual std::shared_ptr<DbCursor> query(std::string) override {
+        throw "not implemented";
+    }
+
+    virtual std::shared_ptr<DbCursor> suggest(std::string) override {
+        throw "not implemented";
+    }
+
+    virtual std::shared_ptr<DbCursor> search(std::string) override {
+        throw "not implemented";
+    }
+
+    virtual int param_id_to_series(aku_ParamId id, char* buf, size_t sz) override {
+        auto str = std::to_string(id);
+        assert(str.size() <= sz);
+        memcpy(buf, str.data(), str.size());
+        return static_cast<int>(str.size());
+    }
+
+    virtual aku_Status series_to_param_id(const char* begin, size_t sz, aku_Sample* sample) override {
+        std::string num(begin, begin + sz);
+        sample->paramid = boost::lexical_cast<u64>(num);
+        return AKU_SUCCESS;
+    }
+
+    virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override {
+        auto nelem = std::count(begin, end, '|') + 1;
+        if (nelem > cap) {
+            return -1*static_cast<int>(nelem);
+        }
+        const char* it_begin = begin;
+        const char* it_end = begin;
+        for (int i = 0; i < nelem; i++) {
+            //move it_end
+            while(*it_end != '|' && it_end != end) {
+                it_end++;
+            }
+            std::string val(it_begin, it_end);
+            ids[i] = boost::lexical_cast<u64>(val);
+            it_begin = ++it_end;
+        }
+        return static_cast<int>(nelem);
+    }
+};
+
+
+struct ConnectionMock : DbConnection {
+    std::vector<ValueT> results;
+    std::mutex mutex;
+
+    virtual std::string get_all_stats() override { throw "not impelemnted"; }
+
+    virtual std::shared_ptr<DbSession> create_session() override {
+        return std::make_shared<SessionMock>(results, mutex);
+    }
+
+    size_t get_size() {
+        std::lock_guard<std::mutex> guard(mutex);
+        return results.size();
+    }
+};
+
+const int PORT = 14097;
+
+static void send_packet(int fd, std::string const& payload) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT);
+    auto res = sendto(fd, payload.data(), payload.size(), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    BOOST_REQUIRE_EQUAL(res, static_cast<ssize_t>(payload.size()));
+}
+
+static std::string make_message(int id, int ts) {
+    return "+" + std::to_string(id) + "\r\n:" + std::to_string(ts) + "\r\n+" + std::to_string(ts) + ".5\r\n";
+}
+
+BOOST_AUTO_TEST_CASE(Test_udp_server_loopback) {
+    auto dbcon = std::make_shared<ConnectionMock>();
+    UdpServer::Settings settings;
+    settings.batch_size = 8;
+    auto server = std::make_shared<UdpServer>(dbcon, 2, PORT, settings);
+    SignalHandler sighandler;
+    server->start(&sighandler, 0);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    BOOST_REQUIRE(fd != -1);
+    const int NPACKETS = 100;
+    for (int i = 0; i < NPACKETS; i++) {
+        send_packet(fd, make_message(1 + i % 10, i));
+    }
+    // Packet that doesn't fit the parser's buffer
+    std::string large;
+    const int NLARGE = 1000;
+    for (int i = 0; i < NLARGE; i++) {
+        large += make_message(100, i);
+    }
+    BOOST_REQUIRE(large.size() > RESPProtocolParser::RDBUF_SIZE);
+    send_packet(fd, large);
+    close(fd);
+
+    size_t expected = NPACKETS + NLARGE;
+    for (int i = 0; i < 500 && dbcon->get_size() < expected; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_REQUIRE_EQUAL(dbcon->get_size(), expected);
+
+    // Cache counters are updated after the batch is processed. Message split between
+    // two parser buffers is parsed twice, so there can be more lookups than messages.
+    boost::property_tree::ptree stats;
+    for (int i = 0; i < 500; i++) {
+        stats.clear();
+        ServerStats::instance().report(&stats);
+        if (stats.get<u64>("udp_server.series_cache_hits") + stats.get<u64>("udp_server.series_cache_misses") >= expected) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    BOOST_REQUIRE(stats.get<u64>("udp_server.series_cache_hits") + stats.get<u64>("udp_server.series_cache_misses") >= expected);
+    // Series name cache is shared by all packets received by the worker, so every
+    // worker looks up each of the 11 names at most once
+    BOOST_REQUIRE(stats.get<u64>("udp_server.series_cache_misses") <= 22);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("udp_server.packets"), NPACKETS + 1);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("udp_server.drops"), 0);
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("udp_server.workers.0.packets") + stats.get<u64>("udp_server.workers.1.packets"),
+                        NPACKETS + 1);
+
+    // Both workers should be stopped
+    for (auto& handler: sighandler.handlers_) {
+        handler.first();
+    }
+}